@@ -33,7 +33,7 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
 #define SHOW_RX_DATA 0
 #define SHOW_TX_DATA 0
 /*******************************************************************/
-void conmgr_rxfunc (int32_t refcon, char *buf, size_t nbuf) {
+void conmgr_rxfunc (intptr_t refcon, char *buf, size_t nbuf) {
 /*
 **  Callback function which receives characters from the connection
 */
@@ -56,9 +56,22 @@ void conmgr_rxfunc (int32_t refcon, char *buf, size_t nbuf) {
 #endif
 }
 /*******************************************************************/
-struct conmgr * conmgr_connect (enum e_contype type, char *hostname, int port) {
+void conmgr_rxvfunc (intptr_t refcon, const struct iovec *iov, int iovcnt) {
 /*
-**  Establish a connection
+**  Vectored callback: every piece one host record produced
+*/
+    int ii;
+
+    for (ii=0; ii<iovcnt; ii++) {
+	if (iov[ii].iov_len)
+	    conmgr_rxfunc (refcon, (char *)iov[ii].iov_base, iov[ii].iov_len);
+    }
+}
+/*******************************************************************/
+struct conmgr * conmgr_connect (enum e_contype type, char *hostname, int port,
+				int profile, int flags) {
+/*
+**  Establish a connection, tuned per the transport profile
 */
     void *ptr=0;
     int s=0;
@@ -66,16 +79,16 @@ struct conmgr * conmgr_connect (enum e_contype type, char *hostname, int port) {
 
     switch (type) {
 	case e_tty:
-	    s = open_tty_connection (hostname);
+	    s = open_tty_connection (hostname, profile);
 	    if (s == -1)
 	      return (0);
 	    break;
         case e_rlogin:
-	    s = open_rlogin_connection (hostname);
+	    s = open_rlogin_connection (hostname, profile, flags);
 	    if (!s) return (0);
 	    break;
         case e_vt3k:
-	    ptr = open_vt3k_connection (hostname, port);
+	    ptr = open_vt3k_connection (hostname, port, profile, flags);
 	    if (!ptr) return (0);
 	    s = VTSocket(ptr);
 	    break;
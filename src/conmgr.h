@@ -19,6 +19,8 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
  * conmgr.h -- Connection manager
  ************************************************************/
 
+struct iovec;
+
 enum e_contype {
     e_none = 0,       /* Connection is not established */
     e_tty = 1,        /* Connection is to a tty port */
@@ -34,9 +36,11 @@ struct conmgr {
     int eof;
 };
 
-struct conmgr * conmgr_connect (enum e_contype type, char *hostname, int port);
+struct conmgr * conmgr_connect (enum e_contype type, char *hostname, int port,
+				int profile, int flags);
 void conmgr_read (struct conmgr *con);
 void conmgr_send (struct conmgr *con, char *buf, size_t nbuf);
 void conmgr_send_break (struct conmgr *con);
 void conmgr_close (struct conmgr *con);
-void conmgr_rxfunc (int32_t refcon, char *buf, size_t nbuf);
+void conmgr_rxfunc (intptr_t refcon, char *buf, size_t nbuf);
+void conmgr_rxvfunc (intptr_t refcon, const struct iovec *iov, int iovcnt);
@@ -0,0 +1,387 @@
+/*
+This file is part of FreeVT3k.
+
+FreeVT3k is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+FreeVT3k is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License along
+with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/************************************************************
+ * evloop.c -- fd and timer event loop
+ *
+ * Watches fds with epoll where there is one and poll(2)
+ *   otherwise; neither has select()'s FD_SETSIZE ceiling, so
+ *   the loop works for a client embedded in a process with
+ *   many files open. Timers are a list sorted by due time;
+ *   the wait sleeps until the first of them.
+ *
+ *   There is no io_uring backend: polling through the ring
+ *   and then making the same recv() and write() calls costs
+ *   more per pass than epoll_wait(). A gain would need the
+ *   connection's receive path itself moved onto the ring.
+ ************************************************************/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#ifdef HAVE_SYS_EPOLL_H
+#  include <sys/epoll.h>
+#endif
+
+#include "evloop.h"
+#include "timers.h"
+
+#define kEvMaxEvents		16	/* Per epoll_wait() */
+
+typedef struct stEvSource
+{
+    int			fFd;		/* -1 when the slot is free	*/
+    int			fEvents;
+    bool		fWatched;	/* Registered with epoll	*/
+    tEvProc *		fProc;
+    void *		fRefCon;
+} tEvSource;
+
+struct stEvLoop
+{
+    int			fEpoll;		/* -1: using poll()		*/
+    tEvSource *		fSources;
+    int			fSourceCount;	/* Slots in use or free		*/
+    int			fSourceAlloc;
+    struct pollfd *	fPollFds;	/* poll() only; fSourceAlloc of them */
+    int *		fPollSlots;
+    tEvTimer *		fTimers;	/* Soonest first		*/
+};
+
+tEvLoop * EvLoopNew(void)
+{ /*EvLoopNew*/
+    tEvLoop * loop = (tEvLoop *) calloc(1, sizeof(tEvLoop));
+
+    if (loop == NULL)
+	return NULL;
+    loop->fEpoll = -1;
+#ifdef HAVE_SYS_EPOLL_H
+    /* A kernel without epoll fails here and we carry on with poll() */
+    loop->fEpoll = epoll_create1(EPOLL_CLOEXEC);
+#endif
+    return loop;
+} /*EvLoopNew*/
+
+void EvLoopFree(tEvLoop * loop)
+{ /*EvLoopFree*/
+    if (loop == NULL)
+	return;
+    if (loop->fEpoll != -1)
+	close(loop->fEpoll);
+    free(loop->fSources);
+    free(loop->fPollFds);
+    free(loop->fPollSlots);
+    free(loop);
+} /*EvLoopFree*/
+
+const char * EvLoopBackend(tEvLoop * loop)
+{ /*EvLoopBackend*/
+    return (loop->fEpoll != -1) ? "epoll" : "poll";
+} /*EvLoopBackend*/
+
+static int FindSource(tEvLoop * loop, int fd)
+{ /*FindSource*/
+    int slot;
+
+    for (slot = 0; slot < loop->fSourceCount; slot++)
+	{
+	if (loop->fSources[slot].fFd == fd)
+	    return slot;
+	}
+    return -1;
+} /*FindSource*/
+
+#ifdef HAVE_SYS_EPOLL_H
+/* Registers the slot's fd with epoll for what it wants. An fd that	*/
+/* wants nothing is taken out altogether, since epoll would still	*/
+/* report hangups on it.						*/
+
+static int Watch(tEvLoop * loop, int slot)
+{ /*Watch*/
+    tEvSource * src = &loop->fSources[slot];
+    struct epoll_event ev;
+    int op;
+
+    if (src->fEvents == 0)
+	{
+	if (src->fWatched)
+	    epoll_ctl(loop->fEpoll, EPOLL_CTL_DEL, src->fFd, NULL);
+	src->fWatched = false;
+	return 0;
+	}
+    memset(&ev, 0, sizeof(ev));
+    if (src->fEvents & kEvRead)
+	ev.events |= EPOLLIN;
+    if (src->fEvents & kEvWrite)
+	ev.events |= EPOLLOUT;
+    ev.data.u64 = ((uint64_t) (uint32_t) src->fFd << 32) | (uint32_t) slot;
+    op = (src->fWatched) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(loop->fEpoll, op, src->fFd, &ev) == -1)
+	return -1;
+    src->fWatched = true;
+    return 0;
+} /*Watch*/
+#endif
+
+int EvLoopAdd(tEvLoop * loop, int fd, int events, tEvProc * proc, void * refCon)
+{ /*EvLoopAdd*/
+    tEvSource * src;
+    void * p;
+    int slot, alloc;
+
+    if (FindSource(loop, fd) != -1)
+	{
+	errno = EEXIST;
+	return -1;
+	}
+    slot = FindSource(loop, -1);
+    if (slot == -1)
+	{
+	if (loop->fSourceCount == loop->fSourceAlloc)
+	    {
+	    alloc = (loop->fSourceAlloc) ? loop->fSourceAlloc * 2 : 4;
+	    if ((p = realloc(loop->fSources, alloc * sizeof(tEvSource))) == NULL)
+		return -1;
+	    loop->fSources = (tEvSource *) p;
+	    if ((p = realloc(loop->fPollFds, alloc * sizeof(struct pollfd))) == NULL)
+		return -1;
+	    loop->fPollFds = (struct pollfd *) p;
+	    if ((p = realloc(loop->fPollSlots, alloc * sizeof(int))) == NULL)
+		return -1;
+	    loop->fPollSlots = (int *) p;
+	    loop->fSourceAlloc = alloc;
+	    }
+	slot = loop->fSourceCount++;
+	}
+    src = &loop->fSources[slot];
+    src->fFd = fd;
+    src->fEvents = events;
+    src->fWatched = false;
+    src->fProc = proc;
+    src->fRefCon = refCon;
+#ifdef HAVE_SYS_EPOLL_H
+    if ((loop->fEpoll != -1) && (Watch(loop, slot) == -1))
+	{
+	src->fFd = -1;
+	return -1;
+	}
+#endif
+    return 0;
+} /*EvLoopAdd*/
+
+int EvLoopModify(tEvLoop * loop, int fd, int events)
+{ /*EvLoopModify*/
+    int slot = FindSource(loop, fd);
+
+    if (slot == -1)
+	{
+	errno = ENOENT;
+	return -1;
+	}
+    if (loop->fSources[slot].fEvents == events)
+	return 0;
+    loop->fSources[slot].fEvents = events;
+#ifdef HAVE_SYS_EPOLL_H
+    if (loop->fEpoll != -1)
+	return Watch(loop, slot);
+#endif
+    return 0;
+} /*EvLoopModify*/
+
+void EvLoopRemove(tEvLoop * loop, int fd)
+{ /*EvLoopRemove*/
+    int slot = FindSource(loop, fd);
+
+    if (slot == -1)
+	return;
+#ifdef HAVE_SYS_EPOLL_H
+    if (loop->fSources[slot].fWatched)
+	epoll_ctl(loop->fEpoll, EPOLL_CTL_DEL, fd, NULL);
+#endif
+    loop->fSources[slot].fFd = -1;
+} /*EvLoopRemove*/
+
+void EvTimerInit(tEvTimer * timer, tEvTimerProc * proc, void * refCon)
+{ /*EvTimerInit*/
+    memset(timer, 0, sizeof(*timer));
+    timer->fProc = proc;
+    timer->fRefCon = refCon;
+} /*EvTimerInit*/
+
+void EvTimerStop(tEvLoop * loop, tEvTimer * timer)
+{ /*EvTimerStop*/
+    tEvTimer ** link;
+
+    if (!timer->fArmed)
+	return;
+    for (link = &loop->fTimers; *link; link = &(*link)->fNext)
+	{
+	if (*link == timer)
+	    {
+	    *link = timer->fNext;
+	    break;
+	    }
+	}
+    timer->fNext = NULL;
+    timer->fArmed = false;
+} /*EvTimerStop*/
+
+/* (Re)starts the timer to go off delayUsec from now */
+
+void EvTimerStart(tEvLoop * loop, tEvTimer * timer, int64_t delayUsec)
+{ /*EvTimerStart*/
+    tEvTimer ** link;
+
+    EvTimerStop(loop, timer);
+    timer->fDue = MyMonotonicUsec() + delayUsec;
+    for (link = &loop->fTimers; *link; link = &(*link)->fNext)
+	{
+	if ((*link)->fDue > timer->fDue)
+	    break;
+	}
+    timer->fNext = *link;
+    *link = timer;
+    timer->fArmed = true;
+} /*EvTimerStart*/
+
+static void RunTimers(tEvLoop * loop)
+{ /*RunTimers*/
+    int64_t now = MyMonotonicUsec();
+    tEvTimer * timer;
+
+    /* A proc may start or stop timers, so take them one at a time */
+
+    while (((timer = loop->fTimers) != NULL) && (timer->fDue <= now))
+	{
+	loop->fTimers = timer->fNext;
+	timer->fNext = NULL;
+	timer->fArmed = false;
+	(*timer->fProc)(timer->fRefCon);
+	}
+} /*RunTimers*/
+
+/* How long to sleep: until the first timer, but no longer than	*/
+/* maxWaitMs (-1 for no limit). Rounded up, so a timer is never	*/
+/* woken for early.							*/
+
+static int WaitMs(tEvLoop * loop, int maxWaitMs)
+{ /*WaitMs*/
+    int64_t left;
+
+    if (loop->fTimers == NULL)
+	return maxWaitMs;
+    left = (loop->fTimers->fDue - MyMonotonicUsec() + 999) / 1000;
+    if (left < 0)
+	left = 0;
+    if ((maxWaitMs >= 0) && (left > maxWaitMs))
+	left = maxWaitMs;
+    if (left > 0x7fffffff)
+	left = 0x7fffffff;
+    return (int) left;
+} /*WaitMs*/
+
+static void Dispatch(tEvLoop * loop, int slot, int fd, int events)
+{ /*Dispatch*/
+    tEvSource * src;
+
+    /* An earlier proc in the same batch may have removed this one */
+
+    if ((slot >= loop->fSourceCount) || (loop->fSources[slot].fFd != fd))
+	return;
+    src = &loop->fSources[slot];
+    (*src->fProc)(src->fRefCon, fd, events);
+} /*Dispatch*/
+
+/* Waits for one round of events and runs their procs, then any	*/
+/* timers that have come due. Returns 0, or -1 with errno set; EINTR	*/
+/* is passed back so the caller can look at what the signal did.	*/
+
+int EvLoopRun(tEvLoop * loop, int maxWaitMs)
+{ /*EvLoopRun*/
+    int waitMs = WaitMs(loop, maxWaitMs);
+    int i, n, nfds, events;
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (loop->fEpoll != -1)
+	{
+	struct epoll_event ev[kEvMaxEvents];
+
+	n = epoll_wait(loop->fEpoll, ev, kEvMaxEvents, waitMs);
+	if (n == -1)
+	    return -1;
+	for (i = 0; i < n; i++)
+	    {
+	    events = 0;
+	    if (ev[i].events & (EPOLLIN | EPOLLHUP))
+		events |= kEvRead;
+	    if (ev[i].events & EPOLLOUT)
+		events |= kEvWrite;
+	    if (ev[i].events & EPOLLERR)
+		events |= kEvError;
+	    Dispatch(loop, (int) (uint32_t) ev[i].data.u64,
+		     (int) (ev[i].data.u64 >> 32), events);
+	    }
+	RunTimers(loop);
+	return 0;
+	}
+#endif
+
+    for (i = nfds = 0; i < loop->fSourceCount; i++)
+	{
+	if ((loop->fSources[i].fFd == -1) || (loop->fSources[i].fEvents == 0))
+	    continue;
+	loop->fPollFds[nfds].fd = loop->fSources[i].fFd;
+	loop->fPollFds[nfds].events =
+	    ((loop->fSources[i].fEvents & kEvRead) ? POLLIN : 0) |
+	    ((loop->fSources[i].fEvents & kEvWrite) ? POLLOUT : 0);
+	loop->fPollFds[nfds].revents = 0;
+	loop->fPollSlots[nfds++] = i;
+	}
+    n = poll(loop->fPollFds, nfds, waitMs);
+    if (n == -1)
+	return -1;
+    for (i = 0; (i < nfds) && (n > 0); i++)
+	{
+	if (!loop->fPollFds[i].revents)
+	    continue;
+	--n;
+	events = 0;
+	if (loop->fPollFds[i].revents & (POLLIN | POLLHUP))
+	    events |= kEvRead;
+	if (loop->fPollFds[i].revents & POLLOUT)
+	    events |= kEvWrite;
+	if (loop->fPollFds[i].revents & (POLLERR | POLLNVAL))
+	    events |= kEvError;
+	Dispatch(loop, loop->fPollSlots[i], loop->fPollFds[i].fd, events);
+	}
+    RunTimers(loop);
+    return 0;
+} /*EvLoopRun*/
+
+/* Local Variables: */
+/* c-indent-level: 0 */
+/* c-continued-statement-offset: 4 */
+/* c-brace-offset: 0 */
+/* c-argdecl-indent: 4 */
+/* c-label-offset: -4 */
+/* End: */
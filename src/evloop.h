@@ -0,0 +1,55 @@
+/*
+This file is part of FreeVT3k.
+
+FreeVT3k is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+FreeVT3k is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License along
+with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/************************************************************
+ * evloop.h -- fd and timer event loop
+ ************************************************************/
+
+/* Events an fd can be watched for. kEvError is only ever reported.	*/
+
+#define kEvRead			0x01
+#define kEvWrite		0x02
+#define kEvError		0x04
+
+typedef struct stEvLoop tEvLoop;
+
+typedef void tEvProc(void * refCon, int fd, int events);
+typedef void tEvTimerProc(void * refCon);
+
+/* Timers belong to the caller and are kept on a list in due order.	*/
+/* Times are MyMonotonicUsec(), so stepping the clock moves nothing.	*/
+
+typedef struct stEvTimer
+{
+    struct stEvTimer *	fNext;
+    int64_t		fDue;
+    bool		fArmed;
+    tEvTimerProc *	fProc;
+    void *		fRefCon;
+} tEvTimer;
+
+tEvLoop * EvLoopNew(void);
+void EvLoopFree(tEvLoop * loop);
+const char * EvLoopBackend(tEvLoop * loop);
+int  EvLoopAdd(tEvLoop * loop, int fd, int events, tEvProc * proc, void * refCon);
+int  EvLoopModify(tEvLoop * loop, int fd, int events);
+void EvLoopRemove(tEvLoop * loop, int fd);
+int  EvLoopRun(tEvLoop * loop, int maxWaitMs);
+
+void EvTimerInit(tEvTimer * timer, tEvTimerProc * proc, void * refCon);
+void EvTimerStart(tEvLoop * loop, tEvTimer * timer, int64_t delayUsec);
+void EvTimerStop(tEvLoop * loop, tEvTimer * timer);
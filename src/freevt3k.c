@@ -37,6 +37,8 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
 #ifdef HAVE_TERMIOS_H
 # include <termios.h>
 typedef struct termios TERMIO, *PTERMIO;
@@ -67,12 +69,24 @@ typedef struct termio TERMIO, *PTERMIO;
 #include "logging.h"
 #include "timers.h"
 #include "kbdtable.h"
+#include "transport.h"
+#include "vtcapture.h"
+#include "evloop.h"
+#include "vtoutput.h"
+#include "vtbatch.h"
 
 /* Useful macros */
 
 #ifndef MAX
 #  define MAX(a,b) (((a) > (b)) ? (a) : (b))
 #endif
+#ifndef MIN
+#  define MIN(a,b) (((a) < (b)) ? (a) : (b))
+#endif
+
+#define TTY_READ_MAX		(4096)	/* Largest read() of stdin */
+#define PASTE_BURST_BYTES	(256)	/* A read this big is a paste */
+#define PASTE_MARK_LEN		(6)
 
 /* Global variables */
 
@@ -90,6 +104,19 @@ bool
 	send_break = false;
 bool
 	type_ahead = false;
+/* Paste handling; see PasteMarks() */
+bool
+	bracketed_paste = false,
+	paste_burst = false,
+	paste_open = false;
+int
+	paste_held = 0;
+static const char
+	paste_start[] = "\033[200~",
+	paste_end[] = "\033[201~";
+bool
+	done = false,
+	stop_at_eof = false;
 TERMIO
 	old_termios;
 
@@ -103,8 +130,49 @@ int
 	term_type = 10;
 bool
 	disable_xon_xoff = false;
-int32_t
-	first_break_time = 0;
+bool
+	show_timing = false,
+	shown_ready = false;
+char
+	*logon_file = NULL;
+tEvLoop
+	*event_loop = NULL;
+bool
+	threaded_output = false;
+tVTOutput
+	*term_output = NULL;
+tVTTermOut
+	*term_buffer = NULL;	/* The data-out procs' refCon */
+/* Headless output; see vtbatch.c */
+char
+	*batch_file = NULL;
+bool
+	strip_output = false;
+tVTBatch
+	*batch = NULL;
+tEvTimer
+	break_window,
+	read_timer;
+int
+	loop_status = 0;
+
+/* Protocol statistics */
+#define DFLT_STATS_FILE		"freevt3k.stats"
+char
+	*stats_file = DFLT_STATS_FILE;
+char
+	*trace_file = NULL;
+char
+	*capture_file = NULL;
+volatile sig_atomic_t
+	stats_requested = 0;
+tVTConnection
+	*active_conn = NULL;
+
+/* Socket tuning; see transport.h */
+int
+	transport_profile = kTransportInteractive,
+	transport_flags = kTransportAutoBulk;
 
 static void PrintUsage(int detail)
 { /*PrintUsage*/
@@ -115,7 +183,10 @@ static void PrintUsage(int detail)
 #endif
   printf("\n\n");
     
-  printf("Usage: freevt3k [-li|-lo|-lio] [-f file] [-x] [-tt n] [-t]\n");
+  printf("Usage: freevt3k [-li|-lo|-lio] [-f file] [-x] [-tt n] [-t] [-paste]\n");
+  printf("                [-ct seconds] [-timing] [-stats file] [-trace file]\n");
+  printf("                [-profile name] [-tos] [-capture file] [-logon file]\n");
+  printf("                [-threads] [-batch file [-strip]]\n");
   printf("                [-C breakchar] ");
   printf("[-B count] [-T timer]\n");
   printf("                [-X file] [-a|-I file] [-d[d]] host\n");
@@ -125,8 +196,34 @@ static void PrintUsage(int detail)
   printf("   -lp             - put a prefix on logging output\n");
   printf("   -f file         - destination for logging [stdout]\n");
   printf("   -x              - disable xon/xoff flow control\n");
+  printf("   -ct seconds     - give up connecting after 'seconds' [%d]\n",
+	 kVT_CONNECT_TIMEOUT / 1000);
+  printf("   -timing         - report how long each step of session setup took,\n");
+  printf("                     up to the first prompt after logon\n");
+  printf("   -stats file     - where SIGUSR1 writes protocol statistics [%s];\n",
+	 DFLT_STATS_FILE);
+  printf("                     'file'.json gets them as one JSON object\n");
+  printf("   -trace file     - time every terminal read, one line each to 'file'\n");
+  printf("   -capture file   - record the session for vt3kreplay\n");
+  printf("   -logon file     - answer the logon prompts from 'file'; lines are\n");
+  printf("                     'hello user.acct', 'password pw' or 'line text'\n");
+  printf("   -threads        - write to the terminal from a thread of its own, so\n");
+  printf("                     a slow terminal doesn't hold up the host\n");
+  printf("   -batch file     - no terminal: write the host's output to 'file'\n");
+  printf("                     ('-' for stdout) untranslated and unlogged; input\n");
+  printf("                     comes from -a, -I or -logon\n");
+  printf("   -strip          - with -batch, strip escape sequences and controls\n");
+  printf("                     to leave plain text\n");
+  printf("   -profile name   - socket tuning: interactive, bulk or default [%s]\n",
+	 TransportProfileName(kTransportInteractive));
+  printf("                     (block mode always runs with the bulk profile)\n");
+  printf("   -tos            - let the profile set IP type of service;\n");
+  printf("                     old MPE V NS transports cannot take it\n");
   printf("   -tt n           - 'n'->10 (default) generates DC1 read triggers\n");
   printf("   -t              - enable type-ahead\n");
+  printf("   -paste          - have the terminal mark pastes (xterm bracketed\n");
+  printf("                     paste); pastes are kept for later reads even\n");
+  printf("                     without -t\n");
   printf("   -C breakchar    - use 'breakchar' (integer) as break trigger [BREAK or nul]\n");
   printf("   -B count        - change number of breaks for command mode [%d]\n",
 	 DFLT_BREAK_MAX);
@@ -138,6 +235,8 @@ static void PrintUsage(int detail)
   printf("   -X file         - specify 256-byte translation table.\n");
   printf("   -a file         - read initial commands from file.\n");
   printf("   -I file         - like -a, but stops when end-of-file reached\n");
+  printf("                     (a line of just %s ends a block mode read)\n",
+	 kVT_SCRIPT_ENTER);
   printf("   -d[d]           - enable debug output to freevt3k.debug\n");
   printf("   host            - name/IP address of target HP 3000\n");
 
@@ -171,6 +270,16 @@ static int GetTtyAttributes(int fd, PTERMIO termio_buf)
 
 } /*GetTtyAttributes*/
 
+/* Get all output onto the terminal before writing to it some other way */
+static void FlushTerminal(void)
+{ /*FlushTerminal*/
+
+  vt3kFlushOutput(term_buffer);
+  if (term_output != NULL)
+    VTOutputDrain(term_output);
+
+} /*FlushTerminal*/
+
 void ProcessInterrupt(void)
 {/*ProcessInterrupt*/
     
@@ -186,10 +295,11 @@ void ProcessInterrupt(void)
       temp_termios = old_termios;
       SetTtyAttributes(STDIN_FILENO, &temp_termios);
     }
+  FlushTerminal();
   printf("\n");
   for (;;)
     {
-      printf("Please enter FREEVT3K command (Exit or Continue) : ");
+      printf("Please enter FREEVT3K command (Exit, Continue, Stats or Json) : ");
       if (fgets(ans, sizeof(ans), stdin) == NULL) continue;
       if (strlen(ans) == 0) continue;
       if (islower(*ans))
@@ -205,11 +315,51 @@ void ProcessInterrupt(void)
 	  break_sigs = break_max;
 	  break;
 	}
+      if (((*ans == 'S') || (*ans == 'J')) && (active_conn != NULL))
+	{
+	  VTReportPrint(active_conn, stdout, (*ans == 'J'));
+	}
     }
   if (stdin_tty)
     SetTtyAttributes(STDIN_FILENO, &curr_termios);
 } /*ProcessInterrupt*/
 
+void CatchStats(int sig_type)
+{ /*CatchStats*/
+
+/* Only note the request; the stats are written from the message loop */
+  stats_requested = 1;
+  (void)signal(SIGUSR1, CatchStats);
+
+} /*CatchStats*/
+
+static void WriteStats(tVTConnection * conn)
+{ /*WriteStats*/
+
+  FILE
+    *fp;
+  char
+    json_file[256];
+
+  stats_requested = 0;
+  snprintf(json_file, sizeof(json_file), "%s.json", stats_file);
+  if ((fp = fopen(stats_file, "w")) == (FILE*)NULL)
+    {
+      perror(stats_file);
+      return;
+    }
+  VTReportPrint(conn, fp, false);
+  fclose(fp);
+  if ((fp = fopen(json_file, "w")) == (FILE*)NULL)
+    {
+      perror(json_file);
+      return;
+    }
+  VTReportPrint(conn, fp, true);
+  fclose(fp);
+
+} /*WriteStats*/
+
 #ifdef USE_CTLC_INTERRUPTS
 typedef void (*SigfuncInt)(int);
 
@@ -252,55 +402,220 @@ int ProcessSocket(tVTConnection * conn)
     whichError = 0;
   static char trigger[] = { ASC_DC1 };                                   /* JCM 040296 */
     
-  whichError = VTReceiveDataReady(conn);
-  if (whichError == kVTCVTOpen)
+/*
+ * Keep going until every complete record that arrived with this read
+ *   has been processed.
+ */
+  do
     {
+      whichError = VTReceiveDataReady(conn);
+      if (whichError == kVTCVTOpen)
+	{
 /*
  * The connection is open now, so initialize for
  * terminal operations. This means setting up
  * the TTY for "raw" operation. (Or, it will
  * once we get that set up.)
  */
-    }
-  else if (whichError != kVTCNoError)
-    {
-      char	messageBuffer[128];
-      if (whichError == kVTCStartShutdown)
-	return(1);
-      VTErrorMessage(conn, whichError,
-		     messageBuffer, sizeof(messageBuffer));
-      fprintf(stderr, "VT error:\r\n%s\r\n", messageBuffer);
-      return(-1);
-    }
-  if (conn->fReadStarted)
-    {
-      conn->fReadStarted = false;
-      if (conn->fReadFlush)	/* RM 960403 */
+	  if (show_timing)
+	    {
+	      char	messageBuffer[256];
+	      VTFormatTimes(conn, messageBuffer, sizeof(messageBuffer));
+	      fprintf(stderr, "Session open: %s\r\n", messageBuffer);
+	    }
+	}
+      else if (whichError != kVTCNoError)
 	{
-	  conn->fReadFlush = false;
-	  FlushQ();
+	  char	messageBuffer[128];
+	  if (whichError == kVTCStartShutdown)
+	    return(1);
+	  VTErrorMessage(conn, whichError,
+			 messageBuffer, sizeof(messageBuffer));
+	  fprintf(stderr, "VT error:\r\n%s\r\n", messageBuffer);
+	  return(-1);
 	}
-      if (term_type == 10)
-	conn->fDataOutProc(conn->fDataOutRefCon,
-			   trigger, sizeof(trigger));
+      if (conn->fReadStarted)
+	{
+	  conn->fReadStarted = false;
+	  if ((show_timing) && (!shown_ready) && (conn->fTimes.fReady))
+	    {
+	      char	messageBuffer[256];
+	      FlushTerminal();
+	      VTFormatTimes(conn, messageBuffer, sizeof(messageBuffer));
+	      fprintf(stderr, "Session ready: %s\r\n", messageBuffer);
+	      if (conn->fHaveLogonInfo)
+		fprintf(stderr, "Logged on as %s, session %s\r\n",
+			conn->fLogonInfo, conn->fLogonSessionID);
+	      shown_ready = true;
+	    }
+	  if (conn->fReadFlush)	/* RM 960403 */
+	    {
+	      conn->fReadFlush = false;
+	      FlushQ(conn);
+	    }
+	  if ((term_type == 10) && (batch == NULL))
+	    conn->fDataOutProc(conn->fDataOutRefCon,
+			       trigger, sizeof(trigger));
 /*
  * As we just got a read request, check for any typed-ahead data and
  *   process it now.
  */
-      ProcessQueueToHost(conn, 0);
-    }
+	  ProcessQueueToHost(conn, 0);
+	}
+    } while (VTReceivePending(conn));
   return(0);
 
 }/*ProcessSocket*/
 
+/* How much of stdin to read at once: no more than the typeahead ring	*/
+/* has room for. When it is full, stdin is left alone until the host	*/
+/* has taken some; the tty holds the rest.				*/
+static size_t TTYReadSize(tVTConnection * conn)
+{ /*TTYReadSize*/
+
+  int
+    room = kVT_INPUT_QUEUE - 1 - conn->fInput->fQueueLength;
+
+  if (room > TTY_READ_MAX)
+    room = TTY_READ_MAX;
+  return((room > 0) ? room : 0);
+
+} /*TTYReadSize*/
+
+/* Does buf hold a character that could end the current read? */
+static bool EndsRead(tVTConnection * conn, char *buf, ssize_t len)
+{ /*EndsRead*/
+
+  if (memchr(buf, conn->fLineTerminationChar, len))
+    return(true);
+  if ((conn->fAltLineTerminationChar) &&
+      (memchr(buf, conn->fAltLineTerminationChar, len)))
+    return(true);
+  return(false);
+
+} /*EndsRead*/
+
+/*
+ * A paste is queued for the reads that follow even when type-ahead is
+ *   off, since it can only be meant for them. One is recognised by the
+ *   terminal's bracketed paste marks, or by more arriving in one read
+ *   than anyone types: a lot of it, or a line end with more after it.
+ *   The burst lasts until the queue has been taken.
+ */
+static bool PasteBurst(tVTConnection * conn, char *buf, ssize_t len)
+{ /*PasteBurst*/
+
+  char
+    *eol;
+
+  if (len >= PASTE_BURST_BYTES)
+    return(true);
+  eol = (char *)memchr(buf, conn->fLineTerminationChar, len);
+  return((eol != NULL) && (eol < &buf[len - 1]));
+
+} /*PasteBurst*/
+
+/*
+ * Take the bracketed paste marks out of what was read. A mark split
+ *   across reads is held back, and put back in the queue if the rest of
+ *   it never comes. An end mark is only looked for inside a paste, and a
+ *   start mark is only held when -paste asked for them; it goes back
+ *   once stdin has been quiet for a moment, so a lone ESC typed at the
+ *   keyboard is never kept waiting for long.
+ */
+static int PasteRelease(tVTConnection * conn)
+{ /*PasteRelease*/
+
+  int
+    n = paste_held;
+
+  paste_held = 0;
+  if ((type_ahead) || (paste_burst) || (conn->fReadInProgress))
+    return(PutQBuffer(conn, (paste_open) ? paste_end : paste_start, n));
+  return(0);
+
+} /*PasteRelease*/
+
+static ssize_t PasteMarks(tVTConnection * conn, char *buf, ssize_t len)
+{ /*PasteMarks*/
+
+  const char
+    *mark;
+  char
+    *ptr = buf;
+  ssize_t
+    left,
+    n;
+
+  if (paste_held)
+    {
+      mark = (paste_open) ? paste_end : paste_start;
+      n = MIN(len, PASTE_MARK_LEN - paste_held);
+      if (memcmp(buf, &mark[paste_held], n))
+	{
+	  if (PasteRelease(conn) == -1)
+	    return(-1);
+	}
+      else
+	{
+	  memmove(buf, &buf[n], len - n);
+	  len -= n;
+	  if ((paste_held += n) < PASTE_MARK_LEN)
+	    return(len);
+	  paste_held = 0;
+	  paste_open = !paste_open;
+	  if (paste_open)
+	    paste_burst = true;
+	}
+    }
+  while ((ptr = (char *)memchr(ptr, ASC_ESC, &buf[len] - ptr)) != NULL)
+    {
+      left = &buf[len] - ptr;
+      mark = (paste_open) ? paste_end : paste_start;
+      n = MIN(left, PASTE_MARK_LEN);
+      if (!memcmp(ptr, mark, n))
+	{
+	  if (n == PASTE_MARK_LEN)
+	    {
+	      paste_open = !paste_open;
+	      if (paste_open)
+		paste_burst = true;
+	      memmove(ptr, &ptr[PASTE_MARK_LEN], left - PASTE_MARK_LEN);
+	      len -= PASTE_MARK_LEN;
+	      continue;
+	    }
+	  if ((paste_open) || (bracketed_paste))
+	    {
+	      paste_held = n;
+	      return(len - n);
+	    }
+	}
+      ++ptr;
+    }
+  return(len);
+
+} /*PasteMarks*/
+
 int ProcessTTY(tVTConnection * conn, char *buf, ssize_t len)
 {/*ProcessTTY*/
-  struct timeval
-    timeout;
+  struct pollfd
+    pfd;
   ssize_t
-    readCount = 1;
-  fd_set
-    readfds;
+    readCount = len,
+    left,
+    n;
+  char
+    *ptr;
+#  ifndef BREAK_VIA_SIG
+  char
+    *brk;
+  int
+    brk_ch = (break_char != -1) ? break_char : (conn->fSysBreakChar & 0xFF);
+#  endif
+  bool
+    ended = false;
+  if ((paste_burst) && (!paste_open) && (!conn->fInput->fQueueLength))
+    paste_burst = false;
   if (len > 0)
     {
       if (debug > 1)
@@ -309,18 +624,19 @@ int ProcessTTY(tVTConnection * conn, char *buf, ssize_t len)
 	  debug_need_crlf = 1;
 	}
 /*
- * Once we get the signal that at least one byte is ready, sit and read
- *   bytes from stdin until the select timer goes off after 10000 microsecs
+ * Once we get the signal that input is ready, sit and read stdin until
+ *   it has been quiet for 10 ms. Once a line has ended, only take what
+ *   has already arrived.
  */
       for (;;)
 	{
 	  if (!readCount)
 	    {
-	      timeout.tv_sec = 0;
-	      timeout.tv_usec = 10000;
-	      FD_ZERO(&readfds);
-	      FD_SET(stdin_fd, &readfds);
-	      switch (select(stdin_fd+1, (void*)&readfds, NULL, NULL, (struct timeval *)&timeout))
+	      if (!TTYReadSize(conn))
+		break;
+	      pfd.fd = stdin_fd;
+	      pfd.events = POLLIN;
+	      switch (poll(&pfd, 1, (ended) ? 0 : 10))
 		{
 		case -1:	/* Error */
 		  if (errno == EINTR)
@@ -328,10 +644,13 @@ int ProcessTTY(tVTConnection * conn, char *buf, ssize_t len)
 		      errno = 0;
 		      continue;
 		    }
-		  fprintf(stderr, "Error on select: %d.\n", errno);
+		  fprintf(stderr, "Error on poll: %d.\n", errno);
 		  return(-1);
 		case 0:		/* Timeout */
 		  readCount = -1;
+		  if ((paste_held) && (!paste_open) &&
+		      (PasteRelease(conn) == -1))
+		    return(-1);
 		  if (debug > 1)
 		    {
 		      if (debug_need_crlf)
@@ -342,64 +661,88 @@ int ProcessTTY(tVTConnection * conn, char *buf, ssize_t len)
 		    }
 		  break;
 		default:
-		  if (FD_ISSET(stdin_fd, &readfds))
+		  if ((readCount = read(stdin_fd, buf,
+					TTYReadSize(conn))) <= 0)
 		    {
-		      if ((readCount = read(stdin_fd, buf, 1)) != 1)
-			{
-			  fprintf(stderr, "Error on read: %d.\n", errno);
-			  return(-1);
-			}
+		      fprintf(stderr, "Error on read: %d.\n", errno);
+		      return(-1);
 		    }
 		}
 	      if (readCount == -1)
 		break;
 	    }
+	  if ((readCount = PasteMarks(conn, buf, readCount)) == -1)
+	    return(-1);
+	  if ((readCount) && (PasteBurst(conn, buf, readCount)))
+	    paste_burst = true;
+/*
+ * Everything up to the next break character goes into the queue in
+ *   one go.
+ */
+	  for (ptr = buf, left = readCount; left > 0; )
+	    {
 #  ifndef BREAK_VIA_SIG
-	  if (((break_char != -1) && (*buf == (char)break_char)) ||
-	      ((break_char == -1) && (*buf == (conn->fSysBreakChar & 0xFF))))
-	    { /* Break */
-	      send_break = true;
-/* Check for consecutive breaks - 'break_max'-in-a-row to get out */
-	      if (debug > 1)
-		{
-		  if (debug_need_crlf)
-		    fprintf(debug_fd, "\n");
-		  fprintf(debug_fd, "break: ");
-		  DEBUG_PRINT_CH(*buf);
-		}
-	      if (break_sigs == break_max)
-		first_break_time = MyGettimeofday();
-	      if (ElapsedTime(first_break_time) > break_timer)
+	      brk = (char *)memchr(ptr, brk_ch, left);
+	      n = (brk) ? brk - ptr : left;
+#  else
+	      n = left;
+#  endif
+	      if (n > 0)
 		{
+		  if (debug > 1)
+		    {
+		      ssize_t i;
+		      for (i = 0; i < n; i++)
+			DEBUG_PRINT_CH(ptr[i]);
+		    }
 		  break_sigs = break_max;
-		  first_break_time = MyGettimeofday();
+		  if ((type_ahead) || (paste_burst) || (conn->fReadInProgress))
+		    {
+		      if (PutQBuffer(conn, ptr, n) == -1)
+			return(-1);
+		      if (!conn->fReadInProgress)
+			PreassembleQ(conn);
+		    }
+		  if (EndsRead(conn, ptr, n))
+		    ended = true;
+		  ptr += n;
+		  left -= n;
 		}
-	      if (!(--break_sigs))
-		ProcessInterrupt();
-	      if (send_break)
-		{
-		  if (conn->fSysBreakEnabled)
-		    ProcessQueueToHost(conn, -2);
-		  send_break = false;
+#  ifndef BREAK_VIA_SIG
+	      if (left > 0)
+		{ /* Break */
+		  send_break = true;
+/* Check for consecutive breaks - 'break_max'-in-a-row to get out */
+		  if (debug > 1)
+		    {
+		      if (debug_need_crlf)
+			fprintf(debug_fd, "\n");
+		      fprintf(debug_fd, "break: ");
+		      DEBUG_PRINT_CH(*ptr);
+		    }
+		  if (break_sigs == break_max)
+		    EvTimerStart(event_loop, &break_window,
+				 (int64_t)break_timer * 1000);
+		  if (!(--break_sigs))
+		    ProcessInterrupt();
+		  if (send_break)
+		    {
+		      if (conn->fSysBreakEnabled)
+			ProcessQueueToHost(conn, -2);
+		      send_break = false;
+		    }
+		  ++ptr;
+		  --left;
 		}
-	      readCount = 0;
-	      continue;
-	    }
 #  endif
-	  if (debug > 1)
-	    DEBUG_PRINT_CH(*buf);
-	  break_sigs = break_max;
-	  if ((type_ahead) || (conn->fReadInProgress))
-	    {
-	      if (PutQ(*buf) == -1)
-		return(-1);
 	    }
 /*
  * If a read is in progress and we've gathered enough data to satisfy it,
  *    get out of the loop.
  */
 	  if ((conn->fReadInProgress) &&
-	      ((input_rec_len + input_queue_len) >= conn->fReadLength))
+	      ((conn->fInput->fRecLength + conn->fInput->fQueueLength) >=
+	       conn->fReadLength))
 	    {
 	      if (debug > 1)
 		{
@@ -501,6 +844,11 @@ int OpenTTY(PTERMIO new_termio, PTERMIO old_termio)
 #endif /*BREAK_VIA_SIG*/
 
   SetTtyAttributes(fd, new_termio);
+  if (bracketed_paste)
+    {
+      static const char on[] = "\033[?2004h";
+      if (write(STDOUT_FILENO, on, sizeof(on) - 1)) {}
+    }
 
   return(fd);
 
@@ -509,6 +857,11 @@ int OpenTTY(PTERMIO new_termio, PTERMIO old_termio)
 void CloseTTY(int fd, PTERMIO old_termio)
 { /*CloseTTY*/
 
+  if ((stdin_tty) && (bracketed_paste))
+    {
+      static const char off[] = "\033[?2004l";
+      if (write(STDOUT_FILENO, off, sizeof(off) - 1)) {}
+    }
   if (stdin_tty)
     SetTtyAttributes(fd, old_termio);
   if (fd != STDIN_FILENO)
@@ -516,42 +869,162 @@ void CloseTTY(int fd, PTERMIO old_termio)
 
 } /*CloseTTY*/
 
+/* A run of breaks only counts if it all comes within break_timer */
+static void BreakWindowOver(void *refCon)
+{ /*BreakWindowOver*/
+
+  break_sigs = break_max;
+
+} /*BreakWindowOver*/
+
+/* The host's read timeout has run out; send what there is */
+static void ReadTimedOut(void *refCon)
+{ /*ReadTimedOut*/
+
+  if (ProcessTTY((tVTConnection *)refCon, NULL, -1) == -1)
+    {
+      loop_status = 1;
+      done = true;
+    }
+
+} /*ReadTimedOut*/
+
+static void OutputDrained(void *refCon, int fd, int events)
+{ /*OutputDrained*/
+
+  VTOutputWoken(term_output);
+
+} /*OutputDrained*/
+
+/* More of a piped input file has come */
+static void FeedReady(void *refCon, int fd, int events)
+{ /*FeedReady*/
+
+  tVTConnection
+    *conn = (tVTConnection *)refCon;
+
+  if (FeedQ(conn) == -1)
+    {
+      loop_status = 1;
+      done = true;
+    }
+  else if (conn->fReadInProgress)
+    {
+      if (ProcessQueueToHost(conn, 0) == -1)
+	{
+	  loop_status = 1;
+	  done = true;
+	}
+    }
+  else
+    PreassembleQ(conn);
+
+} /*FeedReady*/
+
+static void SocketReady(void *refCon, int fd, int events)
+{ /*SocketReady*/
+
+  tVTConnection
+    *conn = (tVTConnection *)refCon;
+  int
+    whichError;
+  char
+    messageBuffer[128];
+
+  if ((events & kEvWrite) && ((whichError = VTSendReady(conn))))
+    {
+      VTErrorMessage(conn, whichError, messageBuffer, sizeof(messageBuffer));
+      fprintf(stderr, "VT error:\r\n%s\r\n", messageBuffer);
+      loop_status = 1;
+      done = true;
+      return;
+    }
+  if (!(events & (kEvRead | kEvError)))
+    return;
+  switch (ProcessSocket(conn))
+    {
+    case -1: loop_status = 1;	/* fall through */
+    case 1:  done = true;
+    }
+
+} /*SocketReady*/
+
+static void StdinReady(void *refCon, int fd, int events)
+{ /*StdinReady*/
+
+  tVTConnection
+    *conn = (tVTConnection *)refCon;
+  ssize_t
+    readCount;
+  char
+    termBuffer[TTY_READ_MAX];
+
+  if (done)
+    return;
+  if (((readCount = read(stdin_fd, termBuffer, TTYReadSize(conn))) <= 0) ||
+      (ProcessTTY(conn, termBuffer, readCount) == -1))
+    {
+      loop_status = 1;
+      done = true;
+    }
+
+} /*StdinReady*/
+
+/*
+ * Keep the read timer in step with the host: running while a timed read
+ *   is outstanding, restarted by each new read request.
+ */
+static void SetReadTimer(tVTConnection * conn)
+{ /*SetReadTimer*/
+
+  static bool
+    timed_read = false;
+  static uint16_t
+    timed_request = 0;
+
+  if ((!conn->fReadInProgress) || (!conn->fReadTimeout))
+    {
+      timed_read = false;
+      EvTimerStop(event_loop, &read_timer);
+      return;
+    }
+  if ((timed_read) && (timed_request == conn->fReadRequestCount))
+    return;
+  timed_read = true;
+  timed_request = conn->fReadRequestCount;
+  EvTimerStart(event_loop, &read_timer, (int64_t)conn->fReadTimeout * 1000000);
+  if (debug)
+    {
+      fprintf(debug_fd, "timer: %d.000000\n", conn->fReadTimeout);
+      debug_need_crlf = 0;
+    }
+
+} /*SetReadTimer*/
+
 int DoMessageLoop(tVTConnection * conn)
 { /*DoMessageLoop*/
   int
     returnValue = 0;
-  ssize_t
-    readCount;
-  struct timeval
-    timeout,
-    *time_ptr;
-  fd_set
-    readfds;
   TERMIO
     new_termios;
   bool
     oldTermiosValid = false;
   int
-    nfds = 0;
-  char
-    termBuffer[2];
-  int32_t
-    start_time = 0,
-    read_timer = 0,
-    time_remaining = 0;
-  bool
-    timed_read = false;
-  int
-    vtSocket;
+    vtSocket,
+    socket_events;
   extern FILE
     *debug_fd;
 
-  if ((stdin_fd = OpenTTY(&new_termios, &old_termios)) == -1)
+/* Headless sessions leave the terminal alone */
+  if (batch == NULL)
     {
-      returnValue = 1;
-      goto Last;
+      if ((stdin_fd = OpenTTY(&new_termios, &old_termios)) == -1)
+	{
+	  returnValue = 1;
+	  goto Last;
+	}
+      oldTermiosValid = true;    /* We can clean up now. */
     }
-  oldTermiosValid = true;    /* We can clean up now. */
 
 /*
  * Setup a read loop waiting for I/O on either fd.  For connection I/O,
@@ -567,49 +1040,71 @@ int DoMessageLoop(tVTConnection * conn)
 #endif
   break_sigs = break_max;
 
+  active_conn = conn;
+  (void)signal(SIGUSR1, CatchStats);
+
   vtSocket = VTSocket(conn);
-  if (stdin_tty)
-    nfds = 1 + MAX(stdin_fd, vtSocket);
-  else
-    nfds = 1 + vtSocket;
-  while (!done)
+  conn->fSendNoWait = true;	/* The loop waits for room instead */
+  loop_status = 0;
+  if (((event_loop = EvLoopNew()) == NULL) ||
+      (EvLoopAdd(event_loop, vtSocket, kEvRead, SocketReady, conn) == -1) ||
+      ((stdin_tty) &&
+       (EvLoopAdd(event_loop, stdin_fd, kEvRead, StdinReady, conn) == -1)) ||
+      ((conn->fInput->fFeedWait) &&
+       (EvLoopAdd(event_loop, conn->fInput->fFeedFd, kEvRead,
+		  FeedReady, conn) == -1)))
     {
-      FD_ZERO(&readfds);
-      if (stdin_tty)
-	FD_SET(stdin_fd, &readfds);
-      FD_SET(vtSocket, &readfds);
-/*
- * If a read timer has been specified, use it in the select()
- *   call.
- */
-      if ((conn->fReadInProgress) && (conn->fReadTimeout))
-	{
-	  if (!timed_read)
-	    { /* First time timer was specified */
-	      timed_read = true;
-	      start_time = MyGettimeofday();
-	      read_timer = conn->fReadTimeout * 1000;
-	      time_remaining = read_timer;
-	    }
-	  timeout.tv_sec = time_remaining / 1000;
-	  timeout.tv_usec = (time_remaining % 1000) * 1000;
-	  time_ptr = (struct timeval*)&timeout;
-	  if (debug)
-	    {
-		    fprintf(debug_fd, "timer: %ld.%06ld\n",
-			    timeout.tv_sec, (long) timeout.tv_usec);
-	      debug_need_crlf = 0;
-	    }
+      fprintf(stderr, "Unable to set up event loop: %d.\n", errno);
+      returnValue = 1;
+      goto Last;
+    }
+  EvTimerInit(&break_window, BreakWindowOver, NULL);
+  EvTimerInit(&read_timer, ReadTimedOut, conn);
+  vt3kBufferOutput(term_buffer, true);
+  if ((threaded_output) && (batch == NULL))
+    {
+      if (((term_output = VTOutputStart(STDOUT_FILENO)) == NULL) ||
+	  (EvLoopAdd(event_loop, VTOutputWakeFd(term_output), kEvRead,
+		     OutputDrained, NULL) == -1))
+	{
+	  fprintf(stderr, "Unable to start the output thread.\r\n");
+	  returnValue = 1;
+	  goto Last;
 	}
-      else
+      vt3kThreadOutput(term_buffer, term_output);
+    }
+  if (show_timing)
+    fprintf(stderr, "Event loop: %s\r\n", EvLoopBackend(event_loop));
+
+  while ((!done) && (!conn->fInput->fEOF))
+    {
+      if (stats_requested)
+	WriteStats(conn);
+      if ((batch != NULL) && (VTBatchError(batch)))
 	{
-	  timed_read = false;
-	  time_ptr = (struct timeval*)NULL;
+	  returnValue = 1;
+	  goto Last;
 	}
+/* Everything the last round wrote goes out before we wait */
+      vt3kFlushOutput(term_buffer);
+/* Take no more from the host while the terminal is far behind */
+      socket_events = kEvRead;
+      if ((term_output != NULL) && (VTOutputBacklog(term_output)))
+	socket_events = 0;
+/* Replies the host hasn't taken yet go when it has room for them */
+      if (VTSendPending(conn))
+	socket_events |= kEvWrite;
+      EvLoopModify(event_loop, vtSocket, socket_events);
+/* Leave stdin in the tty while the typeahead ring is full */
+      if (stdin_tty)
+	EvLoopModify(event_loop, stdin_fd, (TTYReadSize(conn)) ? kEvRead : 0);
+      if (conn->fInput->fFeedWait)
+	EvLoopModify(event_loop, conn->fInput->fFeedFd,
+		     ((FeedPending(conn)) && (TTYReadSize(conn))) ? kEvRead : 0);
+      SetReadTimer(conn);
 
-      switch (select(nfds, (void*)&readfds, NULL, NULL, time_ptr))
+      if (EvLoopRun(event_loop, -1) == -1)
 	{
-	case -1:	/* Error */
 	  if (errno == EINTR)
 	    {
 #  ifdef BREAK_VIA_SIG
@@ -622,45 +1117,29 @@ int DoMessageLoop(tVTConnection * conn)
 	      errno = 0;
 	      continue;
 	    }
-	  fprintf(stderr, "Error on select: %d.\n", errno);
+	  fprintf(stderr, "Error on event wait: %d.\n", errno);
 	  returnValue = 1;
 	  goto Last;
-	case 0:		/* Timeout */
-	  if (ProcessTTY(conn, termBuffer, -1) == -1)
-	    {
-	      returnValue = 1;
-	      goto Last;
-	    }
-	  timed_read = false;
-	  continue;
-	default:
-	  if (timed_read)
-	    time_remaining = read_timer - ElapsedTime(start_time);
-	  if (FD_ISSET(vtSocket, &readfds))
-	    {
-	      switch (ProcessSocket(conn))
-		{
-		case -1: returnValue = 1;	/* fall through */
-		case 1:  done = true;
-		}
-	    }
-	  if ((!done) && (FD_ISSET(stdin_fd, &readfds)))
-	    {
-	      if ((readCount = read(stdin_fd, termBuffer, 1)) != 1)
-		{
-		  returnValue = 1;
-		  goto Last;
-		}
-	      if (ProcessTTY(conn, termBuffer, readCount) == -1)
-		{
-		  returnValue = 1;
-		  goto Last;
-		}
-	    }
-	} /* switch */
+	}
     }  /* End read loop */
+  if (loop_status)
+    returnValue = loop_status;
 
 Last:
+  vt3kBufferOutput(term_buffer, false);
+  if (term_output != NULL)
+    {
+      vt3kThreadOutput(term_buffer, NULL);
+      VTOutputStop(term_output);
+      term_output = NULL;
+    }
+  if (event_loop != NULL)
+    {
+      EvLoopFree(event_loop);
+      event_loop = NULL;
+    }
+  (void)signal(SIGUSR1, SIG_DFL);
+  active_conn = NULL;
 #ifdef USE_CTLC_INTERRUPTS
   RestoreCtlC();
 #endif
@@ -672,14 +1151,13 @@ Last:
 
 int main(int argc, char *argv[])
 { /*main*/
-  long
-    ipAddress;
   int
-    ipPort = kVT_PORT;
-  struct hostent
-    *theHost;
+    ipPort = kVT_PORT,
+    connect_timeout = kVT_CONNECT_TIMEOUT;
   tVTConnection
     *conn;
+  tHPVTContext
+    *hpvt = NULL;
   bool
     parm_error = false;
   int
@@ -716,6 +1194,10 @@ int main(int argc, char *argv[])
 	}
       else if (!strcmp(*argv, "-t"))
 	type_ahead = true;
+      else if (!strcmp(*argv, "-paste"))
+	bracketed_paste = true;
+      else if (!strcmp(*argv, "-threads"))
+	threaded_output = true;
       else if ((!strcmp(*argv, "-a")) ||
 	       (!strcmp(*argv, "-I")))
 	{
@@ -792,6 +1274,103 @@ int main(int argc, char *argv[])
 	  else
 	    parm_error = true;
 	}
+      else if (!strcmp(*argv, "-ct"))
+	{
+	  if (--argc)
+	    {
+	      ++argv;
+	      if (*argv[0] == '-')
+		parm_error = true;
+	      else
+		connect_timeout = atoi(*argv) * 1000;
+	    }
+	  else
+	    parm_error = true;
+	}
+      else if (!strcmp(*argv, "-timing"))
+	show_timing = true;
+      else if (!strcmp(*argv, "-stats"))
+	{
+	  if (--argc)
+	    {
+	      ++argv;
+	      if (*argv[0] == '-')
+		parm_error = true;
+	      else
+		stats_file = *argv;
+	    }
+	  else
+	    parm_error = true;
+	}
+      else if (!strcmp(*argv, "-trace"))
+	{
+	  if (--argc)
+	    {
+	      ++argv;
+	      if (*argv[0] == '-')
+		parm_error = true;
+	      else
+		trace_file = *argv;
+	    }
+	  else
+	    parm_error = true;
+	}
+      else if (!strcmp(*argv, "-capture"))
+	{
+	  if (--argc)
+	    {
+	      ++argv;
+	      if (*argv[0] == '-')
+		parm_error = true;
+	      else
+		capture_file = *argv;
+	    }
+	  else
+	    parm_error = true;
+	}
+      else if (!strcmp(*argv, "-batch"))
+	{
+	  if (--argc)
+	    {
+	      ++argv;
+	      if ((*argv[0] == '-') && (strcmp(*argv, "-")))
+		parm_error = true;
+	      else
+		batch_file = *argv;
+	    }
+	  else
+	    parm_error = true;
+	}
+      else if (!strcmp(*argv, "-strip"))
+	strip_output = true;
+      else if (!strcmp(*argv, "-logon"))
+	{
+	  if (--argc)
+	    {
+	      ++argv;
+	      if (*argv[0] == '-')
+		parm_error = true;
+	      else
+		logon_file = *argv;
+	    }
+	  else
+	    parm_error = true;
+	}
+      else if (!strcmp(*argv, "-profile"))
+	{
+	  if (--argc)
+	    {
+	      ++argv;
+	      if (*argv[0] == '-')
+		parm_error = true;
+	      else if ((transport_profile = TransportProfileByName(*argv)) == -1)
+		parm_error = true;
+	    }
+	  else
+	    parm_error = true;
+	}
+      else if (!strcmp(*argv, "-tos"))
+	transport_flags |= kTransportAllowTOS;
       else if (!strcmp(*argv, "-tt"))
 	{
 	  if (--argc)
@@ -874,7 +1453,7 @@ int main(int argc, char *argv[])
   if (argc > 0)
     hostname = *argv;
 
-  if (!hostname)
+  if ((!hostname) || ((strip_output) && (!batch_file)))
     {
       PrintUsage(0);
       return(2);
@@ -884,48 +1463,10 @@ int main(int argc, char *argv[])
     return 1;
   }
 
-  if (input_file)
-    {
-      FILE *input;
-      char buf[128], *ptr;
-      if ((input = fopen(input_file, "r")) == (FILE*)NULL)
-	{
-	  perror("fopen");
-	  return(1);
-	}
-      for (;;)
-	{
-	  if (fgets(buf, sizeof(buf)-1, input) == NULL)
-	    break;
-	  ptr = buf;
-	  while (*ptr)
-	    {
-	      if (*ptr == '\n')
-		PutQ(ASC_CR);
-	      else
-		PutQ(*ptr);
-	      ++ptr;
-	    }
-	}
-      fclose(input);
-    }
-
     /* First, validate the destination. If the destination can be	*/
     /* validated, create a connection structure and try to open the     */
     /* connection.							*/
 
-  ipAddress = (long)inet_addr(hostname);
-  if (ipAddress == INADDR_NONE)
-    {
-      theHost = gethostbyname(hostname);
-      if (theHost == NULL)
-	{
-	  fprintf(stderr, "Unable to resolve %s.\n", hostname);
-	  return(1);
-	}
-      memcpy((char *) &ipAddress, theHost->h_addr, sizeof(ipAddress));
-    }
-
   conn = (tVTConnection *) calloc(1, sizeof(tVTConnection));
   if (conn == NULL)
     {
@@ -933,7 +1474,7 @@ int main(int argc, char *argv[])
       return(1);
     }
 
-  if ((vtError = VTInitConnection(conn, ipAddress, ipPort)))
+  if ((vtError = VTInitConnection(conn, 0, ipPort)))
     {
       VTErrorMessage(conn, vtError,
 		     messageBuffer, sizeof(messageBuffer));
@@ -942,20 +1483,105 @@ int main(int argc, char *argv[])
       return(1);
     }
 
+  if ((trace_file) && (VTTraceStart(conn, trace_file)))
+    {
+      perror(trace_file);
+      VTCleanUpConnection(conn);
+      return(1);
+    }
+
+  if ((capture_file) &&
+      (VTCaptureStart(conn, capture_file,
+		      kVTCaptureRecords | kVTCaptureOutput)))
+    {
+      perror(capture_file);
+      VTCleanUpConnection(conn);
+      return(1);
+    }
+
+  if ((logon_file) && (LoadLogonProfile(conn, logon_file)))
+    {
+      VTCleanUpConnection(conn);
+      return(1);
+    }
+
+/* Start the typeahead off with the input file; the rest follows as reads take it */
+  conn->fInput->fStopAtEOF = stop_at_eof;
+  if (input_file)
+    {
+      if ((OpenFeedQ(conn, input_file)) || (FeedQ(conn) == -1))
+	{
+	  CloseFeedQ(conn);
+	  VTCleanUpConnection(conn);
+	  return(1);
+	}
+    }
+
+
   if (term_type == 10)
       conn->fBlockModeSupported = true;	/* RM 960411 */
+  VTSetTransportProfile(conn, transport_profile, transport_flags);
   
   conn->fDataOutProc =
     ((vt100) ? vt3kHPtoVT100 :
      ((vt52) ? vt3kHPtoVT52 :
       ((generic) ? vt3kHPtoGeneric: vt3kDataOutProc)));
+  conn->fDataOutVProc =
+    ((vt100) ? vt3kHPtoVT100V :
+     ((vt52) ? vt3kHPtoVT52V :
+      ((generic) ? vt3kHPtoGenericV: vt3kDataOutVProc)));
+  conn->fDataOutFlushProc =
+    ((vt100) || (vt52) || (generic)) ? vt3kHPFlush : vt3kDataOutFlush;
+  if (!batch_file)
+    {
+      if ((term_buffer = vt3kNewOutput()) == NULL)
+	{
+	  fprintf(stderr, "Unable to allocate an output buffer.\n");
+	  CloseFeedQ(conn);
+	  VTCleanUpConnection(conn);
+	  return(1);
+	}
+      conn->fDataOutRefCon = (intptr_t)term_buffer;
+    }
+  if ((!batch_file) && ((vt100) || (vt52) || (generic)))
+    {
+      if ((hpvt = vt3kHPNewContext(conn, term_buffer)) == NULL)
+	{
+	  fprintf(stderr, "Unable to allocate a translator.\n");
+	  CloseFeedQ(conn);
+	  VTCleanUpConnection(conn);
+	  vt3kFreeOutput(term_buffer);
+	  return(1);
+	}
+      conn->fDataOutRefCon = (intptr_t)hpvt;
+    }
+/* Headless: the host's output goes straight to the file, untranslated */
+  if (batch_file)
+    {
+      if ((batch = VTBatchOpen(batch_file, strip_output)) == NULL)
+	{
+	  perror(batch_file);
+	  CloseFeedQ(conn);
+	  VTCleanUpConnection(conn);
+	  return(1);
+	}
+      conn->fDataOutProc = VTBatchOutProc;
+      conn->fDataOutVProc = VTBatchOutVProc;
+      conn->fDataOutFlushProc = NULL;
+      conn->fDataOutRefCon = (intptr_t)batch;
+    }
 
-  if ((vtError = VTConnect(conn)))
+  if ((vtError = VTConnectHost(conn, hostname, ipPort, connect_timeout)))
     {
       VTErrorMessage(conn, vtError,
 		     messageBuffer, sizeof(messageBuffer));
       fprintf(stderr, "Unable to connect to host.\n%s\n", messageBuffer);
+      CloseFeedQ(conn);
       VTCleanUpConnection(conn);
+      if (hpvt)
+	vt3kHPFreeContext(hpvt);
+      vt3kFreeOutput(term_buffer);
+      VTBatchClose(batch);
       return(1);
     }
 
@@ -980,7 +1606,18 @@ int main(int argc, char *argv[])
 
   returnValue = DoMessageLoop(conn);
 
+  VTTracePrint(conn, stderr, false);
+  CloseFeedQ(conn);
   VTCleanUpConnection(conn);
+  if (hpvt)
+    vt3kHPFreeContext(hpvt);
+  vt3kFreeOutput(term_buffer);
+  term_buffer = NULL;
+  if ((batch) && (VTBatchClose(batch)))
+    {
+      perror(batch_file);
+      returnValue = 1;
+    }
 
   return(returnValue);
 } /*main*/
@@ -25,8 +25,21 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
 
 #define VERSION_ID "1.0"
 
-int PutImmediateQ(char ch);
-void vt3kDataOutProc(int32_t refCon, char * buffer, size_t bufferLength);
+struct iovec;
+struct stVTOutput;
+
+/* Terminal output; pass a tVTTermOut as the data-out refCon (0 just	*/
+/* writes to stdout), with vt3kDataOutFlush as the flush proc.		*/
+typedef struct stVTTermOut tVTTermOut;
+
+tVTTermOut *vt3kNewOutput(void);
+void vt3kFreeOutput(tVTTermOut *out);
+void vt3kDataOutProc(intptr_t refCon, char * buffer, size_t bufferLength);
+void vt3kDataOutVProc(intptr_t refCon, const struct iovec * iov, int iovCount);
+void vt3kDataOutFlush(intptr_t refCon);
+void vt3kBufferOutput(tVTTermOut *out, bool on);
+void vt3kFlushOutput(tVTTermOut *out);
+void vt3kThreadOutput(tVTTermOut *out, struct stVTOutput *thread);
 
 #endif
 
@@ -29,26 +29,70 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
 #include <stdlib.h>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 
 #include "freevt3k.h"
 #include "hpterm.h"
+#include "hpvt100.h"
 #include "vtconn.h"
 #include "logging.h"
 
 /* Circular VT queue parms */
 #define MAX_VT_QUEUE		(kVT_MAX_BUFFER)
 
-char
-    vt_ch = '\0',
+/*
+ * Everything a translator carries from one host record to the next.
+ *   One of these per connection, passed in as the data-out refCon.
+ */
+struct stHPVTContext
+{
+  tVTConnection
+    *conn;			/* Status replies go to its queue */
+  tVTTermOut
+    *out;			/* Where the translation goes */
+  char
+    vt_ch,
     vt_queue[MAX_VT_QUEUE],
-    *vtq_rptr = vt_queue,
-    *vtq_rptr_hold = vt_queue,
-    *vtq_wptr = vt_queue;
-int
-    vt_enhanced = 0,
-    vt_queue_len_hold = 0,
-    vt_queue_len = 0;
+    *vtq_rptr,
+    *vtq_rptr_hold,
+    *vtq_wptr,
+    enhance_buf[256];
+  int
+    vt_enhanced,
+    vt_queue_len_hold,
+    vt_queue_len,
+    line_draw;
+};
+
+tHPVTContext *vt3kHPNewContext(tVTConnection *conn, tVTTermOut *out)
+{ /*vt3kHPNewContext*/
+
+  tHPVTContext
+    *ctx;
+
+  if ((ctx = (tHPVTContext*)calloc(1, sizeof(tHPVTContext))) == NULL)
+    return(NULL);
+  ctx->conn = conn;
+  ctx->out = out;
+  ctx->vtq_rptr = ctx->vtq_rptr_hold = ctx->vtq_wptr = ctx->vt_queue;
+  return(ctx);
+
+} /*vt3kHPNewContext*/
+
+void vt3kHPFreeContext(tHPVTContext *ctx)
+{ /*vt3kHPFreeContext*/
+
+  free(ctx);
+
+} /*vt3kHPFreeContext*/
+
+void vt3kHPFlush(intptr_t refCon)
+{ /*vt3kHPFlush*/
+
+  vt3kFlushOutput(((tHPVTContext*)refCon)->out);
+
+} /*vt3kHPFlush*/
 
 int int_sprintf(char *buf, const char *fmt, ...)
 { /*int_sprintf*/
@@ -63,52 +107,76 @@ int int_sprintf(char *buf, const char *fmt, ...)
 
 } /*int_sprintf*/
 
-static int GetVTQueue(void)
+static int GetVTQueue(tHPVTContext *ctx)
 { /*GetVTQueue*/
-  if (!vt_queue_len)
+  if (!ctx->vt_queue_len)
     return(-1);
-  if (++vtq_rptr == &vt_queue[MAX_VT_QUEUE])
-    vtq_rptr = vt_queue;
-  --vt_queue_len;
-  vt_ch = *vtq_rptr;
+  if (++ctx->vtq_rptr == &ctx->vt_queue[MAX_VT_QUEUE])
+    ctx->vtq_rptr = ctx->vt_queue;
+  --ctx->vt_queue_len;
+  ctx->vt_ch = *ctx->vtq_rptr;
   return(0);
 } /*GetVTQueue*/
 
-static int PutVTQueue(char ch)
+static int PutVTQueue(tHPVTContext *ctx, char ch)
 { /*PutVTQueue*/
 
-  if (++vtq_wptr == &vt_queue[MAX_VT_QUEUE])
-    vtq_wptr = vt_queue;
-  if (vtq_wptr == vtq_rptr)
+  if (++ctx->vtq_wptr == &ctx->vt_queue[MAX_VT_QUEUE])
+    ctx->vtq_wptr = ctx->vt_queue;
+  if (ctx->vtq_wptr == ctx->vtq_rptr)
     {
       fprintf(stderr, "<queue overflow>\n");
       return(-1);
     }
-  ++vt_queue_len;
-  *vtq_wptr = ch;
+  ++ctx->vt_queue_len;
+  *ctx->vtq_wptr = ch;
   return(0);
 
 } /*PutVTQueue*/
 
-static int GetNextChar(void)
+static void QueueVTData(tHPVTContext *ctx, char *buf, size_t buf_len)
+{ /*QueueVTData*/
+
+/* Copy raw data to the queue */
+  for (; buf_len; --buf_len)
+    PutVTQueue(ctx, *(buf++));
+
+} /*QueueVTData*/
+
+static size_t QueueVTDataV(tHPVTContext *ctx, const struct iovec *iov, int iov_count)
+{ /*QueueVTDataV*/
+
+  size_t
+    total = 0;
+
+  for (; iov_count > 0; --iov_count, ++iov)
+    {
+      QueueVTData(ctx, (char*)iov->iov_base, iov->iov_len);
+      total += iov->iov_len;
+    }
+  return(total);
+
+} /*QueueVTDataV*/
+
+static int GetNextChar(tHPVTContext *ctx)
 { /*GetNextChar*/
 
-  if (GetVTQueue() == -1)
+  if (GetVTQueue(ctx) == -1)
     {
 /*
  * Ran out of data, reset the read pointer/length to the held value
  *   so we can resume with any escape sequence that we may have been
  *   in the middle of.
  */
-      vtq_rptr = vtq_rptr_hold;
-      vt_queue_len = vt_queue_len_hold;
+      ctx->vtq_rptr = ctx->vtq_rptr_hold;
+      ctx->vt_queue_len = ctx->vt_queue_len_hold;
       return(0);
     }
   return(1);
 
 } /*GetNextChar*/
 
-static char *VT100DisplayEnhance(char ch)
+static char *VT100DisplayEnhance(tHPVTContext *ctx, char ch)
 { /*VT100DisplayEnhance*/
 /*                                      0x40+
 @                                        0000
@@ -135,8 +203,8 @@ O   Half     Underline Inverse  Blink    1111
 #define HPTERM_BOLD		(0x08)
 #define HPTERM_OPT_MASK		(HPTERM_BLINK | HPTERM_INVERSE | HPTERM_UNDERLINE | HPTERM_BOLD)
 
-  static char
-    buf[256];
+  char
+    *buf = ctx->enhance_buf;
 #  define CSI			"\033["
   const char
     *blink = CSI "5m",
@@ -156,18 +224,18 @@ O   Half     Underline Inverse  Blink    1111
 	strcat(buf, smul);
       if (!((int)ch & HPTERM_BOLD))
 	strcat(buf, bold);
-      vt_enhanced = 1;
+      ctx->vt_enhanced = 1;
     }
   else
     {
       strcpy(buf, sgr0);
-      vt_enhanced = 0;
+      ctx->vt_enhanced = 0;
     }
   return(buf);
 
 } /*VT100DisplayEnhance*/
 
-static char *GenericDisplayEnhance(char ch)
+static char *GenericDisplayEnhance(tHPVTContext *ctx, char ch)
 { /*GenericDisplayEnhance*/
 /*                                      0x40+
 @                                        0000
@@ -194,8 +262,8 @@ O   Half     Underline Inverse  Blink    1111
 #define HPTERM_BOLD		(0x08)
 #define HPTERM_OPT_MASK		(HPTERM_BLINK | HPTERM_INVERSE | HPTERM_UNDERLINE | HPTERM_BOLD)
 
-  static char
-    buf[256];
+  char
+    *buf = ctx->enhance_buf;
   const char
     *blink = "<blink>",
     *bold  = "<bold>",
@@ -214,12 +282,12 @@ O   Half     Underline Inverse  Blink    1111
 	strcat(buf, smul);
       if (!((int)ch & HPTERM_BOLD))
 	strcat(buf, bold);
-      vt_enhanced = 1;
+      ctx->vt_enhanced = 1;
     }
   else
     {
       strcpy(buf, sgr0);
-      vt_enhanced = 0;
+      ctx->vt_enhanced = 0;
     }
   return(buf);
 
@@ -403,16 +471,17 @@ static char VT100LineDraw(char ch)
 
 } /*VT100LineDraw*/
 
-void vt3kHPtoVT100(int32_t refCon, char *buf, size_t buf_len)
-{ /*vt3kHPtoVT100*/
+static void TranslateHPtoVT100(tHPVTContext *ctx)
+{ /*TranslateHPtoVT100*/
   int
-    i = 0,
     row_position = 1,
     num_val = 0,
     row = 0,
     col = 0,
     move_relative = 0,
     hold_len;
+  size_t
+    out_len;
 
   char
     out_buf[MAX_VT_QUEUE],
@@ -440,62 +509,53 @@ void vt3kHPtoVT100(int32_t refCon, char *buf, size_t buf_len)
     *sel_g0     = SI,		/* Select G0 character sets from below */
     *g0_usascii = ESC "(B",	/* Specify USASCII set */
     *g0_graphic = ESC "(0";	/* Specify graphics/line drawing set */
-  static int
-    line_draw = 0;
-
-  if (!buf_len)
-    return;
-
-/* Copy raw data to the queue */
-  for (; i<buf_len; i++)
-    PutVTQueue(buf[i]);
 
   if (debug)
     {
-      hold_len = vt_queue_len;
+      hold_len = ctx->vt_queue_len;
       char *ptr;
-      ptr = vtq_rptr;
-      while (GetVTQueue() != -1)
-	*(out_ptr++) = vt_ch;
+      ptr = ctx->vtq_rptr;
+      while (GetVTQueue(ctx) != -1)
+	*(out_ptr++) = ctx->vt_ch;
       DumpBuffer(out_buf, out_ptr - out_buf, "hp");
-      vtq_rptr = ptr;
-      vt_queue_len = hold_len;
+      ctx->vtq_rptr = ptr;
+      ctx->vt_queue_len = hold_len;
     }
 
   out_ptr = out_buf;
   for (;;)
     {
-      vtq_rptr_hold = vtq_rptr;
-      vt_queue_len_hold = vt_queue_len;
-      if (GetVTQueue() == -1)
+      ctx->vtq_rptr_hold = ctx->vtq_rptr;
+      ctx->vt_queue_len_hold = ctx->vt_queue_len;
+      if (GetVTQueue(ctx) == -1)
 	break;
-      if (vt_ch == ASC_SI)
+      if (ctx->vt_ch == ASC_SI)
 	{
-	  line_draw = 0;
+	  ctx->line_draw = 0;
 	  out_ptr += int_sprintf(out_ptr, g0_usascii);
 	  out_ptr += int_sprintf(out_ptr, sel_ascii);
 	  continue;
 	}
-      if (vt_ch == ASC_SO)
+      if (ctx->vt_ch == ASC_SO)
 	{
-	  line_draw = 1;
+	  ctx->line_draw = 1;
 	  out_ptr += int_sprintf(out_ptr, sel_graph);
 	  out_ptr += int_sprintf(out_ptr, g0_graphic);
 	  out_ptr += int_sprintf(out_ptr, sel_g0);
 	  continue;
 	}
-      if (vt_ch != ASC_ESC)
+      if (ctx->vt_ch != ASC_ESC)
 	{
-	  *(out_ptr++) = (char)((line_draw) ? VT100LineDraw(vt_ch) : vt_ch);
-	  if ((vt_enhanced) && ((vt_ch == '\r') || (vt_ch == '\n')))
-	    out_ptr += int_sprintf(out_ptr, VT100DisplayEnhance('@'));
+	  *(out_ptr++) = (char)((ctx->line_draw) ? VT100LineDraw(ctx->vt_ch) : ctx->vt_ch);
+	  if ((ctx->vt_enhanced) && ((ctx->vt_ch == '\r') || (ctx->vt_ch == '\n')))
+	    out_ptr += int_sprintf(out_ptr, VT100DisplayEnhance(ctx, '@'));
 	  continue;
 	}
-      if (!GetNextChar())
+      if (!GetNextChar(ctx))
 	goto Do_Write;
-      if (isdigit((int)vt_ch))
+      if (isdigit((int)ctx->vt_ch))
 	{ /* ESC+digit */
-	  switch ((int)vt_ch)
+	  switch ((int)ctx->vt_ch)
 	    {
 	    case '1':	/* Set tab */
 	      out_ptr += int_sprintf(out_ptr, "%cH", ASC_ESC);
@@ -517,9 +577,9 @@ void vt3kHPtoVT100(int32_t refCon, char *buf, size_t buf_len)
 	    }
 	  continue;
 	}
-      if (isalpha((int)vt_ch))
+      if (isalpha((int)ctx->vt_ch))
 	{ /* ESC+alpha */
-	  switch ((int)vt_ch)
+	  switch ((int)ctx->vt_ch)
 	    {
 	    case 'A':	/* Cursor up */
 	      out_ptr += int_sprintf(out_ptr, cuu, 1);
@@ -596,57 +656,57 @@ void vt3kHPtoVT100(int32_t refCon, char *buf, size_t buf_len)
 	    }
 	  continue;
 	}
-      if (vt_ch == '[')
+      if (ctx->vt_ch == '[')
 	{ /* Special case to handle echo of outbound PF keys */
-	  if (!GetNextChar())
+	  if (!GetNextChar(ctx))
 	    goto Do_Write;
-	  if (isdigit((int)vt_ch))
+	  if (isdigit((int)ctx->vt_ch))
 	    {
 	      for (;;)
 		{ /* Munch till '~' */
-		  if (!GetNextChar())
+		  if (!GetNextChar(ctx))
 		    goto Do_Write;
-		  if (vt_ch == '~')
+		  if (ctx->vt_ch == '~')
 		    break;
 		}
 	      continue;
 	    }
 	  continue;
 	}
-      if ((vt_ch == '*') || (vt_ch == '^') || (vt_ch == '~'))
+      if ((ctx->vt_ch == '*') || (ctx->vt_ch == '^') || (ctx->vt_ch == '~'))
 	{
 	  int do_terminal_id = 0;
-	  if (vt_ch == '^')
+	  if (ctx->vt_ch == '^')
 	    {
 	      char *prim = ESC "\\?008000\r", *ptr = prim;
 	      while (*ptr)
 		{
-		  if (PutImmediateQ(*ptr) == -1)
+		  if (PutImmediateQ(ctx->conn, *ptr) == -1)
 		    return;
 		  ++ptr;
 		}
 	      continue;
 	    }
-	  if (vt_ch == '~')
+	  if (ctx->vt_ch == '~')
 	    {
 	      char *sec = ESC "|0400000\r", *ptr = sec;
 	      while (*ptr)
 		{
-		  if (PutImmediateQ(*ptr) == -1)
+		  if (PutImmediateQ(ctx->conn, *ptr) == -1)
 		    return;
 		  ++ptr;
 		}
 	      continue;
 	    }
-	  if (!GetNextChar())
+	  if (!GetNextChar(ctx))
 	    goto Do_Write;
-	  if (vt_ch == 's')
+	  if (ctx->vt_ch == 's')
 	    do_terminal_id = 1;
 	  for (;;)
 	    {
-	      if (!GetNextChar())
+	      if (!GetNextChar(ctx))
 		goto Do_Write;
-	      if (vt_ch == '^')
+	      if (ctx->vt_ch == '^')
 		break;
 	    }
 	  if (do_terminal_id)
@@ -654,66 +714,66 @@ void vt3kHPtoVT100(int32_t refCon, char *buf, size_t buf_len)
 	      char *id = "2392A\r", *ptr = id;
 	      while (*ptr)
 		{
-		  if (PutImmediateQ(*ptr) == -1)
+		  if (PutImmediateQ(ctx->conn, *ptr) == -1)
 		    return;
 		  ++ptr;
 		}
 	    }
 	    continue;
 	}
-      if (vt_ch != '&')
+      if (ctx->vt_ch != '&')
 	{ /* ESC+anything_but_ampersand */
 	  for (;;)
 	    { /* Munch till upper case or DC1 - may go too far */
-	      if (!GetNextChar())
+	      if (!GetNextChar(ctx))
 		goto Do_Write;
-/*	      if ((isupper((int)vt_ch)) || (vt_ch == ASC_DC1)) */
-	      if (isupper((int)vt_ch))
+/*	      if ((isupper((int)ctx->vt_ch)) || (ctx->vt_ch == ASC_DC1)) */
+	      if (isupper((int)ctx->vt_ch))
 		break;
 	    }
 	  continue;
 	}
 /* ESC+"&" sequences */
-      if (!GetNextChar())
+      if (!GetNextChar(ctx))
 	goto Do_Write;
-      if (vt_ch == 'd')
+      if (ctx->vt_ch == 'd')
 	{ /* ESC+"&dx": Display enhancements */
-	  if (!GetNextChar())
+	  if (!GetNextChar(ctx))
 	    goto Do_Write;
-	  out_ptr += int_sprintf(out_ptr, VT100DisplayEnhance(vt_ch));
+	  out_ptr += int_sprintf(out_ptr, VT100DisplayEnhance(ctx, ctx->vt_ch));
 	  continue;
 	}
-      if (vt_ch != 'a')
+      if (ctx->vt_ch != 'a')
 	{ /* Anything other than cursor address: munch till upper case */
 	  for (;;)
 	    {
-	      if (!GetNextChar())
+	      if (!GetNextChar(ctx))
 		goto Do_Write;
-	      if (isupper((int)vt_ch))
+	      if (isupper((int)ctx->vt_ch))
 		break;
 	    }
 	  continue;
 	}
 /* ESC+"&a [[+|-]n{r|c|x|y}] [[+|-]n{R|C|X|Y}]" */
-      if (!GetNextChar())
+      if (!GetNextChar(ctx))
 	goto Do_Write;
 /* If prefaced with '+|-', this is a cursor relative move */
-      if ((vt_ch == '+') || (vt_ch == '-'))
+      if ((ctx->vt_ch == '+') || (ctx->vt_ch == '-'))
 	move_relative = 1;
 /* Get numeric row/column value */
       num_ptr = num_buf;
-      *(num_ptr++) = vt_ch;
+      *(num_ptr++) = ctx->vt_ch;
       for (;;)
 	{
-	  if (!GetNextChar())
+	  if (!GetNextChar(ctx))
 	    goto Do_Write;
-	  if (isalpha((int)vt_ch))
+	  if (isalpha((int)ctx->vt_ch))
 	    break;
-	  *(num_ptr++) = vt_ch;
+	  *(num_ptr++) = ctx->vt_ch;
 	}
       *num_ptr = '\0';
       num_val = atoi(num_buf);
-      if ((toupper((int)vt_ch) == 'C') || (toupper((int)vt_ch) == 'X'))
+      if ((toupper((int)ctx->vt_ch) == 'C') || (toupper((int)ctx->vt_ch) == 'X'))
 	{
 	  row_position = 0;
 	  col = (move_relative) ? num_val : ++num_val;
@@ -723,7 +783,7 @@ void vt3kHPtoVT100(int32_t refCon, char *buf, size_t buf_len)
 	  row_position = 1;
 	  row = (move_relative) ? num_val : ++num_val;
 	}
-      if (isupper((int)vt_ch))
+      if (isupper((int)ctx->vt_ch))
 	{ /* End of sequence: just row or column position */
 	  if (row_position)
 	    {
@@ -767,111 +827,131 @@ void vt3kHPtoVT100(int32_t refCon, char *buf, size_t buf_len)
       num_ptr = num_buf;
       for (;;)
 	{
-	  if (!GetNextChar())
+	  if (!GetNextChar(ctx))
 	    goto Do_Write;
-	  if (isalpha((int)vt_ch))
+	  if (isalpha((int)ctx->vt_ch))
 	    break;
-	  *(num_ptr++) = vt_ch;
+	  *(num_ptr++) = ctx->vt_ch;
 	}
       *num_ptr = '\0';
       num_val = atoi(num_buf);
-      if ((vt_ch == 'C') || (vt_ch == 'X'))
+      if ((ctx->vt_ch == 'C') || (ctx->vt_ch == 'X'))
 	col = ++num_val;
       else
 	row = ++num_val;
       out_ptr += int_sprintf(out_ptr, cup, row, col);
     } /* main for() loop */
  Do_Write:
-  buf_len = out_ptr - out_buf;
-  vt3kDataOutProc(refCon, out_buf, buf_len);
-  DumpBuffer(out_buf, buf_len, "vt100");
+  out_len = out_ptr - out_buf;
+  vt3kDataOutProc((intptr_t)ctx->out, out_buf, out_len);
+  DumpBuffer(out_buf, out_len, "vt100");
+
+} /*TranslateHPtoVT100*/
+
+void vt3kHPtoVT100(intptr_t refCon, char *buf, size_t buf_len)
+{ /*vt3kHPtoVT100*/
+
+  tHPVTContext
+    *ctx = (tHPVTContext*)refCon;
+
+  if (!buf_len)
+    return;
+  QueueVTData(ctx, buf, buf_len);
+  TranslateHPtoVT100(ctx);
 
 } /*vt3kHPtoVT100*/
+
+void vt3kHPtoVT100V(intptr_t refCon, const struct iovec *iov, int iov_count)
+{ /*vt3kHPtoVT100V*/
+
+  tHPVTContext
+    *ctx = (tHPVTContext*)refCon;
+
+/* Queue every piece first so the whole record goes out in one write */
+  if (!QueueVTDataV(ctx, iov, iov_count))
+    return;
+  TranslateHPtoVT100(ctx);
+
+} /*vt3kHPtoVT100V*/
 
-void vt3kHPtoGeneric(int32_t refCon, char *buf, size_t buf_len)
-{ /*vt3kHPtoGeneric*/
+static void TranslateHPtoGeneric(tHPVTContext *ctx)
+{ /*TranslateHPtoGeneric*/
   int
-    i = 0,
     row_position = 1,
     num_val = 0,
     row = 0,
     col = 0,
     move_relative = 0,
     hold_len;
+  size_t
+    out_len;
   char
     out_buf[MAX_VT_QUEUE],
     num_buf[256],
     *num_ptr = num_buf,
     *out_ptr = out_buf;
 
-  if (!buf_len)
-    return;
-
-/* Copy raw data to the queue */
-  for (; i<buf_len; i++)
-    PutVTQueue(buf[i]);
-
   if (debug)
     {
-      hold_len = vt_queue_len;
+      hold_len = ctx->vt_queue_len;
       char *ptr;
-      ptr = vtq_rptr;
-      while (GetVTQueue() != -1)
-	*(out_ptr++) = vt_ch;
+      ptr = ctx->vtq_rptr;
+      while (GetVTQueue(ctx) != -1)
+	*(out_ptr++) = ctx->vt_ch;
       DumpBuffer(out_buf, out_ptr - out_buf, "hp");
-      vtq_rptr = ptr;
-      vt_queue_len = hold_len;
+      ctx->vtq_rptr = ptr;
+      ctx->vt_queue_len = hold_len;
     }
 
   out_ptr = out_buf;
   for (;;)
     {
-      vtq_rptr_hold = vtq_rptr;
-      vt_queue_len_hold = vt_queue_len;
-      if (GetVTQueue() == -1)
+      ctx->vtq_rptr_hold = ctx->vtq_rptr;
+      ctx->vt_queue_len_hold = ctx->vt_queue_len;
+      if (GetVTQueue(ctx) == -1)
 	break;
-      if (vt_ch == ASC_SI)
+      if (ctx->vt_ch == ASC_SI)
 	{
 	  out_ptr += int_sprintf(out_ptr, "<line_draw_off>");
 	  continue;
 	}
-      if (vt_ch == ASC_SO)
+      if (ctx->vt_ch == ASC_SO)
 	{
 	  out_ptr += int_sprintf(out_ptr, "<line_draw_on>");
 	  continue;
 	}
-      if (vt_ch != ASC_ESC)
+      if (ctx->vt_ch != ASC_ESC)
 	{
-	  if (!vt_ch)
+	  if (!ctx->vt_ch)
 	    out_ptr += int_sprintf(out_ptr, "<nul>");
 	  else
 	    {
-	      *(out_ptr++) = vt_ch;
-	      if ((vt_enhanced) && ((vt_ch == '\r') || (vt_ch == '\n')))
-		out_ptr += int_sprintf(out_ptr, GenericDisplayEnhance('@'));
+	      *(out_ptr++) = ctx->vt_ch;
+	      if ((ctx->vt_enhanced) && ((ctx->vt_ch == '\r') || (ctx->vt_ch == '\n')))
+		out_ptr += int_sprintf(out_ptr, GenericDisplayEnhance(ctx, '@'));
 	    }
 	  continue;
 	}
-      if (!GetNextChar())
+      if (!GetNextChar(ctx))
 	goto Do_Write;
-      if (vt_ch == '[')
+      if (ctx->vt_ch == '[')
 	{
 	  out_ptr += int_sprintf(out_ptr, "<protect_on>");
 	  continue;
 	}
-      if (vt_ch == ']')
+      if (ctx->vt_ch == ']')
 	{
 	  out_ptr += int_sprintf(out_ptr, "<protect_off>");
 	  continue;
 	}
-      if (vt_ch == '@')
+      if (ctx->vt_ch == '@')
 	{
 	  out_ptr += int_sprintf(out_ptr, "<pause>");
 	  continue;
 	}
-      if (isalpha((int)vt_ch))
+      if (isalpha((int)ctx->vt_ch))
 	{				/* ESC+alpha */
-	  switch ((int)vt_ch)
+	  switch ((int)ctx->vt_ch)
 	    {
 	    case 'A':			/* Cursor up */
 	      out_ptr += int_sprintf(out_ptr, "<move:up>");
@@ -959,50 +1039,50 @@ void vt3kHPtoGeneric(int32_t refCon, char *buf, size_t buf_len)
 	      out_ptr += int_sprintf(out_ptr, "<disp_fns_off>");
 	      break;
 	    default:			/* ??? */
-	      out_ptr += int_sprintf(out_ptr, "<esc+\"%c\">", vt_ch);
+	      out_ptr += int_sprintf(out_ptr, "<esc+\"%c\">", ctx->vt_ch);
 	      break;
 	    }
 	  continue;
 	}
-      if ((vt_ch == '*') || (vt_ch == '^') || (vt_ch == '~'))
+      if ((ctx->vt_ch == '*') || (ctx->vt_ch == '^') || (ctx->vt_ch == '~'))
 	{
 	  int do_terminal_id = 0;
-	  if (vt_ch == '^')
+	  if (ctx->vt_ch == '^')
 	    {
 	      out_ptr += int_sprintf(out_ptr, "<prim_status>");
 	      continue;
 	    }
-	  if (vt_ch == '~')
+	  if (ctx->vt_ch == '~')
 	    {
 	      out_ptr += int_sprintf(out_ptr, "<sec_status>");
 	      continue;
 	    }
-	  if (!GetNextChar())
+	  if (!GetNextChar(ctx))
 	    goto Do_Write;
-	  if (vt_ch == 's')
+	  if (ctx->vt_ch == 's')
 	    do_terminal_id = 1;
 	  for (;;)
 	    {
-	      if (!GetNextChar())
+	      if (!GetNextChar(ctx))
 		goto Do_Write;
-	      if (vt_ch == '^')
+	      if (ctx->vt_ch == '^')
 		break;
 	    }
 	  if (do_terminal_id)
 	    out_ptr += int_sprintf(out_ptr, "<term_id>");
 	  continue;
 	}
-      if (vt_ch != '&')
+      if (ctx->vt_ch != '&')
 	{ /* ESC+anything_but_ampersand */
 	  char temp[256], *ptr = temp;
-	  ptr += int_sprintf(ptr, "<esc+\"%c", vt_ch);
+	  ptr += int_sprintf(ptr, "<esc+\"%c", ctx->vt_ch);
 	  for (;;)
 	    { /* Munch till upper case or DC1 - may go too far */
-	      if (!GetNextChar())
+	      if (!GetNextChar(ctx))
 		goto Do_Write;
-	      *(ptr++) = vt_ch;
-/*	      if ((isupper((int)vt_ch)) || (vt_ch == '^') || (vt_ch == '~') || (vt_ch == ASC_DC1))*/
-	      if ((isupper((int)vt_ch)) || (vt_ch == '^') || (vt_ch == '~'))
+	      *(ptr++) = ctx->vt_ch;
+/*	      if ((isupper((int)ctx->vt_ch)) || (ctx->vt_ch == '^') || (ctx->vt_ch == '~') || (ctx->vt_ch == ASC_DC1))*/
+	      if ((isupper((int)ctx->vt_ch)) || (ctx->vt_ch == '^') || (ctx->vt_ch == '~'))
 		break;
 	    }
 	  ptr += int_sprintf(ptr, "\">");
@@ -1010,25 +1090,25 @@ void vt3kHPtoGeneric(int32_t refCon, char *buf, size_t buf_len)
 	  continue;
 	}
 /* ESC+"&" sequences */
-      if (!GetNextChar())
+      if (!GetNextChar(ctx))
 	goto Do_Write;
-      if (vt_ch == 'd')
+      if (ctx->vt_ch == 'd')
 	{ /* ESC+"&dx": Display enhancements */
-	  if (!GetNextChar())
+	  if (!GetNextChar(ctx))
 	    goto Do_Write;
-	  out_ptr += int_sprintf(out_ptr, GenericDisplayEnhance(vt_ch));
+	  out_ptr += int_sprintf(out_ptr, GenericDisplayEnhance(ctx, ctx->vt_ch));
 	  continue;
 	}
-      if (vt_ch != 'a')
+      if (ctx->vt_ch != 'a')
 	{ /* Anything other than cursor address: munch till upper case */
 	  char temp[256], *ptr = temp;
-	  ptr += int_sprintf(ptr, "<esc+\"&%c", vt_ch);
+	  ptr += int_sprintf(ptr, "<esc+\"&%c", ctx->vt_ch);
 	  for (;;)
 	    {
-	      if (!GetNextChar())
+	      if (!GetNextChar(ctx))
 		goto Do_Write;
-	      *(ptr++) = vt_ch;
-	      if ((isupper((int)vt_ch)) || (vt_ch == '@'))
+	      *(ptr++) = ctx->vt_ch;
+	      if ((isupper((int)ctx->vt_ch)) || (ctx->vt_ch == '@'))
 		break;
 	    }
 	  ptr += int_sprintf(ptr, "\">");
@@ -1036,25 +1116,25 @@ void vt3kHPtoGeneric(int32_t refCon, char *buf, size_t buf_len)
 	  continue;
 	}
 /* ESC+"&a [[+|-]n{r|c|x|y}] [[+|-]n{R|C|X|Y}]" */
-      if (!GetNextChar())
+      if (!GetNextChar(ctx))
 	goto Do_Write;
 /* If prefaced with '+|-', this is a cursor relative move */
-      if ((vt_ch == '+') || (vt_ch == '-'))
+      if ((ctx->vt_ch == '+') || (ctx->vt_ch == '-'))
 	move_relative = 1;
 /* Get numeric row/column value */
       num_ptr = num_buf;
-      *(num_ptr++) = vt_ch;
+      *(num_ptr++) = ctx->vt_ch;
       for (;;)
 	{
-	  if (!GetNextChar())
+	  if (!GetNextChar(ctx))
 	    goto Do_Write;
-	  if (isalpha((int)vt_ch))
+	  if (isalpha((int)ctx->vt_ch))
 	    break;
-	  *(num_ptr++) = vt_ch;
+	  *(num_ptr++) = ctx->vt_ch;
 	}
       *num_ptr = '\0';
       num_val = atoi(num_buf);
-      if ((toupper((int)vt_ch) == 'C') || (toupper((int)vt_ch) == 'X'))
+      if ((toupper((int)ctx->vt_ch) == 'C') || (toupper((int)ctx->vt_ch) == 'X'))
 	{
 	  row_position = 0;
 	  col = num_val;
@@ -1064,7 +1144,7 @@ void vt3kHPtoGeneric(int32_t refCon, char *buf, size_t buf_len)
 	  row_position = 1;
 	  row = num_val;
 	}
-      if (isupper((int)vt_ch))
+      if (isupper((int)ctx->vt_ch))
 	{ /* End of sequence: just row or column position */
 	  if (row_position)
 	    {
@@ -1086,37 +1166,64 @@ void vt3kHPtoGeneric(int32_t refCon, char *buf, size_t buf_len)
       num_ptr = num_buf;
       for (;;)
 	{
-	  if (!GetNextChar())
+	  if (!GetNextChar(ctx))
 	    goto Do_Write;
-	  if (isalpha((int)vt_ch))
+	  if (isalpha((int)ctx->vt_ch))
 	    break;
-	  *(num_ptr++) = vt_ch;
+	  *(num_ptr++) = ctx->vt_ch;
 	}
       *num_ptr = '\0';
       num_val = atoi(num_buf);
-      if ((vt_ch == 'C') || (vt_ch == 'X'))
+      if ((ctx->vt_ch == 'C') || (ctx->vt_ch == 'X'))
 	col = num_val;
       else
 	row = num_val;
       out_ptr += int_sprintf(out_ptr, "<move:r=%d,c=%d>", row, col);
     } /* main for() loop */
  Do_Write:
-  buf_len = out_ptr - out_buf;
-  vt3kDataOutProc(refCon, out_buf, buf_len);
-  DumpBuffer(out_buf, buf_len, "Generic");
+  out_len = out_ptr - out_buf;
+  vt3kDataOutProc((intptr_t)ctx->out, out_buf, out_len);
+  DumpBuffer(out_buf, out_len, "Generic");
+
+} /*TranslateHPtoGeneric*/
+
+void vt3kHPtoGeneric(intptr_t refCon, char *buf, size_t buf_len)
+{ /*vt3kHPtoGeneric*/
+
+  tHPVTContext
+    *ctx = (tHPVTContext*)refCon;
+
+  if (!buf_len)
+    return;
+  QueueVTData(ctx, buf, buf_len);
+  TranslateHPtoGeneric(ctx);
 
 } /*vt3kHPtoGeneric*/
+
+void vt3kHPtoGenericV(intptr_t refCon, const struct iovec *iov, int iov_count)
+{ /*vt3kHPtoGenericV*/
+
+  tHPVTContext
+    *ctx = (tHPVTContext*)refCon;
+
+/* Queue every piece first so the whole record goes out in one write */
+  if (!QueueVTDataV(ctx, iov, iov_count))
+    return;
+  TranslateHPtoGeneric(ctx);
+
+} /*vt3kHPtoGenericV*/
 
-void vt3kHPtoVT52(int32_t refCon, char *buf, size_t buf_len)
-{ /*vt3kHPtoVT52*/
+static void TranslateHPtoVT52(tHPVTContext *ctx)
+{ /*TranslateHPtoVT52*/
   int
-    i = 0,
     row_position = 1,
     num_val = 0,
     row = 0,
     col = 0,
     move_relative = 0,
     hold_len;
+  size_t
+    out_len;
   char
     out_buf[MAX_VT_QUEUE],
     num_buf[256],
@@ -1132,57 +1239,48 @@ void vt3kHPtoVT52(int32_t refCon, char *buf, size_t buf_len)
     *home  = ESC "H",		/* Cursor home */
     *ed    = ESC "J",		/* Erase to end-of-display */
     *el    = ESC "K";		/* Erase to end-of-line */
-  static int
-    line_draw = 0;
-
-  if (!buf_len)
-    return;
-
-/* Copy raw data to the queue */
-  for (; i<buf_len; i++)
-    PutVTQueue(buf[i]);
 
   if (debug)
     {
-      hold_len = vt_queue_len;
+      hold_len = ctx->vt_queue_len;
       char *ptr;
-      ptr = vtq_rptr;
-      while (GetVTQueue() != -1)
-	*(out_ptr++) = vt_ch;
+      ptr = ctx->vtq_rptr;
+      while (GetVTQueue(ctx) != -1)
+	*(out_ptr++) = ctx->vt_ch;
       DumpBuffer(out_buf, out_ptr - out_buf, "hp");
-      vtq_rptr = ptr;
-      vt_queue_len = hold_len;
+      ctx->vtq_rptr = ptr;
+      ctx->vt_queue_len = hold_len;
     }
 
   out_ptr = out_buf;
   for (;;)
     {
-      vtq_rptr_hold = vtq_rptr;
-      vt_queue_len_hold = vt_queue_len;
-      if (GetVTQueue() == -1)
+      ctx->vtq_rptr_hold = ctx->vtq_rptr;
+      ctx->vt_queue_len_hold = ctx->vt_queue_len;
+      if (GetVTQueue(ctx) == -1)
 	break;
-      if (vt_ch == ASC_SI)
+      if (ctx->vt_ch == ASC_SI)
 	{
-	  line_draw = 0;
+	  ctx->line_draw = 0;
 	  continue;
 	}
-      if (vt_ch == ASC_SO)
+      if (ctx->vt_ch == ASC_SO)
 	{
-	  line_draw = 1;
+	  ctx->line_draw = 1;
 	  continue;
 	}
-      if (vt_ch != ASC_ESC)
+      if (ctx->vt_ch != ASC_ESC)
 	{
-	  *(out_ptr++) = (char)((line_draw) ? TtyLineDraw(vt_ch) : vt_ch);
-	  if ((vt_enhanced) && ((vt_ch == '\r') || (vt_ch == '\n')))
-	    out_ptr += int_sprintf(out_ptr, VT100DisplayEnhance('@'));
+	  *(out_ptr++) = (char)((ctx->line_draw) ? TtyLineDraw(ctx->vt_ch) : ctx->vt_ch);
+	  if ((ctx->vt_enhanced) && ((ctx->vt_ch == '\r') || (ctx->vt_ch == '\n')))
+	    out_ptr += int_sprintf(out_ptr, VT100DisplayEnhance(ctx, '@'));
 	  continue;
 	}
-      if (!GetNextChar())
+      if (!GetNextChar(ctx))
 	goto Do_Write;
-      if (isalpha((int)vt_ch))
+      if (isalpha((int)ctx->vt_ch))
 	{ /* ESC+alpha */
-	  switch ((int)vt_ch)
+	  switch ((int)ctx->vt_ch)
 	    {
 	    case 'A': /* Cursor up */
 	      out_ptr += int_sprintf(out_ptr, cuu1);
@@ -1211,40 +1309,40 @@ void vt3kHPtoVT52(int32_t refCon, char *buf, size_t buf_len)
 	    }
 	  continue;
 	}
-      if ((vt_ch == '*') || (vt_ch == '^') || (vt_ch == '~'))
+      if ((ctx->vt_ch == '*') || (ctx->vt_ch == '^') || (ctx->vt_ch == '~'))
 	{
 	  int do_terminal_id = 0;
-	  if (vt_ch == '^')
+	  if (ctx->vt_ch == '^')
 	    {
 	      char *prim = ESC "\\?008000\r", *ptr = prim;
 	      while (*ptr)
 		{
-		  if (PutImmediateQ(*ptr) == -1)
+		  if (PutImmediateQ(ctx->conn, *ptr) == -1)
 		    return;
 		  ++ptr;
 		}
 	      continue;
 	    }
-	  if (vt_ch == '~')
+	  if (ctx->vt_ch == '~')
 	    {
 	      char *sec = ESC "|0400000\r", *ptr = sec;
 	      while (*ptr)
 		{
-		  if (PutImmediateQ(*ptr) == -1)
+		  if (PutImmediateQ(ctx->conn, *ptr) == -1)
 		    return;
 		  ++ptr;
 		}
 	      continue;
 	    }
-	  if (!GetNextChar())
+	  if (!GetNextChar(ctx))
 	    goto Do_Write;
-	  if (vt_ch == 's')
+	  if (ctx->vt_ch == 's')
 	    do_terminal_id = 1;
 	  for (;;)
 	    {
-	      if (!GetNextChar())
+	      if (!GetNextChar(ctx))
 		goto Do_Write;
-	      if (vt_ch == '^')
+	      if (ctx->vt_ch == '^')
 		break;
 	    }
 	  if (do_terminal_id)
@@ -1252,66 +1350,66 @@ void vt3kHPtoVT52(int32_t refCon, char *buf, size_t buf_len)
 	      char *id = "2392A\r", *ptr = id;
 	      while (*ptr)
 		{
-		  if (PutImmediateQ(*ptr) == -1)
+		  if (PutImmediateQ(ctx->conn, *ptr) == -1)
 		    return;
 		  ++ptr;
 		}
 	    }
 	  continue;
 	}
-      if (vt_ch != '&')
+      if (ctx->vt_ch != '&')
 	{ /* ESC+anything_but_ampersand */
 	  for (;;)
 	    { /* Munch till upper case or DC1 - may go too far */
-	      if (!GetNextChar())
+	      if (!GetNextChar(ctx))
 		goto Do_Write;
-/*	      if ((isupper((int)vt_ch)) || ((int)vt_ch == ASC_DC1)) */
-	      if (isupper((int)vt_ch))
+/*	      if ((isupper((int)ctx->vt_ch)) || ((int)ctx->vt_ch == ASC_DC1)) */
+	      if (isupper((int)ctx->vt_ch))
 		break;
 	    }
 	  continue;
 	}
 /* ESC+"&" sequences */
-      if (!GetNextChar())
+      if (!GetNextChar(ctx))
 	goto Do_Write;
-      if (vt_ch == 'd')
+      if (ctx->vt_ch == 'd')
 	{ /* ESC+"&dx": Display enhancements */
-	  if (!GetNextChar())
+	  if (!GetNextChar(ctx))
 	    goto Do_Write;
-	  out_ptr += int_sprintf(out_ptr, VT100DisplayEnhance(vt_ch));
+	  out_ptr += int_sprintf(out_ptr, VT100DisplayEnhance(ctx, ctx->vt_ch));
 	  continue;
 	}
-      if (vt_ch != 'a')
+      if (ctx->vt_ch != 'a')
 	{ /* Anything other than cursor address: munch till upper case */
 	  for (;;)
 	    {
-	      if (!GetNextChar())
+	      if (!GetNextChar(ctx))
 		goto Do_Write;
-	      if (isupper((int)vt_ch))
+	      if (isupper((int)ctx->vt_ch))
 		break;
 	    }
 	  continue;
 	}
 /* ESC+"&a [[+|-]n{r|c|x|y}] [[+|-]n{R|C|X|Y}]" */
-      if (!GetNextChar())
+      if (!GetNextChar(ctx))
 	goto Do_Write;
 /* If prefaced with '+|-', this is a cursor relative move */
-      if ((vt_ch == '+') || (vt_ch == '-'))
+      if ((ctx->vt_ch == '+') || (ctx->vt_ch == '-'))
 	move_relative = 1;
 /* Get numeric row/column value */
       num_ptr = num_buf;
-      *(num_ptr++) = vt_ch;
+      *(num_ptr++) = ctx->vt_ch;
       for (;;)
 	{
-	  if (!GetNextChar())
+	  if (!GetNextChar(ctx))
 	    goto Do_Write;
-	  if (isalpha((int)vt_ch))
+	  if (isalpha((int)ctx->vt_ch))
 	    break;
-	  *(num_ptr++) = vt_ch;
+	  *(num_ptr++) = ctx->vt_ch;
 	}
       *num_ptr = '\0';
       num_val = atoi(num_buf);
-      if ((toupper((int)vt_ch) == 'C') || (toupper((int)vt_ch) == 'X'))
+      if ((toupper((int)ctx->vt_ch) == 'C') || (toupper((int)ctx->vt_ch) == 'X'))
 	{
 	  row_position = 0;
 	  col = (move_relative) ? num_val : ++num_val;
@@ -1321,7 +1419,7 @@ void vt3kHPtoVT52(int32_t refCon, char *buf, size_t buf_len)
 	  row_position = 1;
 	  row = (move_relative) ? num_val : ++num_val;
 	}
-      if (isupper((int)vt_ch))
+      if (isupper((int)ctx->vt_ch))
 	{ /* End of sequence: just row or column position */
 /* No can do in VT52 mode */
       if (row_position == 1) {}
@@ -1331,26 +1429,52 @@ void vt3kHPtoVT52(int32_t refCon, char *buf, size_t buf_len)
       num_ptr = num_buf;
       for (;;)
 	{
-	  if (!GetNextChar())
+	  if (!GetNextChar(ctx))
 	    goto Do_Write;
-	  if (isalpha((int)vt_ch))
+	  if (isalpha((int)ctx->vt_ch))
 	    break;
-	  *(num_ptr++) = vt_ch;
+	  *(num_ptr++) = ctx->vt_ch;
 	}
       *num_ptr = '\0';
       num_val = atoi(num_buf);
-      if ((vt_ch == 'C') || (vt_ch == 'X'))
+      if ((ctx->vt_ch == 'C') || (ctx->vt_ch == 'X'))
 	col = ++num_val;
       else
 	row = ++num_val;
       out_ptr += int_sprintf(out_ptr, cup, (char)(037+row), (char)(037+col));
     } /* main for() loop */
  Do_Write:
-  buf_len = out_ptr - out_buf;
-  vt3kDataOutProc(refCon, out_buf, buf_len);
-  DumpBuffer(out_buf, buf_len, "vt52");
+  out_len = out_ptr - out_buf;
+  vt3kDataOutProc((intptr_t)ctx->out, out_buf, out_len);
+  DumpBuffer(out_buf, out_len, "vt52");
+
+} /*TranslateHPtoVT52*/
+
+void vt3kHPtoVT52(intptr_t refCon, char *buf, size_t buf_len)
+{ /*vt3kHPtoVT52*/
+
+  tHPVTContext
+    *ctx = (tHPVTContext*)refCon;
+
+  if (!buf_len)
+    return;
+  QueueVTData(ctx, buf, buf_len);
+  TranslateHPtoVT52(ctx);
 
 } /*vt3kHPtoVT52*/
+
+void vt3kHPtoVT52V(intptr_t refCon, const struct iovec *iov, int iov_count)
+{ /*vt3kHPtoVT52V*/
+
+  tHPVTContext
+    *ctx = (tHPVTContext*)refCon;
+
+/* Queue every piece first so the whole record goes out in one write */
+  if (!QueueVTDataV(ctx, iov, iov_count))
+    return;
+  TranslateHPtoVT52(ctx);
+
+} /*vt3kHPtoVT52V*/
 
 #ifdef TRANSLATE_INPUT
 void TranslateKeyboard(char *buf, int *buf_len)
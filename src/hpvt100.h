@@ -19,7 +19,20 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
  * hpvt100.h -- Header file for VT100 translation
  ************************************************************/
 
-void vt3kHPtoVT100(int32_t refCon, char *buf, size_t buf_len);
-void vt3kHPtoVT52(int32_t refCon, char *buf, size_t buf_len);
-void vt3kHPtoGeneric(int32_t refCon, char *buf, size_t buf_len);
+/* Per-connection translator state; pass it as the data-out refCon, */
+/* with vt3kHPFlush as the flush proc. 'out' may be NULL for stdout. */
+typedef struct stHPVTContext tHPVTContext;
+struct stVTConnection;
+struct stVTTermOut;
+
+tHPVTContext *vt3kHPNewContext(struct stVTConnection *conn,
+			       struct stVTTermOut *out);
+void vt3kHPFreeContext(tHPVTContext *ctx);
+void vt3kHPFlush(intptr_t refCon);
+void vt3kHPtoVT100(intptr_t refCon, char *buf, size_t buf_len);
+void vt3kHPtoVT52(intptr_t refCon, char *buf, size_t buf_len);
+void vt3kHPtoGeneric(intptr_t refCon, char *buf, size_t buf_len);
+void vt3kHPtoVT100V(intptr_t refCon, const struct iovec *iov, int iov_count);
+void vt3kHPtoVT52V(intptr_t refCon, const struct iovec *iov, int iov_count);
+void vt3kHPtoGenericV(intptr_t refCon, const struct iovec *iov, int iov_count);
 void TranslateKeyboard(char *buf, int *buf_len);
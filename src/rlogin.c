@@ -31,6 +31,7 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
 #include <string.h>
 
 #include "conmgr.h"
+#include "transport.h"
 
 static void show_network_error (char * funcname, int errnum)
 /*
@@ -89,10 +90,10 @@ static struct hostent * gethostbynumbers (char * s)
     return (&h);
 }
 /***************************************************************/
-int open_client_connection (char * hostname, int portnum)
+int open_client_connection (char * hostname, int portnum, int profile, int flags)
 /*
-**  Create client socket, connect to server,
-**  return socket number.
+**  Create client socket, connect to server, tune it
+**  per the transport profile, return socket number.
 */
 {
     int s,af,type,protocol;   /* socket() */
@@ -170,6 +171,14 @@ fflush (stdout);
 
 printf ("Got the connection!\n");
 fflush (stdout);
+/*
+**  Tuning is advisory; a stack without some option still works
+*/
+    errn = TransportSetSocket (s, profile, flags);
+    if (errn) {
+        printf ("Unable to apply the %s profile: %s\n",
+                TransportProfileName (profile), strerror (errn));
+    }
     return (s);
 }
 /***************************************************************/
@@ -216,11 +225,12 @@ int send_rlogin_data (int s /* socket number */,
     return (0);
 }
 /***************************************************************/
-int open_rlogin_connection (hostname)
+int open_rlogin_connection (hostname, profile, flags)
 /*
 **  Create an rlogin connection to a remote computer
 */
     char *hostname;
+    int profile, flags;
 {
     int s;
     static char username[100] = "";
@@ -228,7 +238,7 @@ int open_rlogin_connection (hostname)
     char buf[100];
     int nbuf;
 
-    s = open_client_connection (hostname, 513); /* rlogin=513, echo=7 */
+    s = open_client_connection (hostname, 513, profile, flags); /* rlogin=513, echo=7 */
     if (!s) return (0);
 /*
 **  Send the rlogin startup messages
@@ -19,7 +19,7 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
  * rlogin.c -- remote login via rlogin
  ************************************************************/
 
-int open_client_connection (char *hostname, int portnum);
+int open_client_connection (char *hostname, int portnum, int profile, int flags);
 int read_rlogin_data (int s);
 int send_rlogin_data (int s, char *buf, int nbuf);
-int open_rlogin_connection (char *hostname);
+int open_rlogin_connection (char *hostname, int profile, int flags);
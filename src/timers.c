@@ -19,8 +19,10 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
  * timers.c -- gettimeofday wrapper
  ************************************************************/
 
+#include "config.h"
 #include <stdint.h>
 #include <sys/time.h>
+#include <time.h>
 
 int32_t MyGettimeofday(void)
 { /*MyGettimeofday*/
@@ -63,3 +65,43 @@ int32_t ElapsedTime(int32_t start_time)
     return(MyGettimeofday() - start_time);
 
 } /*ElapsedTime*/
+
+int64_t MyMonotonicUsec(void)
+{ /*MyMonotonicUsec*/
+
+/* Microseconds on a clock that never steps; only differences mean anything */
+#  ifdef CLOCK_MONOTONIC
+    struct timespec
+	ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+	return(((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000));
+#  endif
+    {
+    struct timeval
+	tp;
+
+#  ifdef SHORT_GETTIMEOFDAY
+    (void)gettimeofday(&tp);
+#  else
+    (void)gettimeofday(&tp, NULL);
+#  endif
+    return(((int64_t)tp.tv_sec * 1000000) + tp.tv_usec);
+    }
+
+} /*MyMonotonicUsec*/
+
+int64_t MyMonotonicNsec(void)
+{ /*MyMonotonicNsec*/
+
+/* As MyMonotonicUsec, for timing things shorter than a microsecond */
+#  ifdef CLOCK_MONOTONIC
+    struct timespec
+	ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+	return(((int64_t)ts.tv_sec * 1000000000) + ts.tv_nsec);
+#  endif
+    return(MyMonotonicUsec() * 1000);
+
+} /*MyMonotonicNsec*/
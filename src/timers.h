@@ -21,3 +21,5 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
 
 int32_t MyGettimeofday(void);
 int32_t ElapsedTime(int32_t start_time);
+int64_t MyMonotonicUsec(void);
+int64_t MyMonotonicNsec(void);
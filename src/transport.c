@@ -0,0 +1,168 @@
+/*
+This file is part of FreeVT3k.
+
+FreeVT3k is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+FreeVT3k is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License along
+with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/************************************************************
+ * transport.c -- Socket and tty tuning profiles
+ ************************************************************/
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+
+#include "transport.h"
+
+#ifndef IPTOS_LOWDELAY
+#  define IPTOS_LOWDELAY	0x10
+#endif
+#ifndef IPTOS_THROUGHPUT
+#  define IPTOS_THROUGHPUT	0x08
+#endif
+
+/* Interactive users sit behind WAN links where Nagle and delayed ACKs	*/
+/* add 40-200 ms to every keystroke echo. Bulk (block mode) keeps	*/
+/* TCP_NODELAY as well: the connection already gathers its replies	*/
+/* into one send, and Nagle would only stall the odd small reply	*/
+/* behind the host's delayed ACK.					*/
+
+static const tTransportProfile profiles[kTransportProfiles] =
+{
+    /* name	     nodelay quickack rcvbuf sndbuf  usertmo keepalive  tos	       vmin vtime */
+    { "default",     0, 0, 0,	   0,	  0,	  0,  0,  0, 0,		       1,   0 },
+    { "interactive", 1, 1, 0,	   0,	  120000, 60, 10, 6, IPTOS_LOWDELAY,   1,   0 },
+    { "bulk",	     1, 0, 262144, 65536, 300000, 60, 10, 6, IPTOS_THROUGHPUT, 64,  1 }
+};
+
+const tTransportProfile * TransportProfile(int profile)
+{ /*TransportProfile*/
+    if ((profile < 0) || (profile >= kTransportProfiles))
+	profile = kTransportDefault;
+    return &profiles[profile];
+} /*TransportProfile*/
+
+int TransportProfileByName(const char * name)
+{ /*TransportProfileByName*/
+    int i;
+
+    for (i = 0; i < kTransportProfiles; i++)
+	{
+	if (!strcmp(name, profiles[i].fName))
+	    return i;
+	}
+    return -1;
+} /*TransportProfileByName*/
+
+const char * TransportProfileName(int profile)
+{ /*TransportProfileName*/
+    return TransportProfile(profile)->fName;
+} /*TransportProfileName*/
+
+static int SetOption(int fd, int level, int option, int value, int error)
+{ /*SetOption*/
+    if ((0 > setsockopt(fd, level, option, &value, sizeof(value))) && (!error))
+	error = errno;
+    return error;
+} /*SetOption*/
+
+/* Buffer sizes belong on a socket before it connects: the window	*/
+/* scale is fixed by the SYN, and once set (Linux) the stack stops	*/
+/* tuning them itself, so there is no putting the old sizes back.	*/
+/* Profile switches on a live socket pass kTransportKeepBuffers.	*/
+
+int TransportSetBuffers(int fd, int profile)
+{ /*TransportSetBuffers*/
+    const tTransportProfile * p = TransportProfile(profile);
+    int error = 0;
+
+    if (p->fRcvBuf)
+	error = SetOption(fd, SOL_SOCKET, SO_RCVBUF, p->fRcvBuf, error);
+    if (p->fSndBuf)
+	error = SetOption(fd, SOL_SOCKET, SO_SNDBUF, p->fSndBuf, error);
+    return error;
+} /*TransportSetBuffers*/
+
+/* Apply a profile to a connected or connecting TCP socket. Every	*/
+/* option is tried even when an earlier one fails, since older stacks	*/
+/* lack several of them; the first errno is returned, 0 on success.	*/
+/* Tuning is advisory, so callers generally carry on regardless.	*/
+
+int TransportSetSocket(int fd, int profile, int flags)
+{ /*TransportSetSocket*/
+    const tTransportProfile * p = TransportProfile(profile);
+    int error = 0;
+
+    if (profile == kTransportDefault)
+	return 0;
+
+#ifdef TCP_NODELAY
+    error = SetOption(fd, IPPROTO_TCP, TCP_NODELAY, p->fNoDelay, error);
+#endif
+#ifdef TCP_QUICKACK
+    error = SetOption(fd, IPPROTO_TCP, TCP_QUICKACK, p->fQuickAck, error);
+#endif
+    if (!(flags & kTransportKeepBuffers))
+	{
+	int bufError = TransportSetBuffers(fd, profile);
+
+	if (!error)
+	    error = bufError;
+	}
+#ifdef TCP_USER_TIMEOUT
+    error = SetOption(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, p->fUserTimeout, error);
+#endif
+    error = SetOption(fd, SOL_SOCKET, SO_KEEPALIVE, (p->fKeepIdle != 0), error);
+    if (p->fKeepIdle)
+	{
+#ifdef TCP_KEEPIDLE
+	error = SetOption(fd, IPPROTO_TCP, TCP_KEEPIDLE, p->fKeepIdle, error);
+#endif
+#ifdef TCP_KEEPINTVL
+	error = SetOption(fd, IPPROTO_TCP, TCP_KEEPINTVL, p->fKeepIntvl, error);
+#endif
+#ifdef TCP_KEEPCNT
+	error = SetOption(fd, IPPROTO_TCP, TCP_KEEPCNT, p->fKeepCnt, error);
+#endif
+	}
+#ifdef IP_TOS
+    /* See SetConnectOptions in vtconn.c: old NS transports die on a	*/
+    /* non-zero TOS, so it is only set when the user says it is safe.	*/
+    if (flags & kTransportAllowTOS)
+	error = SetOption(fd, IPPROTO_IP, IP_TOS, p->fTOS, error);
+#endif
+    return error;
+} /*TransportSetSocket*/
+
+/* Linux drops out of quick-ACK mode on its own, so a profile that	*/
+/* wants it has to ask again after each read.				*/
+
+void TransportQuickAck(int fd, int profile)
+{ /*TransportQuickAck*/
+#ifdef TCP_QUICKACK
+    int one = 1;
+
+    if (TransportProfile(profile)->fQuickAck)
+	(void)setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+#else
+    (void)fd;
+    (void)profile;
+#endif
+} /*TransportQuickAck*/
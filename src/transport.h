@@ -0,0 +1,56 @@
+/*
+This file is part of FreeVT3k.
+
+FreeVT3k is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+FreeVT3k is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License along
+with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/************************************************************
+ * transport.h -- Socket and tty tuning profiles
+ ************************************************************/
+
+/* Profiles. kTransportDefault leaves the stack's settings alone.	*/
+
+#define kTransportDefault	0
+#define kTransportInteractive	1	/* Keystrokes: no Nagle, quick ACKs */
+#define kTransportBulk		2	/* Block mode: big buffers, batching */
+#define kTransportProfiles	3
+
+/* Profile flags */
+
+#define kTransportAllowTOS	0x01	/* Host tolerates a non-zero IP TOS */
+#define kTransportAutoBulk	0x02	/* vt3k: bulk while in block mode */
+#define kTransportKeepBuffers	0x04	/* Leave SO_RCVBUF/SO_SNDBUF alone */
+
+typedef struct
+{
+    const char *	fName;
+    int			fNoDelay;	/* TCP_NODELAY			*/
+    int			fQuickAck;	/* TCP_QUICKACK, rearmed per read */
+    int			fRcvBuf;	/* SO_RCVBUF, 0 to leave alone	*/
+    int			fSndBuf;	/* SO_SNDBUF, 0 to leave alone	*/
+    int			fUserTimeout;	/* TCP_USER_TIMEOUT, ms		*/
+    int			fKeepIdle;	/* Seconds; 0 for no keepalive	*/
+    int			fKeepIntvl;
+    int			fKeepCnt;
+    int			fTOS;		/* Only with kTransportAllowTOS	*/
+    int			fVMin;		/* tty: bytes per read		*/
+    int			fVTime;		/* tty: inter-byte gap, 1/10 s	*/
+} tTransportProfile;
+
+const tTransportProfile * TransportProfile(int profile);
+int  TransportProfileByName(const char * name);
+const char * TransportProfileName(int profile);
+int  TransportSetSocket(int fd, int profile, int flags);
+int  TransportSetBuffers(int fd, int profile);
+void TransportQuickAck(int fd, int profile);
@@ -36,6 +36,7 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
 #endif
 
 #include "conmgr.h"
+#include "transport.h"
 
 #ifdef HAVE_TERMIOS_H
 typedef struct termios TERMIO, *PTERMIO;
@@ -60,9 +61,10 @@ static void show_tty_error (char * funcname, int errnum)
     fflush (stderr);
 }
 /***************************************************************/
-int open_tty_connection (char * deviceinfo)
+int open_tty_connection (char * deviceinfo, int profile)
   /*
    **  Create tty connection, return file number
+   **  VMIN/VTIME come from the transport profile
    */
 
 {
@@ -182,8 +184,8 @@ int open_tty_connection (char * deviceinfo)
   curr_termio.c_oflag = 0;
   
   curr_termio.c_lflag = 0;
-  curr_termio.c_cc[VMIN] = 1;
-  curr_termio.c_cc[VTIME] = 0;
+  curr_termio.c_cc[VMIN] = TransportProfile(profile)->fVMin;
+  curr_termio.c_cc[VTIME] = TransportProfile(profile)->fVTime;
 
 #ifdef HAVE_TERMIOS_H
   if (tcsetattr(fd, TCSANOW, &curr_termio) == -1)
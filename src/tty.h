@@ -19,6 +19,6 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
  * tty.h -- tty handling
  ************************************************************/
 
-int open_tty_connection (char *devicename);
+int open_tty_connection (char *devicename, int profile);
 int read_tty_data (int s);
 int send_tty_data (int s, char *buf, int nbuf);
@@ -0,0 +1,677 @@
+/* Copyright (C) 1996 Office Products Technology, Inc.
+
+This file is part of FreeVT3k.
+
+FreeVT3k is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+FreeVT3k is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License along
+with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/************************************************************
+ * vt3kbench.c -- record processing benchmark
+ *
+ * Builds streams of host records in memory and pushes them
+ *   through a socketpair into VTReceiveDataReady(), with the
+ *   data-out procs pointed at a null sink, so the time taken
+ *   is the protocol engine's own. Replies are read back and
+ *   thrown away.
+ *
+ *   Each workload is run several times and the best run is
+ *   reported as records/s and MB/s of host data. With -b, the
+ *   results are checked against a baseline saved earlier with
+ *   -s, and the exit status is 1 if any workload has slowed
+ *   down by more than the tolerance or has no baseline to be
+ *   checked against.
+ ************************************************************/
+
+#include "config.h"
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "vt.h"
+#include "freevt3k.h"
+#include "vtcommon.h"
+#include "vtconn.h"
+#include "transport.h"
+#include "timers.h"
+
+#define DFLT_RUN_MS		(250)	/* Length of each timed run */
+#define DFLT_RUNS		(5)
+#define DFLT_TOLERANCE		(20)	/* Percent; runs are noisy */
+#define PASS_SIZE		(1024 * 1024)	/* One pass of records */
+#define MAX_WORKLOADS		(16)
+#define DRAIN_EVERY		(32)	/* VTReceiveDataReady calls */
+
+typedef struct
+{
+  char
+    *buf;
+  int
+    len,
+    size,
+    records;
+  uint16_t
+    req_count;
+} BENCH_STREAM;
+
+typedef void (*BENCH_BUILD)(BENCH_STREAM *stream);
+
+typedef struct
+{
+  char
+    *name;
+  BENCH_BUILD
+    build;
+  char
+    *desc;
+} BENCH_WORKLOAD;
+
+typedef struct
+{
+  char
+    name[32];
+  double
+    records_per_sec,
+    mb_per_sec;
+} BENCH_RESULT;
+
+/* Record builders. Everything goes out in network order, as the	*/
+/* host would send it.							*/
+
+static void *PutRecord(BENCH_STREAM *stream, int type, int prim, int len)
+{ /*PutRecord*/
+
+  tVTMHeader
+    *hdr;
+
+  if (stream->len + len > stream->size)
+    return(NULL);
+  hdr = (tVTMHeader*)(stream->buf + stream->len);
+  memset(hdr, 0, len);
+  hdr->fMessageLength = htons(len);
+  hdr->fProtocolID = kVTProtocolID;
+  hdr->fMessageType = type;
+  hdr->fPrimitive = prim;
+  stream->len += len;
+  ++stream->records;
+  return(hdr);
+
+} /*PutRecord*/
+
+static bool PutWrite(BENCH_STREAM *stream, uint16_t flags, int cctl, int len)
+{ /*PutWrite*/
+
+  tVTMIORequest
+    *req;
+  char
+    *ptr;
+  int
+    i;
+
+  if (cctl != -1)
+    ++len;
+  req = (tVTMIORequest*)PutRecord(stream, kvmtTerminalIOReq, kVTIOWrite,
+				  offsetof(tVTMIORequest, fWriteData) + len);
+  if (req == NULL)
+    return(false);
+  req->fRequestCount = htons(++stream->req_count);
+  ptr = req->fWriteData;
+  if (cctl != -1)
+    {
+      flags |= kVTIOWUseCCTL;
+      *(ptr++) = (char)cctl;
+      --len;
+    }
+  for (i = 0; i < len; i++)
+    ptr[i] = ' ' + ((stream->records + i) % 95);
+  req->fWriteFlags = htons(flags);
+  req->fWriteByteCount = htons(len + ((cctl != -1) ? 1 : 0));
+  return(true);
+
+} /*PutWrite*/
+
+static void FillWrites(BENCH_STREAM *stream, int cctl, int len)
+{ /*FillWrites*/
+
+  while (PutWrite(stream, 0, cctl, len))
+    ;
+
+} /*FillWrites*/
+
+static void BuildWrite16(BENCH_STREAM *stream)
+{ /*BuildWrite16*/
+
+  FillWrites(stream, -1, 16);
+
+} /*BuildWrite16*/
+
+static void BuildWrite80(BENCH_STREAM *stream)
+{ /*BuildWrite80*/
+
+  FillWrites(stream, ' ', 80);
+
+} /*BuildWrite80*/
+
+static void BuildWrite1k(BENCH_STREAM *stream)
+{ /*BuildWrite1k*/
+
+  FillWrites(stream, -1, 1024);
+
+} /*BuildWrite1k*/
+
+static void BuildWrite8k(BENCH_STREAM *stream)
+{ /*BuildWrite8k*/
+
+  FillWrites(stream, -1, 8000);
+
+} /*BuildWrite8k*/
+
+static void BuildCCTL(BENCH_STREAM *stream)
+{ /*BuildCCTL*/
+
+  /* Line printer style output: every spacing code, pre and post	*/
+  /* space, and a response asked for now and then.			*/
+
+  static int
+    cctl[] = { ' ', '0', '-', '+', '1', 0201, 0203, 0210, 0320 };
+  int
+    i = 0;
+  uint16_t
+    flags;
+
+  for (;; i++)
+    {
+      flags = (i & 1) ? kVTIOWPrespace : 0;
+      if ((i % 8) == 7)
+	flags |= kVTIOWNeedsResponse;
+      if (!PutWrite(stream, flags, cctl[i % (sizeof(cctl) / sizeof(cctl[0]))],
+		    132))
+	break;
+    }
+
+} /*BuildCCTL*/
+
+static void BuildReadAbort(BENCH_STREAM *stream)
+{ /*BuildReadAbort*/
+
+  tVTMIORequest
+    *readreq;
+  tVTMAbortIORequest
+    *abortreq;
+  uint16_t
+    read_count;
+
+  for (;;)
+    {
+      if ((stream->len + (int)offsetof(tVTMIORequest, fWriteData) +
+	   (int)sizeof(tVTMAbortIORequest)) > stream->size)
+	break;
+      readreq = (tVTMIORequest*)PutRecord(stream, kvmtTerminalIOReq,
+				kVTIORead, offsetof(tVTMIORequest, fWriteData));
+      read_count = ++stream->req_count;
+      readreq->fRequestCount = htons(read_count);
+      readreq->fReadByteCount = htons(80);
+      readreq->fTimeout = htons((stream->records & 2) ? 30 : 0);
+      abortreq = (tVTMAbortIORequest*)PutRecord(stream, kvmtTerminalIOReq,
+				kVTIOAbort, sizeof(tVTMAbortIORequest));
+      abortreq->fRequestCount = htons(++stream->req_count);
+      abortreq->fRequestMask = htons(read_count);
+    }
+
+} /*BuildReadAbort*/
+
+static void BuildWriteRead(BENCH_STREAM *stream)
+{ /*BuildWriteRead*/
+
+  /* A prompt and its read in one record, then the abort that stands	*/
+  /* in for the user's answer.						*/
+
+  tVTMIORequest
+    *req;
+  tVTMAbortIORequest
+    *abortreq;
+  uint16_t
+    read_count;
+  int
+    len = offsetof(tVTMIORequest, fWriteData) + 2;
+
+  for (;;)
+    {
+      if ((stream->len + len + (int)sizeof(tVTMAbortIORequest)) >
+	  stream->size)
+	break;
+      req = (tVTMIORequest*)PutRecord(stream, kvmtTerminalIOReq,
+				      kVTIOWriteRead, len);
+      read_count = ++stream->req_count;
+      req->fRequestCount = htons(read_count);
+      req->fReadByteCount = htons(80);
+      req->fWriteFlags = htons(kVTIOWUseCCTL | kVTIOWPrompt);
+      req->fWriteByteCount = htons(2);
+      req->fWriteData[0] = (char)0320;
+      req->fWriteData[1] = ':';
+      abortreq = (tVTMAbortIORequest*)PutRecord(stream, kvmtTerminalIOReq,
+				kVTIOAbort, sizeof(tVTMAbortIORequest));
+      abortreq->fRequestCount = htons(++stream->req_count);
+      abortreq->fRequestMask = htons(read_count);
+    }
+
+} /*BuildWriteRead*/
+
+static void BuildDriverControl(BENCH_STREAM *stream)
+{ /*BuildDriverControl*/
+
+  tVTMTerminalDriverControlRequest
+    *req;
+  int
+    i;
+
+  for (i = 0;; i++)
+    {
+      req = (tVTMTerminalDriverControlRequest*)PutRecord(stream,
+				kvmtTerminalCntlReq, kvtpSetDriverInfo,
+				sizeof(tVTMTerminalDriverControlRequest));
+      if (req == NULL)
+	break;
+      req->fRequestCount = htons(++stream->req_count);
+      req->fRequestMask = htons(kTDCMEcho | kTDCMEditMode |
+				kTDCMDriverMode | kTDCMTermChar);
+      req->fEcho = (i & 1) ? kDTCEchoOffAll : kDTCEchoOnAll;
+      req->fEditMode = (i & 2) ? kDTCUneditedMode : kDTCEditedMode;
+      req->fDriverMode = (i & 4) ? kDTCBlockMode : kDTCVanilla;
+      req->fLineTermCharacter = (i & 4) ? 0x1e : 0x0d;
+    }
+
+} /*BuildDriverControl*/
+
+static BENCH_WORKLOAD
+  workloads[] =
+{
+  { "write16",	BuildWrite16,	"16 byte writes, no CCTL" },
+  { "write80",	BuildWrite80,	"80 byte writes with CCTL" },
+  { "write1k",	BuildWrite1k,	"1K writes" },
+  { "write8k",	BuildWrite8k,	"8000 byte writes" },
+  { "cctl",	BuildCCTL,	"132 column print output, mixed CCTL" },
+  { "readabort", BuildReadAbort, "read then abort, over and over" },
+  { "writeread", BuildWriteRead, "prompt with its read, then abort" },
+  { "drvctl",	BuildDriverControl, "driver control mode changes" },
+  { NULL,	NULL,		NULL }
+};
+
+/* Null sinks */
+
+static void NullDataOutProc(intptr_t refCon, char *buffer, size_t bufferLength)
+{ /*NullDataOutProc*/
+} /*NullDataOutProc*/
+
+static void NullDataOutVProc(intptr_t refCon, const struct iovec *iov, int iovCount)
+{ /*NullDataOutVProc*/
+} /*NullDataOutVProc*/
+
+/* Pushes passes copies of the stream through a fresh connection.	*/
+/* Returns elapsed usec, or -1.						*/
+static int64_t RunStream(BENCH_STREAM *stream, int passes)
+{ /*RunStream*/
+
+  tVTConnection
+    conn;
+  int
+    fds[2],
+    vtError,
+    pass = 0,
+    off = 0,
+    pending,
+    calls,
+    n;
+  char
+    junk[65536],
+    messageBuffer[128];
+  int64_t
+    start,
+    elapsed = -1;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+    {
+      perror("socketpair");
+      return(-1);
+    }
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL, 0) | O_NONBLOCK);
+  fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL, 0) | O_NONBLOCK);
+
+  memset(&conn, 0, sizeof(conn));
+  if ((vtError = VTInitConnection(&conn, 0, kVT_PORT)))
+    goto Error;
+  conn.fSocket = fds[1];
+  conn.fState = kvtsOpen;
+  /* Socket tuning is not what is being measured, and means nothing	*/
+  /* on a Unix socket anyway.						*/
+  VTSetTransportProfile(&conn, kTransportDefault, 0);
+  conn.fBlockModeSupported = true;
+  conn.fDataOutProc = NullDataOutProc;
+  conn.fDataOutVProc = NullDataOutVProc;
+
+  start = MyMonotonicUsec();
+  for (;;)
+    {
+      /* Host side: as much of the stream as the socket will take */
+      while (pass < passes)
+	{
+	  n = write(fds[0], stream->buf + off, stream->len - off);
+	  if (n <= 0)
+	    break;
+	  if ((off += n) == stream->len)
+	    {
+	      off = 0;
+	      ++pass;
+	    }
+	}
+
+      /* Terminal side. Each reply is its own skb on a Unix socket,	*/
+      /* so they are drained every so often or the socket fills up	*/
+      /* long before its byte limit.					*/
+      calls = 0;
+      do
+	{
+	  if ((vtError = VTReceiveDataReady(&conn)))
+	    goto Error;
+	  conn.fReadStarted = false;
+	  if ((++calls % DRAIN_EVERY) == 0)
+	    while (read(fds[0], junk, sizeof(junk)) > 0)
+	      ;
+	} while (VTReceivePending(&conn));
+
+      /* Replies */
+      while (read(fds[0], junk, sizeof(junk)) > 0)
+	;
+
+      if ((pass == passes) && (conn.fRingHead == conn.fRingTail) &&
+	  (ioctl(fds[1], FIONREAD, &pending) == 0) && (!pending))
+	break;
+    }
+  elapsed = MyMonotonicUsec() - start;
+  vtError = kVTCNoError;
+
+Error:
+  if (vtError)
+    {
+      VTErrorMessage(&conn, vtError, messageBuffer, sizeof(messageBuffer));
+      fprintf(stderr, "vt3kbench: %s\n", messageBuffer);
+    }
+  conn.fSocket = -1;
+  VTCleanUpConnection(&conn);
+  close(fds[0]);
+  close(fds[1]);
+  return(elapsed);
+
+} /*RunStream*/
+
+/* Baseline file: one "name records/s MB/s" line per workload */
+
+static int ReadBaseline(char *file_name, BENCH_RESULT *base, int max)
+{ /*ReadBaseline*/
+
+  FILE
+    *input;
+  char
+    line[128];
+  int
+    count = 0;
+
+  if ((input = fopen(file_name, "r")) == (FILE*)NULL)
+    return(-1);
+  while ((count < max) && (fgets(line, sizeof(line), input)))
+    {
+      if (line[0] == '#')
+	continue;
+      if (sscanf(line, "%31s %lf %lf", base[count].name,
+		 &base[count].records_per_sec, &base[count].mb_per_sec) == 3)
+	++count;
+    }
+  fclose(input);
+  return(count);
+
+} /*ReadBaseline*/
+
+static int WriteBaseline(char *file_name, BENCH_RESULT *results, int count)
+{ /*WriteBaseline*/
+
+  FILE
+    *output;
+  int
+    i;
+
+  if ((output = fopen(file_name, "w")) == (FILE*)NULL)
+    {
+      perror(file_name);
+      return(-1);
+    }
+  fprintf(output, "# vt3kbench baseline: workload records/s MB/s\n");
+  for (i = 0; i < count; i++)
+    fprintf(output, "%s %.0f %.2f\n", results[i].name,
+	    results[i].records_per_sec, results[i].mb_per_sec);
+  fclose(output);
+  return(0);
+
+} /*WriteBaseline*/
+
+static void PrintUsage(void)
+{ /*PrintUsage*/
+
+  int
+    i;
+
+  printf("vt3kbench - version %s\n\n", VERSION_ID);
+  printf("Usage: vt3kbench [-T ms] [-r runs] [-b file] [-s file]\n");
+  printf("                 [-t percent] [workload ...]\n");
+  printf("   -T ms           - length of each run [%d]\n", DFLT_RUN_MS);
+  printf("   -r runs         - runs per workload; the best one counts [%d]\n",
+	 DFLT_RUNS);
+  printf("   -b file         - compare with the baseline in 'file', which\n");
+  printf("                     must exist (save it first with -s)\n");
+  printf("   -s file         - save the results to 'file' as a baseline\n");
+  printf("   -t percent      - slowdown allowed against the baseline [%d]\n",
+	 DFLT_TOLERANCE);
+  printf("\nWorkloads (default all):\n");
+  for (i = 0; workloads[i].name; i++)
+    printf("   %-15s - %s\n", workloads[i].name, workloads[i].desc);
+
+} /*PrintUsage*/
+
+int main(int argc, char *argv[])
+{ /*main*/
+
+  char
+    *baseline_file = NULL,
+    *save_file = NULL;
+  int
+    run_ms = DFLT_RUN_MS,
+    runs = DFLT_RUNS,
+    tolerance = DFLT_TOLERANCE,
+    base_count = 0,
+    result_count = 0,
+    passes,
+    regressions = 0,
+    missing = 0,
+    i,
+    j,
+    r;
+  bool
+    selected[MAX_WORKLOADS],
+    any_selected = false;
+  BENCH_STREAM
+    stream;
+  BENCH_RESULT
+    base[MAX_WORKLOADS],
+    results[MAX_WORKLOADS],
+    *res;
+  int64_t
+    usec,
+    best;
+  double
+    change;
+
+  memset(selected, 0, sizeof(selected));
+  while (--argc)
+    {
+      ++argv;
+      if (!strcmp(*argv, "-T") && (argc > 1))
+	{
+	  --argc;
+	  run_ms = atoi(*(++argv));
+	}
+      else if (!strcmp(*argv, "-r") && (argc > 1))
+	{
+	  --argc;
+	  runs = atoi(*(++argv));
+	}
+      else if (!strcmp(*argv, "-b") && (argc > 1))
+	{
+	  --argc;
+	  baseline_file = *(++argv);
+	}
+      else if (!strcmp(*argv, "-s") && (argc > 1))
+	{
+	  --argc;
+	  save_file = *(++argv);
+	}
+      else if (!strcmp(*argv, "-t") && (argc > 1))
+	{
+	  --argc;
+	  tolerance = atoi(*(++argv));
+	}
+      else if ((*argv)[0] != '-')
+	{
+	  for (i = 0; workloads[i].name; i++)
+	    if (!strcmp(*argv, workloads[i].name))
+	      break;
+	  if (!workloads[i].name)
+	    {
+	      PrintUsage();
+	      return(2);
+	    }
+	  selected[i] = any_selected = true;
+	}
+      else
+	{
+	  PrintUsage();
+	  return(2);
+	}
+    }
+  if ((run_ms < 1) || (runs < 1))
+    {
+      PrintUsage();
+      return(2);
+    }
+
+  /* A check with nothing to check against must not pass */
+  if ((baseline_file) &&
+      ((base_count = ReadBaseline(baseline_file, base, MAX_WORKLOADS)) <= 0))
+    {
+      fprintf(stderr, "vt3kbench: no baseline in %s; save one first with "
+	      "-s (\"make bench-baseline\").\n", baseline_file);
+      return(1);
+    }
+
+  memset(&stream, 0, sizeof(stream));
+  stream.size = PASS_SIZE;
+  if ((stream.buf = (char*)malloc(stream.size)) == NULL)
+    {
+      fprintf(stderr, "Out of memory.\n");
+      return(1);
+    }
+
+  printf("%-10s %14s %10s", "workload", "records/s", "MB/s");
+  if (base_count)
+    printf(" %14s %8s", "baseline", "change");
+  printf("\n");
+
+  for (i = 0; workloads[i].name; i++)
+    {
+      if ((any_selected) && (!selected[i]))
+	continue;
+      stream.len = stream.records = 0;
+      stream.req_count = 0;
+      workloads[i].build(&stream);
+
+      /* Size the runs from one pass, so every workload is timed	*/
+      /* over about the same stretch whatever its speed.		*/
+      if ((usec = RunStream(&stream, 1)) < 0)
+	return(1);
+      passes = (int)(((int64_t)run_ms * 1000) / ((usec) ? usec : 1));
+      if (passes < 1)
+	passes = 1;
+
+      best = -1;
+      for (r = 0; r < runs; r++)
+	{
+	  if ((usec = RunStream(&stream, passes)) < 0)
+	    return(1);
+	  if ((best == -1) || (usec < best))
+	    best = usec;
+	}
+      if (best < 1)
+	best = 1;
+
+      res = &results[result_count++];
+      snprintf(res->name, sizeof(res->name), "%s", workloads[i].name);
+      res->records_per_sec = (double)stream.records * passes * 1e6 / best;
+      res->mb_per_sec = (double)stream.len * passes / best;	/* bytes/us */
+      printf("%-10s %14.0f %10.2f", res->name, res->records_per_sec,
+	     res->mb_per_sec);
+
+      for (j = 0; j < base_count; j++)
+	if (!strcmp(base[j].name, res->name))
+	  break;
+      if ((j < base_count) && (base[j].records_per_sec > 0))
+	{
+	  change = (res->records_per_sec / base[j].records_per_sec - 1.0) *
+	    100.0;
+	  printf(" %14.0f %+7.1f%%", base[j].records_per_sec, change);
+	  if (change < -tolerance)
+	    {
+	      printf("  REGRESSION");
+	      ++regressions;
+	    }
+	}
+      else if (base_count)
+	{
+	  printf(" %14s", "NO BASELINE");
+	  ++missing;
+	}
+      printf("\n");
+    }
+  free(stream.buf);
+
+  if ((save_file) && (WriteBaseline(save_file, results, result_count)))
+    return(1);
+  if (missing)
+    printf("%d workload(s) not in the baseline; save a new one.\n",
+	   missing);
+  if (regressions)
+    printf("%d workload(s) more than %d%% slower than the baseline.\n",
+	   regressions, tolerance);
+  if ((missing) || (regressions))
+    return(1);
+  return(0);
+
+} /*main*/
@@ -44,6 +44,7 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
 #include "vt.h"
 #include "freevt3k.h"
 #include "vtconn.h"
+#include "transport.h"
 
 #include "conmgr.h"
 
@@ -57,32 +58,17 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
 
 
 
-tVTConnection * open_vt3k_connection (char *hostname, int port)
+tVTConnection * open_vt3k_connection (char *hostname, int port,
+				      int profile, int flags)
 {
-    long  ipAddress;
     int   ipPort = port;
-    struct hostent * theHost;
     tVTConnection * theConnection;
     int             vtError;
     char	messageBuffer[128];
     int         term_type = 10;
 
-    /* First, validate the destination. If the destination can be	*/
-    /* validated, create a connection structure and try to open the     */
-    /* connection.							*/
-
-    ipAddress = inet_addr(hostname);
-    if (ipAddress == INADDR_NONE)
-	{
-	theHost = gethostbyname(hostname);
-	if (theHost == NULL)
-	    {
-            printf("Unable to resolve %s.\n", hostname);
-	    theConnection = NULL;
-	    goto Last;
-            }
-        memcpy((char *) &ipAddress, theHost->h_addr, sizeof(ipAddress));
-	}
+    /* Create a connection structure and try to open the connection. */
+    /* The name is resolved as part of connecting.			 */
 
     theConnection = (tVTConnection *) calloc(1, sizeof(tVTConnection));
     if (theConnection == NULL)
@@ -91,7 +77,7 @@ tVTConnection * open_vt3k_connection (char *hostname, int port)
         goto Last;
         }
 
-    if ((vtError = VTInitConnection(theConnection, ipAddress, ipPort)))
+    if ((vtError = VTInitConnection(theConnection, 0, ipPort)))
         {
         printf("Unable to initialize the connection.\n");
         VTErrorMessage(theConnection, vtError,
@@ -108,9 +94,14 @@ tVTConnection * open_vt3k_connection (char *hostname, int port)
 	theConnection->fBlockModeSupported = true;      /* RM 960411 */
     }
 
+    /* Block mode pages switch to the bulk profile by themselves */
+    VTSetTransportProfile(theConnection, profile, flags | kTransportAutoBulk);
+
     theConnection->fDataOutProc = conmgr_rxfunc;
+    theConnection->fDataOutVProc = conmgr_rxvfunc;
 
-    if ((vtError = VTConnect(theConnection)))
+    if ((vtError = VTConnectHost(theConnection, hostname, ipPort,
+				 kVT_CONNECT_TIMEOUT)))
 	{
         printf("Unable to connect to host.\n");
         VTErrorMessage(theConnection, vtError,
@@ -135,50 +126,55 @@ int read_vt3k_data (tVTConnection * theConnection) {
     int eof=0;
 
 
-    whichError = VTReceiveDataReady(theConnection);
-    if (whichError == kVTCVTOpen)
-	{
-	/* Now the connection is _really_ open */
-	}
-    else if (whichError != kVTCNoError) {
-	{
-	if (whichError == kVTCStartShutdown) {
-            done=true;
-            eof=1;
-	} else
+    do {
+	whichError = VTReceiveDataReady(theConnection);
+	if (whichError == kVTCVTOpen)
 	    {
-	    printf ("VT error!:\n");
-	    VTErrorMessage(theConnection, whichError,
-			  messageBuffer, sizeof(messageBuffer));
-            printf ("%s\n", messageBuffer);
-	    done=true;
+	    /* Now the connection is _really_ open */
 	    }
-        }
-    }
-/*
- *  Check for start of a new read
- */
-    if (!done && theConnection->fReadStarted) {
-	theConnection->fReadStarted = false;
-/*
- *      Check for need to flush the type-ahead buffer
- */
-	if (theConnection->fReadFlush)  /* RM 960403 */
+	else if (whichError != kVTCNoError) {
 	    {
-	    theConnection->fReadFlush = false;
-	    FlushQ();
+	    if (whichError == kVTCStartShutdown) {
+		done=true;
+		eof=1;
+	    } else
+		{
+		printf ("VT error!:\n");
+		VTErrorMessage(theConnection, whichError,
+			      messageBuffer, sizeof(messageBuffer));
+		printf ("%s\n", messageBuffer);
+		done=true;
+		}
 	    }
-/*
- *      Send read trigger that is needed by hpterm
- */
-	theConnection->fDataOutProc (theConnection->fDataOutRefCon,
-				     trigger, sizeof(trigger));
-/*
- *      As we just got a read request, check for any typed-ahead data and
- *      process it now.
- */
-	ProcessQueueToHost(theConnection, 0);
-    }
+	}
+    /*
+     *  Check for start of a new read
+     */
+	if (!done && theConnection->fReadStarted) {
+	    theConnection->fReadStarted = false;
+    /*
+     *      Check for need to flush the type-ahead buffer
+     */
+	    if (theConnection->fReadFlush)  /* RM 960403 */
+		{
+		theConnection->fReadFlush = false;
+		FlushQ(theConnection);
+		}
+    /*
+     *      Send read trigger that is needed by hpterm
+     */
+	    theConnection->fDataOutProc (theConnection->fDataOutRefCon,
+					 trigger, sizeof(trigger));
+    /*
+     *      As we just got a read request, check for any typed-ahead data and
+     *      process it now.
+     */
+	    ProcessQueueToHost(theConnection, 0);
+	}
+    /*
+     *  More complete records may have arrived with the same read
+     */
+    } while (!done && VTReceivePending(theConnection));
     return (eof);
 }
 /**********************************************************************/
@@ -189,11 +185,13 @@ int send_vt3k_data (tVTConnection * theConnection, char *buf, size_t nbuf) {
 
     for (ii=0; ii<nbuf; ii++) {
 	ch = buf[ii];
-	if (PutQ(ch) == -1) break;
+	if (PutQ(theConnection, ch) == -1) break;
     }
 
     if (theConnection->fReadInProgress) {
         ProcessQueueToHost(theConnection, 0);
+    } else {
+        PreassembleQ(theConnection);
     }
 
     return (0);
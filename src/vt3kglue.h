@@ -47,7 +47,8 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
 #include "hpterm.h"
 
 void myDataOutProc (int32_t refCon, char *buf, int nbuf);
-tVTConnection * open_vt3k_connection (char *hostname, int port);
+tVTConnection * open_vt3k_connection (char *hostname, int port,
+				      int profile, int flags);
 int read_vt3k_data (tVTConnection * theConnection);
 int send_vt3k_data (tVTConnection * theConnection, char *buf, int nbuf);
 void send_vt3k_break (tVTConnection * theConnection);
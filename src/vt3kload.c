@@ -0,0 +1,775 @@
+/* Copyright (C) 1996 Office Products Technology, Inc.
+
+This file is part of FreeVT3k.
+
+FreeVT3k is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+FreeVT3k is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License along
+with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/************************************************************
+ * vt3kload.c -- headless NS/VT load generator
+ *
+ * Opens a number of sessions to one host at once and answers
+ *   every read the host posts with the next line of a
+ *   keystroke script (the same format as freevt3k -a/-I).
+ *   Host output is counted and thrown away.
+ *
+ * For each session, and for all of them together, reports:
+ *   - connect/negotiation time, to the point the session opened
+ *   - time until the host's first prompt after the logon
+ *     dialogue (-L), when the session is ready for work
+ *   - read round trip: from sending a line to the host's next
+ *     read request, as p50/p90/p99/p99.9
+ *   - host output in bytes and bytes/s
+ ************************************************************/
+
+#include "config.h"
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "vt.h"
+#include "freevt3k.h"
+#include "vtcommon.h"
+#include "hpterm.h"
+#include "vtconn.h"
+#include "timers.h"
+
+#define CONNECT_POLL_MS		(1)	/* Resolver has no fd; keep setup times honest */
+
+typedef enum
+{
+  kLoadWaiting,			/* Not started yet (-r) */
+  kLoadConnecting,
+  kLoadOpen,
+  kLoadDone
+} LOAD_STATE;
+
+typedef struct
+{
+  int
+    id;
+  LOAD_STATE
+    state;
+  tVTConnection
+    conn;
+  int
+    script_off,			/* Next byte of the script to send */
+    vt_error;			/* What ended the session, if not the host */
+  bool
+    echoing;			/* Our own echo; don't count it */
+  char
+    error[80];			/* VTErrorMessage() for vt_error */
+  int64_t
+    setup,			/* Connect to session open, usec */
+    ready,			/* Connect to first prompt after logon */
+    open_at,
+    done_at,
+    sent_at,			/* Answered a read; 0 once timed */
+    answer_at;			/* Think time for the current read */
+  int64_t
+    *lat;			/* Read round trips, usec */
+  int
+    lat_count,
+    lat_size;
+  long long
+    out_bytes;
+} LOAD_SESSION;
+
+/* Global variables */
+
+LOAD_SESSION
+	*sessions = NULL;
+int
+	session_count = 1,
+	connect_timeout = kVT_CONNECT_TIMEOUT,
+	think_ms = 0,
+	ramp_ms = 0,
+	run_seconds = 0;
+char
+	*script = NULL;
+tVTConnection
+	logon;			/* Holds the -L dialogue to copy */
+int
+	script_len = 0;
+bool
+	stop_at_eof = false,
+	quiet = false,
+	stop_now = false;
+
+static void PrintUsage(void)
+{ /*PrintUsage*/
+
+  printf("vt3kload - version %s\n\n", VERSION_ID);
+  printf("Usage: vt3kload [-n sessions] [-p port] [-a|-I file] [-k ms] [-r ms]\n");
+  printf("                [-t seconds] [-ct seconds] [-L file] [-q] host\n");
+  printf("   -n sessions     - number of concurrent sessions [1]\n");
+  printf("   -p port         - connect to 'port' instead of the default [%d]\n",
+	 kVT_PORT);
+  printf("   -a file         - answer reads with lines from file, repeating\n");
+  printf("   -I file         - like -a, but end each session at end-of-file\n");
+  printf("   -k ms           - think time before answering each read [0]\n");
+  printf("   -r ms           - time between starting sessions [0]\n");
+  printf("   -t seconds      - stop after 'seconds' [run until sessions end]\n");
+  printf("   -ct seconds     - give up connecting after 'seconds' [%d]\n",
+	 kVT_CONNECT_TIMEOUT / 1000);
+  printf("   -L file         - log each session on from this freevt3k -logon\n");
+  printf("                     profile before starting the script\n");
+  printf("   -q              - aggregate report only\n");
+
+} /*PrintUsage*/
+
+static void CatchTerm(int sig)
+{ /*CatchTerm*/
+
+  stop_now = true;
+
+} /*CatchTerm*/
+
+static int LoadScript(char *file_name)
+{ /*LoadScript*/
+
+  FILE
+    *input;
+  int
+    ch,
+    i,
+    j,
+    size = 0;
+
+  if ((input = fopen(file_name, "r")) == (FILE*)NULL)
+    {
+      perror(file_name);
+      return(-1);
+    }
+  while ((ch = getc(input)) != EOF)
+    {
+      if (script_len == size)
+	{
+	  size = (size) ? size * 2 : 1024;
+	  if ((script = (char*)realloc(script, size)) == NULL)
+	    {
+	      fprintf(stderr, "Out of memory.\n");
+	      fclose(input);
+	      return(-1);
+	    }
+	}
+/* As with freevt3k -a, newline is typed as a return */
+      script[script_len++] = (ch == '\n') ? ASC_CR : ch;
+    }
+  fclose(input);
+/* A kVT_SCRIPT_ENTER line is an RS, for block mode reads */
+  for (i = j = 0; i < script_len; )
+    {
+      if (((i == 0) || (script[i - 1] == ASC_CR)) &&
+	  (script_len - i >= kVT_SCRIPT_ENTER_LEN) &&
+	  (!memcmp(&script[i], kVT_SCRIPT_ENTER, kVT_SCRIPT_ENTER_LEN)) &&
+	  ((i + kVT_SCRIPT_ENTER_LEN == script_len) ||
+	   (script[i + kVT_SCRIPT_ENTER_LEN] == ASC_CR)))
+	{
+	  script[j++] = ASC_RS;
+	  i += kVT_SCRIPT_ENTER_LEN + 1;
+	}
+      else
+	script[j++] = script[i++];
+    }
+  script_len = j;
+/* A last line without a terminator would leave its read hanging */
+  if ((script_len) && (script[script_len - 1] != ASC_CR) &&
+      (script[script_len - 1] != ASC_RS))
+    {
+      if ((script = (char*)realloc(script, script_len + 1)) == NULL)
+	{
+	  fprintf(stderr, "Out of memory.\n");
+	  return(-1);
+	}
+      script[script_len++] = ASC_CR;
+    }
+  return(0);
+
+} /*LoadScript*/
+
+/* Host output goes nowhere; only its size matters */
+
+static void LoadDataOutProc(intptr_t refCon, char *buffer, size_t bufferLength)
+{ /*LoadDataOutProc*/
+
+  LOAD_SESSION
+    *session = (LOAD_SESSION*)refCon;
+
+  if (!session->echoing)
+    session->out_bytes += bufferLength;
+
+} /*LoadDataOutProc*/
+
+static void LoadDataOutVProc(intptr_t refCon, const struct iovec *iov, int iovCount)
+{ /*LoadDataOutVProc*/
+
+  LOAD_SESSION
+    *session = (LOAD_SESSION*)refCon;
+
+  if (session->echoing)
+    return;
+  for (; iovCount > 0; --iovCount, ++iov)
+    session->out_bytes += iov->iov_len;
+
+} /*LoadDataOutVProc*/
+
+static void EndSession(LOAD_SESSION *session, int vt_error)
+{ /*EndSession*/
+
+  if (session->state == kLoadDone)
+    return;
+  session->state = kLoadDone;
+  session->vt_error = vt_error;
+  session->done_at = MyMonotonicUsec();
+/* The connection is zeroed by the clean up; keep what Report() needs */
+  if (vt_error)
+    VTErrorMessage(&session->conn, vt_error,
+		   session->error, sizeof(session->error));
+  VTCleanUpConnection(&session->conn);
+
+} /*EndSession*/
+
+static void StartSession(LOAD_SESSION *session, char *hostname, int ipPort)
+{ /*StartSession*/
+
+  tVTConnection
+    *conn = &session->conn;
+  int
+    vtError;
+
+  vtError = VTInitConnection(conn, 0, ipPort);
+  if ((vtError == kVTCNoError) && (logon.fInput))
+    {
+      memcpy(conn->fInput->fLogon, logon.fInput->fLogon,
+	     sizeof(conn->fInput->fLogon));
+      conn->fInput->fLogonLines = logon.fInput->fLogonLines;
+    }
+  if (vtError == kVTCNoError)
+    vtError = VTConnectStart(conn, hostname, ipPort, connect_timeout);
+  conn->fBlockModeSupported = true;
+  conn->fSendNoWait = true;	/* Replies wait for POLLOUT in main() */
+  conn->fDataOutProc = LoadDataOutProc;
+  conn->fDataOutVProc = LoadDataOutVProc;
+  conn->fDataOutRefCon = (intptr_t)session;
+  session->state = kLoadConnecting;
+  if ((vtError != kVTCNoError) && (vtError != kVTCConnectPending))
+    EndSession(session, vtError);
+
+} /*StartSession*/
+
+static void AddLatency(LOAD_SESSION *session, int64_t usec)
+{ /*AddLatency*/
+
+  int64_t
+    *lat;
+  int
+    size;
+
+  if (session->lat_count == session->lat_size)
+    {
+      size = (session->lat_size) ? session->lat_size * 2 : 256;
+      if ((lat = (int64_t*)realloc(session->lat,
+				   size * sizeof(int64_t))) == NULL)
+	return;
+      session->lat = lat;
+      session->lat_size = size;
+    }
+  session->lat[session->lat_count++] = usec;
+
+} /*AddLatency*/
+
+/* Types the next line of the script, up to and including its	*/
+/* terminator, and sends it to satisfy the current read. In block	*/
+/* mode that is everything up to the next kVT_SCRIPT_ENTER line.	*/
+static void AnswerRead(LOAD_SESSION *session)
+{ /*AnswerRead*/
+
+  tVTConnection
+    *conn = &session->conn;
+  char
+    ch;
+
+  session->answer_at = 0;
+/* The logon dialogue goes first and doesn't use up the script */
+  if (conn->fInput->fLogonNext < conn->fInput->fLogonLines)
+    {
+      session->echoing = true;
+      ProcessQueueToHost(conn, 0);
+      session->echoing = false;
+      if (!conn->fReadInProgress)
+	session->sent_at = MyMonotonicUsec();
+      return;
+    }
+  if (session->script_off >= script_len)
+    {
+      if (stop_at_eof)
+	{
+	  EndSession(session, kVTCNoError);
+	  return;
+	}
+      session->script_off = 0;
+    }
+  if (!script_len)
+    PutQ(conn, ASC_CR);
+  while (session->script_off < script_len)
+    {
+      ch = script[session->script_off++];
+      PutQ(conn, ch);
+/* A return doesn't end a block mode read; the fields run on to the RS */
+      if (((ch == ASC_CR) && (conn->fDriverMode != kDTCBlockMode)) ||
+	  (ch == ASC_RS) ||
+	  ((conn->fAltLineTerminationChar) &&
+	   (ch == conn->fAltLineTerminationChar)))
+	break;
+    }
+
+  session->echoing = true;
+  ProcessQueueToHost(conn, 0);
+  session->echoing = false;
+  if (!conn->fReadInProgress)
+    session->sent_at = MyMonotonicUsec();
+
+} /*AnswerRead*/
+
+static void ProcessSession(LOAD_SESSION *session)
+{ /*ProcessSession*/
+
+  tVTConnection
+    *conn = &session->conn;
+  int
+    whichError;
+  int64_t
+    now;
+
+  do
+    {
+      whichError = VTReceiveDataReady(conn);
+      if (whichError == kVTCVTOpen)
+	{
+	  session->open_at = MyMonotonicUsec();
+	  session->setup = session->open_at - conn->fTimes.fStart;
+	}
+      else if (whichError == kVTCStartShutdown)
+	{
+	  EndSession(session, kVTCNoError);
+	  return;
+	}
+      else if (whichError != kVTCNoError)
+	{
+	  EndSession(session, whichError);
+	  return;
+	}
+      if (conn->fReadStarted)
+	{
+	  conn->fReadStarted = false;
+	  if (conn->fReadFlush)
+	    {
+	      conn->fReadFlush = false;
+	      FlushQ(conn);
+	    }
+	  now = MyMonotonicUsec();
+	  if ((!session->ready) && (conn->fTimes.fReady))
+	    session->ready = conn->fTimes.fReady - conn->fTimes.fStart;
+	  if (session->sent_at)
+	    {
+	      AddLatency(session, now - session->sent_at);
+	      session->sent_at = 0;
+	    }
+	  if (think_ms)
+	    session->answer_at = now + (int64_t)think_ms * 1000;
+	  else
+	    AnswerRead(session);
+	}
+    } while ((session->state == kLoadOpen) && (VTReceivePending(conn)));
+
+} /*ProcessSession*/
+
+static void StepConnect(LOAD_SESSION *session)
+{ /*StepConnect*/
+
+  int
+    vtError;
+
+  vtError = VTConnectStep(&session->conn);
+  if (vtError == kVTCConnectPending)
+    return;
+  if (vtError != kVTCNoError)
+    {
+      EndSession(session, vtError);
+      return;
+    }
+  session->state = kLoadOpen;
+
+} /*StepConnect*/
+
+/* Reporting */
+
+static int CompareLatency(const void *a, const void *b)
+{ /*CompareLatency*/
+
+  int64_t
+    x = *(const int64_t*)a,
+    y = *(const int64_t*)b;
+
+  return((x < y) ? -1 : ((x > y) ? 1 : 0));
+
+} /*CompareLatency*/
+
+/* Nearest rank; lat must be sorted */
+static double Percentile(int64_t *lat, int count, double pct)
+{ /*Percentile*/
+
+  int
+    rank;
+
+  if (!count)
+    return(0.0);
+  rank = (int)((pct / 100.0) * count + 0.999999);
+  if (rank < 1)
+    rank = 1;
+  if (rank > count)
+    rank = count;
+  return((double)lat[rank - 1] / 1000.0);
+
+} /*Percentile*/
+
+static void PrintLatency(int64_t *lat, int count)
+{ /*PrintLatency*/
+
+  printf("%8.3f %8.3f %8.3f %8.3f",
+	 Percentile(lat, count, 50.0), Percentile(lat, count, 90.0),
+	 Percentile(lat, count, 99.0), Percentile(lat, count, 99.9));
+
+} /*PrintLatency*/
+
+static void Report(int64_t run_start, int64_t run_end)
+{ /*Report*/
+
+  LOAD_SESSION
+    *session;
+  int64_t
+    *all_lat = NULL,
+    *setup = NULL,
+    *ready = NULL;
+  int
+    all_count = 0,
+    opened = 0,
+    readied = 0,
+    failed = 0,
+    i;
+  long long
+    total_bytes = 0;
+  double
+    secs,
+    run_secs = (double)(run_end - run_start) / 1e6;
+
+  for (i = 0; i < session_count; i++)
+    all_count += sessions[i].lat_count;
+  all_lat = (int64_t*)malloc((all_count + 1) * sizeof(int64_t));
+  setup = (int64_t*)malloc(session_count * sizeof(int64_t));
+  ready = (int64_t*)malloc(session_count * sizeof(int64_t));
+  if ((all_lat == NULL) || (setup == NULL) || (ready == NULL))
+    {
+      fprintf(stderr, "Out of memory.\n");
+      free(all_lat);
+      free(setup);
+      free(ready);
+      return;
+    }
+  all_count = 0;
+
+  if (!quiet)
+    printf("session    reads  p50(ms)  p90(ms)  p99(ms) p99.9(ms) setup(ms)"
+	   " ready(ms)     bytes    bytes/s\n");
+  for (i = 0; i < session_count; i++)
+    {
+      session = &sessions[i];
+      if (session->open_at)
+	setup[opened++] = session->setup;
+      if (session->ready)
+	ready[readied++] = session->ready;
+      if (session->vt_error)
+	++failed;
+      qsort(session->lat, session->lat_count, sizeof(int64_t),
+	    CompareLatency);
+      memcpy(all_lat + all_count, session->lat,
+	     session->lat_count * sizeof(int64_t));
+      all_count += session->lat_count;
+      total_bytes += session->out_bytes;
+      if (quiet)
+	continue;
+      secs = (session->open_at)
+	? (double)(session->done_at - session->open_at) / 1e6 : 0.0;
+      printf("%7d %8d ", session->id, session->lat_count);
+      PrintLatency(session->lat, session->lat_count);
+      printf(" %9.3f %9.3f %9lld %10.0f", (double)session->setup / 1000.0,
+	     (double)session->ready / 1000.0, session->out_bytes,
+	     (secs > 0.0) ? (double)session->out_bytes / secs : 0.0);
+      if (session->vt_error)
+	printf("  %s", session->error);
+      printf("\n");
+    }
+
+  qsort(all_lat, all_count, sizeof(int64_t), CompareLatency);
+  qsort(setup, opened, sizeof(int64_t), CompareLatency);
+  qsort(ready, readied, sizeof(int64_t), CompareLatency);
+  printf("\n%d sessions, %d opened, %d failed, %.3f s\n",
+	 session_count, opened, failed, run_secs);
+  printf("setup (ms)    p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+	 Percentile(setup, opened, 50.0), Percentile(setup, opened, 90.0),
+	 Percentile(setup, opened, 99.0), Percentile(setup, opened, 100.0));
+  printf("ready (ms)    p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+	 Percentile(ready, readied, 50.0), Percentile(ready, readied, 90.0),
+	 Percentile(ready, readied, 99.0), Percentile(ready, readied, 100.0));
+  printf("reads %d, round trip (ms)  p50 %.3f  p90 %.3f  p99 %.3f"
+	 "  p99.9 %.3f\n", all_count,
+	 Percentile(all_lat, all_count, 50.0),
+	 Percentile(all_lat, all_count, 90.0),
+	 Percentile(all_lat, all_count, 99.0),
+	 Percentile(all_lat, all_count, 99.9));
+  printf("output %lld bytes, %.0f bytes/s aggregate",
+	 total_bytes, (run_secs > 0.0) ? (double)total_bytes / run_secs : 0.0);
+  if ((run_secs > 0.0) && (opened))
+    printf(", %.0f bytes/s per session",
+	   (double)total_bytes / run_secs / opened);
+  printf("\n");
+
+  free(all_lat);
+  free(setup);
+  free(ready);
+
+} /*Report*/
+
+int main(int argc, char *argv[])
+{ /*main*/
+
+  char
+    *hostname = NULL,
+    *script_file = NULL,
+    *logon_file = NULL;
+  int
+    ipPort = kVT_PORT,
+    started = 0,
+    active,
+    nfds,
+    wait_ms,
+    vtError,
+    i;
+  struct pollfd
+    *pfds;
+  LOAD_SESSION
+    **pfd_sessions;
+  int64_t
+    now,
+    run_start,
+    next_start,
+    deadline = 0,
+    due;
+
+  while ((--argc) && ((*(++argv))[0] == '-'))
+    {
+      if (!strcmp(*argv, "-n") && (argc > 1))
+	{
+	  --argc;
+	  session_count = atoi(*(++argv));
+	}
+      else if (!strcmp(*argv, "-p") && (argc > 1))
+	{
+	  --argc;
+	  ipPort = atoi(*(++argv));
+	}
+      else if ((!strcmp(*argv, "-a") || !strcmp(*argv, "-I")) && (argc > 1))
+	{
+	  stop_at_eof = (!strcmp(*argv, "-I")) ? true : false;
+	  --argc;
+	  script_file = *(++argv);
+	}
+      else if (!strcmp(*argv, "-k") && (argc > 1))
+	{
+	  --argc;
+	  think_ms = atoi(*(++argv));
+	}
+      else if (!strcmp(*argv, "-r") && (argc > 1))
+	{
+	  --argc;
+	  ramp_ms = atoi(*(++argv));
+	}
+      else if (!strcmp(*argv, "-t") && (argc > 1))
+	{
+	  --argc;
+	  run_seconds = atoi(*(++argv));
+	}
+      else if (!strcmp(*argv, "-ct") && (argc > 1))
+	{
+	  --argc;
+	  connect_timeout = atoi(*(++argv)) * 1000;
+	}
+      else if (!strcmp(*argv, "-L") && (argc > 1))
+	{
+	  --argc;
+	  logon_file = *(++argv);
+	}
+      else if (!strcmp(*argv, "-q"))
+	quiet = true;
+      else
+	{
+	  PrintUsage();
+	  return(2);
+	}
+    }
+  if (argc == 1)
+    hostname = *argv;
+  if ((!hostname) || (session_count < 1))
+    {
+      PrintUsage();
+      return(2);
+    }
+  if ((script_file) && (LoadScript(script_file) == -1))
+    return(1);
+  if (logon_file)
+    {
+      if ((logon.fInput = (tVTInput*)calloc(1, sizeof(tVTInput))) == NULL)
+	{
+	  fprintf(stderr, "Out of memory.\n");
+	  return(1);
+	}
+      if (LoadLogonProfile(&logon, logon_file))
+	return(1);
+    }
+
+  sessions = (LOAD_SESSION*)calloc(session_count, sizeof(LOAD_SESSION));
+  pfds = (struct pollfd*)calloc(session_count, sizeof(struct pollfd));
+  pfd_sessions = (LOAD_SESSION**)calloc(session_count, sizeof(LOAD_SESSION*));
+  if ((sessions == NULL) || (pfds == NULL) || (pfd_sessions == NULL))
+    {
+      fprintf(stderr, "Out of memory.\n");
+      return(1);
+    }
+  for (i = 0; i < session_count; i++)
+    sessions[i].id = i;
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, CatchTerm);
+  signal(SIGTERM, CatchTerm);
+
+  run_start = next_start = MyMonotonicUsec();
+  if (run_seconds)
+    deadline = run_start + (int64_t)run_seconds * 1000000;
+
+  while (!stop_now)
+    {
+      now = MyMonotonicUsec();
+      if ((deadline) && (now >= deadline))
+	break;
+
+      while ((started < session_count) && (now >= next_start))
+	{
+	  StartSession(&sessions[started++], hostname, ipPort);
+	  next_start += (int64_t)ramp_ms * 1000;
+	}
+
+/* Step connects, answer reads whose think time is up, and collect */
+/* the sockets that are open.					   */
+      nfds = 0;
+      active = session_count - started;
+      wait_ms = (started < session_count)
+	? (int)((next_start - now) / 1000) : -1;
+      for (i = 0; i < started; i++)
+	{
+	  LOAD_SESSION *session = &sessions[i];
+
+	  if (session->state == kLoadConnecting)
+	    {
+	      StepConnect(session);
+	      if (session->state == kLoadConnecting)
+		wait_ms = ((wait_ms == -1) || (wait_ms > CONNECT_POLL_MS))
+		  ? CONNECT_POLL_MS : wait_ms;
+	    }
+	  if ((session->state == kLoadOpen) && (session->answer_at))
+	    {
+	      if (now >= session->answer_at)
+		AnswerRead(session);
+	      else
+		{
+		  due = (session->answer_at - now + 999) / 1000;
+		  if ((wait_ms == -1) || (due < wait_ms))
+		    wait_ms = (int)due;
+		}
+	    }
+	  if (session->state == kLoadDone)
+	    continue;
+	  ++active;
+	  if (session->state == kLoadOpen)
+	    {
+	      pfds[nfds].fd = VTSocket(&session->conn);
+	      pfds[nfds].events = POLLIN |
+		((VTSendPending(&session->conn)) ? POLLOUT : 0);
+	      pfd_sessions[nfds++] = session;
+	    }
+	}
+      if (!active)
+	break;
+      if (deadline)
+	{
+	  due = (deadline - now + 999) / 1000;
+	  if ((wait_ms == -1) || (due < wait_ms))
+	    wait_ms = (int)due;
+	}
+
+      if (poll(pfds, nfds, wait_ms) == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  perror("poll");
+	  break;
+	}
+      for (i = 0; i < nfds; i++)
+	{
+	  LOAD_SESSION *session = pfd_sessions[i];
+
+	  if ((pfds[i].revents & POLLOUT) && (session->state == kLoadOpen) &&
+	      ((vtError = VTSendReady(&session->conn))))
+	    EndSession(session, vtError);
+	  if ((pfds[i].revents & ~POLLOUT) && (session->state == kLoadOpen))
+	    ProcessSession(session);
+	}
+    }
+
+  now = MyMonotonicUsec();
+  for (i = 0; i < started; i++)
+    EndSession(&sessions[i], kVTCNoError);
+  Report(run_start, now);
+
+  for (i = 0; i < session_count; i++)
+    free(sessions[i].lat);
+  free(sessions);
+  free(pfds);
+  free(pfd_sessions);
+  free(script);
+  return(0);
+
+} /*main*/
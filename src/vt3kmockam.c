@@ -0,0 +1,1115 @@
+/* Copyright (C) 1996 Office Products Technology, Inc.
+
+This file is part of FreeVT3k.
+
+FreeVT3k is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+FreeVT3k is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License along
+with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/************************************************************
+ * vt3kmockam.c -- pretend to be an HP 3000 NS/VT host
+ *
+ * Listens like the AM side of an NS/VT session does and
+ *   drives each connection through a canned workload, so the
+ *   terminal side can be exercised and timed without a real
+ *   MPE system:
+ *
+ *	scroll	- bulk text, with and without CCTL
+ *	forms	- block mode screens with unprotected fields, each
+ *		  read ending with RS (a ^^ line in a script)
+ *	prompt	- prompt/read cycles, echoing what came back
+ *	all	- each of the above in turn
+ *
+ *   Every session starts with the AM negotiation and ends
+ *   with a termination request. With -logon, an MPE style
+ *   HELLO and password dialogue comes first. Each connection
+ *   is served by its own child process.
+ ************************************************************/
+
+#include "config.h"
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+
+#include "vt.h"
+#include "freevt3k.h"
+#include "hpterm.h"
+#include "vtconn.h"
+#include "timers.h"
+
+#define DFLT_BIND_ADDRESS	"127.0.0.1"
+#define DFLT_LINE_LENGTH	(79)
+#define DFLT_ACK_EVERY		(16)
+#define MOCK_BUFFER_SIZE	(8192)	/* Offered in AM negotiation */
+#define MOCK_OUT_BUFFER		(65536)	/* Records batched per send */
+#define MOCK_IN_BUFFER		(65536)
+#define MOCK_REPLY_WAIT_MS	(30000)	/* Give up on a silent TM */
+#define FORM_FIELDS		(8)
+#define FORM_FIELD_WIDTH	(20)
+#define LINE_DELETE_ECHO	"!!!\r\n"
+#define MOCK_SESSION_ID		"#S1234"
+#define MOCK_LOGON_TRIES	(3)
+
+typedef enum
+{
+  kWorkScroll,
+  kWorkForms,
+  kWorkPrompt,
+  kWorkAll
+} MOCK_WORKLOAD;
+
+typedef struct
+{
+  int
+    fd;
+  uint16_t
+    req_count;			/* Last request count we used */
+  char
+    out[MOCK_OUT_BUFFER],
+    in[MOCK_IN_BUFFER];
+  int
+    out_len,
+    out_sent,			/* Part of out already sent */
+    in_len;
+  bool
+    reading,			/* In ReadInput(); don't reenter it */
+    closed,			/* TM hung up or terminated */
+    am_replied,
+    tm_requested,
+    logon_acked,
+    terminated;
+  int
+    pending_writes,		/* Writes awaiting a response */
+    pending_controls;		/* Driver control awaiting a response */
+  uint16_t
+    read_count,			/* Outstanding read, 0 for none */
+    abort_count,		/* Outstanding abort, 0 for none */
+    read_completion;
+  bool
+    read_done;
+  int
+    read_len;
+  char
+    read_data[kVT_MAX_BUFFER];
+  long long
+    bytes_out,
+    bytes_in,
+    records_out,
+    records_in;
+} MOCK_SESSION;
+
+/* Options */
+
+static char
+  *workload_names[] = { "scroll", "forms", "prompt", "all", NULL };
+static MOCK_WORKLOAD
+  workload = kWorkScroll;
+static int
+  count = 0,			/* 0 = the workload's own default */
+  line_length = DFLT_LINE_LENGTH,
+  ack_every = DFLT_ACK_EVERY,
+  read_timeout = 0,		/* Seconds, sent with prompt reads */
+  abort_after = 0,		/* Seconds before we abort a read */
+  logon_passwords = -1,		/* -logon: password prompts; -1, no logon */
+  debug = 0;
+static bool
+  write_read = false;		/* Prompt and read in one message */
+
+static void PrintUsage(void)
+{ /*PrintUsage*/
+
+  printf("vt3kmockam - version %s\n\n", VERSION_ID);
+  printf("Usage: vt3kmockam [-p port] [-b address] [-w workload] [-n count]\n");
+  printf("                  [-s length] [-k n] [-rt seconds] [-ra seconds] [-wr]\n");
+  printf("                  [-logon n] [-1] [-d]\n");
+  printf("   -p port         - listen on 'port' [%d]\n", kVT_PORT);
+  printf("   -b address      - listen on 'address' [%s]\n", DFLT_BIND_ADDRESS);
+  printf("   -w workload     - scroll, forms, prompt or all [scroll]\n");
+  printf("   -n count        - lines, screens or prompts per session\n");
+  printf("                     [1000, 10, 10]\n");
+  printf("   -s length       - length of each scrolled line [%d]\n",
+	 DFLT_LINE_LENGTH);
+  printf("   -k n            - ask for a response to every n'th write [%d]\n",
+	 DFLT_ACK_EVERY);
+  printf("   -rt seconds     - timeout to send with prompt reads [none]\n");
+  printf("   -ra seconds     - abort reads unanswered after 'seconds' [never]\n");
+  printf("   -wr             - send prompts and screens with their reads as\n");
+  printf("                     write-read requests\n");
+  printf("   -logon n        - start with HELLO and then n (0-3) passwords\n");
+  printf("   -1              - serve one session in the foreground and exit\n");
+  printf("   -d[d]           - trace records to stderr\n");
+
+} /*PrintUsage*/
+
+static void TraceRecord(char *dir, char *buf, int len)
+{ /*TraceRecord*/
+
+  tVTMHeader
+    *hdr = (tVTMHeader*)buf;
+  int
+    i;
+
+  fprintf(stderr, "%s type=%d prim=%d len=%d", dir,
+	  hdr->fMessageType, hdr->fPrimitive, len);
+  if (debug > 1)
+    {
+      fprintf(stderr, " ");
+      for (i = sizeof(tVTMHeader); (i < len) && (i < 32); i++)
+	fprintf(stderr, "%02x", (unsigned char)buf[i]);
+    }
+  fprintf(stderr, "\n");
+
+} /*TraceRecord*/
+
+/* Record I/O. Outgoing records are gathered in s->out and go out	*/
+/* with one send(); while a send is stalled, whatever the TM sends	*/
+/* back is read and handled so neither side can wedge the other.	*/
+
+static void HandleRecord(MOCK_SESSION *s, char *buf, int len);
+
+static int ReadInput(MOCK_SESSION *s)
+{ /*ReadInput*/
+
+  int
+    n,
+    off,
+    rec_len;
+
+  n = read(s->fd, s->in + s->in_len, sizeof(s->in) - s->in_len);
+  if (n == -1)
+    return(((errno == EAGAIN) || (errno == EINTR)) ? 0 : -1);
+  if (n == 0)
+    {
+      s->closed = true;
+      return(-1);
+    }
+  s->in_len += n;
+  s->bytes_in += n;
+
+  s->reading = true;
+  off = 0;
+  while (s->in_len - off >= (int)sizeof(tVTMHeader))
+    {
+      rec_len = ntohs(((tVTMHeader*)(s->in + off))->fMessageLength);
+      if (rec_len < (int)sizeof(tVTMHeader))
+	{
+	  fprintf(stderr, "vt3kmockam: bad record length %d\n", rec_len);
+	  s->closed = true;
+	  break;
+	}
+      if (s->in_len - off < rec_len)
+	break;
+      ++s->records_in;
+      HandleRecord(s, s->in + off, rec_len);
+      off += rec_len;
+    }
+  s->reading = false;
+  if (off)
+    {
+      memmove(s->in, s->in + off, s->in_len - off);
+      s->in_len -= off;
+    }
+  return((s->closed) ? -1 : 0);
+
+} /*ReadInput*/
+
+static int FlushOutput(MOCK_SESSION *s)
+{ /*FlushOutput*/
+
+  /* Handling input can queue replies, and so land back here; the	*/
+  /* progress kept in out_sent makes that safe.			*/
+
+  struct pollfd
+    pfd;
+  int
+    n;
+
+  while (s->out_sent < s->out_len)
+    {
+      n = send(s->fd, s->out + s->out_sent, s->out_len - s->out_sent, 0);
+      if (n > 0)
+	{
+	  s->out_sent += n;
+	  s->bytes_out += n;
+	  continue;
+	}
+      if ((n == -1) && (errno != EAGAIN) && (errno != EINTR))
+	{
+	  s->closed = true;
+	  return(-1);
+	}
+      pfd.fd = s->fd;
+      pfd.events = (s->reading) ? POLLOUT : (POLLIN | POLLOUT);
+      if (poll(&pfd, 1, -1) == -1)
+	continue;
+      if ((!s->reading) && (pfd.revents & (POLLIN | POLLHUP)) &&
+	  (ReadInput(s) == -1))
+	return(-1);
+    }
+  s->out_len = 0;
+  s->out_sent = 0;
+  return(0);
+
+} /*FlushOutput*/
+
+static int PutRecord(MOCK_SESSION *s, int type, int prim,
+		     void *body, int body_len)
+{ /*PutRecord*/
+
+  tVTMHeader
+    *hdr;
+  int
+    len = sizeof(tVTMHeader) + body_len;
+
+  if ((s->out_len + len > (int)sizeof(s->out)) && (FlushOutput(s) == -1))
+    return(-1);
+  hdr = (tVTMHeader*)(s->out + s->out_len);
+  hdr->fMessageLength = htons(len);
+  hdr->fProtocolID = kVTProtocolID;
+  hdr->fMessageType = type;
+  hdr->fUnused = 0;
+  hdr->fPrimitive = prim;
+  memcpy(s->out + s->out_len + sizeof(tVTMHeader), body, body_len);
+  if (debug)
+    TraceRecord("TX", s->out + s->out_len, len);
+  s->out_len += len;
+  ++s->records_out;
+  return(0);
+
+} /*PutRecord*/
+
+/* Builds a whole record in a local and hands PutRecord the part	*/
+/* after the header.							*/
+#define PUT_STRUCT(s, type, prim, rec, len) \
+  PutRecord((s), (type), (prim), ((char*)&(rec)) + sizeof(tVTMHeader), \
+	    (len) - sizeof(tVTMHeader))
+
+/* Sends what is queued, then waits up to timeout_ms (-1 forever) for	*/
+/* the TM and handles whatever it sent.					*/
+static int Pump(MOCK_SESSION *s, int timeout_ms)
+{ /*Pump*/
+
+  struct pollfd
+    pfd;
+  int
+    n;
+
+  if (FlushOutput(s) == -1)
+    return(-1);
+  pfd.fd = s->fd;
+  pfd.events = POLLIN;
+  n = poll(&pfd, 1, timeout_ms);
+  if (n == -1)
+    return((errno == EINTR) ? 0 : -1);
+  if (n == 0)
+    return(0);
+  return(ReadInput(s));
+
+} /*Pump*/
+
+/* Pumps until *flag is set, the TM goes away or timeout_ms passes	*/
+static int WaitFor(MOCK_SESSION *s, bool *flag, int timeout_ms)
+{ /*WaitFor*/
+
+  int64_t
+    end = MyMonotonicUsec() + (int64_t)timeout_ms * 1000;
+  int
+    left;
+
+  while (!*flag)
+    {
+      left = (int)((end - MyMonotonicUsec()) / 1000);
+      if (left <= 0)
+	return(-1);
+      if ((Pump(s, left) == -1) || (s->closed))
+	return(-1);
+    }
+  return(0);
+
+} /*WaitFor*/
+
+static int WaitForWrites(MOCK_SESSION *s)
+{ /*WaitForWrites*/
+
+  int64_t
+    end = MyMonotonicUsec() + (int64_t)MOCK_REPLY_WAIT_MS * 1000;
+
+  while ((s->pending_writes > 0) || (s->pending_controls > 0))
+    {
+      if ((MyMonotonicUsec() >= end) ||
+	  (Pump(s, 100) == -1) || (s->closed))
+	return(-1);
+    }
+  return(0);
+
+} /*WaitForWrites*/
+
+/* Requests from the AM side */
+
+/* Request counts wrap, but 0 means "none outstanding" */
+static uint16_t NextRequest(MOCK_SESSION *s)
+{ /*NextRequest*/
+
+  if (!++s->req_count)
+    ++s->req_count;
+  return(s->req_count);
+
+} /*NextRequest*/
+
+static int SendAMNegotiation(MOCK_SESSION *s)
+{ /*SendAMNegotiation*/
+
+  char
+    buf[sizeof(tVTMAMNegotiationRequest) + sizeof(tVTMAMBreakInfo) +
+	sizeof(LINE_DELETE_ECHO)];
+  tVTMAMNegotiationRequest
+    *req = (tVTMAMNegotiationRequest*)buf;
+  tVTMAMBreakInfo
+    *brk;
+  int
+    off = offsetof(tVTMAMNegotiationRequest, fVariable);
+
+  memset(buf, 0, sizeof(buf));
+  req->fRequestCount = htons(NextRequest(s));
+  req->fVersionMask[0] = (char)0xd0;
+  req->fBufferSize = htons(MOCK_BUFFER_SIZE);
+  req->fEcho = 1;
+  req->fEchoControl = kAMEchoSwitchOK;
+  req->fCharacterDelete = ASC_BS;
+  req->fCharacterDeleteEcho = kAMEchoBsSpBs;
+  req->fLineDeleteCharacter = 0x18;	/* ^X */
+  req->fTypeAheadSize = htons(kVT_MAX_BUFFER);
+
+  req->fBreakOffset = htons(off);
+  req->fBreakIndexCount = htons(2);
+  brk = (tVTMAMBreakInfo*)(buf + off);
+  brk->fSysBreakEnabled = htons(1);
+  brk->fSubsysBreakEnabled = htons(1);
+  brk->fSysBreakChar = htons(-1);
+  brk->fSubsysBreakChar = htons(0x19);	/* ^Y */
+  off += sizeof(tVTMAMBreakInfo);
+
+  req->fLineDeleteOffset = htons(off);
+  req->fLineDeleteLength = htons(strlen(LINE_DELETE_ECHO));
+  memcpy(buf + off, LINE_DELETE_ECHO, strlen(LINE_DELETE_ECHO));
+  off += strlen(LINE_DELETE_ECHO);
+
+  req->fAMMaxReceiveBurst = htons(1);
+  req->fAMMaxSendBurst = htons(1);
+
+  return(PUT_STRUCT(s, kvmtEnvCntlReq, kvtpAMNegotiate, *req, off));
+
+} /*SendAMNegotiation*/
+
+/* cctl is the carriage control byte, or -1 to send the data as is */
+static int SendWrite(MOCK_SESSION *s, uint16_t flags, int cctl,
+		     char *data, int len)
+{ /*SendWrite*/
+
+  char
+    buf[sizeof(tVTMIORequest) + MOCK_BUFFER_SIZE];
+  tVTMIORequest
+    *req = (tVTMIORequest*)buf;
+  char
+    *ptr = req->fWriteData;
+
+  if (len > MOCK_BUFFER_SIZE - 1)
+    len = MOCK_BUFFER_SIZE - 1;
+  memset(buf, 0, offsetof(tVTMIORequest, fWriteData));
+  if (cctl != -1)
+    {
+      flags |= kVTIOWUseCCTL;
+      *(ptr++) = (char)cctl;
+    }
+  memcpy(ptr, data, len);
+  ptr += len;
+  req->fRequestCount = htons(NextRequest(s));
+  req->fWriteFlags = htons(flags);
+  req->fWriteByteCount = htons(ptr - req->fWriteData);
+  if (flags & kVTIOWNeedsResponse)
+    ++s->pending_writes;
+  return(PUT_STRUCT(s, kvmtTerminalIOReq, kVTIOWrite, *req,
+		    ptr - buf));
+
+} /*SendWrite*/
+
+/* With a prompt, the read goes out as a write-read carrying it */
+static int SendRead(MOCK_SESSION *s, uint16_t flags, int len, int timeout,
+		    uint16_t wflags, char *prompt, int prompt_len)
+{ /*SendRead*/
+
+  char
+    buf[sizeof(tVTMIORequest) + MOCK_BUFFER_SIZE];
+  tVTMIORequest
+    *req = (tVTMIORequest*)buf;
+  char
+    *ptr = req->fWriteData;
+
+  memset(buf, 0, offsetof(tVTMIORequest, fWriteData));
+  req->fRequestCount = htons(NextRequest(s));
+  req->fReadFlags = htons(flags);
+  req->fReadByteCount = htons(len);
+  req->fTimeout = htons(timeout);
+  if (prompt)
+    {
+      if (prompt_len > MOCK_BUFFER_SIZE - 1)
+	prompt_len = MOCK_BUFFER_SIZE - 1;
+      *(ptr++) = (char)0320;
+      memcpy(ptr, prompt, prompt_len);
+      ptr += prompt_len;
+      req->fWriteFlags = htons((wflags & ~kVTIOWNeedsResponse) |
+			       kVTIOWUseCCTL);
+      req->fWriteByteCount = htons(ptr - req->fWriteData);
+    }
+  s->read_count = s->req_count;
+  s->read_done = false;
+  s->read_len = 0;
+  s->read_completion = 0;
+  return(PUT_STRUCT(s, kvmtTerminalIOReq,
+		    (prompt) ? kVTIOWriteRead : kVTIORead, *req,
+		    ptr - buf));
+
+} /*SendRead*/
+
+static int SendAbort(MOCK_SESSION *s)
+{ /*SendAbort*/
+
+  tVTMAbortIORequest
+    req;
+
+  /* The read being aborted is named in the mask word */
+
+  req.fRequestCount = htons(NextRequest(s));
+  req.fRequestMask = htons(s->read_count);
+  s->abort_count = s->req_count;
+  return(PUT_STRUCT(s, kvmtTerminalIOReq, kVTIOAbort, req, sizeof(req)));
+
+} /*SendAbort*/
+
+static int SendDriverControl(MOCK_SESSION *s, uint16_t mask, int echo,
+			     int driver_mode, int term_char)
+{ /*SendDriverControl*/
+
+  tVTMTerminalDriverControlRequest
+    req;
+
+  memset(&req, 0, sizeof(req));
+  req.fRequestCount = htons(NextRequest(s));
+  req.fRequestMask = htons(mask);
+  req.fEcho = echo;
+  req.fDriverMode = driver_mode;
+  req.fLineTermCharacter = term_char;
+  ++s->pending_controls;
+  return(PUT_STRUCT(s, kvmtTerminalCntlReq, kvtpSetDriverInfo, req,
+		    sizeof(req)));
+
+} /*SendDriverControl*/
+
+static int SendLogonInfo(MOCK_SESSION *s, char *logon, int len)
+{ /*SendLogonInfo*/
+
+  char
+    buf[sizeof(tVTMLogonInfo) + kVT_MAX_BUFFER];
+  tVTMLogonInfo
+    *req = (tVTMLogonInfo*)buf;
+
+  if (len > kVT_MAX_BUFFER)
+    len = kVT_MAX_BUFFER;
+  memset(buf, 0, offsetof(tVTMLogonInfo, fLogonString));
+  req->fRequestCount = htons(NextRequest(s));
+  memcpy(req->fSessionID, MOCK_SESSION_ID, sizeof(req->fSessionID));
+  req->fLogonLength = htons(len);
+  memcpy(req->fLogonString, logon, len);
+  return(PUT_STRUCT(s, kvmtEnvCntlReq, kvtpLogonInfo, *req,
+		    offsetof(tVTMLogonInfo, fLogonString) + len));
+
+} /*SendLogonInfo*/
+
+static int SendTermination(MOCK_SESSION *s)
+{ /*SendTermination*/
+
+  tVTMTerminationRequest
+    req;
+
+  memset(&req, 0, sizeof(req));
+  req.fRequestCount = htons(NextRequest(s));
+  req.fTerminationType = kVTTerminationAgreed;
+  req.fTerminationReason = htons(kVTTerminateNormal);
+  return(PUT_STRUCT(s, kvmtEnvCntlReq, kvtpTerminate, req, sizeof(req)));
+
+} /*SendTermination*/
+
+/* Traffic from the TM */
+
+static void HandleRecord(MOCK_SESSION *s, char *buf, int len)
+{ /*HandleRecord*/
+
+  tVTMHeader
+    *hdr = (tVTMHeader*)buf;
+  tVTMTerminalIOResponse
+    *ioresp = (tVTMTerminalIOResponse*)buf;
+  tVTMTMNegotiationRequest
+    *tmreq = (tVTMTMNegotiationRequest*)buf;
+  tVTMTMNegotiationReply
+    tmresp;
+  tVTMTerminationRequest
+    *termreq = (tVTMTerminationRequest*)buf;
+  tVTMTerminationResponse
+    termresp;
+  tVTMApplCntlReq
+    *applreq = (tVTMApplCntlReq*)buf;
+  tVTMApplCntlResp
+    applresp;
+  int
+    n;
+
+  if (debug)
+    TraceRecord("RX", buf, len);
+
+  switch (hdr->fMessageType)
+    {
+    case kvmtEnvCntlReq:
+      if (hdr->fPrimitive == kvtpTMNegotiate)
+	{
+	  memset(&tmresp, 0, sizeof(tmresp));
+	  tmresp.fRequestCount = tmreq->fRequestCount;
+	  tmresp.fResponseCode = htons(kTMNRSuccessful);
+	  tmresp.fTerminalClass = htons(kVTDefaultTerminalClass);
+	  PUT_STRUCT(s, kvmtEnvCntlResp, kvtpTMNegotiate, tmresp,
+		     sizeof(tmresp));
+	  s->tm_requested = true;
+	}
+      else if (hdr->fPrimitive == kvtpTerminate)
+	{
+	  /* The user closed the session from the terminal end */
+	  memset(&termresp, 0, sizeof(termresp));
+	  termresp.fRequestCount = termreq->fRequestCount;
+	  PUT_STRUCT(s, kvmtEnvCntlResp, kvtpTerminate, termresp,
+		     sizeof(termresp));
+	  s->terminated = true;
+	}
+      break;
+
+    case kvmtEnvCntlResp:
+      if (hdr->fPrimitive == kvtpAMNegotiate)
+	s->am_replied = true;
+      else if (hdr->fPrimitive == kvtpLogonInfo)
+	s->logon_acked = true;
+      else if (hdr->fPrimitive == kvtpTerminate)
+	s->terminated = true;
+      break;
+
+    case kvmtTerminalIOResp:
+      switch (hdr->fPrimitive)
+	{
+	case kVTIOWrite:
+	  if (s->pending_writes > 0)
+	    --s->pending_writes;
+	  break;
+	case kVTIORead:
+	case kVTIOWriteRead:
+	  /* Answers to reads we already gave up on are dropped */
+	  if ((!s->read_count) ||
+	      (ntohs(ioresp->fRequestCount) != s->read_count))
+	    break;
+	  n = ntohs(ioresp->fBytesRead);
+	  if (n > len - (int)offsetof(tVTMTerminalIOResponse, fBytes))
+	    n = len - (int)offsetof(tVTMTerminalIOResponse, fBytes);
+	  if (n > (int)sizeof(s->read_data))
+	    n = sizeof(s->read_data);
+	  if (n > 0)
+	    memcpy(s->read_data, ioresp->fBytes, n);
+	  s->read_len = (n > 0) ? n : 0;
+	  s->read_completion = ntohs(ioresp->fCompletionMask);
+	  s->read_count = 0;
+	  s->read_done = true;
+	  break;
+	case kVTIOAbort:
+	  s->abort_count = 0;
+	  break;
+	}
+      break;
+
+    case kvmtTerminalCntlResp:
+      if ((hdr->fPrimitive == kvtpSetDriverInfo) && (s->pending_controls > 0))
+	--s->pending_controls;
+      break;
+
+    case kvmtApplicationCntlReq:
+      /* A break. Acknowledge it; there is nothing here to interrupt. */
+      memset(&applresp, 0, sizeof(applresp));
+      applresp.fRequestCount = applreq->fRequestCount;
+      applresp.fApplIndex = applreq->fApplIndex;
+      PUT_STRUCT(s, kvmtApplicationCntlResp, hdr->fPrimitive, applresp,
+		 sizeof(applresp));
+      break;
+
+    default:
+      break;
+    }
+
+} /*HandleRecord*/
+
+/* Writes the prompt (if any) and issues a read, then waits for it,	*/
+/* aborting it after abort_after seconds if asked to. With -wr the	*/
+/* prompt and read are a single write-read. Returns -1 if the		*/
+/* session went away.							*/
+static int DoRead(MOCK_SESSION *s, uint16_t wflags, char *prompt,
+		  int prompt_len, uint16_t flags, int len, int timeout)
+{ /*DoRead*/
+
+  if (write_read)
+    {
+      if (SendRead(s, flags, len, timeout, wflags, prompt, prompt_len) == -1)
+	return(-1);
+    }
+  else if (((prompt) &&
+	    (SendWrite(s, wflags, 0320, prompt, prompt_len) == -1)) ||
+	   (SendRead(s, flags, len, timeout, 0, NULL, 0) == -1))
+    return(-1);
+  if (abort_after)
+    {
+      if (WaitFor(s, &s->read_done, abort_after * 1000) == 0)
+	return(0);
+      if ((s->closed) || (SendAbort(s) == -1))
+	return(-1);
+      s->read_count = 0;
+      s->read_completion = kVTIOCAborted;
+      while (s->abort_count)
+	if ((Pump(s, -1) == -1) || (s->closed))
+	  return(-1);
+      return(0);
+    }
+  while (!s->read_done)
+    if ((Pump(s, -1) == -1) || (s->closed) || (s->terminated))
+      return(-1);
+  return(0);
+
+} /*DoRead*/
+
+/* Workloads */
+
+static int RunScroll(MOCK_SESSION *s, int lines)
+{ /*RunScroll*/
+
+  char
+    line[MOCK_BUFFER_SIZE];
+  int
+    i,
+    j,
+    len;
+  uint16_t
+    flags;
+
+  if (line_length > MOCK_BUFFER_SIZE - 3)
+    line_length = MOCK_BUFFER_SIZE - 3;
+  for (i = 0; (i < lines) && (!s->terminated); i++)
+    {
+      len = snprintf(line, sizeof(line), "%06d ", i);
+      for (j = len; j < line_length; j++)
+	line[j] = ' ' + ((i + j) % 95);
+      len = (line_length > len) ? line_length : len;
+      flags = ((ack_every) && ((i % ack_every) == ack_every - 1))
+	? kVTIOWNeedsResponse : 0;
+      /* Every third line carries its own CR/LF instead of CCTL */
+      if ((i % 3) == 2)
+	{
+	  line[len++] = '\r';
+	  line[len++] = '\n';
+	  if (SendWrite(s, flags, -1, line, len) == -1)
+	    return(-1);
+	}
+      else if (SendWrite(s, flags, ' ', line, len) == -1)
+	return(-1);
+    }
+  return(WaitForWrites(s));
+
+} /*RunScroll*/
+
+static int RunForms(MOCK_SESSION *s, int screens)
+{ /*RunForms*/
+
+  char
+    form[MOCK_BUFFER_SIZE],
+    *ptr;
+  int
+    i,
+    f;
+
+  if ((SendDriverControl(s, kTDCMEcho | kTDCMDriverMode | kTDCMTermChar,
+			 kDTCEchoOffAll, kDTCBlockMode, ASC_RS) == -1) ||
+      (WaitForWrites(s) == -1))
+    return(-1);
+
+  for (i = 0; (i < screens) && (!s->terminated); i++)
+    {
+      /* Clear, lay out labels and unprotected fields, format mode on */
+      ptr = form;
+      ptr += sprintf(ptr, "\033X\033H\033J\033&a0r30CSCREEN %d", i + 1);
+      for (f = 0; f < FORM_FIELDS; f++)
+	{
+	  ptr += sprintf(ptr, "\033&a%dr2CFIELD%d:\033&a%dr12C\033&dD\033[",
+			 2 + 2 * f, f + 1, 2 + 2 * f);
+	  memset(ptr, ' ', FORM_FIELD_WIDTH);
+	  ptr += FORM_FIELD_WIDTH;
+	  ptr += sprintf(ptr, "\033]\033&d@");
+	}
+      ptr += sprintf(ptr, "\033W\033h");
+      if (DoRead(s, kVTIOWNeedsResponse, form, ptr - form,
+		 0, FORM_FIELDS * (FORM_FIELD_WIDTH + 4), read_timeout) == -1)
+	return(-1);
+    }
+
+  /* Format mode off and back to character mode */
+  if ((SendWrite(s, 0, 0320, "\033X\033H\033J", 6) == -1) ||
+      (SendDriverControl(s, kTDCMEcho | kTDCMDriverMode | kTDCMTermChar,
+			 kDTCEchoOnAll, kDTCVanilla, 0) == -1))
+    return(-1);
+  return(WaitForWrites(s));
+
+} /*RunForms*/
+
+static int RunPrompt(MOCK_SESSION *s, int prompts)
+{ /*RunPrompt*/
+
+  char
+    line[kVT_MAX_BUFFER + 64],
+    *what;
+  int
+    i,
+    len;
+
+  for (i = 0; (i < prompts) && (!s->terminated); i++)
+    {
+      if (DoRead(s, kVTIOWPrompt, ":", 1, 0, 80, read_timeout) == -1)
+	return(-1);
+      if (s->read_completion & kVTIOCAborted)
+	what = "ABORTED";
+      else if (s->read_completion & kVTIOCTimeout)
+	what = "TIMEOUT";
+      else
+	what = "READ";
+      len = snprintf(line, sizeof(line), "%s %d: %.*s", what, s->read_len,
+		     s->read_len, s->read_data);
+      if (len >= (int)sizeof(line))
+	len = sizeof(line) - 1;
+      if (SendWrite(s, 0, ' ', line, len) == -1)
+	return(-1);
+      if ((s->read_len == 3) && (!strncasecmp(s->read_data, "BYE", 3)))
+	break;
+    }
+  return(WaitForWrites(s));
+
+} /*RunPrompt*/
+
+/* HELLO at the colon prompt, then the passwords with echo off, then	*/
+/* the logon info request MPE sends once the session is logged on.	*/
+static int RunLogon(MOCK_SESSION *s)
+{ /*RunLogon*/
+
+  static char
+    *password_prompts[] = { "ENTER USER PASSWORD:",
+			    "ENTER ACCOUNT PASSWORD:",
+			    "ENTER GROUP PASSWORD:" };
+  char
+    logon[kVT_MAX_BUFFER];
+  int
+    logon_len = 0,
+    tries,
+    i;
+
+  for (tries = 0; ; tries++)
+    {
+      if (tries == MOCK_LOGON_TRIES)
+	return(-1);
+      if (DoRead(s, kVTIOWPrompt, ":", 1, 0, 80, read_timeout) == -1)
+	return(-1);
+      if ((s->read_len > 6) && (!strncasecmp(s->read_data, "HELLO ", 6)))
+	break;
+      if (SendWrite(s, 0, ' ', "EXPECTED [:]HELLO COMMAND. (CIERR 1402)",
+		    39) == -1)
+	return(-1);
+    }
+  logon_len = s->read_len - 6;
+  memcpy(logon, s->read_data + 6, logon_len);
+
+  for (i = 0; (i < logon_passwords) && (i < 3); i++)
+    {
+      if ((SendDriverControl(s, kTDCMEcho, kDTCEchoOffAll, 0, 0) == -1) ||
+	  (DoRead(s, kVTIOWPrompt, password_prompts[i],
+		  strlen(password_prompts[i]), 0, 8, read_timeout) == -1) ||
+	  (SendDriverControl(s, kTDCMEcho, kDTCEchoOnAll, 0, 0) == -1))
+	return(-1);
+    }
+
+  if ((SendLogonInfo(s, logon, logon_len) == -1) ||
+      (WaitFor(s, &s->logon_acked, MOCK_REPLY_WAIT_MS) == -1) ||
+      (SendWrite(s, 0, ' ', "HP3000  Release: C.75.00  User Version: "
+		 "C.75.00", 47) == -1))
+    return(-1);
+  return(WaitForWrites(s));
+
+} /*RunLogon*/
+
+static int RunWorkload(MOCK_SESSION *s, MOCK_WORKLOAD which)
+{ /*RunWorkload*/
+
+  switch (which)
+    {
+    case kWorkScroll:
+      return(RunScroll(s, (count) ? count : 1000));
+    case kWorkForms:
+      return(RunForms(s, (count) ? count : 10));
+    case kWorkPrompt:
+      return(RunPrompt(s, (count) ? count : 10));
+    case kWorkAll:
+      if ((RunWorkload(s, kWorkScroll) == -1) ||
+	  (RunWorkload(s, kWorkForms) == -1))
+	return(-1);
+      return(RunWorkload(s, kWorkPrompt));
+    }
+  return(-1);
+
+} /*RunWorkload*/
+
+static void ServeSession(int fd, struct sockaddr_in *peer)
+{ /*ServeSession*/
+
+  MOCK_SESSION
+    *s;
+  int64_t
+    start,
+    open_at = 0;
+  int
+    flags,
+    one = 1,
+    status = 0;
+  double
+    secs;
+
+  if ((s = (MOCK_SESSION*)calloc(1, sizeof(MOCK_SESSION))) == NULL)
+    {
+      perror("calloc");
+      close(fd);
+      return;
+    }
+  s->fd = fd;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char*)&one, sizeof(one));
+  if ((flags = fcntl(fd, F_GETFL, 0)) != -1)
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  start = MyMonotonicUsec();
+
+  if ((SendAMNegotiation(s) == -1) ||
+      (WaitFor(s, &s->tm_requested, MOCK_REPLY_WAIT_MS) == -1))
+    {
+      fprintf(stderr, "vt3kmockam: %s: negotiation failed\n",
+	      inet_ntoa(peer->sin_addr));
+      status = -1;
+    }
+  else
+    {
+      open_at = MyMonotonicUsec();
+      status = ((logon_passwords >= 0) && (RunLogon(s) == -1))
+	? -1 : RunWorkload(s, workload);
+      if ((!s->closed) && (!s->terminated))
+	{
+	  SendTermination(s);
+	  WaitFor(s, &s->terminated, MOCK_REPLY_WAIT_MS);
+	}
+      FlushOutput(s);
+    }
+
+  secs = (double)(MyMonotonicUsec() - ((open_at) ? open_at : start)) / 1e6;
+  fprintf(stderr, "vt3kmockam: %s: %s, %lld records/%lld bytes out,"
+	  " %lld records/%lld bytes in, %.3f s",
+	  inet_ntoa(peer->sin_addr),
+	  (status == -1) ? "failed" : "done",
+	  s->records_out, s->bytes_out, s->records_in, s->bytes_in, secs);
+  if (secs > 0)
+    fprintf(stderr, ", %.0f bytes/s", (double)s->bytes_out / secs);
+  fprintf(stderr, "\n");
+
+  close(fd);
+  free(s);
+
+} /*ServeSession*/
+
+int main(int argc, char *argv[])
+{ /*main*/
+
+  char
+    *bind_address = DFLT_BIND_ADDRESS,
+    *ptr;
+  int
+    port = kVT_PORT,
+    listen_fd,
+    fd,
+    one = 1,
+    i;
+  bool
+    single = false;
+  struct sockaddr_in
+    addr,
+    peer;
+  socklen_t
+    peer_len;
+
+  while ((--argc) && ((*(++argv))[0] == '-'))
+    {
+      if (!strcmp(*argv, "-p") && (argc > 1))
+	{
+	  --argc;
+	  port = atoi(*(++argv));
+	}
+      else if (!strcmp(*argv, "-b") && (argc > 1))
+	{
+	  --argc;
+	  bind_address = *(++argv);
+	}
+      else if (!strcmp(*argv, "-w") && (argc > 1))
+	{
+	  --argc;
+	  ++argv;
+	  for (i = 0; workload_names[i]; i++)
+	    if (!strcmp(*argv, workload_names[i]))
+	      break;
+	  if (!workload_names[i])
+	    {
+	      PrintUsage();
+	      return(2);
+	    }
+	  workload = (MOCK_WORKLOAD)i;
+	}
+      else if (!strcmp(*argv, "-n") && (argc > 1))
+	{
+	  --argc;
+	  count = atoi(*(++argv));
+	}
+      else if (!strcmp(*argv, "-s") && (argc > 1))
+	{
+	  --argc;
+	  line_length = atoi(*(++argv));
+	}
+      else if (!strcmp(*argv, "-k") && (argc > 1))
+	{
+	  --argc;
+	  ack_every = atoi(*(++argv));
+	}
+      else if (!strcmp(*argv, "-rt") && (argc > 1))
+	{
+	  --argc;
+	  read_timeout = atoi(*(++argv));
+	}
+      else if (!strcmp(*argv, "-ra") && (argc > 1))
+	{
+	  --argc;
+	  abort_after = atoi(*(++argv));
+	}
+      else if (!strcmp(*argv, "-logon") && (argc > 1))
+	{
+	  --argc;
+	  logon_passwords = atoi(*(++argv));
+	}
+      else if (!strcmp(*argv, "-wr"))
+	write_read = true;
+      else if (!strcmp(*argv, "-1"))
+	single = true;
+      else if (!strncmp(*argv, "-d", 2))
+	{
+	  ptr = *argv;
+	  while (*(++ptr) == 'd')
+	    ++debug;
+	}
+      else
+	{
+	  PrintUsage();
+	  return(2);
+	}
+    }
+  if (argc > 0)
+    {
+      PrintUsage();
+      return(2);
+    }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_aton(bind_address, &addr.sin_addr) == 0)
+    {
+      fprintf(stderr, "vt3kmockam: bad address %s\n", bind_address);
+      return(2);
+    }
+  if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    {
+      perror("socket");
+      return(1);
+    }
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, (char*)&one, sizeof(one));
+  if ((bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) ||
+      (listen(listen_fd, 64) == -1))
+    {
+      perror("bind");
+      return(1);
+    }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGCHLD, SIG_IGN);	/* No zombies */
+
+  for (;;)
+    {
+      peer_len = sizeof(peer);
+      if ((fd = accept(listen_fd, (struct sockaddr*)&peer, &peer_len)) == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  perror("accept");
+	  return(1);
+	}
+      if (single)
+	{
+	  close(listen_fd);
+	  ServeSession(fd, &peer);
+	  return(0);
+	}
+      switch (fork())
+	{
+	case -1:
+	  perror("fork");
+	  close(fd);
+	  break;
+	case 0:
+	  close(listen_fd);
+	  ServeSession(fd, &peer);
+	  _exit(0);
+	default:
+	  close(fd);
+	  break;
+	}
+    }
+
+} /*main*/
@@ -0,0 +1,1272 @@
+/* Copyright (C) 1996 Office Products Technology, Inc.
+
+This file is part of FreeVT3k.
+
+FreeVT3k is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+FreeVT3k is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License along
+with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/************************************************************
+ * vt3kmuxd.c -- many NS/VT sessions behind one epoll loop
+ *
+ * Sessions stay open in the daemon; local clients attach to
+ *   them over a Unix domain socket. A client starts in
+ *   command mode and sends one line:
+ *
+ *	OPEN host [port]	- new session, attach to it once
+ *				  connected
+ *	ATTACH id		- attach to an open session
+ *	LIST			- one line per session, then "."
+ *	CLOSE id		- drop a session
+ *
+ *   OPEN and ATTACH answer "OK id" and from then on the socket
+ *   is a raw byte stream: keystrokes in, host output back.
+ *   Closing the client detaches it and leaves the session
+ *   open for the next one. Errors come back as "ERR text".
+ *
+ *   Only the user running the daemon may connect.
+ ************************************************************/
+
+#include "config.h"
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "vt.h"
+#include "freevt3k.h"
+#include "vtcommon.h"
+#include "hpterm.h"
+#include "vtconn.h"
+#include "logging.h"
+#include "timers.h"
+
+#define SOCKET_NAME		"vt3kmuxd.sock"
+#define MAX_EVENTS		(256)
+#define MAX_CMD_LINE		(256)
+#define MAX_CLIENT_BACKLOG	(256 * 1024)	/* Drop slower clients */
+
+/* Every epoll registration points at one of these */
+typedef enum
+{
+  kMuxListener,
+  kMuxResolver,			/* A name lookup has finished */
+  kMuxSession,
+  kMuxClient
+} MUX_KIND;
+
+typedef struct stMuxHandle
+{
+  MUX_KIND
+    kind;
+  bool
+    dead;			/* Freed once the event batch is done */
+  struct stMuxHandle
+    *next_dead;
+} MUX_HANDLE;
+
+typedef struct stMuxClient MUX_CLIENT;
+typedef struct stMuxSession MUX_SESSION;
+
+/*
+ * Sessions waiting on something are kept on lists, so a wakeup only
+ *   looks at the ones that are due. Deadline lists are in due order,
+ *   soonest first, like evloop.c's timers; a new entry is placed from
+ *   the tail, since deadlines mostly come in the order they're set.
+ */
+typedef struct stMuxLink
+{
+  struct stMuxLink
+    *prev,
+    *next;
+  MUX_SESSION
+    *session;
+  int64_t
+    due;			/* MyMonotonicUsec(); 0 if not ordered */
+  bool
+    linked;
+} MUX_LINK;
+
+typedef struct
+{
+  MUX_LINK
+    *head,
+    *tail;
+} MUX_LIST;
+
+struct stMuxSession
+{
+  MUX_HANDLE
+    h;				/* Must be first */
+  int
+    id;
+  char
+    host[64];
+  tVTConnection
+    conn;
+  MUX_CLIENT
+    *client;			/* Attached client, if any */
+  bool
+    connecting,			/* VTConnectStep() not done yet */
+    want_out;			/* EPOLLOUT armed */
+  MUX_LINK
+    connect_link,		/* On connect_list; gives up when due */
+    resolve_link,		/* On resolve_list */
+    read_link;			/* On read_list; times the read out */
+};
+
+struct stMuxClient
+{
+  MUX_HANDLE
+    h;				/* Must be first */
+  int
+    fd;
+  MUX_SESSION
+    *session;			/* NULL while in command mode */
+  char
+    cmd[MAX_CMD_LINE];
+  int
+    cmd_len;
+  char
+    *out;			/* Output the socket wasn't ready for */
+  int
+    out_len,
+    out_size;
+  bool
+    want_out;			/* EPOLLOUT armed */
+};
+
+/* Global variables */
+
+int
+	epoll_fd = -1,
+	resolver_fd = -1;
+MUX_HANDLE
+	listener = { kMuxListener },
+	resolver = { kMuxResolver };
+MUX_SESSION
+	**sessions = NULL;	/* Indexed by session id */
+int
+	max_sessions = 0,
+	open_sessions = 0,
+	connect_timeout = kVT_CONNECT_TIMEOUT;
+bool
+	stop_now = false;
+MUX_HANDLE
+	*dead_list = NULL;
+MUX_LIST
+	connect_list = { NULL, NULL },	/* Connects with a deadline */
+	resolve_list = { NULL, NULL },	/* Names still being looked up */
+	read_list = { NULL, NULL };	/* Reads with a timeout */
+
+static void PrintUsage(void)
+{ /*PrintUsage*/
+
+  printf("vt3kmuxd - version %s\n\n", VERSION_ID);
+  printf("Usage: vt3kmuxd [-s path] [-ct seconds] [-li|-lo|-lio] [-f file] [-d[d]]\n");
+  printf("   -s path         - listen on Unix socket 'path'\n");
+  printf("                     [$XDG_RUNTIME_DIR/%s, or /tmp/vt3kmuxd-uid/%s]\n",
+	 SOCKET_NAME, SOCKET_NAME);
+  printf("   -ct seconds     - give up connecting after 'seconds' [%d]\n",
+	 kVT_CONNECT_TIMEOUT / 1000);
+  printf("   -li|-lo|-lio    - specify input|output logging options\n");
+  printf("   -f file         - destination for logging [stdout]\n");
+  printf("   -d[d]           - enable debug output to freevt3k.debug\n");
+
+} /*PrintUsage*/
+
+static void CatchTerm(int sig)
+{ /*CatchTerm*/
+
+  stop_now = true;
+
+} /*CatchTerm*/
+
+static int SetNonBlocking(int fd)
+{ /*SetNonBlocking*/
+
+  int
+    flags;
+
+  if ((flags = fcntl(fd, F_GETFL, 0)) == -1)
+    return(-1);
+  return(fcntl(fd, F_SETFL, flags | O_NONBLOCK));
+
+} /*SetNonBlocking*/
+
+/* 'due' of 0 just puts it at the end */
+static void ListAdd(MUX_LIST *list, MUX_LINK *link, int64_t due)
+{ /*ListAdd*/
+
+  MUX_LINK
+    *after;
+
+  link->due = due;
+  for (after = list->tail; (after) && (after->due > due); after = after->prev)
+    ;
+  link->prev = after;
+  link->next = (after) ? after->next : list->head;
+  if (link->next)
+    link->next->prev = link;
+  else
+    list->tail = link;
+  if (after)
+    after->next = link;
+  else
+    list->head = link;
+  link->linked = true;
+
+} /*ListAdd*/
+
+static void ListRemove(MUX_LIST *list, MUX_LINK *link)
+{ /*ListRemove*/
+
+  if (!link->linked)
+    return;
+  if (link->prev)
+    link->prev->next = link->next;
+  else
+    list->head = link->next;
+  if (link->next)
+    link->next->prev = link->prev;
+  else
+    list->tail = link->prev;
+  link->prev = link->next = NULL;
+  link->linked = false;
+
+} /*ListRemove*/
+
+/* Milliseconds until the head of 'list' is due, rounded up; -1 if empty */
+static int ListWaitMs(MUX_LIST *list)
+{ /*ListWaitMs*/
+
+  int64_t
+    left;
+
+  if (list->head == NULL)
+    return(-1);
+  left = (list->head->due - MyMonotonicUsec() + 999) / 1000;
+  if (left < 0)
+    left = 0;
+  if (left > 0x7fffffff)
+    left = 0x7fffffff;
+  return((int)left);
+
+} /*ListWaitMs*/
+
+static void ArmClientOutput(MUX_CLIENT *client, bool want)
+{ /*ArmClientOutput*/
+
+  struct epoll_event
+    ev;
+
+  if (client->want_out == want)
+    return;
+  ev.events = EPOLLIN | ((want) ? EPOLLOUT : 0);
+  ev.data.ptr = client;
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &ev);
+  client->want_out = want;
+
+} /*ArmClientOutput*/
+
+/*
+ * Other events from the same epoll_wait() may still point at a
+ *   handle we are finished with, so it is only marked here and
+ *   freed by ReapHandles() at the end of the batch.
+ */
+static void Bury(MUX_HANDLE *h)
+{ /*Bury*/
+
+  h->dead = true;
+  h->next_dead = dead_list;
+  dead_list = h;
+
+} /*Bury*/
+
+static void ReapHandles(void)
+{ /*ReapHandles*/
+
+  MUX_HANDLE
+    *h;
+
+  while ((h = dead_list) != NULL)
+    {
+      dead_list = h->next_dead;
+      if (h->kind == kMuxClient)
+	free(((MUX_CLIENT*)h)->out);
+      free(h);
+    }
+
+} /*ReapHandles*/
+
+static void DropClient(MUX_CLIENT *client)
+{ /*DropClient*/
+
+  if (client->h.dead)
+    return;
+  if (client->session)
+    client->session->client = NULL;
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+  close(client->fd);
+  Bury(&client->h);
+
+} /*DropClient*/
+
+/*
+ * Send to a client without ever blocking the loop. Whatever the
+ *   socket won't take now is kept and sent on EPOLLOUT; a client
+ *   that falls too far behind is cut loose.
+ */
+static int ClientWrite(MUX_CLIENT *client, const char *buf, int len)
+{ /*ClientWrite*/
+
+  ssize_t
+    sent = 0;
+
+  if (!client->out_len)
+    {
+      sent = send(client->fd, buf, len, MSG_NOSIGNAL);
+      if (sent == -1)
+	{
+	  if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+	    return(-1);
+	  sent = 0;
+	}
+      if (sent == len)
+	return(0);
+    }
+  buf += sent;
+  len -= sent;
+  if (client->out_len + len > client->out_size)
+    {
+      int
+	new_size = client->out_size ? client->out_size : 4096;
+      char
+	*new_out;
+      while (new_size < client->out_len + len)
+	new_size *= 2;
+      if (new_size > MAX_CLIENT_BACKLOG)
+	return(-1);
+      if ((new_out = (char*)realloc(client->out, new_size)) == NULL)
+	return(-1);
+      client->out = new_out;
+      client->out_size = new_size;
+    }
+  memcpy(&client->out[client->out_len], buf, len);
+  client->out_len += len;
+  ArmClientOutput(client, true);
+  return(0);
+
+} /*ClientWrite*/
+
+static int ClientPrintf(MUX_CLIENT *client, const char *fmt, ...)
+{ /*ClientPrintf*/
+
+  va_list
+    va_alist;
+  char
+    buf[256];
+  int
+    len;
+
+  va_start(va_alist, fmt);
+  len = vsnprintf(buf, sizeof(buf), fmt, va_alist);
+  va_end(va_alist);
+  if (len >= (int)sizeof(buf))
+    len = sizeof(buf) - 1;
+  return(ClientWrite(client, buf, len));
+
+} /*ClientPrintf*/
+
+static void FlushClient(MUX_CLIENT *client)
+{ /*FlushClient*/
+
+  ssize_t
+    sent;
+
+  while (client->out_len)
+    {
+      sent = send(client->fd, client->out, client->out_len, MSG_NOSIGNAL);
+      if (sent == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+	    return;
+	  DropClient(client);
+	  return;
+	}
+      client->out_len -= sent;
+      memmove(client->out, &client->out[sent], client->out_len);
+    }
+  ArmClientOutput(client, false);
+
+} /*FlushClient*/
+
+/* Host output goes to whoever is attached, or nowhere */
+static void MuxDataOutVProc(intptr_t refCon, const struct iovec *iov, int iovCount)
+{ /*MuxDataOutVProc*/
+
+  MUX_SESSION
+    *session = (MUX_SESSION*)refCon;
+  int
+    i;
+
+  for (i = 0; i < iovCount; i++)
+    {
+      Logit (LOG_OUTPUT, (char *) iov[i].iov_base, iov[i].iov_len, true);
+      if ((session->client) && (iov[i].iov_len) &&
+	  (ClientWrite(session->client, (char*)iov[i].iov_base,
+		       iov[i].iov_len) == -1))
+	DropClient(session->client);
+    }
+
+} /*MuxDataOutVProc*/
+
+static void MuxDataOutProc(intptr_t refCon, char *buffer, size_t bufferLength)
+{ /*MuxDataOutProc*/
+
+  struct iovec
+    iov;
+
+  iov.iov_base = buffer;
+  iov.iov_len = bufferLength;
+  MuxDataOutVProc(refCon, &iov, 1);
+
+} /*MuxDataOutProc*/
+
+static void CloseSession(MUX_SESSION *session)
+{ /*CloseSession*/
+
+  if (session->client)
+    {
+      MUX_CLIENT *client = session->client;
+      client->session = NULL;
+      DropClient(client);
+    }
+  ListRemove(&read_list, &session->read_link);
+  ListRemove(&connect_list, &session->connect_link);
+  ListRemove(&resolve_list, &session->resolve_link);
+  if (!session->connecting)
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, VTSocket(&session->conn), NULL);
+  VTCleanUpConnection(&session->conn);
+  sessions[session->id] = NULL;
+  --open_sessions;
+  Bury(&session->h);
+
+} /*CloseSession*/
+
+static MUX_SESSION *OpenSession(char *hostname, int ipPort, char *msg, int msg_len)
+{ /*OpenSession*/
+
+  MUX_SESSION
+    *session;
+  int
+    id,
+    vtError;
+
+/* Find a free slot, growing the table if there isn't one */
+  for (id = 0; id < max_sessions; id++)
+    if (sessions[id] == NULL)
+      break;
+  if (id == max_sessions)
+    {
+      int
+	new_max = max_sessions ? max_sessions * 2 : 64;
+      MUX_SESSION
+	**new_sessions;
+      if ((new_sessions = (MUX_SESSION**)realloc(sessions,
+				new_max * sizeof(MUX_SESSION*))) == NULL)
+	{
+	  snprintf(msg, msg_len, "out of memory");
+	  return(NULL);
+	}
+      memset(&new_sessions[max_sessions], 0,
+	     (new_max - max_sessions) * sizeof(MUX_SESSION*));
+      sessions = new_sessions;
+      max_sessions = new_max;
+    }
+
+  if ((session = (MUX_SESSION*)calloc(1, sizeof(MUX_SESSION))) == NULL)
+    {
+      snprintf(msg, msg_len, "out of memory");
+      return(NULL);
+    }
+  session->h.kind = kMuxSession;
+  session->id = id;
+  session->connect_link.session = session;
+  session->resolve_link.session = session;
+  session->read_link.session = session;
+  snprintf(session->host, sizeof(session->host), "%s", hostname);
+
+/* The connect itself finishes later, in StepConnect() */
+  vtError = VTInitConnection(&session->conn, 0, ipPort);
+  if (vtError == kVTCNoError)
+    vtError = VTConnectStart(&session->conn, hostname, ipPort,
+			     connect_timeout);
+  if ((vtError != kVTCNoError) && (vtError != kVTCConnectPending))
+    {
+      VTErrorMessage(&session->conn, vtError, msg, msg_len);
+      VTCleanUpConnection(&session->conn);
+      free(session);
+      return(NULL);
+    }
+  session->conn.fBlockModeSupported = true;
+  session->conn.fSendNoWait = true;	/* See ArmSessionOutput() */
+  session->conn.fDataOutProc = MuxDataOutProc;
+  session->conn.fDataOutVProc = MuxDataOutVProc;
+  session->conn.fDataOutRefCon = (intptr_t)session;
+  session->connecting = true;
+/* Just after the library's own deadline, so the step there times out */
+  if (connect_timeout > 0)
+    ListAdd(&connect_list, &session->connect_link,
+	    MyMonotonicUsec() + (int64_t)connect_timeout * 1000);
+  if (session->conn.fState == kvtsResolving)
+    ListAdd(&resolve_list, &session->resolve_link, 0);
+
+  sessions[id] = session;
+  ++open_sessions;
+  return(session);
+
+} /*OpenSession*/
+
+/*
+ * A connect in progress wakes the loop when one of its sockets turns
+ *   writable (answered or refused), a lookup when resolver_fd does, and
+ *   CheckConnects() sees to the deadline; nothing is polled. The
+ *   sockets that lose are closed by the library, which takes them out
+ *   of the epoll set, and the one that wins keeps its registration.
+ */
+static void StepConnect(MUX_SESSION *session)
+{ /*StepConnect*/
+
+  struct epoll_event
+    ev;
+  char
+    msg[128];
+  int
+    fds[kVT_MAX_CONNECT_ATTEMPTS],
+    count,
+    i,
+    vtError;
+
+  vtError = VTConnectStep(&session->conn);
+  if (session->conn.fState != kvtsResolving)
+    ListRemove(&resolve_list, &session->resolve_link);
+  if (vtError == kVTCConnectPending)
+    {
+      ev.events = EPOLLOUT;
+      ev.data.ptr = session;
+      count = VTConnectSockets(&session->conn, fds, kVT_MAX_CONNECT_ATTEMPTS);
+      for (i = 0; i < count; i++)
+	if ((epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &ev) == -1) &&
+	    (errno != EEXIST))
+	  {
+	    vtError = kVTCSocketError;
+	    session->conn.fLastSocketError = errno;
+	    break;
+	  }
+      if (vtError == kVTCConnectPending)
+	return;
+    }
+  session->connecting = false;
+  ListRemove(&connect_list, &session->connect_link);
+  if (vtError == kVTCNoError)
+    {
+      ev.events = EPOLLIN | EPOLLRDHUP;
+      ev.data.ptr = session;
+      if ((epoll_ctl(epoll_fd, EPOLL_CTL_MOD, VTSocket(&session->conn),
+		     &ev) == 0) ||
+	  ((errno == ENOENT) &&
+	   (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, VTSocket(&session->conn),
+		      &ev) == 0)))
+	{
+	  if (session->client)
+	    ClientPrintf(session->client, "OK %d\n", session->id);
+	  return;
+	}
+      snprintf(msg, sizeof(msg), "epoll_ctl: %s", strerror(errno));
+    }
+  else
+    VTErrorMessage(&session->conn, vtError, msg, sizeof(msg));
+  if (session->client)
+    {
+/* Back to command mode for another try */
+      ClientPrintf(session->client, "ERR %s\n", msg);
+      session->client->session = NULL;
+      session->client = NULL;
+    }
+  CloseSession(session);
+
+} /*StepConnect*/
+
+/*
+ * Give up on connects that have run out of time and return how long
+ *   epoll_wait() may sleep before the next deadline.
+ */
+static int CheckConnects(void)
+{ /*CheckConnects*/
+
+  MUX_LINK
+    *link;
+  int64_t
+    now = MyMonotonicUsec();
+
+  while (((link = connect_list.head) != NULL) && (link->due <= now))
+    {
+      ListRemove(&connect_list, link);
+      StepConnect(link->session);
+    }
+  return(ListWaitMs(&connect_list));
+
+} /*CheckConnects*/
+
+/* Some lookup has finished; it doesn't say which */
+static void ResolverDone(void)
+{ /*ResolverDone*/
+
+  uint64_t
+    count;
+  MUX_LINK
+    *link,
+    *next;
+
+  if (read(resolver_fd, &count, sizeof(count)) == -1)
+    return;
+/* A step takes its own session off the list and no other */
+  for (link = resolve_list.head; link != NULL; link = next)
+    {
+      next = link->next;
+      StepConnect(link->session);
+    }
+
+} /*ResolverDone*/
+
+/* 'started' says a new read was posted, which restarts the clock */
+static void UpdateReadTimer(MUX_SESSION *session, bool started)
+{ /*UpdateReadTimer*/
+
+  bool
+    timed = ((session->conn.fReadInProgress) &&
+	     (session->conn.fReadTimeout));
+
+  if ((timed == session->read_link.linked) && (!started))
+    return;
+  ListRemove(&read_list, &session->read_link);
+  if (timed)
+    ListAdd(&read_list, &session->read_link,
+	    MyMonotonicUsec() + (int64_t)session->conn.fReadTimeout * 1000000);
+
+} /*UpdateReadTimer*/
+
+/*
+ * Replies to a host that isn't reading are kept on the connection
+ *   rather than holding up every other session; they go out on
+ *   EPOLLOUT. Called after anything that may have sent to the host.
+ */
+static void ArmSessionOutput(MUX_SESSION *session)
+{ /*ArmSessionOutput*/
+
+  struct epoll_event
+    ev;
+  bool
+    want = VTSendPending(&session->conn);
+
+  if ((session->connecting) || (session->want_out == want))
+    return;
+  ev.events = EPOLLIN | EPOLLRDHUP | ((want) ? EPOLLOUT : 0);
+  ev.data.ptr = session;
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, VTSocket(&session->conn), &ev);
+  session->want_out = want;
+
+} /*ArmSessionOutput*/
+
+static void SessionWritable(MUX_SESSION *session)
+{ /*SessionWritable*/
+
+  int
+    whichError;
+  char
+    messageBuffer[128];
+
+  if ((whichError = VTSendReady(&session->conn)))
+    {
+      if (session->client)
+	{
+	  VTErrorMessage(&session->conn, whichError,
+			 messageBuffer, sizeof(messageBuffer));
+	  ClientPrintf(session->client, "\r\nVT error: %s\r\n",
+		       messageBuffer);
+	}
+      CloseSession(session);
+      return;
+    }
+  ArmSessionOutput(session);
+
+} /*SessionWritable*/
+
+static void ProcessSession(MUX_SESSION *session)
+{ /*ProcessSession*/
+
+  tVTConnection
+    *conn = &session->conn;
+  int
+    whichError;
+  bool
+    started = false;
+  static char trigger[] = { ASC_DC1 };
+
+  do
+    {
+      whichError = VTReceiveDataReady(conn);
+      if ((whichError != kVTCNoError) && (whichError != kVTCVTOpen))
+	{
+	  if ((whichError != kVTCStartShutdown) && (session->client))
+	    {
+	      char	messageBuffer[128];
+	      VTErrorMessage(conn, whichError,
+			     messageBuffer, sizeof(messageBuffer));
+	      ClientPrintf(session->client, "\r\nVT error: %s\r\n",
+			   messageBuffer);
+	    }
+	  CloseSession(session);
+	  return;
+	}
+      if (conn->fReadStarted)
+	{
+	  conn->fReadStarted = false;
+	  started = true;
+	  if (conn->fReadFlush)
+	    {
+	      conn->fReadFlush = false;
+	      FlushQ(conn);
+	    }
+	  conn->fDataOutProc(conn->fDataOutRefCon, trigger, sizeof(trigger));
+	  ProcessQueueToHost(conn, 0);
+	}
+    } while (VTReceivePending(conn));
+  UpdateReadTimer(session, started);
+  ArmSessionOutput(session);
+
+} /*ProcessSession*/
+
+/*
+ * The host has hung up. Take whatever it sent before it went, then the
+ *   read that comes back empty closes the session; a hung-up socket
+ *   never makes us wait.
+ */
+static void HostHungUp(MUX_SESSION *session)
+{ /*HostHungUp*/
+
+  uint64_t
+    reads;
+
+  while (!session->h.dead)
+    {
+      reads = session->conn.fStats.fReads;
+      ProcessSession(session);
+      if ((!session->h.dead) && (session->conn.fStats.fReads == reads) &&
+	  (!VTReceivePending(&session->conn)))
+	{
+	  CloseSession(session);	/* Nothing more to be had */
+	  break;
+	}
+    }
+
+} /*HostHungUp*/
+
+static void Attach(MUX_CLIENT *client, MUX_SESSION *session)
+{ /*Attach*/
+
+  client->session = session;
+  session->client = client;
+  ClientPrintf(client, "OK %d\n", session->id);
+
+} /*Attach*/
+
+static void DoCommand(MUX_CLIENT *client, char *line)
+{ /*DoCommand*/
+
+  char
+    *verb,
+    *arg1,
+    *arg2,
+    msg[128];
+  int
+    id;
+  MUX_SESSION
+    *session;
+
+  verb = strtok(line, " \t\r");
+  arg1 = strtok(NULL, " \t\r");
+  arg2 = strtok(NULL, " \t\r");
+  if (verb == NULL)
+    return;
+  if (!strcasecmp(verb, "OPEN") && (arg1))
+    {
+      session = OpenSession(arg1, (arg2) ? atoi(arg2) : kVT_PORT,
+			    msg, sizeof(msg));
+      if (session == NULL)
+	ClientPrintf(client, "ERR %s\n", msg);
+      else
+	{
+	  client->session = session;
+	  session->client = client;
+	  StepConnect(session);		/* "OK id" once it's up */
+	}
+    }
+  else if (!strcasecmp(verb, "ATTACH") && (arg1))
+    {
+      id = atoi(arg1);
+      if ((id < 0) || (id >= max_sessions) || (sessions[id] == NULL))
+	ClientPrintf(client, "ERR no session %s\n", arg1);
+      else if (sessions[id]->client)
+	ClientPrintf(client, "ERR session %d is attached\n", id);
+      else
+	Attach(client, sessions[id]);
+    }
+  else if (!strcasecmp(verb, "CLOSE") && (arg1))
+    {
+      id = atoi(arg1);
+      if ((id < 0) || (id >= max_sessions) || (sessions[id] == NULL))
+	ClientPrintf(client, "ERR no session %s\n", arg1);
+      else
+	{
+	  CloseSession(sessions[id]);
+	  ClientPrintf(client, "OK %d\n", id);
+	}
+    }
+  else if (!strcasecmp(verb, "LIST"))
+    {
+      for (id = 0; id < max_sessions; id++)
+	if ((session = sessions[id]) != NULL)
+	  ClientPrintf(client, "%d %s %s\n", id, session->host,
+		       (session->connecting) ? "connecting" :
+		       ((session->client) ? "attached" :
+			((session->conn.fState == kvtsOpen) ? "idle" : "opening")));
+      ClientPrintf(client, ".\n");
+    }
+  else
+    ClientPrintf(client, "ERR unknown command\n");
+
+} /*DoCommand*/
+
+static void ProcessClient(MUX_CLIENT *client)
+{ /*ProcessClient*/
+
+  char
+    buf[4096],
+    *ptr;
+  ssize_t
+    len;
+  int
+    i;
+  tVTConnection
+    *conn;
+
+  if ((len = read(client->fd, buf, sizeof(buf))) <= 0)
+    {
+      if ((len == -1) && ((errno == EAGAIN) || (errno == EINTR)))
+	return;
+      DropClient(client);
+      return;
+    }
+  ptr = buf;
+  if (client->session == NULL)
+    {
+/* Still in command mode: collect a line */
+      for (i = 0; i < len; i++)
+	{
+	  if (buf[i] != '\n')
+	    {
+	      if (client->cmd_len < MAX_CMD_LINE - 1)
+		client->cmd[client->cmd_len++] = buf[i];
+	      continue;
+	    }
+	  client->cmd[client->cmd_len] = '\0';
+	  client->cmd_len = 0;
+	  DoCommand(client, client->cmd);
+	  if (client->session)
+	    break;
+	}
+      if ((client->session == NULL) || (++i >= len))
+	return;
+      ptr = &buf[i];
+      len -= i;
+    }
+  conn = &client->session->conn;
+  PutQBuffer(conn, ptr, len);
+  if (conn->fReadInProgress)
+    {
+      ProcessQueueToHost(conn, len);
+      UpdateReadTimer(client->session, false);
+      ArmSessionOutput(client->session);
+    }
+
+} /*ProcessClient*/
+
+/* Clients have to be running as the daemon's own user */
+static bool PeerAllowed(int fd)
+{ /*PeerAllowed*/
+
+  struct ucred
+    cred;
+  socklen_t
+    len = sizeof(cred);
+
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+    return(false);
+  return(cred.uid == geteuid());
+
+} /*PeerAllowed*/
+
+static void AcceptClient(int listen_fd)
+{ /*AcceptClient*/
+
+  int
+    fd;
+  MUX_CLIENT
+    *client;
+  struct epoll_event
+    ev;
+
+  while ((fd = accept(listen_fd, NULL, NULL)) != -1)
+    {
+      if ((!PeerAllowed(fd)) ||
+	  (SetNonBlocking(fd) == -1) ||
+	  ((client = (MUX_CLIENT*)calloc(1, sizeof(MUX_CLIENT))) == NULL))
+	{
+	  close(fd);
+	  continue;
+	}
+      client->h.kind = kMuxClient;
+      client->fd = fd;
+      ev.events = EPOLLIN;
+      ev.data.ptr = client;
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+	{
+	  close(fd);
+	  free(client);
+	}
+    }
+
+} /*AcceptClient*/
+
+/*
+ * Time out any timed reads that have run their course and return
+ *   how long epoll_wait() may sleep before the next one is due.
+ */
+static int CheckReadTimers(void)
+{ /*CheckReadTimers*/
+
+  MUX_LINK
+    *link;
+  MUX_SESSION
+    *session;
+  int64_t
+    now = MyMonotonicUsec();
+
+  while (((link = read_list.head) != NULL) && (link->due <= now))
+    {
+      session = link->session;
+      ListRemove(&read_list, link);
+      ProcessQueueToHost(&session->conn, -1);
+      UpdateReadTimer(session, false);
+      ArmSessionOutput(session);
+    }
+  return(ListWaitMs(&read_list));
+
+} /*CheckReadTimers*/
+
+/*
+ * The sessions are logged on, so only the user running the daemon may
+ *   reach them. By default the socket goes in $XDG_RUNTIME_DIR, or else
+ *   in a directory under /tmp that only that user can get into; either
+ *   way it is made 0600, and every client is checked in AcceptClient().
+ */
+static char *DefaultSocketPath(void)
+{ /*DefaultSocketPath*/
+
+  static char
+    path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  char
+    dir[sizeof(path)],
+    *runtime_dir = getenv("XDG_RUNTIME_DIR");
+  struct stat
+    st;
+
+  if ((runtime_dir != NULL) && (*runtime_dir))
+    {
+      if (snprintf(path, sizeof(path), "%s/%s", runtime_dir,
+		   SOCKET_NAME) >= (int)sizeof(path))
+	{
+	  fprintf(stderr, "Socket path too long: %s/%s\n", runtime_dir,
+		  SOCKET_NAME);
+	  return(NULL);
+	}
+      return(path);
+    }
+  snprintf(dir, sizeof(dir), "/tmp/vt3kmuxd-%ld", (long)geteuid());
+  if ((mkdir(dir, 0700) == -1) && (errno != EEXIST))
+    {
+      perror(dir);
+      return(NULL);
+    }
+/* Someone else may have made it first; it has to be ours and private */
+  if ((lstat(dir, &st) == -1) || (!S_ISDIR(st.st_mode)) ||
+      (st.st_uid != geteuid()) || (st.st_mode & 077))
+    {
+      fprintf(stderr, "%s is not a private directory of ours\n", dir);
+      return(NULL);
+    }
+  if (snprintf(path, sizeof(path), "%s/%s", dir, SOCKET_NAME) >=
+      (int)sizeof(path))
+    {
+      fprintf(stderr, "Socket path too long: %s/%s\n", dir, SOCKET_NAME);
+      return(NULL);
+    }
+  return(path);
+
+} /*DefaultSocketPath*/
+
+static int OpenListener(char *path)
+{ /*OpenListener*/
+
+  int
+    fd,
+    bound;
+  struct sockaddr_un
+    addr;
+  struct stat
+    st;
+  mode_t
+    old_mask;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    {
+      fprintf(stderr, "Socket path too long: %s\n", path);
+      return(-1);
+    }
+  strcpy(addr.sun_path, path);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+    {
+      perror("socket");
+      return(-1);
+    }
+/* Only a socket of ours left over from last time is taken away */
+  if (lstat(path, &st) == 0)
+    {
+      if ((!S_ISSOCK(st.st_mode)) || (st.st_uid != geteuid()))
+	{
+	  fprintf(stderr, "%s exists and is not our socket\n", path);
+	  close(fd);
+	  return(-1);
+	}
+      unlink(path);
+    }
+  old_mask = umask(077);
+  bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  umask(old_mask);
+  if ((bound == -1) ||
+      (chmod(path, 0600) == -1) ||
+      (listen(fd, SOMAXCONN) == -1) ||
+      (SetNonBlocking(fd) == -1))
+    {
+      perror(path);
+      close(fd);
+      return(-1);
+    }
+  return(fd);
+
+} /*OpenListener*/
+
+int main(int argc, char *argv[])
+{ /*main*/
+
+  char
+    *socket_path = NULL,
+    *log_file = NULL,
+    *ptr;
+  int
+    listen_fd,
+    log_mask = 0,
+    nfds,
+    wait_ms,
+    connect_ms,
+    i,
+    id;
+  struct epoll_event
+    ev,
+    events[MAX_EVENTS];
+  MUX_HANDLE
+    *h;
+
+  while ((--argc) && ((*(++argv))[0] == '-'))
+    {
+      if (!strcmp(*argv, "-s") && (argc > 1))
+	{
+	  --argc;
+	  socket_path = *(++argv);
+	}
+      else if (!strcmp(*argv, "-ct") && (argc > 1))
+	{
+	  --argc;
+	  connect_timeout = atoi(*(++argv)) * 1000;
+	}
+      else if (!strcmp(*argv, "-f") && (argc > 1))
+	{
+	  --argc;
+	  log_file = *(++argv);
+	}
+      else if (!strncmp(*argv, "-l", 2))
+	{
+	  if ((log_mask = ParseLogMask(*argv + 2)) == -1)
+	    {
+	      PrintUsage();
+	      return(2);
+	    }
+	}
+      else if (!strncmp(*argv, "-d", 2))
+	{
+	  ptr = *argv;
+	  while (*(++ptr) == 'd')
+	    ++debug;
+	}
+      else
+	{
+	  PrintUsage();
+	  return(2);
+	}
+    }
+  if (argc > 0)
+    {
+      PrintUsage();
+      return(2);
+    }
+
+  if (LogOpen(log_file, log_mask) != 0)
+    return(1);
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, CatchTerm);
+  signal(SIGTERM, CatchTerm);
+
+  if ((epoll_fd = epoll_create1(0)) == -1)
+    {
+      perror("epoll_create1");
+      return(1);
+    }
+  if ((socket_path == NULL) &&
+      ((socket_path = DefaultSocketPath()) == NULL))
+    return(1);
+  if ((listen_fd = OpenListener(socket_path)) == -1)
+    return(1);
+  ev.events = EPOLLIN;
+  ev.data.ptr = &listener;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+  if ((resolver_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+    {
+      perror("eventfd");
+      return(1);
+    }
+  ev.data.ptr = &resolver;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, resolver_fd, &ev);
+  VTConnectNotify(resolver_fd);
+
+  while (!stop_now)
+    {
+      wait_ms = CheckReadTimers();
+      connect_ms = CheckConnects();
+      if ((wait_ms == -1) || ((connect_ms != -1) && (connect_ms < wait_ms)))
+	wait_ms = connect_ms;
+      nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, wait_ms);
+      if (nfds == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  perror("epoll_wait");
+	  break;
+	}
+      for (i = 0; i < nfds; i++)
+	{
+	  h = (MUX_HANDLE*)events[i].data.ptr;
+	  if (h->dead)
+	    continue;
+	  switch (h->kind)
+	    {
+	    case kMuxListener:
+	      AcceptClient(listen_fd);
+	      break;
+	    case kMuxResolver:
+	      ResolverDone();
+	      break;
+	    case kMuxSession:
+	      if (((MUX_SESSION*)h)->connecting)
+		{
+		  StepConnect((MUX_SESSION*)h);
+		  break;
+		}
+	      if (events[i].events & EPOLLOUT)
+		{
+		  SessionWritable((MUX_SESSION*)h);
+		  if ((h->dead) || (!(events[i].events & ~EPOLLOUT)))
+		    break;
+		}
+	      if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+		HostHungUp((MUX_SESSION*)h);
+	      else
+		ProcessSession((MUX_SESSION*)h);
+	      break;
+	    case kMuxClient:
+	      if (events[i].events & EPOLLOUT)
+		{
+		  FlushClient((MUX_CLIENT*)h);
+		  break;	/* Client may be gone; read next time */
+		}
+	      ProcessClient((MUX_CLIENT*)h);
+	      break;
+	    }
+	}
+      ReapHandles();
+    }
+
+  for (id = 0; id < max_sessions; id++)
+    if (sessions[id])
+      CloseSession(sessions[id]);
+  ReapHandles();
+  close(resolver_fd);
+  close(listen_fd);
+  unlink(socket_path);
+  return(0);
+
+} /*main*/
@@ -0,0 +1,558 @@
+/*
+This file is part of FreeVT3k.
+
+FreeVT3k is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+FreeVT3k is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License along
+with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/************************************************************
+ * vt3kreplay.c -- replay a session capture
+ *
+ * Plays back a file written by freevt3k -capture. In records
+ *   mode the captured host records go through the protocol
+ *   engine again, as if they had just come off the socket; in
+ *   output mode the captured terminal output goes straight to
+ *   the sink. The sink is the null device, stdout, the VT100
+ *   translator or a headless copy of the xhpterm emulator.
+ *
+ *   The whole capture is read into memory first, so only the
+ *   replay itself is timed. By default it runs as fast as it
+ *   can; -p keeps the pace the session had.
+ ************************************************************/
+
+#include "config.h"
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "vt.h"
+#include "freevt3k.h"
+#include "vtcommon.h"
+#include "vtconn.h"
+#include "vtcapture.h"
+#include "transport.h"
+#include "hpvt100.h"
+#include "hpterm.h"
+#include "conmgr.h"
+#include "x11glue.h"
+#include "timers.h"
+
+#define DRAIN_EVERY		(32)	/* Records between reply drains */
+#define SCREEN_ROWS		(26)	/* 24 lines and the two menus */
+#define SCREEN_COLS		(80)
+
+typedef enum
+{
+  kSinkNull = 0,
+  kSinkRaw,
+  kSinkVT100,
+  kSinkHPTerm
+} REPLAY_SINK;
+
+typedef struct
+{
+  int
+    kind,
+    length;
+  uint64_t
+    time;
+  char
+    *data;
+} REPLAY_ENTRY;
+
+typedef struct
+{
+  REPLAY_ENTRY
+    *entries;
+  int
+    count,
+    size;
+} REPLAY_CAPTURE;
+
+/* hpterm.c expects the globals and display entry points that	*/
+/* x11glue.c and conmgr.c would otherwise supply. The display	*/
+/* calls keep a plain text copy of the screen for -S.		*/
+
+struct conmgr
+	*con = NULL;
+int
+	logging = 0;
+char
+	*termid = NULL;
+static char
+	screen[SCREEN_ROWS][SCREEN_COLS + 1];
+static int
+	screen_rows = 0;
+
+void disp_drawtext(int style, int row, int col, char *buf, int nbuf)
+{ /*disp_drawtext*/
+
+  if ((row < 0) || (row >= SCREEN_ROWS) || (col < 0) || (col >= SCREEN_COLS))
+    return;
+  if (nbuf > SCREEN_COLS - col)
+    nbuf = SCREEN_COLS - col;
+  memcpy(&screen[row][col], buf, nbuf);
+  if (row >= screen_rows)
+    screen_rows = row + 1;
+
+} /*disp_drawtext*/
+
+void disp_erasetext(int row, int col, int nchar)
+{ /*disp_erasetext*/
+
+  if ((row < 0) || (row >= SCREEN_ROWS) || (col < 0) || (col >= SCREEN_COLS))
+    return;
+  if (nchar > SCREEN_COLS - col)
+    nchar = SCREEN_COLS - col;
+  memset(&screen[row][col], ' ', nchar);
+
+} /*disp_erasetext*/
+
+void disp_drawcursor(int style, int row, int col)
+{ /*disp_drawcursor*/
+} /*disp_drawcursor*/
+
+void doXBell(void)
+{ /*doXBell*/
+} /*doXBell*/
+
+void conmgr_send(struct conmgr *c, char *buf, size_t nbuf)
+{ /*conmgr_send*/
+} /*conmgr_send*/
+
+void conmgr_send_break(struct conmgr *c)
+{ /*conmgr_send_break*/
+} /*conmgr_send_break*/
+
+/* Sinks */
+
+static void NullDataOutProc(intptr_t refCon, char *buffer, size_t bufferLength)
+{ /*NullDataOutProc*/
+} /*NullDataOutProc*/
+
+static void NullDataOutVProc(intptr_t refCon, const struct iovec *iov, int iovCount)
+{ /*NullDataOutVProc*/
+} /*NullDataOutVProc*/
+
+static void HPTermDataOutProc(intptr_t refCon, char *buffer, size_t bufferLength)
+{ /*HPTermDataOutProc*/
+
+  hpterm_rxfunc(NULL, buffer, bufferLength);
+
+} /*HPTermDataOutProc*/
+
+static void HPTermDataOutVProc(intptr_t refCon, const struct iovec *iov, int iovCount)
+{ /*HPTermDataOutVProc*/
+
+  int
+    i;
+
+  for (i = 0; i < iovCount; i++)
+    if (iov[i].iov_len)
+      hpterm_rxfunc(NULL, (char *)iov[i].iov_base, iov[i].iov_len);
+
+} /*HPTermDataOutVProc*/
+
+static void SetSink(tVTConnection *conn, REPLAY_SINK sink, tHPVTContext **hpvt)
+{ /*SetSink*/
+
+  switch (sink)
+    {
+    case kSinkRaw:
+      conn->fDataOutProc = vt3kDataOutProc;
+      conn->fDataOutVProc = vt3kDataOutVProc;
+      break;
+    case kSinkVT100:
+      if ((*hpvt = vt3kHPNewContext(conn, NULL)) == NULL)
+	{
+	  fprintf(stderr, "vt3kreplay: unable to allocate a translator.\n");
+	  exit(1);
+	}
+      conn->fDataOutProc = vt3kHPtoVT100;
+      conn->fDataOutVProc = vt3kHPtoVT100V;
+      conn->fDataOutRefCon = (intptr_t)*hpvt;
+      break;
+    case kSinkHPTerm:
+      conn->fDataOutProc = HPTermDataOutProc;
+      conn->fDataOutVProc = HPTermDataOutVProc;
+      break;
+    default:
+      conn->fDataOutProc = NullDataOutProc;
+      conn->fDataOutVProc = NullDataOutVProc;
+      break;
+    }
+
+} /*SetSink*/
+
+static int LoadCapture(char *file_name, REPLAY_CAPTURE *cap, int *what)
+{ /*LoadCapture*/
+
+  FILE
+    *input;
+  tVTCaptureEntry
+    entry;
+  char
+    data[kVTCaptureMaxData];
+  REPLAY_ENTRY
+    *e;
+  int
+    status;
+
+  if ((input = fopen(file_name, "rb")) == (FILE*)NULL)
+    {
+      perror(file_name);
+      return(-1);
+    }
+  if (VTCaptureOpen(input, what))
+    {
+      fprintf(stderr, "vt3kreplay: %s is not a capture file.\n", file_name);
+      fclose(input);
+      return(-1);
+    }
+  while ((status = VTCaptureRead(input, &entry, data)) == 1)
+    {
+      if (entry.fKind == kVTCaptureKindDropped)
+	{
+	  fprintf(stderr, "vt3kreplay: the capture lost entries here; "
+		  "the replay may go wrong.\n");
+	  continue;
+	}
+      if (cap->count == cap->size)
+	{
+	  cap->size = (cap->size) ? cap->size * 2 : 1024;
+	  cap->entries = (REPLAY_ENTRY*)realloc(cap->entries,
+					cap->size * sizeof(REPLAY_ENTRY));
+	  if (cap->entries == NULL)
+	    break;
+	}
+      e = &cap->entries[cap->count];
+      if ((e->data = (char*)malloc(entry.fLength + 1)) == NULL)
+	break;
+      memcpy(e->data, data, entry.fLength);
+      e->kind = entry.fKind;
+      e->length = entry.fLength;
+      e->time = entry.fTime;
+      ++cap->count;
+    }
+  fclose(input);
+  if (status == -1)
+    fprintf(stderr, "vt3kreplay: %s is cut short; replaying what there is.\n",
+	    file_name);
+  else if (status == 1)
+    {
+      fprintf(stderr, "vt3kreplay: out of memory.\n");
+      return(-1);
+    }
+  return(0);
+
+} /*LoadCapture*/
+
+/* Sleep until 'when' ns into the replay, scaled by 'factor' */
+
+static void Pace(int64_t start, uint64_t when, double factor)
+{ /*Pace*/
+
+  int64_t
+    due = start + (int64_t)(when / factor),
+    now = MyMonotonicNsec();
+  struct timespec
+    nap;
+
+  if (due <= now)
+    return;
+  nap.tv_sec = (due - now) / 1000000000;
+  nap.tv_nsec = (due - now) % 1000000000;
+  while ((nanosleep(&nap, &nap) == -1) && (errno == EINTR))
+    ;
+
+} /*Pace*/
+
+static int Replay(REPLAY_CAPTURE *cap, int kind, REPLAY_SINK sink,
+		  bool paced, double factor, uint64_t *bytes)
+{ /*Replay*/
+
+  tVTConnection
+    conn;
+  tHPVTContext
+    *hpvt = NULL;
+  int
+    fds[2] = { -1, -1 },
+    vtError = kVTCNoError,
+    records = 0,
+    i;
+  char
+    junk[65536],
+    messageBuffer[128];
+  struct iovec
+    iov;
+  int64_t
+    start;
+  REPLAY_ENTRY
+    *e;
+
+  /* Records need somewhere to send their replies; they are read	*/
+  /* back now and again and thrown away.				*/
+  memset(&conn, 0, sizeof(conn));
+  if ((vtError = VTInitConnection(&conn, 0, kVT_PORT)))
+    {
+      VTErrorMessage(&conn, vtError, messageBuffer, sizeof(messageBuffer));
+      fprintf(stderr, "vt3kreplay: %s\n", messageBuffer);
+      VTCleanUpConnection(&conn);
+      return(-1);
+    }
+  if (kind == kVTCaptureKindRecord)
+    {
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+	{
+	  perror("socketpair");
+	  VTCleanUpConnection(&conn);
+	  return(-1);
+	}
+      fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL, 0) | O_NONBLOCK);
+      fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL, 0) | O_NONBLOCK);
+      close(conn.fSocket);
+      conn.fSocket = fds[1];
+      conn.fState = kvtsWaitingForAM;
+    }
+  conn.fBlockModeSupported = true;
+  VTSetTransportProfile(&conn, kTransportDefault, 0);
+  SetSink(&conn, sink, &hpvt);
+
+  start = MyMonotonicNsec();
+  for (i = 0; i < cap->count; i++)
+    {
+      e = &cap->entries[i];
+      if (e->kind != kind)
+	continue;
+      if (paced)
+	Pace(start, e->time, factor);
+      *bytes += e->length;
+      if (kind == kVTCaptureKindRecord)
+	{
+	  vtError = VTReplayRecord(&conn, e->data, e->length);
+	  conn.fReadStarted = false;
+	  if (vtError == kVTCStartShutdown)
+	    {
+	      vtError = kVTCNoError;
+	      break;
+	    }
+	  if ((vtError != kVTCNoError) && (vtError != kVTCVTOpen))
+	    goto Error;
+	  vtError = kVTCNoError;
+	  if ((++records % DRAIN_EVERY) == 0)
+	    while (read(fds[0], junk, sizeof(junk)) > 0)
+	      ;
+	}
+      else
+	{
+	  iov.iov_base = e->data;
+	  iov.iov_len = e->length;
+	  VTDataOut(&conn, &iov, 1);
+	}
+      if (sink == kSinkHPTerm)
+	term_update();
+    }
+
+Error:
+  if (vtError)
+    {
+      VTErrorMessage(&conn, vtError, messageBuffer, sizeof(messageBuffer));
+      fprintf(stderr, "vt3kreplay: entry %d: %s\n", i, messageBuffer);
+    }
+  if (fds[0] != -1)
+    {
+      conn.fSocket = -1;
+      close(fds[0]);
+      close(fds[1]);
+    }
+  VTCleanUpConnection(&conn);
+  if (hpvt)
+    vt3kHPFreeContext(hpvt);
+  return((vtError) ? -1 : 0);
+
+} /*Replay*/
+
+static void PrintScreen(void)
+{ /*PrintScreen*/
+
+  int
+    row,
+    len;
+
+  term_redraw();
+  for (row = 0; row < screen_rows; row++)
+    {
+      for (len = SCREEN_COLS; (len > 0) && (screen[row][len - 1] == ' '); len--)
+	;
+      printf("%.*s\n", len, screen[row]);
+    }
+
+} /*PrintScreen*/
+
+static void PrintUsage(void)
+{ /*PrintUsage*/
+
+  printf("vt3kreplay - version %s\n\n", VERSION_ID);
+  printf("Usage: vt3kreplay [-m mode] [-o sink] [-p] [-x factor] [-n passes]\n");
+  printf("                  [-S] file\n");
+  printf("   -m mode         - records: run the host records through the\n");
+  printf("                     protocol engine; output: send the captured\n");
+  printf("                     terminal output straight to the sink [records]\n");
+  printf("   -o sink         - null, raw (stdout), vt100 or hpterm [null]\n");
+  printf("   -p              - keep the pace of the original session\n");
+  printf("   -x factor       - with -p, play 'factor' times faster [1]\n");
+  printf("   -n passes       - play the capture 'passes' times [1]\n");
+  printf("   -S              - with -o hpterm, print the final screen\n");
+
+} /*PrintUsage*/
+
+int main(int argc, char *argv[])
+{ /*main*/
+
+  char
+    *file_name = NULL;
+  int
+    kind = kVTCaptureKindRecord,
+    what = 0,
+    passes = 1,
+    entries = 0,
+    pass,
+    i;
+  REPLAY_SINK
+    sink = kSinkNull;
+  bool
+    paced = false,
+    show_screen = false;
+  double
+    factor = 1.0,
+    secs;
+  REPLAY_CAPTURE
+    cap;
+  uint64_t
+    bytes = 0;
+  int64_t
+    start;
+
+  while (--argc)
+    {
+      ++argv;
+      if (!strcmp(*argv, "-m") && (argc > 1))
+	{
+	  --argc;
+	  ++argv;
+	  if (!strcmp(*argv, "records"))
+	    kind = kVTCaptureKindRecord;
+	  else if (!strcmp(*argv, "output"))
+	    kind = kVTCaptureKindOutput;
+	  else
+	    {
+	      PrintUsage();
+	      return(2);
+	    }
+	}
+      else if (!strcmp(*argv, "-o") && (argc > 1))
+	{
+	  --argc;
+	  ++argv;
+	  if (!strcmp(*argv, "null"))
+	    sink = kSinkNull;
+	  else if (!strcmp(*argv, "raw"))
+	    sink = kSinkRaw;
+	  else if (!strcmp(*argv, "vt100"))
+	    sink = kSinkVT100;
+	  else if (!strcmp(*argv, "hpterm"))
+	    sink = kSinkHPTerm;
+	  else
+	    {
+	      PrintUsage();
+	      return(2);
+	    }
+	}
+      else if (!strcmp(*argv, "-p"))
+	paced = true;
+      else if (!strcmp(*argv, "-x") && (argc > 1))
+	{
+	  --argc;
+	  factor = atof(*(++argv));
+	}
+      else if (!strcmp(*argv, "-n") && (argc > 1))
+	{
+	  --argc;
+	  passes = atoi(*(++argv));
+	}
+      else if (!strcmp(*argv, "-S"))
+	show_screen = true;
+      else if (((*argv)[0] != '-') && (file_name == NULL))
+	file_name = *argv;
+      else
+	{
+	  PrintUsage();
+	  return(2);
+	}
+    }
+  if ((file_name == NULL) || (passes < 1) || (factor <= 0.0))
+    {
+      PrintUsage();
+      return(2);
+    }
+
+  memset(&cap, 0, sizeof(cap));
+  if (LoadCapture(file_name, &cap, &what))
+    return(1);
+  if (!(what & ((kind == kVTCaptureKindRecord) ?
+		kVTCaptureRecords : kVTCaptureOutput)))
+    {
+      fprintf(stderr, "vt3kreplay: %s has no %s.\n", file_name,
+	      (kind == kVTCaptureKindRecord) ? "records" : "output");
+      return(1);
+    }
+  for (i = 0; i < cap.count; i++)
+    if (cap.entries[i].kind == kind)
+      ++entries;
+
+  if (sink == kSinkHPTerm)
+    {
+      memset(screen, ' ', sizeof(screen));
+      init_hpterm();
+      hpterm_winsize(SCREEN_ROWS, SCREEN_COLS);
+    }
+
+  start = MyMonotonicNsec();
+  for (pass = 0; pass < passes; pass++)
+    if (Replay(&cap, kind, sink, paced, factor, &bytes))
+      return(1);
+  secs = (double)(MyMonotonicNsec() - start) / 1e9;
+
+  if ((sink == kSinkHPTerm) && (show_screen))
+    PrintScreen();
+  fflush(stdout);
+  fprintf(stderr, "vt3kreplay: %d %s x %d in %.3f s: %.0f/s, %.2f MB/s\n",
+	  entries, (kind == kVTCaptureKindRecord) ? "records" : "outputs",
+	  passes, secs, (secs > 0) ? entries * passes / secs : 0.0,
+	  (secs > 0) ? bytes / secs / 1e6 : 0.0);
+
+  for (i = 0; i < cap.count; i++)
+    free(cap.entries[i].data);
+  free(cap.entries);
+  return(0);
+
+} /*main*/
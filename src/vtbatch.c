@@ -0,0 +1,259 @@
+/*
+This file is part of FreeVT3k.
+
+FreeVT3k is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+FreeVT3k is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License along
+with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/************************************************************
+ * vtbatch.c -- Headless output writer
+ *
+ * For scripted sessions whose output goes to a file or a
+ *   pipe rather than a terminal. The host's output is taken
+ *   as it comes from the connection, with no translation and
+ *   no logging, and collected into large writes.
+ *
+ * Optionally the HP escape sequences are stripped on the way,
+ *   leaving plain text: CRs, other controls and escape
+ *   sequences go, and line feeds, tabs and form feeds stay.
+ *   A sequence may be split across records; the state
+ *   carries over.
+ ************************************************************/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "vtbatch.h"
+
+/* What the strip filter does with each byte; see BuildClasses() */
+
+#define kStripText		0x01	/* Kept, outside a sequence */
+#define kStripEscape		0x02	/* Starts a sequence */
+#define kStripIntro		0x04	/* After ESC: parameters follow */
+#define kStripFinal		0x08	/* Ends a sequence with parameters */
+
+enum
+{
+    kStripGround,
+    kStripEsc,
+    kStripParam
+};
+
+struct stVTBatch
+{
+    int			fFd;
+    bool		fStdout;
+    bool		fStrip;
+    int			fState;
+    int			fEscLength;
+    int			fError;		/* First write error, or 0 */
+    size_t		fLength;
+    char		fBuffer[kVT_BATCH_BUFFER];
+};
+
+static unsigned char sClass[256];
+static bool sClassReady = false;
+
+/*
+ * Two character sequences (cursor moves, clears, tabs, margins, status
+ *   requests) end with the character after the ESC. Those starting
+ *   '&', '*', '(' or ')' run on to a capital, '@', '^' or '~', as in
+ *   ESC &a12c5Y, ESC &dB or ESC *s^.
+ */
+static void BuildClasses(void)
+{ /*BuildClasses*/
+    int ch;
+
+    for (ch = ' '; ch < 0x7F; ch++)
+	sClass[ch] |= kStripText;
+    for (ch = 0x80; ch < 0x100; ch++)
+	sClass[ch] |= kStripText;	/* Roman8 */
+    sClass['\n'] |= kStripText;
+    sClass['\t'] |= kStripText;
+    sClass['\f'] |= kStripText;
+    sClass[0x1B] |= kStripEscape;
+    sClass['&'] |= kStripIntro;
+    sClass['*'] |= kStripIntro;
+    sClass['('] |= kStripIntro;
+    sClass[')'] |= kStripIntro;
+    for (ch = 'A'; ch <= 'Z'; ch++)
+	sClass[ch] |= kStripFinal;
+    sClass['@'] |= kStripFinal;
+    sClass['^'] |= kStripFinal;
+    sClass['~'] |= kStripFinal;
+    sClassReady = true;
+} /*BuildClasses*/
+
+static void WriteAll(tVTBatch * batch, const char * buf, size_t length)
+{ /*WriteAll*/
+    ssize_t written;
+
+    while ((length > 0) && (!batch->fError))
+	{
+	written = write(batch->fFd, buf, length);
+	if (written < 0)
+	    {
+	    if (errno != EINTR)
+		batch->fError = errno;
+	    continue;
+	    }
+	buf += written;
+	length -= written;
+	}
+} /*WriteAll*/
+
+static void Flush(tVTBatch * batch)
+{ /*Flush*/
+    WriteAll(batch, batch->fBuffer, batch->fLength);
+    batch->fLength = 0;
+} /*Flush*/
+
+static void Put(tVTBatch * batch, const char * buf, size_t length)
+{ /*Put*/
+    if (batch->fError)
+	return;
+    if (batch->fLength + length > sizeof(batch->fBuffer))
+	Flush(batch);
+    if (length >= sizeof(batch->fBuffer))
+	WriteAll(batch, buf, length);
+    else
+	{
+	memcpy(batch->fBuffer + batch->fLength, buf, length);
+	batch->fLength += length;
+	}
+} /*Put*/
+
+static void Strip(tVTBatch * batch, const char * buf, size_t length)
+{ /*Strip*/
+    const unsigned char * ptr = (const unsigned char *) buf;
+    const unsigned char * end = ptr + length;
+    const unsigned char * run;
+
+    while (ptr < end)
+	{
+	switch (batch->fState)
+	    {
+	    case kStripGround:
+		/* Text goes out a run at a time */
+		for (run = ptr; (ptr < end) && (sClass[*ptr] & kStripText); ptr++)
+		    ;
+		if (ptr > run)
+		    Put(batch, (const char *) run, ptr - run);
+		if (ptr == end)
+		    break;
+		if (sClass[*ptr] & kStripEscape)
+		    batch->fState = kStripEsc;
+		ptr++;
+		break;
+
+	    case kStripEsc:
+		batch->fState = (sClass[*ptr] & kStripIntro) ? kStripParam : kStripGround;
+		batch->fEscLength = 0;
+		ptr++;
+		break;
+
+	    case kStripParam:
+		/* A runaway sequence must not eat the rest of the report */
+		if (sClass[*ptr] & kStripEscape)
+		    batch->fState = kStripEsc;
+		else if ((sClass[*ptr] & kStripFinal) ||
+		    (++batch->fEscLength >= kVT_BATCH_MAX_ESCAPE))
+		    batch->fState = kStripGround;
+		ptr++;
+		break;
+	    }
+	}
+} /*Strip*/
+
+tVTBatch * VTBatchOpen(const char * fileName, bool strip)
+{ /*VTBatchOpen*/
+    tVTBatch * batch;
+
+    batch = (tVTBatch *) calloc(1, sizeof(tVTBatch));
+    if (batch == NULL)
+	return NULL;
+    if (!strcmp(fileName, "-"))
+	{
+	batch->fFd = STDOUT_FILENO;
+	batch->fStdout = true;
+	}
+    else if ((batch->fFd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+	{
+	free(batch);
+	return NULL;
+	}
+    batch->fStrip = strip;
+    batch->fState = kStripGround;
+    if ((strip) && (!sClassReady))
+	BuildClasses();
+    return batch;
+} /*VTBatchOpen*/
+
+void VTBatchOutProc(intptr_t refCon, char * buffer, size_t bufferLength)
+{ /*VTBatchOutProc*/
+    tVTBatch * batch = (tVTBatch *) refCon;
+
+    if (batch->fStrip)
+	Strip(batch, buffer, bufferLength);
+    else
+	Put(batch, buffer, bufferLength);
+} /*VTBatchOutProc*/
+
+void VTBatchOutVProc(intptr_t refCon, const struct iovec * iov, int iovCount)
+{ /*VTBatchOutVProc*/
+    int i;
+
+    for (i = 0; i < iovCount; i++)
+	VTBatchOutProc(refCon, (char *) iov[i].iov_base, iov[i].iov_len);
+} /*VTBatchOutVProc*/
+
+int VTBatchError(tVTBatch * batch)
+{ /*VTBatchError*/
+    return batch->fError;
+} /*VTBatchError*/
+
+int VTBatchClose(tVTBatch * batch)
+{ /*VTBatchClose*/
+    int error;
+
+    if (batch == NULL)
+	return 0;
+    Flush(batch);
+    if ((!batch->fStdout) && (close(batch->fFd) == -1) && (!batch->fError))
+	batch->fError = errno;
+    error = batch->fError;
+    free(batch);
+    if (error)
+	{
+	errno = error;
+	return -1;
+	}
+    return 0;
+} /*VTBatchClose*/
+
+/* Local Variables: */
+/* c-indent-level: 0 */
+/* c-continued-statement-offset: 4 */
+/* c-brace-offset: 0 */
+/* c-argdecl-indent: 4 */
+/* c-label-offset: -4 */
+/* End: */
@@ -0,0 +1,39 @@
+/*
+This file is part of FreeVT3k.
+
+FreeVT3k is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+FreeVT3k is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License along
+with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/************************************************************
+ * vtbatch.h -- Headless output writer
+ ************************************************************/
+
+#define kVT_BATCH_BUFFER	(1024 * 1024)
+#define kVT_BATCH_MAX_ESCAPE	(64)	/* Longer than this is not an escape */
+
+typedef struct stVTBatch tVTBatch;
+
+/* VTBatchOpen() takes "-" for stdout. Pass the writer as the data-out	*/
+/* refCon, with VTBatchOutProc and VTBatchOutVProc as the procs.	*/
+
+tVTBatch * VTBatchOpen(const char * fileName, bool strip);
+void VTBatchOutProc(intptr_t refCon, char * buffer, size_t bufferLength);
+void VTBatchOutVProc(intptr_t refCon, const struct iovec * iov, int iovCount);
+
+/* The first write error is kept, and everything after it is thrown	*/
+/* away. VTBatchError() returns its errno, or 0; VTBatchClose() flushes	*/
+/* and returns -1 with errno set if anything was lost.			*/
+
+int  VTBatchError(tVTBatch * batch);
+int  VTBatchClose(tVTBatch * batch);
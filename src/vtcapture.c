@@ -0,0 +1,397 @@
+/*
+This file is part of FreeVT3k.
+
+FreeVT3k is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+FreeVT3k is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License along
+with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/************************************************************
+ * vtcapture.c -- Session capture
+ *
+ * Entries go into a single-producer, single-consumer ring.
+ *   The connection's thread only ever copies into it; a
+ *   writer thread moves it to the file, sleeping while it
+ *   is empty. Past half full the producer yields the CPU, so
+ *   a writer sharing it can catch up; if it still falls
+ *   behind, entries are dropped and counted rather than
+ *   holding up the socket loop. Without threads, the ring
+ *   is written out inline whenever it gets half full.
+ ************************************************************/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#  include <sched.h>
+#endif
+
+#include "vt.h"
+#include "vtconn.h"
+#include "vtcapture.h"
+#include "timers.h"
+
+struct stVTCapture
+{
+    int			fFd;
+    int			fWhat;
+    int64_t		fStart;
+    char *		fRing;
+    size_t		fMask;
+    uint32_t		fDropped;	/* Not yet reported in the file */
+
+    /* Head is the writer's, tail the producer's. They sit on their	*/
+    /* own cache lines so the two threads don't fight over one.	*/
+
+    char		fPad0[64];
+    _Atomic size_t	fHead;
+    char		fPad1[64];
+    _Atomic size_t	fTail;
+    char		fPad2[64];
+    _Atomic bool	fStop;
+    _Atomic int		fWriteError;
+#ifdef HAVE_PTHREAD
+    /* The writer sleeps on fCond with fWriterIdle set while the ring	*/
+    /* is empty; the producer wakes it when it puts something in.	*/
+
+    _Atomic bool	fWriterIdle;
+    pthread_mutex_t	fLock;
+    pthread_cond_t	fCond;
+    pthread_t		fWriter;
+#endif
+};
+
+static void PutBytes(tVTCapture * cap, size_t pos, const void * src, size_t length)
+{ /*PutBytes*/
+    size_t off = pos & cap->fMask;
+    size_t first = cap->fMask + 1 - off;
+
+    if (first >= length)
+	memcpy(cap->fRing + off, src, length);
+    else
+	{
+	memcpy(cap->fRing + off, src, first);
+	memcpy(cap->fRing, (const char *) src + first, length - first);
+	}
+} /*PutBytes*/
+
+static void PutHeader(tVTCapture * cap, size_t pos, int kind, int length,
+		      uint64_t when)
+{ /*PutHeader*/
+    unsigned char hdr[kVTCaptureEntryHeader];
+    uint32_t word;
+
+    hdr[0] = kind;
+    hdr[1] = 0;
+    hdr[2] = (length >> 8) & 0xff;
+    hdr[3] = length & 0xff;
+    word = htonl((uint32_t) (when >> 32));
+    memcpy(hdr + 4, &word, 4);
+    word = htonl((uint32_t) when);
+    memcpy(hdr + 8, &word, 4);
+    PutBytes(cap, pos, hdr, sizeof(hdr));
+} /*PutHeader*/
+
+/* Write out whatever is in the ring. Returns false once there is	*/
+/* nothing left to write.						*/
+
+static bool DrainRing(tVTCapture * cap)
+{ /*DrainRing*/
+    size_t head = atomic_load_explicit(&cap->fHead, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&cap->fTail, memory_order_acquire);
+    size_t off, length;
+    ssize_t written;
+
+    if (head == tail)
+	return false;
+    off = head & cap->fMask;
+    length = tail - head;
+    if (length > cap->fMask + 1 - off)
+	length = cap->fMask + 1 - off;
+    written = write(cap->fFd, cap->fRing + off, length);
+    if (written < 0)
+	{
+	if (errno == EINTR)
+	    return true;
+	/* Keep draining so the producer never stalls; the file is	*/
+	/* lost anyway.							*/
+	atomic_store_explicit(&cap->fWriteError, errno, memory_order_relaxed);
+	written = length;
+	}
+    atomic_store_explicit(&cap->fHead, head + written, memory_order_release);
+    return true;
+} /*DrainRing*/
+
+#ifdef HAVE_PTHREAD
+static void Wake(tVTCapture * cap)
+{ /*Wake*/
+    pthread_mutex_lock(&cap->fLock);
+    pthread_cond_broadcast(&cap->fCond);
+    pthread_mutex_unlock(&cap->fLock);
+} /*Wake*/
+
+static void * WriterThread(void * arg)
+{ /*WriterThread*/
+    tVTCapture * cap = (tVTCapture *) arg;
+    size_t head;
+
+    for (;;)
+	{
+	if (DrainRing(cap))
+	    continue;
+	head = atomic_load_explicit(&cap->fHead, memory_order_relaxed);
+	pthread_mutex_lock(&cap->fLock);
+	atomic_store(&cap->fWriterIdle, true);
+	while ((atomic_load(&cap->fTail) == head) &&
+	       (!atomic_load(&cap->fStop)))
+	    pthread_cond_wait(&cap->fCond, &cap->fLock);
+	atomic_store(&cap->fWriterIdle, false);
+	pthread_mutex_unlock(&cap->fLock);
+	if (atomic_load(&cap->fTail) == head)
+	    break;		/* Stopped, and nothing left */
+	}
+    return NULL;
+} /*WriterThread*/
+#endif
+
+static void Put(tVTCapture * cap, int kind, const struct iovec * iov,
+		int iovCount, size_t length)
+{ /*Put*/
+    size_t head = atomic_load_explicit(&cap->fHead, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&cap->fTail, memory_order_relaxed);
+    size_t need = kVTCaptureEntryHeader + length;
+    uint64_t when = (uint64_t) (MyMonotonicNsec() - cap->fStart);
+    unsigned char count[4];
+    uint32_t word;
+
+    if (cap->fDropped)
+	need += kVTCaptureEntryHeader + sizeof(count);
+    if ((cap->fMask + 1) - (tail - head) < need)
+	{
+	cap->fDropped++;
+	return;
+	}
+    if (cap->fDropped)
+	{
+	word = htonl(cap->fDropped);
+	memcpy(count, &word, sizeof(count));
+	PutHeader(cap, tail, kVTCaptureKindDropped, sizeof(count), when);
+	PutBytes(cap, tail + kVTCaptureEntryHeader, count, sizeof(count));
+	tail += kVTCaptureEntryHeader + sizeof(count);
+	cap->fDropped = 0;
+	}
+    PutHeader(cap, tail, kind, length, when);
+    tail += kVTCaptureEntryHeader;
+    for (; iovCount > 0; --iovCount, ++iov)
+	{
+	PutBytes(cap, tail, iov->iov_base, iov->iov_len);
+	tail += iov->iov_len;
+	}
+#ifdef HAVE_PTHREAD
+    atomic_store(&cap->fTail, tail);
+    if (atomic_exchange(&cap->fWriterIdle, false))
+	Wake(cap);
+    else if (tail - head > (cap->fMask + 1) / 2)
+	sched_yield();
+#else
+    atomic_store_explicit(&cap->fTail, tail, memory_order_release);
+    if (tail - head > (cap->fMask + 1) / 2)
+	while (DrainRing(cap))
+	    ;
+#endif
+} /*Put*/
+
+int VTCaptureStart(tVTConnection * conn, const char * fileName, int what)
+{ /*VTCaptureStart*/
+    tVTCapture * cap;
+    unsigned char hdr[kVTCaptureFileHeader];
+    uint32_t word;
+
+    if (conn->fCapture)
+	return kVTCNoError;
+    cap = (tVTCapture *) calloc(1, sizeof(tVTCapture));
+    if (cap == NULL)
+	return kVTCMemoryAllocationError;
+    cap->fRing = (char *) malloc(kVT_CAPTURE_RING);
+    if (cap->fRing == NULL)
+	{
+	free(cap);
+	return kVTCMemoryAllocationError;
+	}
+    cap->fMask = kVT_CAPTURE_RING - 1;
+    cap->fWhat = what;
+    atomic_init(&cap->fHead, 0);
+    atomic_init(&cap->fTail, 0);
+    atomic_init(&cap->fStop, false);
+    atomic_init(&cap->fWriteError, 0);
+
+    cap->fFd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (cap->fFd == -1)
+	goto Error;
+    memcpy(hdr, kVTCaptureMagic, 8);
+    word = htonl((uint32_t) time(NULL));
+    memcpy(hdr + 8, &word, 4);
+    word = htonl((uint32_t) what);
+    memcpy(hdr + 12, &word, 4);
+    if (write(cap->fFd, hdr, sizeof(hdr)) != sizeof(hdr))
+	goto Error;
+    cap->fStart = MyMonotonicNsec();
+#ifdef HAVE_PTHREAD
+    atomic_init(&cap->fWriterIdle, false);
+    pthread_mutex_init(&cap->fLock, NULL);
+    pthread_cond_init(&cap->fCond, NULL);
+    if (pthread_create(&cap->fWriter, NULL, WriterThread, cap))
+	{
+	pthread_cond_destroy(&cap->fCond);
+	pthread_mutex_destroy(&cap->fLock);
+	goto Error;
+	}
+#endif
+    conn->fCapture = cap;
+    return kVTCNoError;
+
+Error:
+    if (cap->fFd != -1)
+	close(cap->fFd);
+    free(cap->fRing);
+    free(cap);
+    return kVTCFileError;
+} /*VTCaptureStart*/
+
+void VTCaptureRecord(tVTConnection * conn, const char * record, int length)
+{ /*VTCaptureRecord*/
+    struct iovec iov;
+
+    if (!(conn->fCapture->fWhat & kVTCaptureRecords))
+	return;
+    iov.iov_base = (void *) record;
+    iov.iov_len = length;
+    Put(conn->fCapture, kVTCaptureKindRecord, &iov, 1, length);
+} /*VTCaptureRecord*/
+
+void VTCaptureOutput(tVTConnection * conn, const struct iovec * iov, int iovCount)
+{ /*VTCaptureOutput*/
+    tVTCapture * cap = conn->fCapture;
+    struct iovec piece;
+    size_t total = 0;
+    size_t off, length;
+    int i;
+
+    if (!(cap->fWhat & kVTCaptureOutput))
+	return;
+    for (i = 0; i < iovCount; i++)
+	total += iov[i].iov_len;
+    if (total == 0)
+	return;
+    if (total <= kVTCaptureMaxData)
+	{
+	Put(cap, kVTCaptureKindOutput, iov, iovCount, total);
+	return;
+	}
+
+    /* Too big for one entry; a replay joins them up again anyway */
+
+    for (i = 0; i < iovCount; i++)
+	{
+	for (off = 0; off < iov[i].iov_len; off += length)
+	    {
+	    length = iov[i].iov_len - off;
+	    if (length > kVTCaptureMaxData)
+		length = kVTCaptureMaxData;
+	    piece.iov_base = (char *) iov[i].iov_base + off;
+	    piece.iov_len = length;
+	    Put(cap, kVTCaptureKindOutput, &piece, 1, length);
+	    }
+	}
+} /*VTCaptureOutput*/
+
+void VTCaptureStop(tVTConnection * conn)
+{ /*VTCaptureStop*/
+    tVTCapture * cap = conn->fCapture;
+    int error;
+
+    if (cap == NULL)
+	return;
+    atomic_store_explicit(&cap->fStop, true, memory_order_release);
+#ifdef HAVE_PTHREAD
+    Wake(cap);
+    pthread_join(cap->fWriter, NULL);
+    pthread_cond_destroy(&cap->fCond);
+    pthread_mutex_destroy(&cap->fLock);
+#else
+    while (DrainRing(cap))
+	;
+#endif
+    if ((error = atomic_load_explicit(&cap->fWriteError, memory_order_relaxed)))
+	fprintf(stderr, "Capture file: %s\n", strerror(error));
+    else if (cap->fDropped)
+	fprintf(stderr, "Capture file: %u entries lost at the end\n",
+		(unsigned) cap->fDropped);
+    close(cap->fFd);
+    free(cap->fRing);
+    free(cap);
+    conn->fCapture = NULL;
+} /*VTCaptureStop*/
+
+int VTCaptureOpen(FILE * fp, int * what)
+{ /*VTCaptureOpen*/
+    unsigned char hdr[kVTCaptureFileHeader];
+    uint32_t word;
+
+    if ((fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)) ||
+	(memcmp(hdr, kVTCaptureMagic, 8)))
+	return -1;
+    memcpy(&word, hdr + 12, 4);
+    if (what)
+	*what = (int) ntohl(word);
+    return 0;
+} /*VTCaptureOpen*/
+
+int VTCaptureRead(FILE * fp, tVTCaptureEntry * entry, char * data)
+{ /*VTCaptureRead*/
+    unsigned char hdr[kVTCaptureEntryHeader];
+    uint32_t high, low;
+    size_t got;
+
+    got = fread(hdr, 1, sizeof(hdr), fp);
+    if (got == 0)
+	return 0;
+    if (got != sizeof(hdr))
+	return -1;
+    entry->fKind = hdr[0];
+    entry->fLength = (hdr[2] << 8) | hdr[3];
+    memcpy(&high, hdr + 4, 4);
+    memcpy(&low, hdr + 8, 4);
+    entry->fTime = ((uint64_t) ntohl(high) << 32) | ntohl(low);
+    if (fread(data, 1, entry->fLength, fp) != (size_t) entry->fLength)
+	return -1;
+    return 1;
+} /*VTCaptureRead*/
+
+/* Local Variables: */
+/* c-indent-level: 0 */
+/* c-continued-statement-offset: 4 */
+/* c-brace-offset: 0 */
+/* c-argdecl-indent: 4 */
+/* c-label-offset: -4 */
+/* End: */
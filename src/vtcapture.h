@@ -0,0 +1,72 @@
+/*
+This file is part of FreeVT3k.
+
+FreeVT3k is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+FreeVT3k is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License along
+with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/************************************************************
+ * vtcapture.h -- Session capture file format
+ ************************************************************/
+
+/* A capture file is a 16 byte file header followed by entries, each	*/
+/* a 12 byte entry header and its data. Multi-byte fields are in	*/
+/* network order, like the records themselves.				*/
+/*									*/
+/*   file header:  magic[8] "VT3KCAP1", start (uint32, time(2)	*/
+/*		   seconds), what (uint32, kVTCapture* bits)		*/
+/*   entry header: kind (uint8), unused (uint8), length (uint16),	*/
+/*		   time (uint32 high, uint32 low; monotonic ns since	*/
+/*		   the capture started)					*/
+/*									*/
+/* A record entry is one NS/VT record exactly as it came off the	*/
+/* wire, length word included. An output entry is the terminal bytes	*/
+/* one call of VTDataOut() produced. A dropped entry carries a uint32	*/
+/* count of entries lost because the writer fell behind.		*/
+
+#define kVTCaptureMagic		"VT3KCAP1"
+#define kVTCaptureFileHeader	16
+#define kVTCaptureEntryHeader	12
+#define kVTCaptureMaxData	65535
+
+#define kVTCaptureKindRecord	1
+#define kVTCaptureKindOutput	2
+#define kVTCaptureKindDropped	3
+
+/* What to capture */
+
+#define kVTCaptureRecords	0x01
+#define kVTCaptureOutput	0x02
+
+#define kVT_CAPTURE_RING	(1024 * 1024)	/* Power of two */
+
+typedef struct
+{
+    int			fKind;
+    int			fLength;
+    uint64_t		fTime;		/* ns since the capture began */
+} tVTCaptureEntry;
+
+/* Writing; the hooks are called from vtconn.c */
+
+int  VTCaptureStart(tVTConnection * conn, const char * fileName, int what);
+void VTCaptureRecord(tVTConnection * conn, const char * record, int length);
+void VTCaptureOutput(tVTConnection * conn, const struct iovec * iov, int iovCount);
+void VTCaptureStop(tVTConnection * conn);
+
+/* Reading. VTCaptureRead() returns 1 with an entry, 0 at the end of	*/
+/* the file and -1 if the file is damaged. data must have room for	*/
+/* kVTCaptureMaxData bytes.						*/
+
+int  VTCaptureOpen(FILE * fp, int * what);
+int  VTCaptureRead(FILE * fp, tVTCaptureEntry * entry, char * data);
@@ -31,12 +31,16 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
 #include <ctype.h>
 #include <sys/types.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #ifdef HAVE_TERMIOS_H
 # include <termios.h>
 typedef struct termios TERMIO, *PTERMIO;
@@ -66,110 +70,437 @@ typedef struct termio TERMIO, *PTERMIO;
 #include "logging.h"
 #include "timers.h"
 #include "kbdtable.h"
+#include "vtoutput.h"
 
 /* Global variables */
 
 #define DFLT_BREAK_MAX		(3)
 #define DFLT_BREAK_TIMER	(1)
 
-bool done = false;
-bool stop_at_eof = false;
-
-/* Current line awaiting send to satisfy an FREAD request */
-#define MAX_INPUT_REC		(kVT_MAX_BUFFER)
-char
-	input_rec[MAX_INPUT_REC];
-int input_rec_len = 0;
-
-/* Circular input queue parms */
-#define MAX_INPUT_QUEUE		(kVT_MAX_BUFFER)
-char
-	input_queue[MAX_INPUT_QUEUE],
-	*inq_rptr = input_queue,
-	*inq_wptr = input_queue;
-int
-	input_queue_len = 0;
-
-/* Immediate queue for things like status requests, etc. */
-#define MAX_IMM_INPUT_QUEUE	(256)
-char
-	imm_input_queue[MAX_IMM_INPUT_QUEUE],
-	*imm_inq_rptr = imm_input_queue,
-	*imm_inq_wptr = imm_input_queue;
-int
-	imm_input_queue_len = 0;
-
 /* Miscellaneous stuff */
 bool
 	translate = false;
 
-void FlushQ(void)
+void FlushQ(tVTConnection *conn)
 { /*FlushQ*/
 
-    input_queue_len = 0;
-    inq_rptr = inq_wptr = input_queue;
-    imm_input_queue_len = 0;
-    imm_inq_rptr = imm_inq_wptr = imm_input_queue;
+  tVTInput
+    *in = conn->fInput;
+
+  DiscardAheadQ(conn);
+  if (in->fFeeding)
+    in->fFeedEOF = true;	/* The rest of the input file goes too */
+  in->fQueueLength = 0;
+  in->fQueueRead = in->fQueueWrite = in->fQueue;
+  in->fImmQueueLength = 0;
+  in->fImmQueueRead = in->fImmQueueWrite = in->fImmQueue;
 
 } /*FlushQ*/
 
-int GetQ(void)
+int GetQ(tVTConnection *conn)
 { /*GetQ*/
 
+  tVTInput
+    *in = conn->fInput;
+
 /*
  * Get a byte from the immediate queue if one's present, else
  *   get it from the normal circular queue.
  */
-  if (imm_input_queue_len)
+  if (in->fImmQueueLength)
     {
-      if (++imm_inq_rptr == &imm_input_queue[MAX_IMM_INPUT_QUEUE])
-	imm_inq_rptr = imm_input_queue;
-      --imm_input_queue_len;
-      return(*imm_inq_rptr);
+      if (++in->fImmQueueRead == &in->fImmQueue[kVT_IMM_INPUT_QUEUE])
+	in->fImmQueueRead = in->fImmQueue;
+      --in->fImmQueueLength;
+      return(*in->fImmQueueRead);
     }
-  if (input_queue_len)
+  if (in->fQueueLength)
     {
-      if (++inq_rptr == &input_queue[MAX_INPUT_QUEUE])
-	inq_rptr = input_queue;
-      --input_queue_len;
-      return(*inq_rptr);
+      if (++in->fQueueRead == &in->fQueue[kVT_INPUT_QUEUE])
+	in->fQueueRead = in->fQueue;
+      --in->fQueueLength;
+      return(*in->fQueueRead);
     }
   return(-1);
     
 } /*GetQ*/
 
-int PutQ(char ch)
+int PutQ(tVTConnection *conn, char ch)
 { /*PutQ*/
 
-  if (++inq_wptr == &input_queue[MAX_INPUT_QUEUE])
-    inq_wptr = input_queue;
-  if (inq_wptr == inq_rptr)
+  tVTInput
+    *in = conn->fInput;
+
+  if (++in->fQueueWrite == &in->fQueue[kVT_INPUT_QUEUE])
+    in->fQueueWrite = in->fQueue;
+  if (in->fQueueWrite == in->fQueueRead)
     {
       fprintf(stderr, "<queue overflow>\n");
       return(-1);
     }
-  ++input_queue_len;
-  *inq_wptr = ch;
+  ++in->fQueueLength;
+  *in->fQueueWrite = ch;
   return(0);
 
 } /*PutQ*/
 
-int PutImmediateQ(char ch)
+/* PutQ for a run of characters; as much as fits goes in */
+int PutQBuffer(tVTConnection *conn, const char *buf, int len)
+{ /*PutQBuffer*/
+
+  tVTInput
+    *in = conn->fInput;
+  int
+    room = kVT_INPUT_QUEUE - 1 - in->fQueueLength,
+    off,
+    first,
+    returnValue = 0;
+
+  if (len > room)
+    {
+      fprintf(stderr, "<queue overflow>\n");
+      len = room;
+      returnValue = -1;
+    }
+  if (len <= 0)
+    return(returnValue);
+  off = (in->fQueueWrite - in->fQueue) + 1;
+  if (off == kVT_INPUT_QUEUE)
+    off = 0;
+  first = kVT_INPUT_QUEUE - off;
+  if (first > len)
+    first = len;
+  memcpy(&in->fQueue[off], buf, first);
+  memcpy(in->fQueue, buf + first, len - first);
+  off += len - 1;
+  if (off >= kVT_INPUT_QUEUE)
+    off -= kVT_INPUT_QUEUE;
+  in->fQueueWrite = &in->fQueue[off];
+  in->fQueueLength += len;
+  return(returnValue);
+
+} /*PutQBuffer*/
+
+int PutImmediateQ(tVTConnection *conn, char ch)
 { /*PutImmediateQ*/
 
-  if (++imm_inq_wptr == &imm_input_queue[MAX_IMM_INPUT_QUEUE])
-    imm_inq_wptr = imm_input_queue;
-  if (imm_inq_wptr == imm_inq_rptr)
+  tVTInput
+    *in = conn->fInput;
+
+  if (++in->fImmQueueWrite == &in->fImmQueue[kVT_IMM_INPUT_QUEUE])
+    in->fImmQueueWrite = in->fImmQueue;
+  if (in->fImmQueueWrite == in->fImmQueueRead)
     {
       fprintf(stderr, "<immediate queue overflow>\n");
       return(-1);
     }
-  ++imm_input_queue_len;
-  *imm_inq_wptr = ch;
+  ++in->fImmQueueLength;
+  *in->fImmQueueWrite = ch;
   return(0);
 
 } /*PutImmediateQ*/
 
+int PutLogonQ(tVTConnection *conn, const char *text, int length,
+	      bool secret)
+{ /*PutLogonQ*/
+
+  tVTInput
+    *in = conn->fInput;
+  tVTLogonLine
+    *line;
+
+  if ((in->fLogonLines == kVT_LOGON_LINES) ||
+      (length > kVT_LOGON_LENGTH))
+    {
+      fprintf(stderr, "<logon queue overflow>\n");
+      return(-1);
+    }
+  line = &in->fLogon[in->fLogonLines++];
+  memcpy(line->fText, text, length);
+  line->fLength = length;
+  line->fSecret = secret;
+  return(0);
+
+} /*PutLogonQ*/
+
+/*
+ * A logon profile holds the dialogue that follows the colon prompt,
+ *   one line per read:
+ *
+ *	# comment
+ *	hello USER.ACCOUNT,GROUP	sent as "HELLO USER.ACCOUNT,GROUP"
+ *	password secret			sent without echo, never logged
+ *	line text			sent as it stands
+ *
+ *   Returns 0, or -1 after saying what was wrong.
+ */
+int LoadLogonProfile(tVTConnection *conn, const char *fileName)
+{ /*LoadLogonProfile*/
+
+  FILE
+    *fp;
+  struct stat
+    st;
+  char
+    buf[kVT_LOGON_LENGTH + 32],
+    text[kVT_LOGON_LENGTH + 32],
+    *key,
+    *arg,
+    *ptr;
+  int
+    line_no = 0,
+    len,
+    returnValue = 0;
+  bool
+    secret,
+    have_secret = false;
+
+  if ((fp = fopen(fileName, "r")) == (FILE*)NULL)
+    {
+      perror(fileName);
+      return(-1);
+    }
+  while ((returnValue == 0) && (fgets(buf, sizeof(buf), fp) != NULL))
+    {
+      ++line_no;
+      if ((ptr = strpbrk(buf, "\r\n")) != NULL)
+	*ptr = 0;
+      for (key = buf; isspace((unsigned char)*key); key++)
+	;
+      if ((!*key) || (*key == '#'))
+	continue;
+      for (arg = key; (*arg) && (!isspace((unsigned char)*arg)); arg++)
+	;
+      if (*arg)
+	*arg++ = 0;
+      while (isspace((unsigned char)*arg))
+	++arg;
+      secret = false;
+      if (!strcasecmp(key, "hello"))
+	len = snprintf(text, sizeof(text), "HELLO %s", arg);
+      else if (!strcasecmp(key, "password"))
+	{
+	  len = snprintf(text, sizeof(text), "%s", arg);
+	  secret = have_secret = true;
+	}
+      else if (!strcasecmp(key, "line"))
+	len = snprintf(text, sizeof(text), "%s", arg);
+      else
+	{
+	  fprintf(stderr, "%s: line %d: unknown keyword '%s'\n",
+		  fileName, line_no, key);
+	  returnValue = -1;
+	  break;
+	}
+      if (PutLogonQ(conn, text, len, secret))
+	returnValue = -1;
+    }
+  memset(buf, 0, sizeof(buf));
+  memset(text, 0, sizeof(text));
+  if ((returnValue == 0) && (have_secret) &&
+      (fstat(fileno(fp), &st) == 0) && (st.st_mode & (S_IRWXG | S_IRWXO)))
+    fprintf(stderr, "Warning: %s holds passwords but others can read it.\n",
+	    fileName);
+  fclose(fp);
+  return(returnValue);
+
+} /*LoadLogonProfile*/
+
+/*
+ * An input file (-a, -I) is fed into the ring a piece at a time as reads
+ *   take from it, so it can be any size. A regular file is mapped;
+ *   anything else is read. A pipe, socket or tty is read without
+ *   blocking, and the caller waits for it to be readable when FeedQ()
+ *   gets nothing; other devices (/dev/null) can't be waited on. As
+ *   when the file was preloaded, each newline is sent as a CR, and a
+ *   typeahead flush (FlushQ) throws away the rest of the file, not just
+ *   what is in the ring; the feed never resumes part way into a line.
+ *   A kVT_SCRIPT_ENTER line is sent as RS, for block mode reads.
+ */
+#define FEED_CHUNK		(4096)
+
+/*
+ * Copies a piece of the file to 'out' the way it is to be sent, and
+ *   returns how long that came to. fFeedMark counts how much of a
+ *   kVT_SCRIPT_ENTER line has been seen at the start of the current
+ *   line, -1 once it can't be one; what it has seen is held back until
+ *   the line shows what it is, so 'out' needs room for that too.
+ */
+static int FeedLines(tVTInput *in, const char *buf, int len, char *out)
+{ /*FeedLines*/
+
+  char
+    *start = out;
+  int
+    i;
+
+  for (i = 0; i < len; i++)
+    {
+      if (in->fFeedMark >= 0)
+	{
+	  if ((in->fFeedMark < kVT_SCRIPT_ENTER_LEN) &&
+	      (buf[i] == kVT_SCRIPT_ENTER[in->fFeedMark]))
+	    {
+	      ++in->fFeedMark;
+	      continue;
+	    }
+	  if ((in->fFeedMark == kVT_SCRIPT_ENTER_LEN) && (buf[i] == '\n'))
+	    {
+	      *out++ = ASC_RS;
+	      in->fFeedMark = 0;
+	      continue;
+	    }
+	  memcpy(out, kVT_SCRIPT_ENTER, in->fFeedMark);
+	  out += in->fFeedMark;
+	  in->fFeedMark = -1;
+	}
+      if (buf[i] == '\n')
+	{
+	  *out++ = ASC_CR;
+	  in->fFeedMark = 0;
+	}
+      else
+	*out++ = buf[i];
+    }
+  if ((in->fFeedEOF) && (in->fFeedMark > 0))
+    {
+      /* A last line with no newline */
+      if (in->fFeedMark == kVT_SCRIPT_ENTER_LEN)
+	*out++ = ASC_RS;
+      else
+	{
+	  memcpy(out, kVT_SCRIPT_ENTER, in->fFeedMark);
+	  out += in->fFeedMark;
+	}
+      in->fFeedMark = -1;
+    }
+  return(out - start);
+
+} /*FeedLines*/
+
+int OpenFeedQ(tVTConnection *conn, const char *fileName)
+{ /*OpenFeedQ*/
+
+  tVTInput
+    *in = conn->fInput;
+  struct stat
+    st;
+  int
+    fd;
+
+  if (((fd = open(fileName, O_RDONLY)) == -1) ||
+      (fstat(fd, &st) == -1))
+    {
+      perror(fileName);
+      if (fd != -1)
+	close(fd);
+      return(-1);
+    }
+  in->fFeeding = true;
+  in->fFeedWait = false;
+  in->fFeedEOF = false;
+  in->fFeedFd = fd;
+  in->fFeedMap = NULL;
+  in->fFeedSize = 0;
+  in->fFeedOffset = 0;
+  in->fFeedMark = 0;
+  if (S_ISREG(st.st_mode))
+    {
+      if (st.st_size == 0)
+	in->fFeedEOF = true;
+      else if ((in->fFeedMap = (char *)mmap(NULL, st.st_size, PROT_READ,
+					    MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+	in->fFeedMap = NULL;	/* Read it instead */
+      else
+	{
+	  in->fFeedSize = st.st_size;
+	  (void)madvise(in->fFeedMap, in->fFeedSize, MADV_SEQUENTIAL);
+	}
+    }
+  else if ((S_ISFIFO(st.st_mode)) || (S_ISSOCK(st.st_mode)) || (isatty(fd)))
+    {
+      in->fFeedWait = true;
+      (void)fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+  return(0);
+
+} /*OpenFeedQ*/
+
+/* Fills the ring from the input file. Returns how much went in, or -1 */
+int FeedQ(tVTConnection *conn)
+{ /*FeedQ*/
+
+  tVTInput
+    *in = conn->fInput;
+  char
+    buf[FEED_CHUNK],
+    out[FEED_CHUNK + kVT_SCRIPT_ENTER_LEN];
+  int
+    room,
+    total = 0;
+  ssize_t
+    n;
+
+  while (FeedPending(conn))
+    {
+/* Leave room for a held kVT_SCRIPT_ENTER that turns out not to be one */
+      if ((room = kVT_INPUT_QUEUE - 1 - kVT_SCRIPT_ENTER_LEN -
+	   in->fQueueLength) <= 0)
+	break;
+      if (room > (int)sizeof(buf))
+	room = sizeof(buf);
+      if (in->fFeedMap != NULL)
+	{
+	  n = in->fFeedSize - in->fFeedOffset;
+	  if (n > room)
+	    n = room;
+	  memcpy(buf, &in->fFeedMap[in->fFeedOffset], n);
+	  if ((in->fFeedOffset += n) == in->fFeedSize)
+	    in->fFeedEOF = true;
+	}
+      else if ((n = read(in->fFeedFd, buf, room)) <= 0)
+	{
+	  if ((n == -1) && (errno == EINTR))
+	    continue;
+	  if ((n == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+	    break;
+	  if (n == -1)
+	    {
+	      perror("input file");
+	      return(-1);
+	    }
+	  in->fFeedEOF = true;
+	  n = 0;
+	}
+      PutQBuffer(conn, out, FeedLines(in, buf, n, out));
+      total += n;
+    }
+  return(total);
+
+} /*FeedQ*/
+
+bool FeedPending(tVTConnection *conn)
+{ /*FeedPending*/
+
+  return((conn->fInput->fFeeding) && (!conn->fInput->fFeedEOF));
+
+} /*FeedPending*/
+
+void CloseFeedQ(tVTConnection *conn)
+{ /*CloseFeedQ*/
+
+  tVTInput
+    *in = conn->fInput;
+
+  if (!in->fFeeding)
+    return;
+  if (in->fFeedMap != NULL)
+    munmap(in->fFeedMap, in->fFeedSize);
+  close(in->fFeedFd);
+  in->fFeeding = false;
+
+} /*CloseFeedQ*/
+
 bool AltEol(tVTConnection *conn, char ch)
 { /*AltEol*/
 
@@ -201,12 +532,74 @@ bool PrimEol(tVTConnection *conn, char ch)
 
 } /*PrimEol*/
 
-int ProcessQueueToHost(tVTConnection *conn, ssize_t len)
-{/*ProcessQueueToHost*/
+/*
+ * Echo produced while working through the queue is collected here and
+ *   handed to the terminal in one piece rather than a call per byte.
+ *   Echo for typeahead assembled before its read is held back instead,
+ *   so that it still appears after the host's prompt.
+ */
+#define MAX_ECHO		(256)
+typedef struct
+{
+  char
+    *buf;
+  int
+    len,
+    max;
+  bool
+    hold,
+    overflow;
+} ECHO_BUF;
+
+/* Where a scan of the input queue stopped */
+#define SCAN_EMPTY		(0)	/* Ran out of characters */
+#define SCAN_RECORD		(1)	/* fRec holds a complete record */
+#define SCAN_FORMS		(2)	/* DC2 at the start of a block mode read */
+
+static void FlushEcho(tVTConnection *conn, ECHO_BUF *echo)
+{ /*FlushEcho*/
+
+  struct iovec
+    iov;
+
+  if (echo->len)
+    {
+      iov.iov_base = echo->buf;
+      iov.iov_len = echo->len;
+      VTDataOut(conn, &iov, 1);
+      echo->len = 0;
+    }
+/* Echo is what the user is waiting to see; don't leave it buffered */
+  if (conn->fDataOutFlushProc != NULL)
+    conn->fDataOutFlushProc(conn->fDataOutRefCon);
+
+} /*FlushEcho*/
+
+static void AddEcho(tVTConnection *conn, ECHO_BUF *echo, char *buf, int len)
+{ /*AddEcho*/
+
+  if (echo->len + len > echo->max)
+    {
+      if (echo->hold)
+	{
+	  echo->overflow = true;
+	  return;
+	}
+      FlushEcho(conn, echo);
+    }
+  memcpy(&echo->buf[echo->len], buf, len);
+  echo->len += len;
+
+} /*AddEcho*/
 
 /*
-#define TRANSLATE_INPUT	(1)
+ * Apply the line editing rules to queued input, adding to the record in
+ *   fRec until it is complete or 'get' runs out of characters.
  */
+static int ScanQueue(tVTConnection *conn, ECHO_BUF *echo,
+		     int (*get)(tVTConnection *),
+		     int *comp_mask, int *send_index)
+{ /*ScanQueue*/
 
   static char
     cr = '\r',
@@ -218,185 +611,434 @@ int ProcessQueueToHost(tVTConnection *conn, ssize_t len)
     alt = false,
     prim = false;
   int
-    int_ch = 0,
-    whichError = 0,
-    send_index = -1,
-    comp_mask = kVTIOCSuccessful;
+    int_ch = 0;
+  tVTInput
+    *in = conn->fInput;
+  char
+    *input_rec = in->fRec;
 
-  if (len == -2)
-    { /* Break - flush all queues */
-      if (conn->fSysBreakEnabled)
-	{
-	  send_index = kDTCSystemBreakIndex;
-	  FlushQ();
-	}
-    }
-  else if (len == -1)
-    comp_mask = kVTIOCTimeout;
-  else if (len >= 0)
+  for (;;)
     {
-      for (;;)
+      if ((int_ch = (*get)(conn)) == -1)
+	return(SCAN_EMPTY);	/* Ran out of characters */
+      ch = (char)int_ch;
+      if ((!(conn->fUneditedMode)) && (!(conn->fBinaryMode)))
 	{
-	  if ((int_ch = GetQ()) == -1)
+	  if ((ch == conn->fCharDeleteChar) ||
+	      (ch == (char)127))
 	    {
-	      if (stop_at_eof)
-		done = true;
-	      return(0);	/* Ran out of characters */
-	    }
-	  ch = (char)int_ch;
-	  if ((!(conn->fUneditedMode)) && (!(conn->fBinaryMode)))
-	    {
-	      if ((ch == conn->fCharDeleteChar) ||
-		  (ch == (char)127))
+	      if (in->fRecLength)
 		{
-		  if (input_rec_len)
+		  char	bs_buf[8];
+		  int	bs_len = 0;
+		  --in->fRecLength;
+		  switch (conn->fCharDeleteEcho)
 		    {
-		      char	bs_buf[8];
-		      int	bs_len = 0;
-		      --input_rec_len;
-		      switch (conn->fCharDeleteEcho)
-			{
-			case kAMEchoBackspace:
-			  bs_buf[0] = ASC_BS;
-			  bs_len = 1;
-			  break;
-			case kAMEchoBSSlash:
-			  bs_buf[0] = '\\';
-			  bs_buf[1] = ASC_LF;
-			  bs_len = 2;
-			  break;
-			case kAMEchoBsSpBs:
-			  bs_buf[0] = ASC_BS;
-			  bs_buf[1] = ' ';
-			  bs_buf[2] = ASC_BS;
-			  bs_len = 3;
-			  break;
-			default:bs_len = 0;
-			}
-		      if ((bs_len) && (conn->fEchoControl != 1))
-			conn->fDataOutProc(conn->fDataOutRefCon,
-					   bs_buf, bs_len);
+		    case kAMEchoBackspace:
+		      bs_buf[0] = ASC_BS;
+		      bs_len = 1;
+		      break;
+		    case kAMEchoBSSlash:
+		      bs_buf[0] = '\\';
+		      bs_buf[1] = ASC_LF;
+		      bs_len = 2;
+		      break;
+		    case kAMEchoBsSpBs:
+		      bs_buf[0] = ASC_BS;
+		      bs_buf[1] = ' ';
+		      bs_buf[2] = ASC_BS;
+		      bs_len = 3;
+		      break;
+		    default:bs_len = 0;
 		    }
-		  continue;
-		}
-	      if (ch == conn->fLineDeleteChar)
-		{
-		  input_rec_len = 0;
-/* Don't echo if line delete echo disabled */
-		  if (conn->fDisableLineDeleteEcho)
-		    continue;
-		  conn->fDataOutProc(conn->fDataOutRefCon,
-				     conn->fLineDeleteEcho,
-				     conn->fLineDeleteEchoLength);
-		  continue;
-		}
-	    }
-	  if (conn->fDriverMode == kDTCBlockMode)
-	    {
-	      if ((!input_rec_len) && (ch == ASC_DC2))
-		{
-		  input_rec[0] = ASC_ESC;
-		  input_rec[1] = 'h';
-		  input_rec[2] = ASC_ESC;
-		  input_rec[3] = 'c';
-		  input_rec[4] = ASC_DC1;
-		  conn->fDataOutProc(conn->fDataOutRefCon,
-				     (void*)input_rec, 5);
-		  while (GetQ() != -1);
-		  return(0);
+		  if ((bs_len) && (conn->fEchoControl != 1))
+		    AddEcho(conn, echo, bs_buf, bs_len);
 		}
+	      continue;
 	    }
-	  input_rec[input_rec_len++] = ch;
-	  if ((conn->fEchoControl != 1) &&
-	      (conn->fDriverMode == kDTCVanilla))
+	  if (ch == conn->fLineDeleteChar)
 	    {
-	      char ch1 = ch;
-	      if (table_spec == 1)
-		ch1 = in_table[((int)ch1) & 0x00FF];
-	      conn->fDataOutProc(conn->fDataOutRefCon, (void*)&ch1, 1);
+	      in->fRecLength = 0;
+/* Don't echo if line delete echo disabled */
+	      if (conn->fDisableLineDeleteEcho)
+		continue;
+	      AddEcho(conn, echo, conn->fLineDeleteEcho,
+		      conn->fLineDeleteEchoLength);
+	      continue;
 	    }
-	  if ((conn->fSubsysBreakEnabled) &&
+	}
+      if (conn->fDriverMode == kDTCBlockMode)
+	{
+	  if ((!in->fRecLength) && (ch == ASC_DC2))
+	    return(SCAN_FORMS);
+	}
+      input_rec[in->fRecLength++] = ch;
+      if ((conn->fEchoControl != 1) &&
+	  (conn->fDriverMode == kDTCVanilla))
+	{
+	  char ch1 = ch;
+	  if (table_spec == 1)
+	    ch1 = in_table[((int)ch1) & 0x00FF];
+	  AddEcho(conn, echo, &ch1, 1);
+	}
+      if ((conn->fSubsysBreakEnabled) &&
 /*
  * 961126: Don't check for ctl-y if in binary mode
  */
-	      (!(conn->fBinaryMode)) &&
-	      (ch == conn->fSubsysBreakChar))
-	    send_index = kDTCCntlYIndex;
+	  (!(conn->fBinaryMode)) &&
+	  (ch == conn->fSubsysBreakChar))
+	*send_index = kDTCCntlYIndex;
 #ifdef TRANSLATE_INPUT
-	  if ((translate) && (ch == '~') && (input_rec[0] == ASC_ESC))
-	    vt_fkey = true;
-	  else
+      if ((translate) && (ch == '~') && (input_rec[0] == ASC_ESC))
+	vt_fkey = true;
+      else
 #endif
-	  if (conn->fDriverMode != kDTCBlockMode)
-	    prim = PrimEol(conn, ch);
-	  alt = AltEol(conn, ch);
+      if (conn->fDriverMode != kDTCBlockMode)
+	prim = PrimEol(conn, ch);
+      alt = AltEol(conn, ch);
 /*
-	    if (debug)
-		{
-		extern FILE *debug_fd;
-		fprintf(debug_fd,
-			"ch=%02x, alt=%d, prim=%d, mode=%d, UneditedMode=%d, LTC=%02x, ALTC=%02x\n",
-			ch, alt, prim,
-			conn->fDriverMode,
-			(int) conn->fUneditedMode,
-			conn->fLineTerminationChar,
-			conn->fAltLineTerminationChar);
-		debug_need_crlf = 0;
-		}
+	if (debug)
+	    {
+	    extern FILE *debug_fd;
+	    fprintf(debug_fd,
+		    "ch=%02x, alt=%d, prim=%d, mode=%d, UneditedMode=%d, LTC=%02x, ALTC=%02x\n",
+		    ch, alt, prim,
+		    conn->fDriverMode,
+		    (int) conn->fUneditedMode,
+		    conn->fLineTerminationChar,
+		    conn->fAltLineTerminationChar);
+	    debug_need_crlf = 0;
+	    }
  */
-	  if ((send_index == kDTCCntlYIndex) ||
-	      (input_rec_len >= conn->fReadLength) ||
-	      (prim) || (alt) || (vt_fkey))
+      if ((*send_index == kDTCCntlYIndex) ||
+	  (in->fRecLength >= conn->fReadLength) ||
+	  (prim) || (alt) || (vt_fkey))
+	{
+	  if (*send_index == kDTCCntlYIndex)
+	    --in->fRecLength;
+	  else
 	    {
-	      if (send_index == kDTCCntlYIndex)
-		--input_rec_len;
-	      else
+	      if (alt)
 		{
-		  if (alt)
-		    {
-		      comp_mask = kVTIOCBreakRead;
-		      if ((conn->fEchoControl != 1) &&
-			  (conn->fDriverMode == kDTCVanilla))
-			conn->fDataOutProc(conn->fDataOutRefCon,
-					   (void*)&cr, 1);
-		    }
-		  else if (input_rec_len <= conn->fReadLength)
-		    {
-		      if (prim)
-			--input_rec_len;
-		    }
-		  if ((conn->fEchoCRLFOnCR) &&
-		      (conn->fDriverMode == kDTCVanilla) &&
-		      (!(conn->fBinaryMode)))
-		    {
-		      if (!prim) /* Echo cr if read didn't include one */
-			conn->fDataOutProc(conn->fDataOutRefCon,
-					   (void*)&cr, 1);
-		      conn->fDataOutProc(conn->fDataOutRefCon,
-					 (void*)&lf, 1);
-		    }
+		  *comp_mask = kVTIOCBreakRead;
+		  if ((conn->fEchoControl != 1) &&
+		      (conn->fDriverMode == kDTCVanilla))
+		    AddEcho(conn, echo, &cr, 1);
+		}
+	      else if (in->fRecLength <= conn->fReadLength)
+		{
+		  if (prim)
+		    --in->fRecLength;
+		}
+	      if ((conn->fEchoCRLFOnCR) &&
+		  (conn->fDriverMode == kDTCVanilla) &&
+		  (!(conn->fBinaryMode)))
+		{
+		  if (!prim) /* Echo cr if read didn't include one */
+		    AddEcho(conn, echo, &cr, 1);
+		  AddEcho(conn, echo, &lf, 1);
 		}
-
-		Logit (LOG_INPUT, input_rec, input_rec_len, false);
-		    
-	      break;
 	    }
+	  return(SCAN_RECORD);
 	}
     }
 
+} /*ScanQueue*/
+
+/*
+ * Typeahead is assembled into fRec as it arrives, before the host asks
+ *   for it, so that a read can be answered as soon as it is posted. The
+ *   characters stay in the ring until the record is taken: if the host
+ *   posts the read with different settings from the ones the record was
+ *   built under, it is thrown away and the queue scanned again.
+ */
+static void GetInputSettings(tVTConnection *conn, tVTInputSettings *settings)
+{ /*GetInputSettings*/
+
+  memset(settings, 0, sizeof(*settings));
+  settings->fReadLength = conn->fReadLength;
+  settings->fDriverMode = conn->fDriverMode;
+  settings->fEchoControl = conn->fEchoControl;
+  settings->fCharDeleteEcho = conn->fCharDeleteEcho;
+  settings->fLineDeleteEchoLength = conn->fLineDeleteEchoLength;
+  settings->fSubsysBreakChar = conn->fSubsysBreakChar;
+  settings->fCharDeleteChar = conn->fCharDeleteChar;
+  settings->fLineDeleteChar = conn->fLineDeleteChar;
+  settings->fLineTerminationChar = conn->fLineTerminationChar;
+  settings->fAltLineTerminationChar = conn->fAltLineTerminationChar;
+  settings->fUneditedMode = conn->fUneditedMode;
+  settings->fBinaryMode = conn->fBinaryMode;
+  settings->fDisableLineDeleteEcho = conn->fDisableLineDeleteEcho;
+  settings->fSubsysBreakEnabled = conn->fSubsysBreakEnabled;
+  settings->fEchoCRLFOnCR = conn->fEchoCRLFOnCR;
+
+} /*GetInputSettings*/
+
+static int GetAheadQ(tVTConnection *conn)
+{ /*GetAheadQ*/
+
+  tVTInput
+    *in = conn->fInput;
+
+/* As GetQ, but leaves the characters in the ring */
+  if (in->fAheadLength >= in->fQueueLength)
+    return(-1);
+  if (++in->fAheadRead == &in->fQueue[kVT_INPUT_QUEUE])
+    in->fAheadRead = in->fQueue;
+  ++in->fAheadLength;
+  return(*in->fAheadRead);
+
+} /*GetAheadQ*/
+
+void DiscardAheadQ(tVTConnection *conn)
+{ /*DiscardAheadQ*/
+
+  tVTInput
+    *in = conn->fInput;
+
+  if (in->fAheadState == kVTAheadIdle)
+    return;
+  in->fAheadState = kVTAheadIdle;
+  in->fAheadLength = 0;
+  in->fAheadEchoLength = 0;
+  in->fRecLength = 0;
+
+} /*DiscardAheadQ*/
+
+void PreassembleQ(tVTConnection *conn)
+{ /*PreassembleQ*/
+
+  tVTInput
+    *in = conn->fInput;
+  tVTInputSettings
+    settings;
+  ECHO_BUF
+    echo;
+  int
+    scan;
+
+  if ((conn->fReadInProgress) || (in->fImmQueueLength) ||
+      (in->fLogonNext < in->fLogonLines))
+    return;
+  if (FeedQ(conn) == -1)
+    return;
+  GetInputSettings(conn, &settings);
+  if ((in->fAheadState != kVTAheadIdle) &&
+      (memcmp(&settings, &in->fAheadSettings, sizeof(settings))))
+    DiscardAheadQ(conn);
+  switch (in->fAheadState)
+    {
+    case kVTAheadIdle:
+/* A partial record left by an aborted read is not ours to extend */
+      if ((in->fRecLength) || (in->fQueueLength == 0))
+	return;
+      in->fAheadState = kVTAheadPartial;
+      in->fAheadRead = in->fQueueRead;
+      in->fAheadSettings = settings;
+      in->fAheadCompMask = kVTIOCSuccessful;
+      in->fAheadSendIndex = -1;
+      break;
+    case kVTAheadPartial:
+      break;
+    default:
+      return;
+    }
+
+  echo.buf = in->fAheadEcho;
+  echo.len = in->fAheadEchoLength;
+  echo.max = sizeof(in->fAheadEcho);
+  echo.hold = true;
+  echo.overflow = false;
+  scan = ScanQueue(conn, &echo, GetAheadQ,
+		   &in->fAheadCompMask, &in->fAheadSendIndex);
+  in->fAheadEchoLength = echo.len;
+  if ((scan == SCAN_FORMS) || (echo.overflow))
+    in->fAheadState = kVTAheadGiveUp;
+  else if (scan == SCAN_RECORD)
+    in->fAheadState = kVTAheadRecord;
+
+} /*PreassembleQ*/
+
+static int TakeAheadQ(tVTConnection *conn, ECHO_BUF *echo,
+		      int *comp_mask, int *send_index)
+{ /*TakeAheadQ*/
+
+  tVTInput
+    *in = conn->fInput;
+  tVTInputSettings
+    settings;
+  struct iovec
+    iov;
+  int
+    state = in->fAheadState;
+
+/*
+ * Returns SCAN_RECORD if fRec holds the whole record for this read,
+ *   otherwise the queue still has to be scanned as usual, carrying on
+ *   from any partial record taken.
+ */
+  if (state == kVTAheadIdle)
+    return(SCAN_EMPTY);
+  GetInputSettings(conn, &settings);
+  if ((state == kVTAheadGiveUp) || (in->fImmQueueLength) ||
+      (memcmp(&settings, &in->fAheadSettings, sizeof(settings))))
+    {
+      DiscardAheadQ(conn);
+      return(SCAN_EMPTY);
+    }
+
+  in->fQueueRead = in->fAheadRead;
+  in->fQueueLength -= in->fAheadLength;
+  if (in->fAheadEchoLength)
+    {
+      FlushEcho(conn, echo);
+      iov.iov_base = in->fAheadEcho;
+      iov.iov_len = in->fAheadEchoLength;
+      VTDataOut(conn, &iov, 1);
+    }
+  *comp_mask = in->fAheadCompMask;
+  *send_index = in->fAheadSendIndex;
+  in->fAheadState = kVTAheadIdle;
+  in->fAheadLength = 0;
+  in->fAheadEchoLength = 0;
+  return((state == kVTAheadRecord) ? SCAN_RECORD : SCAN_EMPTY);
+
+} /*TakeAheadQ*/
+
+static int TakeLogonQ(tVTConnection *conn, ECHO_BUF *echo, bool *secret)
+{ /*TakeLogonQ*/
+
+  tVTInput
+    *in = conn->fInput;
+  tVTLogonLine
+    *line;
+  char
+    cr = ASC_CR,
+    lf = ASC_LF;
+
+/*
+ * Answers the read with the next line of the logon dialogue, if any is
+ *   left and the read is an ordinary one. Anything typed ahead waits
+ *   for the dialogue to finish.
+ */
+  if ((in->fLogonNext >= in->fLogonLines) ||
+      (!conn->fReadInProgress) ||
+      (conn->fDriverMode != kDTCVanilla))
+    return(SCAN_EMPTY);
+  DiscardAheadQ(conn);
+  if (in->fRecLength)
+    return(SCAN_EMPTY);
+
+  line = &in->fLogon[in->fLogonNext++];
+  memcpy(in->fRec, line->fText, line->fLength);
+  in->fRecLength = line->fLength;
+  *secret = line->fSecret;
+  memset(line->fText, 0, sizeof(line->fText));
+  if ((!line->fSecret) && (conn->fEchoControl != 1))
+    AddEcho(conn, echo, in->fRec, in->fRecLength);
+  if ((conn->fEchoCRLFOnCR) && (!(conn->fBinaryMode)))
+    {
+      AddEcho(conn, echo, &cr, 1);
+      AddEcho(conn, echo, &lf, 1);
+    }
+  return(SCAN_RECORD);
+
+} /*TakeLogonQ*/
+
+int ProcessQueueToHost(tVTConnection *conn, ssize_t len)
+{/*ProcessQueueToHost*/
+
+/*
+#define TRANSLATE_INPUT	(1)
+ */
+
+  char
+    echo_buf[MAX_ECHO];
+  int
+    scan,
+    whichError = 0,
+    send_index = -1,
+    comp_mask = kVTIOCSuccessful;
+  ECHO_BUF
+    echo;
+  tVTInput
+    *in = conn->fInput;
+  char
+    *input_rec = in->fRec;
+  bool
+    secret = false;
+
+  VTTraceMark(conn, kVTTraceScan);
+  echo.buf = echo_buf;
+  echo.len = 0;
+  echo.max = sizeof(echo_buf);
+  echo.hold = false;
+  echo.overflow = false;
+  if (len == -2)
+    { /* Break - flush all queues */
+      DiscardAheadQ(conn);
+      if (conn->fSysBreakEnabled)
+	{
+	  send_index = kDTCSystemBreakIndex;
+	  FlushQ(conn);
+	}
+    }
+  else if (len == -1)
+    {
+      comp_mask = kVTIOCTimeout;
+      DiscardAheadQ(conn);
+    }
+  else if (len >= 0)
+    {
+      if (FeedQ(conn) == -1)
+	return(-1);
+      scan = TakeLogonQ(conn, &echo, &secret);
+      if (scan != SCAN_RECORD)
+	scan = TakeAheadQ(conn, &echo, &comp_mask, &send_index);
+      if (scan != SCAN_RECORD)
+	scan = ScanQueue(conn, &echo, GetQ, &comp_mask, &send_index);
+      if (scan == SCAN_EMPTY)
+	{
+	  FlushEcho(conn, &echo);
+	  if ((in->fStopAtEOF) && (!FeedPending(conn)))
+	    in->fEOF = true;
+	  return(0);
+	}
+      if (scan == SCAN_FORMS)
+	{
+	  input_rec[0] = ASC_ESC;
+	  input_rec[1] = 'h';
+	  input_rec[2] = ASC_ESC;
+	  input_rec[3] = 'c';
+	  input_rec[4] = ASC_DC1;
+	  AddEcho(conn, &echo, input_rec, 5);
+	  FlushEcho(conn, &echo);
+	  while (GetQ(conn) != -1);
+	  return(0);
+	}
+
+      if (!secret)
+	Logit (LOG_INPUT, input_rec, in->fRecLength, false);
+    }
+
+/* Get the echo onto the screen before the host can answer */
+  FlushEcho(conn, &echo);
+
   if (send_index == -1)
     {
+      VTTraceMark(conn, kVTTraceTranslate);
 #ifdef TRANSLATE_INPUT
       if (translate)
-	TranslateKeyboard(input_rec, &input_rec_len);
+	TranslateKeyboard(input_rec, &in->fRecLength);
 #endif
 /*
  * Do input translation here
  */
       if (table_spec == 1)
-	for (send_index=0; send_index<input_rec_len; send_index++)
+	for (send_index=0; send_index<in->fRecLength; send_index++)
 	  input_rec[send_index] = in_table[((int)input_rec[send_index]) & 0x00FF];
-      whichError = VTSendData(conn, input_rec, input_rec_len, comp_mask);
+      VTTraceMark(conn, kVTTraceSend);
+      whichError = VTSendData(conn, input_rec, in->fRecLength, comp_mask);
     }
   else
     whichError = VTSendBreak(conn, send_index);
@@ -410,15 +1052,162 @@ int ProcessQueueToHost(tVTConnection *conn, ssize_t len)
     }
 
   conn->fReadInProgress = false;
-  input_rec_len = 0;
+  if (secret)
+    memset(input_rec, 0, in->fRecLength);
+  in->fRecLength = 0;
+
+/* Have the next record ready for the next read */
+  PreassembleQ(conn);
   return(0);
 
 }/*ProcessQueueToHost*/
 
-void vt3kDataOutProc(int32_t refCon, char * buffer, size_t bufferLength)
+/*
+ * Terminal output can be collected and written in one go. freevt3k
+ *   turns this on for its message loop and flushes before it waits;
+ *   echo is flushed as soon as it is complete (vt3kDataOutFlush), so
+ *   typing never waits on the host's next record. With an output
+ *   thread, what would have been written is handed to it instead.
+ *   One of these per connection, passed in as the data-out refCon; a
+ *   refCon of 0 writes straight to stdout.
+ */
+#define OUT_BUFFER_MAX		(16384)
+
+struct stVTTermOut
+{
+  char
+    buffer[OUT_BUFFER_MAX];
+  size_t
+    length;
+  bool
+    buffered;
+  tVTOutput
+    *thread;
+};
+
+tVTTermOut *vt3kNewOutput(void)
+{ /*vt3kNewOutput*/
+
+  return((tVTTermOut*)calloc(1, sizeof(tVTTermOut)));
+
+} /*vt3kNewOutput*/
+
+void vt3kFreeOutput(tVTTermOut *out)
+{ /*vt3kFreeOutput*/
+
+  if (out == NULL)
+    return;
+  vt3kFlushOutput(out);
+  free(out);
+
+} /*vt3kFreeOutput*/
+
+static void WriteOutput(tVTTermOut *out, const char *buf, size_t len)
+{ /*WriteOutput*/
+
+  ssize_t
+    n;
+
+  if (out->thread != NULL)
+    {
+      VTOutputWrite(out->thread, buf, len);
+      return;
+    }
+  while (len > 0)
+    {
+      if ((n = write(STDOUT_FILENO, buf, len)) == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return;
+	}
+      buf += n;
+      len -= n;
+    }
+
+} /*WriteOutput*/
+
+void vt3kFlushOutput(tVTTermOut *out)
+{ /*vt3kFlushOutput*/
+
+  if ((out == NULL) || (!out->length))
+    return;
+  WriteOutput(out, out->buffer, out->length);
+  out->length = 0;
+
+} /*vt3kFlushOutput*/
+
+void vt3kBufferOutput(tVTTermOut *out, bool on)
+{ /*vt3kBufferOutput*/
+
+  if (out == NULL)
+    return;
+  if (!on)
+    vt3kFlushOutput(out);
+  out->buffered = on;
+
+} /*vt3kBufferOutput*/
+
+/* Only takes effect with buffering on; NULL to write directly again */
+void vt3kThreadOutput(tVTTermOut *out, tVTOutput *thread)
+{ /*vt3kThreadOutput*/
+
+  if (out == NULL)
+    return;
+  vt3kFlushOutput(out);
+  out->thread = thread;
+
+} /*vt3kThreadOutput*/
+
+static void PutOutput(tVTTermOut *out, const char *buf, size_t len)
+{ /*PutOutput*/
+
+  if (out->length + len > sizeof(out->buffer))
+    vt3kFlushOutput(out);
+  if (len > sizeof(out->buffer))
+    WriteOutput(out, buf, len);
+  else
+    {
+      memcpy(&out->buffer[out->length], buf, len);
+      out->length += len;
+    }
+
+} /*PutOutput*/
+
+void vt3kDataOutProc(intptr_t refCon, char * buffer, size_t bufferLength)
 { /*vt3kDataOutProc*/
 
+  tVTTermOut
+    *out = (tVTTermOut*)refCon;
+
   Logit (LOG_OUTPUT, buffer, bufferLength, true);
 
-  if (write(STDOUT_FILENO, buffer, bufferLength)) {}
+  if ((out != NULL) && (out->buffered))
+    PutOutput(out, buffer, bufferLength);
+  else if (write(STDOUT_FILENO, buffer, bufferLength)) {}
 } /*vt3kDataOutProc*/
+
+void vt3kDataOutVProc(intptr_t refCon, const struct iovec * iov, int iovCount)
+{ /*vt3kDataOutVProc*/
+  tVTTermOut
+    *out = (tVTTermOut*)refCon;
+  int
+    i;
+
+  for (i = 0; i < iovCount; i++)
+    Logit (LOG_OUTPUT, (char *) iov[i].iov_base, iov[i].iov_len, true);
+
+  if ((out != NULL) && (out->buffered))
+    {
+      for (i = 0; i < iovCount; i++)
+	PutOutput(out, (char *) iov[i].iov_base, iov[i].iov_len);
+    }
+  else if (writev(STDOUT_FILENO, iov, iovCount)) {}
+} /*vt3kDataOutVProc*/
+
+void vt3kDataOutFlush(intptr_t refCon)
+{ /*vt3kDataOutFlush*/
+
+  vt3kFlushOutput((tVTTermOut*)refCon);
+
+} /*vt3kDataOutFlush*/
@@ -20,8 +20,4 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
  * vtcommon.h -- common HP/VT routines
  ************************************************************/
 
-extern int input_rec_len;
-extern int input_queue_len;
 extern bool translate;
-extern bool done;
-extern bool stop_at_eof;
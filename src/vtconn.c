@@ -22,6 +22,7 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
 
 #include "config.h"
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
@@ -36,46 +37,172 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
+#include <signal.h>
 
 #include "logging.h"
+#include "timers.h"
+#include "transport.h"
 #include "vt3kglue.h"
+#include "vtcapture.h"
 
 extern int
 	debug;
-int
-	appl_req_count = 0;
 
 
-static void DefaultDataOutProc(int32_t refCon, char * buffer, size_t bufferLength)
+static void DefaultDataOutProc(intptr_t refCon, char * buffer, size_t bufferLength)
 { /*DefaultDataOutProc*/
     if (write(STDOUT_FILENO, buffer, bufferLength)) {}
 } /*DefaultDataOutProc*/
 
+static bool ResizeBuffer(char ** buffer, int * alloc, int newSize);
+static bool GrowBuffer(char ** buffer, int * alloc, int needed, int limit);
+
+/* Keep what the socket wouldn't take; see fSendNoWait */
+static int AddToBacklog(tVTConnection * conn, char * buffer, int length)
+{ /*AddToBacklog*/
+    int needed = conn->fSendBacklogLength + length;
+
+    if (((conn->fSendBacklogSize == 0) &&
+	 (!ResizeBuffer(&conn->fSendBacklog, &conn->fSendBacklogSize,
+			kVT_OUT_QUEUE))) ||
+	(!GrowBuffer(&conn->fSendBacklog, &conn->fSendBacklogSize,
+		     needed, kVT_SEND_BACKLOG)))
+	{
+	conn->fLastSocketError = ENOBUFS;
+	return kVTCSendError;
+	}
+    memcpy(conn->fSendBacklog + conn->fSendBacklogLength, buffer, length);
+    conn->fSendBacklogLength = needed;
+    return kVTCNoError;
+} /*AddToBacklog*/
+
+static int SendAll(tVTConnection * conn, char * buffer, int length)
+{ /*SendAll*/
+    int   returnValue = kVTCNoError;
+    ssize_t
+	charsSent;
+    struct pollfd
+	pfd;
+    int64_t
+	deadline = 0,
+	remaining;
+
+    /* Nothing may overtake what is already waiting */
+
+    if (conn->fSendBacklogLength > 0)
+	return AddToBacklog(conn, buffer, length);
+
+    /* The socket is non-blocking once connected, so a large queue	*/
+    /* may go out in pieces. Don't drop a reply for want of room.	*/
+
+    while (length > 0)
+	{
+	charsSent = send(conn->fSocket, buffer, length, 0);
+	if (charsSent == -1)
+	    {
+	    if (errno == EINTR)
+		continue;
+	    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+		{
+		if (conn->fSendNoWait)
+		    return AddToBacklog(conn, buffer, length);
+		if (deadline == 0)
+		    deadline = MyMonotonicUsec() +
+			       (int64_t) kVT_SEND_TIMEOUT * 1000;
+		remaining = (deadline - MyMonotonicUsec()) / 1000;
+		if (remaining <= 0)
+		    {
+		    returnValue = kVTCSendError;
+		    conn->fLastSocketError = ETIMEDOUT;
+		    break;
+		    }
+		pfd.fd = conn->fSocket;
+		pfd.events = POLLOUT;
+		(void) poll(&pfd, 1, (int) remaining);
+		continue;
+		}
+	    returnValue = kVTCSocketError;
+	    conn->fLastSocketError = errno;
+	    break;
+	    }
+	else if (charsSent == 0)
+	    {
+	    returnValue = kVTCSendError;
+	    break;
+	    }
+	conn->fStats.fSends++;
+	conn->fStats.fSendBytes += charsSent;
+	buffer += charsSent;
+	length -= charsSent;
+	}
+    return returnValue;
+} /*SendAll*/
+
+static int FlushToAM(tVTConnection * conn)
+{ /*FlushToAM*/
+    int   returnValue = kVTCNoError;
+
+    if (conn->fOutQueueLength > 0)
+	{
+	returnValue = SendAll(conn, conn->fOutQueue, conn->fOutQueueLength);
+	conn->fOutQueueLength = 0;
+	conn->fOutQueueRecords = 0;
+	}
+    return returnValue;
+} /*FlushToAM*/
+
 static int SendToAM(tVTConnection * conn, 
                       tVTMHeader * theMessage, uint16_t messageLength)
 { /*SendToAM*/
     int   returnValue = kVTCNoError;
-    ssize_t
-	charsSent;
 
     theMessage->fMessageLength = htons(messageLength);
     if (debug > 0)
 	DumpBuffer(&theMessage->fProtocolID,
 		   messageLength-sizeof(theMessage->fMessageLength),
 		   "to_host");
-    charsSent = send(conn->fSocket, (void*)theMessage, messageLength, 0);
-    if (charsSent == -1)
-        {
-        returnValue = kVTCSocketError;
-        conn->fLastSocketError = errno;
-        }
-    else if (charsSent != messageLength)
-        {
-        returnValue = kVTCSendError;
-        }
+
+    /* While a batch of records is being processed, append the reply	*/
+    /* to the outbound queue; VTReceiveDataReady flushes it at the end.	*/
+
+    if ((conn->fOutQueueHold) && (messageLength <= conn->fOutQueueSize))
+	{
+	if (conn->fOutQueueLength + messageLength > conn->fOutQueueSize)
+	    {
+	    if ((returnValue = FlushToAM(conn)))
+		goto Last;
+	    }
+	memcpy(conn->fOutQueue + conn->fOutQueueLength,
+	       (char *) theMessage, messageLength);
+	conn->fOutQueueLength += messageLength;
+	if (++conn->fOutQueueRecords == conn->fAMSendBurst)
+	    returnValue = FlushToAM(conn);
+	goto Last;
+	}
+
+    if ((returnValue = FlushToAM(conn)))
+	goto Last;
+    returnValue = SendAll(conn, (char *) theMessage, messageLength);
+
+Last:
     return returnValue;
 } /*SendToAM*/
 
+static int SendUrgentToAM(tVTConnection * conn, 
+			  tVTMHeader * theMessage, uint16_t messageLength)
+{ /*SendUrgentToAM*/
+    /* Breaks don't wait for the rest of the batch; they go out ahead	*/
+    /* of anything still sitting in the outbound queue.			*/
+
+    theMessage->fMessageLength = htons(messageLength);
+    if (debug > 0)
+	DumpBuffer(&theMessage->fProtocolID,
+		   messageLength-sizeof(theMessage->fMessageLength),
+		   "to_host");
+    return SendAll(conn, (char *) theMessage, messageLength);
+} /*SendUrgentToAM*/
+
 static void FillStandardMessageHeader(tVTMHeader * theHeader, 
 				       tVTMessageType messageType,
 				       uint8_t primitive)	/* RM 960410 */
@@ -88,10 +215,108 @@ static void FillStandardMessageHeader(tVTMHeader * theHeader,
 
 static void SetUpForNewRecordReceive(tVTConnection * conn)
 { /*SetUpForNewRecordReceive*/
-    conn->fLengthToReceive = 2;
-    conn->fReceiveBufferOffset = -2;
+    conn->fRingHead = 0;
+    conn->fRingTail = 0;
 } /*SetUpForNewRecordReceive*/
 
+static bool ResizeBuffer(char ** buffer, int * alloc, int newSize)
+{ /*ResizeBuffer*/
+    char * newBuffer = (char *) realloc(*buffer, newSize);
+
+    if (newBuffer == NULL)
+	return false;
+    *buffer = newBuffer;
+    *alloc = newSize;
+    return true;
+} /*ResizeBuffer*/
+
+static bool GrowBuffer(char ** buffer, int * alloc, int needed, int limit)
+{ /*GrowBuffer*/
+    int newSize = *alloc;
+
+    /* Double until it fits, but don't overshoot the limit. */
+
+    if (needed <= newSize)
+	return true;
+    if (needed > limit)
+	return false;
+    while (newSize < needed)
+	newSize *= 2;
+    if (newSize > limit)
+	newSize = limit;
+    return ResizeBuffer(buffer, alloc, newSize);
+} /*GrowBuffer*/
+
+static void TrimBuffer(char ** buffer, int * alloc, int * peak, int minSize)
+{ /*TrimBuffer*/
+    if ((*alloc > minSize) && (*peak <= *alloc / 4))
+	(void) ResizeBuffer(buffer, alloc,
+			    (*alloc / 2 < minSize) ? minSize : *alloc / 2);
+    *peak = 0;
+} /*TrimBuffer*/
+
+static void TrimBuffers(tVTConnection * conn)
+{ /*TrimBuffers*/
+    /* Called with the ring empty, so nothing in it needs keeping. */
+
+    if (--conn->fTrimCountdown > 0)
+	return;
+    conn->fTrimCountdown = kVT_TRIM_INTERVAL;
+    TrimBuffer(&conn->fSendBuffer, &conn->fSendBufferAlloc,
+	       &conn->fSendBufferPeak, kVT_MIN_BUFFER);
+    TrimBuffer(&conn->fReceiveBuffer, &conn->fReceiveBufferAlloc,
+	       &conn->fReceiveBufferPeak, kVT_MIN_BUFFER);
+    TrimBuffer(&conn->fReceiveRing, &conn->fReceiveRingSize,
+	       &conn->fRingPeak, kVT_RECEIVE_RING_MIN);
+} /*TrimBuffers*/
+
+static int RecordAvailable(tVTConnection * conn)
+{ /*RecordAvailable*/
+    /* Returns the length of the complete record at the head of the	*/
+    /* receive ring, 0 if only part of one has arrived so far, or -1	*/
+    /* if its length word is invalid.					*/
+
+    int		available = conn->fRingTail - conn->fRingHead;
+    int		recordLength;
+    unsigned char * lengthWord;
+
+    if (available < 2)
+	return 0;
+    lengthWord = (unsigned char *) conn->fReceiveRing + conn->fRingHead;
+    recordLength = (lengthWord[0] << 8) | lengthWord[1];
+
+    /* Validate the received length word. */
+
+    if ((recordLength > conn->fReceiveBufferSize) ||
+	(recordLength < 4))
+	return -1;
+    if (available < recordLength)
+	return 0;
+    return recordLength;
+} /*RecordAvailable*/
+
+static const char * LocalNodeName(void)
+{ /*LocalNodeName*/
+    /* Sent with every TM negotiation; it won't change while we run,	*/
+    /* so look it up once.						*/
+    static char	nodeName[258];
+    static bool	nodeNameSet = false;
+    char	domainName[128];
+
+    if (nodeNameSet)
+	return nodeName;
+    gethostname(nodeName, 128);
+    nodeName[127] = 0;
+    if (getdomainname(domainName, sizeof(domainName)) == 0)
+	{
+	domainName[sizeof(domainName) - 1] = 0;
+	strcat(nodeName, ".");
+	strcat(nodeName, domainName);
+	}
+    nodeNameSet = true;
+    return nodeName;
+} /*LocalNodeName*/
+
 static int ProcessAMNegotiationRequest(tVTConnection * conn)
 { /*ProcessAMNegotiationRequest*/
     int returnValue = kVTCNoError;
@@ -99,8 +324,7 @@ static int ProcessAMNegotiationRequest(tVTConnection * conn)
 						conn->fReceiveBuffer;
     tVTMAMNegotiationReply      amresp;
     tVTMTMNegotiationRequest    tmreq;
-    char	hostName[128];
-    char	domainName[128];
+    const char	* nodeName;
     uint16_t	nodeNameLength;
     tVTMAMBreakInfo		*breakInfo;
     char	pid_buf[sizeof(tmreq.fSessionID)+1];
@@ -148,6 +372,7 @@ static int ProcessAMNegotiationRequest(tVTConnection * conn)
        is, or is it telling us what it wants our buffer size to be? */
     if ((int)amreq->fBufferSize < conn->fSendBufferSize)
 	conn->fSendBufferSize = amreq->fBufferSize;
+    conn->fAMSendBurst = amreq->fAMMaxSendBurst;
 
     if (amreq->fBreakOffset)
         {
@@ -181,6 +406,8 @@ static int ProcessAMNegotiationRequest(tVTConnection * conn)
 
     if (conn->fState == kvtsWaitingForAM) {
 
+	conn->fTimes.fAMNegotiation = MyMonotonicUsec();
+
 	/* put together and send an initial TM negotiation request */ 
 
 	FillStandardMessageHeader((tVTMHeader *) &tmreq, 
@@ -192,20 +419,13 @@ static int ProcessAMNegotiationRequest(tVTConnection * conn)
 	sprintf(pid_buf, "%0*d", (int) sizeof(tmreq.fSessionID), getpid());
 	memcpy(tmreq.fSessionID, pid_buf, sizeof(tmreq.fSessionID));
 
-	gethostname(hostName, sizeof(hostName));
-	if (getdomainname(domainName, sizeof(domainName)) != 0) {
-        domainName[0] = 0;
-    } else {
-	    strcat(hostName, ".");
-	    strcat(hostName, domainName);
-    }
-
-	nodeNameLength = strlen(hostName);
+	nodeName = LocalNodeName();
+	nodeNameLength = strlen(nodeName);
 	if (nodeNameLength > sizeof(tmreq.fNodeName))
 	    nodeNameLength = sizeof(tmreq.fNodeName);
 	tmreq.fNodeLength = htons(nodeNameLength);
 	memset((char *)tmreq.fNodeName, 0, sizeof(tmreq.fNodeName));
-	memcpy(tmreq.fNodeName, hostName, nodeNameLength);
+	memcpy(tmreq.fNodeName, nodeName, nodeNameLength);
 	if ((returnValue = SendToAM(conn, (tVTMHeader *) &tmreq, sizeof(tmreq))))
 		goto Last;
 
@@ -230,6 +450,7 @@ static int ProcessTMNegotiationResponse(tVTConnection * conn)
    else {
 	returnValue = kVTCVTOpen;
 	conn->fState = kvtsOpen;
+	conn->fTimes.fOpen = MyMonotonicUsec();
    }
 
    return returnValue;
@@ -246,9 +467,11 @@ static int ProcessTerminationResponse(tVTConnection * conn)
     return returnValue;
 } /*ProcessTerminationResponse*/
 
-static void ProcessCCTL(tVTConnection * conn, unsigned char cctlChar)
-{ /*ProcessCCTL*/
-    char  lfBuffer[80];
+static int BuildCCTL(unsigned char cctlChar, char * lfBuffer)
+{ /*BuildCCTL*/
+    /* Fills lfBuffer (at least 80 bytes) with the spacing for cctlChar */
+    /* and returns its length.						 */
+
     char  *ptr;
     long  len = 0;
 
@@ -257,7 +480,7 @@ static void ProcessCCTL(tVTConnection * conn, unsigned char cctlChar)
 #define FF	(0x0C)
 /* NOCCTL - nothing else to do */
     if (cctlChar == 0320)
-        return;
+        return 0;
     if ((0200 <= cctlChar) && (cctlChar <= 0277))	/* Skip 'n' lines */
 	len = cctlChar - 0200;
     else
@@ -280,32 +503,38 @@ static void ProcessCCTL(tVTConnection * conn, unsigned char cctlChar)
         while ((len--) > 0)
         *(ptr++) = LF;
         }
-    len = ptr - lfBuffer;
-    conn->fDataOutProc(conn->fDataOutRefCon, lfBuffer, len);
-} /*ProcessCCTL*/
+    return (ptr - lfBuffer);
+} /*BuildCCTL*/
 
-static int ProcessWriteRequest(tVTConnection * conn)
-{ /*ProcessWriteRequest*/
-    int returnValue = kVTCNoError;
+/* The write half of a write or write-read request: put it on the	*/
+/* terminal.								*/
+
+static void WriteToTerminal(tVTConnection * conn)
+{ /*WriteToTerminal*/
     tVTMIORequest * writereq = (tVTMIORequest *) conn->fReceiveBuffer;
-    tVTMTerminalIOResponse  * writeresp = (tVTMTerminalIOResponse * ) conn->fSendBuffer;
     char * writeData = writereq->fWriteData;
     uint16_t writeFlags = ntohs(writereq->fWriteFlags);
     uint16_t writeDataLength = ntohs(writereq->fWriteByteCount);
+    char  preSpace[80];
+    char  postSpace[80];
+    struct iovec iov[3];
+    int   iovCount = 0;
+    int   len;
     extern unsigned char out_table[];
     extern int table_spec;
-    
+
+    /* Prespace, data and postspace are handed to the terminal in one	*/
+    /* vectored call.							*/
+
     if ((writeFlags & kVTIOWUseCCTL) &&
 	(writeFlags & kVTIOWPrespace))
 	{
-#ifndef old_way
-	ProcessCCTL(conn, ((writeDataLength) ? *writeData : '\0'));
-#else
-	if (writeDataLength)
-	    ProcessCCTL(conn, *writeData);
-	else
-	    ProcessCCTL(conn, 0);
-#endif
+	len = BuildCCTL(((writeDataLength) ? *writeData : '\0'), preSpace);
+	if (len > 0)
+	    {
+	    iov[iovCount].iov_base = preSpace;
+	    iov[iovCount++].iov_len = len;
+	    }
 	}
 
     if (writeDataLength)
@@ -325,30 +554,41 @@ static int ProcessWriteRequest(tVTConnection * conn)
 	      }
 	    }
 	if (writeFlags & kVTIOWUseCCTL)
-	    conn->fDataOutProc(conn->fDataOutRefCon, writeData + 1, (writeDataLength - 1));
+	    {
+	    iov[iovCount].iov_base = writeData + 1;
+	    iov[iovCount++].iov_len = writeDataLength - 1;
+	    }
 	else
-	    conn->fDataOutProc(conn->fDataOutRefCon, writeData, writeDataLength);
+	    {
+	    iov[iovCount].iov_base = writeData;
+	    iov[iovCount++].iov_len = writeDataLength;
+	    }
 	}
 
     if ((writeFlags & kVTIOWUseCCTL) &&
 	(!(writeFlags & kVTIOWPrespace)))
 	{
-/* Meaningless test.
-	if (!(writeFlags & kVTIOWUseCCTL))
-	    ProcessCCTL(conn, 0);
-	else
- */
-#ifndef old_way
-	ProcessCCTL(conn, ((writeDataLength) ? *writeData : '\0'));
-#else
-	if (writeDataLength)
-	    ProcessCCTL(conn, *writeData);
-	else
-	    ProcessCCTL(conn, 0);
-#endif
+	len = BuildCCTL(((writeDataLength) ? *writeData : '\0'), postSpace);
+	if (len > 0)
+	    {
+	    iov[iovCount].iov_base = postSpace;
+	    iov[iovCount++].iov_len = len;
+	    }
 	}
 
-    if (writeFlags & kVTIOWNeedsResponse)
+    if (iovCount > 0)
+	VTDataOut(conn, iov, iovCount);
+} /*WriteToTerminal*/
+
+static int ProcessWriteRequest(tVTConnection * conn)
+{ /*ProcessWriteRequest*/
+    int returnValue = kVTCNoError;
+    tVTMIORequest * writereq = (tVTMIORequest *) conn->fReceiveBuffer;
+    tVTMTerminalIOResponse  * writeresp = (tVTMTerminalIOResponse * ) conn->fSendBuffer;
+
+    WriteToTerminal(conn);
+
+    if (ntohs(writereq->fWriteFlags) & kVTIOWNeedsResponse)
 	{
 	FillStandardMessageHeader((tVTMHeader *) writeresp,
 				  kvmtTerminalIOResp, kVTIOWrite);
@@ -376,16 +616,41 @@ static int ProcessReadRequest(tVTConnection * conn)
     conn->fReadTimeout = ntohs(readreq->fTimeout);
     conn->fReadInProgress = true;
     conn->fReadStarted = true;	/* RM 960403 */
+    if (conn->fTrace)
+	conn->fTrace->fPosted = MyMonotonicNsec();
+    if (!conn->fTimes.fReady)
+	{
+	/* The session is ready for use once the logon dialogue has	*/
+	/* gone and the host asks for more.				*/
+	if (!conn->fTimes.fFirstRead)
+	    conn->fTimes.fFirstRead = MyMonotonicUsec();
+	if (conn->fInput->fLogonNext >= conn->fInput->fLogonLines)
+	    conn->fTimes.fReady = MyMonotonicUsec();
+	}
     if (readFlags & kVTIORFlushTypeAhead)
 	conn->fReadFlush = true;	/* RM 960403 */
     conn->fReadLength = readDataLength;
     conn->fReadRequestCount = readreq->fRequestCount;
+    conn->fReadPrimitive = kVTIORead;
     conn->fEchoCRLFOnCR = true;
     if (readFlags & kVTIORNoCRLF) conn->fEchoCRLFOnCR = false;
 
     return returnValue;
 } /*ProcessReadRequest*/
 
+/* A write-read is a prompt and its read in one message. The write	*/
+/* gets no response of its own; the read's answers both halves.	*/
+
+static int ProcessWriteReadRequest(tVTConnection * conn)
+{ /*ProcessWriteReadRequest*/
+    int returnValue;
+
+    WriteToTerminal(conn);
+    returnValue = ProcessReadRequest(conn);
+    conn->fReadPrimitive = kVTIOWriteRead;
+    return returnValue;
+} /*ProcessWriteReadRequest*/
+
 static int ProcessAbortRequest(tVTConnection * conn)
 { /*ProcessAbortRequest*/
     int returnValue = kVTCNoError;
@@ -394,7 +659,7 @@ static int ProcessAbortRequest(tVTConnection * conn)
            (tVTMTerminalIOResponse * ) conn->fSendBuffer;
 
     FillStandardMessageHeader((tVTMHeader *) resp, kvmtTerminalIOResp,
-				kVTIORead);
+				conn->fReadPrimitive);
     resp->fRequestCount = abortreq->fReadFlags;
     resp->fResponseCode = htons(kVTIOCSuccessful);
     resp->fCompletionMask = htons(kVTIOCAborted);
@@ -434,12 +699,14 @@ static int ProcessTerminalIOReq(tVTConnection * conn)
 	returnValue = ProcessWriteRequest(conn);
 	break;
 
+    case kVTIOWriteRead:
+	returnValue = ProcessWriteReadRequest(conn);
+	break;
+
     case kVTIOAbort:
 	returnValue = ProcessAbortRequest(conn);
 	break;
 
-        /* What do we do with read/write? */
-
     default:
 	returnValue = kVTCReceivedInvalidIOPrimitive;
 	conn->fLastSocketError = messageHeader->fPrimitive;
@@ -501,14 +768,30 @@ static int ProcessLogonInfo(tVTConnection * conn)
     int returnValue = kVTCNoError;
     tVTMLogonInfo * termreq = (tVTMLogonInfo *) conn->fReceiveBuffer;
     tVTMLogonInfoResponse loginResp;
-
-    /* What the heck am I supposed to do with this info? */
-    /* Just send a response for now.                     */
+    int available = termreq->fMessageLength -
+			(int) offsetof(tVTMLogonInfo, fLogonString);
+    int length = ntohs(termreq->fLogonLength);
+
+    /* The AM tells us who the session logged on as. Nothing here	*/
+    /* depends on it; keep it for the user to look at.			*/
+
+    if (length > available)
+	length = available;
+    if (length > (int) sizeof(conn->fLogonInfo) - 1)
+	length = sizeof(conn->fLogonInfo) - 1;
+    if (length < 0)
+	length = 0;
+    memcpy(conn->fLogonSessionID, termreq->fSessionID,
+	   sizeof(termreq->fSessionID));
+    conn->fLogonSessionID[sizeof(termreq->fSessionID)] = 0;
+    memcpy(conn->fLogonInfo, termreq->fLogonString, length);
+    conn->fLogonInfo[length] = 0;
+    conn->fHaveLogonInfo = true;
 
     FillStandardMessageHeader((tVTMHeader *) &loginResp, 
 				kvmtEnvCntlResp, kvtpLogonInfo);
     loginResp.fResponseCount = termreq->fRequestCount;
-    loginResp.fResponseMask = htons(kvtRespFailed);
+    loginResp.fResponseMask = htons(kvtRespNoError);
     returnValue = SendToAM(conn, (tVTMHeader *) &loginResp, sizeof(loginResp));
 
     return returnValue;
@@ -563,6 +846,35 @@ static int ProcessSetBreakRequest(tVTConnection * conn)
     return returnValue;
 } /*ProcessSetBreakRequest*/
 
+/* Put the profile the session wants right now on the socket. Only	*/
+/* the vanilla driver mode counts as interactive; block mode pages	*/
+/* go over the bulk profile when kTransportAutoBulk is set. Buffer	*/
+/* sizes are only set on a fresh socket, and with kTransportAutoBulk	*/
+/* they are the bulk ones from the start; see TransportSetBuffers().	*/
+/* Tuning is advisory, so a failure is remembered but not returned.	*/
+
+static void ApplyTransportProfile(tVTConnection * conn, int fd, bool fresh)
+{ /*ApplyTransportProfile*/
+    int profile = conn->fTransportProfile;
+    int flags = conn->fTransportFlags;
+    int error;
+
+    if ((flags & kTransportAutoBulk) &&
+	(profile != kTransportDefault) &&
+	(conn->fDriverMode != kDTCVanilla))
+	profile = kTransportBulk;
+    if ((fd == -1) || (profile == conn->fTransportActive))
+	return;
+    if ((!fresh) || (flags & kTransportAutoBulk))
+	flags |= kTransportKeepBuffers;
+    if ((error = TransportSetSocket(fd, profile, flags)))
+	conn->fLastSocketError = error;
+    if ((fresh) && (conn->fTransportFlags & kTransportAutoBulk) &&
+	(error = TransportSetBuffers(fd, kTransportBulk)))
+	conn->fLastSocketError = error;
+    conn->fTransportActive = profile;
+} /*ApplyTransportProfile*/
+
 static int ProcessDriverControlRequest(tVTConnection * conn)
 { /*ProcessDriverControlRequest*/
     int returnValue = kVTCNoError;
@@ -627,6 +939,7 @@ static int ProcessDriverControlRequest(tVTConnection * conn)
 	    {
 	    conn->fDriverMode = req->fDriverMode;
 	    responseFlags |= kTDCMDriverMode;
+	    ApplyTransportProfile(conn, conn->fSocket, false);
 	    }
 	}
 
@@ -745,10 +1058,11 @@ static int GenerateApplControlReq(tVTConnection * conn, int send_index)
     FillStandardMessageHeader((tVTMHeader *) &ApplResp, 
 				kvmtApplicationCntlReq, kvtpApplInvokeBreak);
     ApplResp.fUnused = 0xFF;
-    ++appl_req_count;
-    ApplResp.fRequestCount = htons(appl_req_count);
+    ++conn->fApplReqCount;
+    ApplResp.fRequestCount = htons(conn->fApplReqCount);
     ApplResp.fApplIndex = htons(send_index);
-    returnValue = SendToAM(conn, (tVTMHeader *) &ApplResp, sizeof(ApplResp));
+    returnValue = SendUrgentToAM(conn, (tVTMHeader *) &ApplResp,
+				 sizeof(ApplResp));
 
     return returnValue;
 } /*GenerateApplControlReq*/
@@ -930,6 +1244,29 @@ void VTErrorMessage(tVTConnection * conn, int errorCode, char * msg, int maxLeng
 	strcpy(messageBuffer, "Received unexpected app control request.");
 	break;
 
+    case kVTCResolveError:
+	if (conn)
+	    sprintf(messageBuffer, "Unable to resolve host name: %s.",
+		    gai_strerror(conn->fLastSocketError));
+	else strcpy(messageBuffer, "Unable to resolve host name.");
+	break;
+
+    case kVTCConnectTimeout:
+	strcpy(messageBuffer, "Timed out connecting to host.");
+	break;
+
+    case kVTCConnectPending:
+	strcpy(messageBuffer, "Connection in progress.");
+	break;
+
+    case kVTCFileError:
+	strcpy(messageBuffer, "Unable to open file.");
+	break;
+
+    case kVTCConnectionClosed:
+	strcpy(messageBuffer, "Connection closed by host.");
+	break;
+
     default:
 	sprintf(messageBuffer, "Unknown socket error code %d.", errorCode);
 	break;
@@ -943,6 +1280,83 @@ void VTErrorMessage(tVTConnection * conn, int errorCode, char * msg, int maxLeng
     else strcpy(msg, messageBuffer);
 } /*VTErrorMessage*/
 
+/* Asynchronous connection setup. VTConnectStart() kicks off name	*/
+/* resolution (getaddrinfo_a where the C library has it) and		*/
+/* VTConnectStep() moves things along without ever blocking: once	*/
+/* addresses are known, a non-blocking connect() goes out to up to	*/
+/* kVT_MAX_CONNECT_ATTEMPTS of them at once and the first to answer	*/
+/* becomes the connection's socket. Both return kVTCConnectPending	*/
+/* until the socket is up (kVTCNoError) or the deadline passes.	*/
+/* VTConnectWait() sleeps between steps for callers with nothing	*/
+/* else to do. An event loop can instead wait on VTConnectSockets()	*/
+/* for writing, on the fd given to VTConnectNotify() for reading	*/
+/* while a name is resolving, and for VTConnectTimeLeft().		*/
+
+typedef struct stVTConnectAttempt
+{
+    char		fName[256];
+    char		fService[16];
+    struct addrinfo	fHints;
+    struct addrinfo *	fResult;
+#ifdef HAVE_GETADDRINFO_A
+    struct gaicb	fRequest;
+    bool		fResolving;		/* fRequest outstanding	*/
+#endif
+    int64_t		fDeadline;		/* 0 for none		*/
+    int			fCount;
+    int			fSockets[kVT_MAX_CONNECT_ATTEMPTS];
+    struct sockaddr_in	fAddresses[kVT_MAX_CONNECT_ATTEMPTS];
+} tVTConnectAttempt;
+
+/* Where a finished lookup says so; -1 for nowhere */
+static int connectNotifyFd = -1;
+
+void VTConnectNotify(int fd)
+{ /*VTConnectNotify*/
+    connectNotifyFd = fd;
+} /*VTConnectNotify*/
+
+#ifdef HAVE_GETADDRINFO_A
+/* Runs on a thread of the resolver's; the fd outlives every lookup */
+static void ResolveDone(union sigval value)
+{ /*ResolveDone*/
+    uint64_t one = 1;
+
+    (void) write(value.sival_int, &one, sizeof(one));
+} /*ResolveDone*/
+#endif
+
+static void FreeConnectAttempt(tVTConnection * conn)
+{ /*FreeConnectAttempt*/
+    tVTConnectAttempt * attempt = conn->fAttempt;
+    int i;
+
+    if (attempt == NULL)
+	return;
+#ifdef HAVE_GETADDRINFO_A
+    if (attempt->fResolving)
+	{
+	/* A lookup that can't be cancelled still owns fRequest; wait	*/
+	/* for it so the result can be freed.				*/
+	struct gaicb * list[1];
+
+	list[0] = &attempt->fRequest;
+	if (gai_cancel(&attempt->fRequest) == EAI_NOTCANCELED)
+	    while (gai_error(&attempt->fRequest) == EAI_INPROGRESS)
+		gai_suspend((const struct gaicb * const *) list, 1, NULL);
+	if (attempt->fRequest.ar_result)
+	    freeaddrinfo(attempt->fRequest.ar_result);
+	}
+#endif
+    if (attempt->fResult)
+	freeaddrinfo(attempt->fResult);
+    for (i = 0; i < attempt->fCount; i++)
+	if (attempt->fSockets[i] != -1)
+	    close(attempt->fSockets[i]);
+    free(attempt);
+    conn->fAttempt = NULL;
+} /*FreeConnectAttempt*/
+
 int VTInitConnection(tVTConnection * conn, long ipAddress, int ipPort)
 { /*VTInitConnection*/
     int returnValue = kVTCNoError;	/* Assume failure.	*/
@@ -955,15 +1369,53 @@ int VTInitConnection(tVTConnection * conn, long ipAddress, int ipPort)
 
     returnValue = kVTCMemoryAllocationError;
 
-    conn->fSendBuffer = (char *) malloc(kVT_MAX_BUFFER);
+    conn->fSendBuffer = (char *) malloc(kVT_MIN_BUFFER);
     if (conn->fSendBuffer == NULL) goto Last;
+    conn->fSendBufferAlloc = kVT_MIN_BUFFER;
 
-    conn->fReceiveBuffer = (char *) malloc(kVT_MAX_BUFFER);
+    conn->fReceiveBuffer = (char *) malloc(kVT_MIN_BUFFER);
     if (conn->fReceiveBuffer == NULL) 
         {
         free(conn->fSendBuffer);
         goto Last;
         }
+    conn->fReceiveBufferAlloc = kVT_MIN_BUFFER;
+
+    conn->fReceiveRing = (char *) malloc(kVT_RECEIVE_RING_MIN);
+    if (conn->fReceiveRing == NULL)
+        {
+        free(conn->fSendBuffer);
+        free(conn->fReceiveBuffer);
+        goto Last;
+        }
+    conn->fReceiveRingSize = kVT_RECEIVE_RING_MIN;
+    conn->fTrimCountdown = kVT_TRIM_INTERVAL;
+    SetUpForNewRecordReceive(conn);
+
+    conn->fOutQueue = (char *) malloc(kVT_OUT_QUEUE);
+    if (conn->fOutQueue == NULL)
+        {
+        free(conn->fSendBuffer);
+        free(conn->fReceiveBuffer);
+        free(conn->fReceiveRing);
+        goto Last;
+        }
+    conn->fOutQueueSize = kVT_OUT_QUEUE;
+    conn->fOutQueueLength = 0;
+    conn->fOutQueueRecords = 0;
+    conn->fOutQueueHold = false;
+
+    conn->fInput = (tVTInput *) malloc(sizeof(tVTInput));
+    if (conn->fInput == NULL)
+        {
+        free(conn->fSendBuffer);
+        free(conn->fReceiveBuffer);
+        free(conn->fReceiveRing);
+        free(conn->fOutQueue);
+        goto Last;
+        }
+    memset((char *) conn->fInput, 0, offsetof(tVTInput, fImmQueue));
+    FlushQ(conn);
 
     /* There are a few things that the AM never tells us but 	*/
     /* that it's pretty clear we're suppsed to know. One of     */
@@ -972,6 +1424,8 @@ int VTInitConnection(tVTConnection * conn, long ipAddress, int ipPort)
 
     conn->fLineTerminationChar = 015;  /* CR */
 
+    VTStatsReset(conn);
+
     conn->fSendBufferSize = kVT_MAX_BUFFER;
     conn->fReceiveBufferSize = kVT_MAX_BUFFER;
 
@@ -989,9 +1443,14 @@ int VTInitConnection(tVTConnection * conn, long ipAddress, int ipPort)
 	}
 
     conn->fDataOutProc = DefaultDataOutProc;
+    conn->fDataOutVProc = NULL;
+    conn->fDataOutFlushProc = NULL;
     conn->fState = kvtsClosed;
     conn->fDriverMode = kDTCVanilla;
     conn->fBlockModeSupported = false;	/* RM 960411 */
+    conn->fTransportProfile = kTransportInteractive;
+    conn->fTransportFlags = kTransportAutoBulk;
+    conn->fTransportActive = kTransportDefault;
     returnValue = kVTCNoError;
 
 Last:
@@ -1000,8 +1459,19 @@ Last:
 
 void VTCleanUpConnection(tVTConnection * conn)
 { /*VTCleanUpConnection*/
+    FreeConnectAttempt(conn);
+    VTTraceStop(conn);
+    VTCaptureStop(conn);
     if (conn->fSendBuffer) free(conn->fSendBuffer);
     if (conn->fReceiveBuffer) free(conn->fReceiveBuffer);
+    if (conn->fReceiveRing) free(conn->fReceiveRing);
+    if (conn->fOutQueue) free(conn->fOutQueue);
+    if (conn->fSendBacklog) free(conn->fSendBacklog);
+    if (conn->fInput)
+	{
+	memset(conn->fInput->fLogon, 0, sizeof(conn->fInput->fLogon));
+	free(conn->fInput);
+	}
     if (conn->fSocket != -1) 
 	{
 	shutdown(conn->fSocket, 2);
@@ -1012,17 +1482,56 @@ void VTCleanUpConnection(tVTConnection * conn)
     conn->fSocket = -1;
 } /*VTCleanUpConnection*/
 
+bool VTSendPending(tVTConnection * conn)
+{ /*VTSendPending*/
+    return (conn->fSendBacklogLength > 0);
+} /*VTSendPending*/
+
+/* The socket is writable again; send as much of the backlog as it takes */
+
+int VTSendReady(tVTConnection * conn)
+{ /*VTSendReady*/
+    ssize_t
+	charsSent;
+
+    while (conn->fSendBacklogLength > 0)
+	{
+	charsSent = send(conn->fSocket, conn->fSendBacklog,
+			 conn->fSendBacklogLength, 0);
+	if (charsSent == -1)
+	    {
+	    if (errno == EINTR)
+		continue;
+	    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+		break;
+	    conn->fLastSocketError = errno;
+	    return kVTCSocketError;
+	    }
+	conn->fStats.fSends++;
+	conn->fStats.fSendBytes += charsSent;
+	conn->fSendBacklogLength -= charsSent;
+	memmove(conn->fSendBacklog, conn->fSendBacklog + charsSent,
+		conn->fSendBacklogLength);
+	}
+    return kVTCNoError;
+} /*VTSendReady*/
+
 int VTSocket(tVTConnection * conn)
 { /*VTSocket*/
     return conn->fSocket;
 } /*VTSocket*/
 
-int VTConnect(tVTConnection * conn)
-{ /*VTConnect*/
-    int  connectError;
+void VTSetTransportProfile(tVTConnection * conn, int profile, int flags)
+{ /*VTSetTransportProfile*/
+    conn->fTransportProfile = profile;
+    conn->fTransportFlags = flags;
+    if (conn->fState != kvtsClosed)
+	ApplyTransportProfile(conn, conn->fSocket, false);
+} /*VTSetTransportProfile*/
+
+static int SetConnectOptions(tVTConnection * conn, int fd)
+{ /*SetConnectOptions*/
     int  returnValue = kVTCNoError;	/* Assume success */
-    int
-	flags = 0;
 #ifdef IPPROTO_IP
 #ifdef IP_TOS
     int tos = 0;
@@ -1034,12 +1543,6 @@ int VTConnect(tVTConnection * conn)
 #endif /* TCP_NOOPT */
 #endif /* IPPROTO_TCP */
 
-    if (conn->fState != kvtsClosed)
-	{
-	returnValue = kVTCNotInitialized;
-	goto Last;
-	}
-
 #ifdef IPPROTO_IP
 #ifdef IP_TOS
     /* older versions of NS Transport on classic MPE V/E (V-delta-9, before, likely
@@ -1047,7 +1550,7 @@ int VTConnect(tVTConnection * conn)
      * and older versions of NS/3000 VT server will call SUDDENDEATH(969) on the resulting
      * socket error; so force it to zero and don't be the remote denial-of-service
      */
-    if (0 > setsockopt(conn->fSocket, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)))
+    if (0 > setsockopt(fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)))
 	{
 	returnValue = kVTCSocketError;
 	conn->fLastSocketError = errno;
@@ -1067,7 +1570,7 @@ int VTConnect(tVTConnection * conn)
      * and as a bonus get connected faster, but too bad about MSS negotiation via
      * TCP options.
      */
-    if (0 > setsockopt(conn->fSocket, IPPROTO_TCP, TCP_NOOPT, &noopt, sizeof(noopt)))
+    if (0 > setsockopt(fd, IPPROTO_TCP, TCP_NOOPT, &noopt, sizeof(noopt)))
         {
 	returnValue = kVTCSocketError;
 	conn->fLastSocketError = errno;
@@ -1076,33 +1579,63 @@ int VTConnect(tVTConnection * conn)
 #endif /* TCP_NOOPT */
 #endif /* IPPROTO_TCP */
 
-    connectError = connect(conn->fSocket, 
-			   (struct sockaddr *) &conn->fTargetAddress,
-			   sizeof(conn->fTargetAddress));
+    conn->fTransportActive = kTransportDefault;	/* A fresh socket */
+    ApplyTransportProfile(conn, fd, true);
 
-    if (connectError)
+Last:
+    return returnValue;
+} /*SetConnectOptions*/
+
+static int SetNonBlocking(tVTConnection * conn, int fd)
+{ /*SetNonBlocking*/
+    int
+	flags = 0;
+
+#  ifdef O_NONBLOCK
+    if ((flags = fcntl(fd, F_GETFL, 0)) == -1)
 	{
-	returnValue = kVTCSocketError;
 	conn->fLastSocketError = errno;
-	goto Last;
+	return kVTCSocketError;
 	}
-
-#  ifdef O_NONBLOCK
-    if ((flags = fcntl(conn->fSocket, F_GETFL, 0)) == -1)
+    flags |= O_NONBLOCK;
+    if (fcntl(fd, F_SETFL, flags) == -1)
 	{
-	returnValue = kVTCSocketError;
 	conn->fLastSocketError = errno;
+	return kVTCSocketError;
+	}
+#  endif
+    return kVTCNoError;
+} /*SetNonBlocking*/
+
+int VTConnect(tVTConnection * conn)
+{ /*VTConnect*/
+    int  connectError;
+    int  returnValue = kVTCNoError;	/* Assume success */
+
+    if (conn->fState != kvtsClosed)
+	{
+	returnValue = kVTCNotInitialized;
 	goto Last;
 	}
-    flags |= O_NONBLOCK;
-    if (fcntl(conn->fSocket, F_SETFL, flags) == -1)
+
+    conn->fTimes.fStart = conn->fTimes.fResolved = MyMonotonicUsec();
+
+    if ((returnValue = SetConnectOptions(conn, conn->fSocket))) goto Last;
+
+    connectError = connect(conn->fSocket, 
+			   (struct sockaddr *) &conn->fTargetAddress,
+			   sizeof(conn->fTargetAddress));
+
+    if (connectError)
 	{
 	returnValue = kVTCSocketError;
 	conn->fLastSocketError = errno;
 	goto Last;
 	}
-#  endif
 
+    if ((returnValue = SetNonBlocking(conn, conn->fSocket))) goto Last;
+
+    conn->fTimes.fConnected = MyMonotonicUsec();
     SetUpForNewRecordReceive(conn);
     conn->fState = kvtsWaitingForAM;
 
@@ -1110,99 +1643,617 @@ Last:
     return returnValue;
 } /*VTConnect*/
 
+static int StartConnects(tVTConnection * conn)
+{ /*StartConnects*/
+    tVTConnectAttempt * attempt = conn->fAttempt;
+    struct addrinfo * ai;
+    int returnValue = kVTCNoError;
+    int fd;
+
+    conn->fTimes.fResolved = MyMonotonicUsec();
+    for (ai = attempt->fResult;
+	 (ai != NULL) && (attempt->fCount < kVT_MAX_CONNECT_ATTEMPTS);
+	 ai = ai->ai_next)
+	{
+	if ((ai->ai_family != AF_INET) ||
+	    (ai->ai_addrlen != sizeof(struct sockaddr_in)))
+	    continue;
+	fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (fd == -1)
+	    {
+	    conn->fLastSocketError = errno;
+	    continue;
+	    }
+	if ((SetConnectOptions(conn, fd)) || (SetNonBlocking(conn, fd)))
+	    {
+	    close(fd);
+	    continue;
+	    }
+	if ((connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) &&
+	    (errno != EINPROGRESS))
+	    {
+	    conn->fLastSocketError = errno;
+	    close(fd);
+	    continue;
+	    }
+	attempt->fSockets[attempt->fCount] = fd;
+	memcpy(&attempt->fAddresses[attempt->fCount], ai->ai_addr,
+	       sizeof(struct sockaddr_in));
+	++attempt->fCount;
+	}
+    if (attempt->fCount == 0)
+	returnValue = kVTCSocketError;
+    else
+	conn->fState = kvtsConnecting;
+    return returnValue;
+} /*StartConnects*/
+
+static int CheckConnects(tVTConnection * conn)
+{ /*CheckConnects*/
+    tVTConnectAttempt * attempt = conn->fAttempt;
+    struct pollfd pfd[kVT_MAX_CONNECT_ATTEMPTS];
+    int i, live = 0, soError;
+    socklen_t soLength;
+
+    for (i = 0; i < attempt->fCount; i++)
+	{
+	pfd[i].fd = attempt->fSockets[i];	/* -1 is ignored by poll */
+	pfd[i].events = POLLOUT;
+	pfd[i].revents = 0;
+	}
+    if (poll(pfd, attempt->fCount, 0) == -1)
+	return (errno == EINTR) ? kVTCConnectPending : kVTCSocketError;
+
+    for (i = 0; i < attempt->fCount; i++)
+	{
+	if (attempt->fSockets[i] == -1)
+	    continue;
+	if (!pfd[i].revents)
+	    {
+	    ++live;
+	    continue;
+	    }
+	soError = 0;
+	soLength = sizeof(soError);
+	if (getsockopt(attempt->fSockets[i], SOL_SOCKET, SO_ERROR,
+		       &soError, &soLength) == -1)
+	    soError = errno;
+	if (soError)
+	    {
+	    conn->fLastSocketError = soError;
+	    close(attempt->fSockets[i]);
+	    attempt->fSockets[i] = -1;
+	    continue;
+	    }
+
+	/* This one answered first: it becomes the connection. */
+
+	if (conn->fSocket != -1)
+	    close(conn->fSocket);
+	conn->fSocket = attempt->fSockets[i];
+	attempt->fSockets[i] = -1;
+	memcpy(&conn->fTargetAddress, &attempt->fAddresses[i],
+	       sizeof(conn->fTargetAddress));
+	FreeConnectAttempt(conn);
+	conn->fTimes.fConnected = MyMonotonicUsec();
+	SetUpForNewRecordReceive(conn);
+	conn->fState = kvtsWaitingForAM;
+	return kVTCNoError;
+	}
+    return (live) ? kVTCConnectPending : kVTCSocketError;
+} /*CheckConnects*/
+
+int VTConnectStart(tVTConnection * conn, char * hostName, int ipPort, int timeoutMs)
+{ /*VTConnectStart*/
+    tVTConnectAttempt * attempt;
+    int returnValue;
+
+    if (conn->fState != kvtsClosed)
+	return kVTCNotInitialized;
+
+    attempt = (tVTConnectAttempt *) calloc(1, sizeof(tVTConnectAttempt));
+    if (attempt == NULL)
+	return kVTCMemoryAllocationError;
+    conn->fAttempt = attempt;
+    memset(&conn->fTimes, 0, sizeof(conn->fTimes));
+    conn->fTimes.fStart = MyMonotonicUsec();
+    if (timeoutMs > 0)
+	attempt->fDeadline = conn->fTimes.fStart + (int64_t) timeoutMs * 1000;
+
+    snprintf(attempt->fName, sizeof(attempt->fName), "%s", hostName);
+    snprintf(attempt->fService, sizeof(attempt->fService), "%d", ipPort);
+    attempt->fHints.ai_family = AF_INET;
+    attempt->fHints.ai_socktype = SOCK_STREAM;
+    attempt->fHints.ai_protocol = IPPROTO_TCP;
+
+#ifdef HAVE_GETADDRINFO_A
+    {
+    struct gaicb * list[1];
+    struct sigevent notify, * notifyp = NULL;
+
+    attempt->fRequest.ar_name = attempt->fName;
+    attempt->fRequest.ar_service = attempt->fService;
+    attempt->fRequest.ar_request = &attempt->fHints;
+    list[0] = &attempt->fRequest;
+    if (connectNotifyFd != -1)
+	{
+	memset(&notify, 0, sizeof(notify));
+	notify.sigev_notify = SIGEV_THREAD;
+	notify.sigev_notify_function = ResolveDone;
+	notify.sigev_value.sival_int = connectNotifyFd;
+	notifyp = &notify;
+	}
+    if ((returnValue = getaddrinfo_a(GAI_NOWAIT, list, 1, notifyp)))
+	{
+	conn->fLastSocketError = returnValue;
+	FreeConnectAttempt(conn);
+	return kVTCResolveError;
+	}
+    attempt->fResolving = true;
+    conn->fState = kvtsResolving;
+    }
+#else
+    /* No asynchronous resolver here; this part may block. */
+    if ((returnValue = getaddrinfo(attempt->fName, attempt->fService,
+				   &attempt->fHints, &attempt->fResult)))
+	{
+	conn->fLastSocketError = returnValue;
+	FreeConnectAttempt(conn);
+	return kVTCResolveError;
+	}
+    if ((returnValue = StartConnects(conn)))
+	{
+	FreeConnectAttempt(conn);
+	return returnValue;
+	}
+#endif
+    return VTConnectStep(conn);
+} /*VTConnectStart*/
+
+int VTConnectStep(tVTConnection * conn)
+{ /*VTConnectStep*/
+    tVTConnectAttempt * attempt = conn->fAttempt;
+    int returnValue = kVTCConnectPending;
+
+    if (attempt == NULL)
+	return (conn->fState == kvtsClosed) ? kVTCNotInitialized : kVTCNoError;
+
+#ifdef HAVE_GETADDRINFO_A
+    if (conn->fState == kvtsResolving)
+	{
+	returnValue = gai_error(&attempt->fRequest);
+	if (returnValue == EAI_INPROGRESS)
+	    returnValue = kVTCConnectPending;
+	else
+	    {
+	    attempt->fResolving = false;
+	    attempt->fResult = attempt->fRequest.ar_result;
+	    attempt->fRequest.ar_result = NULL;
+	    if (returnValue)
+		{
+		conn->fLastSocketError = returnValue;
+		returnValue = kVTCResolveError;
+		}
+	    else
+		returnValue = StartConnects(conn);
+	    }
+	}
+#endif
+    if (conn->fState == kvtsConnecting)
+	returnValue = CheckConnects(conn);
+
+    if ((returnValue == kVTCConnectPending) && (attempt->fDeadline) &&
+	(MyMonotonicUsec() >= attempt->fDeadline))
+	returnValue = kVTCConnectTimeout;
+    if ((returnValue != kVTCConnectPending) && (returnValue != kVTCNoError))
+	{
+	FreeConnectAttempt(conn);
+	conn->fState = kvtsClosed;
+	}
+    return returnValue;
+} /*VTConnectStep*/
+
+int VTConnectSockets(tVTConnection * conn, int * fds, int maxFds)
+{ /*VTConnectSockets*/
+    tVTConnectAttempt * attempt = conn->fAttempt;
+    int i, count = 0;
+
+    if ((attempt == NULL) || (conn->fState != kvtsConnecting))
+	return 0;
+    for (i = 0; (i < attempt->fCount) && (count < maxFds); i++)
+	if (attempt->fSockets[i] != -1)
+	    fds[count++] = attempt->fSockets[i];
+    return count;
+} /*VTConnectSockets*/
+
+int VTConnectTimeLeft(tVTConnection * conn)
+{ /*VTConnectTimeLeft*/
+    tVTConnectAttempt * attempt = conn->fAttempt;
+    int64_t left;
+
+    if ((attempt == NULL) || (!attempt->fDeadline))
+	return -1;
+    left = (attempt->fDeadline - MyMonotonicUsec() + 999) / 1000;
+    return (left > 0) ? (int) left : 0;
+} /*VTConnectTimeLeft*/
+
+int VTConnectWait(tVTConnection * conn)
+{ /*VTConnectWait*/
+    int returnValue;
+    int waitMs, i;
+    tVTConnectAttempt * attempt;
+    struct pollfd pfd[kVT_MAX_CONNECT_ATTEMPTS];
+
+    while ((returnValue = VTConnectStep(conn)) == kVTCConnectPending)
+	{
+	attempt = conn->fAttempt;
+	waitMs = VTConnectTimeLeft(conn);
+#ifdef HAVE_GETADDRINFO_A
+	if (conn->fState == kvtsResolving)
+	    {
+	    struct gaicb * list[1];
+	    struct timespec ts, * tsp = NULL;
+
+	    list[0] = &attempt->fRequest;
+	    if (waitMs >= 0)
+		{
+		ts.tv_sec = waitMs / 1000;
+		ts.tv_nsec = (waitMs % 1000) * 1000000L;
+		tsp = &ts;
+		}
+	    gai_suspend((const struct gaicb * const *) list, 1, tsp);
+	    continue;
+	    }
+#endif
+	for (i = 0; i < attempt->fCount; i++)
+	    {
+	    pfd[i].fd = attempt->fSockets[i];
+	    pfd[i].events = POLLOUT;
+	    }
+	(void) poll(pfd, attempt->fCount, waitMs);
+	}
+    return returnValue;
+} /*VTConnectWait*/
+
+int VTConnectHost(tVTConnection * conn, char * hostName, int ipPort, int timeoutMs)
+{ /*VTConnectHost*/
+    int returnValue;
+
+    if ((returnValue = VTConnectStart(conn, hostName, ipPort, timeoutMs))
+	== kVTCConnectPending)
+	returnValue = VTConnectWait(conn);
+    return returnValue;
+} /*VTConnectHost*/
+
+static void FormatPhase(char * buffer, char * name, int64_t from, int64_t to)
+{ /*FormatPhase*/
+    if ((from) && (to))
+	sprintf(buffer + strlen(buffer), "%s%s %.1f ms",
+		(*buffer) ? ", " : "", name, (double) (to - from) / 1000.0);
+} /*FormatPhase*/
+
+void VTFormatTimes(tVTConnection * conn, char * msg, int maxLen)
+{ /*VTFormatTimes*/
+    char  messageBuffer[256];
+    tVTPhaseTimes * t = &conn->fTimes;
+
+    messageBuffer[0] = 0;
+    FormatPhase(messageBuffer, "resolve", t->fStart, t->fResolved);
+    FormatPhase(messageBuffer, "connect", t->fResolved, t->fConnected);
+    FormatPhase(messageBuffer, "AM negotiation", t->fConnected, t->fAMNegotiation);
+    FormatPhase(messageBuffer, "TM reply", t->fAMNegotiation, t->fOpen);
+    FormatPhase(messageBuffer, "first prompt", t->fOpen, t->fFirstRead);
+    if (t->fReady != t->fFirstRead)
+	FormatPhase(messageBuffer, "logon", t->fFirstRead, t->fReady);
+    FormatPhase(messageBuffer, "total", t->fStart,
+		(t->fReady) ? t->fReady : t->fOpen);
+    snprintf(msg, maxLen, "%s", messageBuffer);
+} /*VTFormatTimes*/
+
+static int Log2Bucket(int64_t value)
+{ /*Log2Bucket*/
+    int bucket;
+
+    for (bucket = 0; (bucket < kVT_STATS_BUCKETS - 1) &&
+		     ((value >> (bucket + 1)) > 0); bucket++)
+	;
+    return bucket;
+} /*Log2Bucket*/
+
+static int CountAndProcessRecord(tVTConnection * conn, int recordLength)
+{ /*CountAndProcessRecord*/
+    tVTStats * st = &conn->fStats;
+    unsigned  type, prim;
+    int       bucket, returnValue;
+    int64_t   start, elapsed;
+
+    /* Counting is two adds per record. Timing costs two clock reads,	*/
+    /* so only one record in kVT_STATS_SAMPLE is timed.		*/
+
+    type = (unsigned char) conn->fReceiveBuffer[3];
+    prim = (unsigned char) conn->fReceiveBuffer[5];
+    if ((type >= kVT_STATS_TYPES) || (prim >= kVT_STATS_PRIMS))
+	{
+	st->fOtherRecords++;
+	returnValue = ProcessReceivedRecord(conn);
+	}
+    else if (st->fSampleCountdown-- != 0)
+	{
+	st->fCounts[type][prim].fRecords++;
+	st->fCounts[type][prim].fBytes += recordLength;
+	returnValue = ProcessReceivedRecord(conn);
+	}
+    else
+	{
+	st->fCounts[type][prim].fRecords++;
+	st->fCounts[type][prim].fBytes += recordLength;
+	st->fSampleCountdown = kVT_STATS_SAMPLE - 1;
+
+	start = MyMonotonicNsec();
+	returnValue = ProcessReceivedRecord(conn);
+	elapsed = MyMonotonicNsec() - start;
+	bucket = Log2Bucket(elapsed);
+	st->fSamples[type]++;
+	st->fSampleNsec[type] += (elapsed > 0) ? elapsed : 0;
+	st->fTimeHist[type][bucket]++;
+	}
+
+    if ((returnValue != kVTCNoError) && (returnValue != kVTCVTOpen) &&
+	(returnValue != kVTCStartShutdown))
+	st->fErrors++;
+    return returnValue;
+} /*CountAndProcessRecord*/
+
 int VTReceiveDataReady(tVTConnection * conn)
 { /*VTReceiveDataReady*/
     int    returnValue = kVTCNoError;
-    char * dataDest;
-    size_t lengthToReceive;
+    int    flushError;
+    int    recordLength;
+    int    readSpace;
     ssize_t
 	   receivedLength;
 
-    if (conn->fReceiveBufferOffset < 0)  /* Receiving length word? */
-        {
-        dataDest = conn->fReceiveBufferOffset +
-			(char *) &conn->fLengthWord + 
-			    sizeof(conn->fLengthWord);
-        lengthToReceive = -conn->fReceiveBufferOffset;
-        }
-    else   /* Receiving data, not length */
+    /* Only go to the socket if the ring doesn't already hold a	*/
+    /* complete record left over from the previous call.		*/
+
+    recordLength = RecordAvailable(conn);
+    if (recordLength == 0)
 	{
-	dataDest = conn->fReceiveBuffer +
-			conn->fReceiveBufferOffset;
-        lengthToReceive = conn->fLengthToReceive;
-        }
+	if (conn->fRingHead > 0)	/* Slide partial record to front */
+	    {
+	    memmove(conn->fReceiveRing,
+		    conn->fReceiveRing + conn->fRingHead,
+		    conn->fRingTail - conn->fRingHead);
+	    conn->fRingTail -= conn->fRingHead;
+	    conn->fRingHead = 0;
+	    }
 
-    receivedLength = read(conn->fSocket, dataDest, lengthToReceive);
-    if (receivedLength > 0)
-        {
-        if (conn->fReceiveBufferOffset < 0) /* Data intended for len?*/
-	    {  /* Yes, accumulate in length word */
-            conn->fReceiveBufferOffset += receivedLength;
-            if (conn->fReceiveBufferOffset >= 0)  
-                {
-                /* We have the length word. Set up to receive the record. */
+	/* Make room for the whole of a record we have the start of */
 
-                assert(conn->fReceiveBufferOffset == 0);
-                conn->fLengthToReceive = ntohs(conn->fLengthWord) - 2;
+	if (conn->fRingTail >= 2)
+	    {
+	    recordLength = ((unsigned char) conn->fReceiveRing[0] << 8) |
+			   (unsigned char) conn->fReceiveRing[1];
+	    if (!GrowBuffer(&conn->fReceiveRing, &conn->fReceiveRingSize,
+			    recordLength, kVT_RECEIVE_RING))
+		{
+		returnValue = kVTCMemoryAllocationError;
+		goto Last;
+		}
+	    }
 
-		/* Validate the received length word. */
+	readSpace = conn->fReceiveRingSize - conn->fRingTail;
+	receivedLength = read(conn->fSocket,
+			      conn->fReceiveRing + conn->fRingTail,
+			      readSpace);
+	if (receivedLength < 0)  /* Error occurred? */
+	    {
+	    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) ||
+		(errno == EINTR))
+		goto Last;
+	    returnValue = kVTCSocketError;
+	    conn->fLastSocketError = errno;
+	    goto Last;
+	    }
 
-		if ((conn->fLengthToReceive > conn->fReceiveBufferSize - 2) ||
-		    (conn->fLengthToReceive < 2))
-		    {
-		    returnValue = kVTCReceiveRecordLengthError;
-	    	    goto Last;
-		    }
+	/* The host went away without a termination message. Every	*/
+	/* poller reports a hangup as readable, so this has to end	*/
+	/* the session or the caller would be called straight back.	*/
 
-		/* Copy the length word into the buffer, then set the	*/
-		/* offset to point past it. The remainder of the record */
-		/* will follow the length word.				*/
+	if ((receivedLength == 0) && (readSpace > 0))
+	    {
+	    returnValue = kVTCConnectionClosed;
+	    goto Last;
+	    }
+	TransportQuickAck(conn->fSocket, conn->fTransportActive);
+	conn->fStats.fReads++;
+	conn->fStats.fReadBytes += receivedLength;
+	conn->fRingTail += receivedLength;
+	if (conn->fRingTail > conn->fRingPeak)
+	    conn->fRingPeak = conn->fRingTail;
+
+	/* A read that filled the ring suggests more was waiting. */
+
+	if ((receivedLength == readSpace) &&
+	    (conn->fReceiveRingSize < kVT_RECEIVE_RING))
+	    (void) GrowBuffer(&conn->fReceiveRing, &conn->fReceiveRingSize,
+			      conn->fReceiveRingSize * 2, kVT_RECEIVE_RING);
+	recordLength = RecordAvailable(conn);
+	}
 
-		memcpy(conn->fReceiveBuffer,
-			(char *) &conn->fLengthWord, 2);
-                conn->fReceiveBufferOffset = 2; /* Past length word */
-		}
-            }
-        else  /* A record receive, not a data receive */
-            {
-	    assert(receivedLength <= conn->fLengthToReceive);
-	    conn->fReceiveBufferOffset += receivedLength;
-	    conn->fLengthToReceive -= receivedLength;
-	    if (conn->fLengthToReceive <= 0)
+    /* Process every complete record in the ring. Stop early when a	*/
+    /* record needs the caller's attention: an error or state change,	*/
+    /* or a newly posted read that has to be triggered before the next	*/
+    /* record is looked at. VTReceivePending() tells the caller to come	*/
+    /* back for the rest.						*/
+
+    conn->fOutQueueHold = true;
+    while (recordLength > 0)
+	{
+	if (recordLength > conn->fReceiveBufferPeak)	/* Peak <= Alloc */
+	    {
+	    if (!GrowBuffer(&conn->fReceiveBuffer, &conn->fReceiveBufferAlloc,
+			    recordLength, conn->fReceiveBufferSize))
 		{
-		if (debug > 0)
-		    DumpBuffer(dataDest, receivedLength, "from_host");
-		returnValue = ProcessReceivedRecord(conn);
-		SetUpForNewRecordReceive(conn);
+		returnValue = kVTCMemoryAllocationError;
+		break;
 		}
-            }
-        }
-    else if (receivedLength < 0)  /* Error occurred? */
-        {
-	returnValue = kVTCSocketError;
-	conn->fLastSocketError = errno;
-        }
+	    conn->fReceiveBufferPeak = recordLength;
+	    }
+	memcpy(conn->fReceiveBuffer,
+	       conn->fReceiveRing + conn->fRingHead, recordLength);
+	conn->fRingHead += recordLength;
+	if (conn->fCapture)
+	    VTCaptureRecord(conn, conn->fReceiveBuffer, recordLength);
+	if (debug > 0)
+	    DumpBuffer(conn->fReceiveBuffer + 2, recordLength - 2,
+		       "from_host");
+	returnValue = CountAndProcessRecord(conn, recordLength);
+	if ((returnValue != kVTCNoError) || (conn->fReadStarted))
+	    break;
+	recordLength = RecordAvailable(conn);
+	}
+    if (recordLength < 0)
+	returnValue = kVTCReceiveRecordLengthError;
+
+    /* Send everything the batch generated in one go. */
+
+    conn->fOutQueueHold = false;
+    flushError = FlushToAM(conn);
+    if (returnValue == kVTCNoError)
+	returnValue = flushError;
+
+    if (conn->fRingHead == conn->fRingTail)
+	{
+	SetUpForNewRecordReceive(conn);
+	TrimBuffers(conn);
+	}
 
 Last:
     return returnValue;
 } /*VTReceiveDataReady*/
 
+/* Process one record that came from somewhere other than the socket,	*/
+/* such as a capture file being replayed. Replies still go to the	*/
+/* socket.								*/
+
+int VTReplayRecord(tVTConnection * conn, const char * record, int length)
+{ /*VTReplayRecord*/
+    int    returnValue;
+    int    flushError;
+
+    if ((length < (int) sizeof(tVTMHeader)) ||
+	(length != (((unsigned char) record[0] << 8) |
+		    (unsigned char) record[1])))
+	return kVTCReceiveRecordLengthError;
+    if (length > conn->fReceiveBufferPeak)
+	{
+	if (!GrowBuffer(&conn->fReceiveBuffer, &conn->fReceiveBufferAlloc,
+			length, conn->fReceiveBufferSize))
+	    return kVTCMemoryAllocationError;
+	conn->fReceiveBufferPeak = length;
+	}
+    memcpy(conn->fReceiveBuffer, record, length);
+
+    conn->fOutQueueHold = true;
+    returnValue = CountAndProcessRecord(conn, length);
+    conn->fOutQueueHold = false;
+    flushError = FlushToAM(conn);
+    if (returnValue == kVTCNoError)
+	returnValue = flushError;
+    return returnValue;
+} /*VTReplayRecord*/
+
+bool VTReceivePending(tVTConnection * conn)
+{ /*VTReceivePending*/
+    return (RecordAvailable(conn) != 0);
+} /*VTReceivePending*/
+
+void VTDataOut(tVTConnection * conn, const struct iovec * iov, int iovCount)
+{ /*VTDataOut*/
+    if (conn->fCapture)
+	VTCaptureOutput(conn, iov, iovCount);
+    if (conn->fDataOutVProc)
+	{
+	conn->fDataOutVProc(conn->fDataOutRefCon, iov, iovCount);
+	return;
+	}
+
+    /* Compatibility: one call per piece to a plain data-out proc. */
+
+    for (; iovCount > 0; --iovCount, ++iov)
+	{
+	if (iov->iov_len > 0)
+	    conn->fDataOutProc(conn->fDataOutRefCon,
+			       (char *) iov->iov_base, iov->iov_len);
+	}
+} /*VTDataOut*/
+
 int VTSendBreak(tVTConnection * conn, int send_index)
 { /*VTSendBreak*/
     return(GenerateApplControlReq(conn, send_index));
 } /*VTSendBreak*/
 
+static void TraceReadDone(tVTConnection * conn, int length, int comp_mask)
+{ /*TraceReadDone*/
+    tVTReadTrace * trace = conn->fTrace;
+    int64_t   sent = MyMonotonicNsec();
+    int64_t   wait, client;
+
+    /* Marks older than this read belong to an earlier one; a reply	*/
+    /* with no read posted is counted as taking no time at all.	*/
+
+    if (trace->fPosted == 0)
+	trace->fPosted = sent;
+    if (trace->fScan < trace->fPosted)
+	trace->fScan = sent;
+    if (trace->fTranslate < trace->fScan)
+	trace->fTranslate = trace->fScan;
+    if (trace->fSend < trace->fTranslate)
+	trace->fSend = trace->fTranslate;
+
+    wait = (trace->fScan - trace->fPosted) / 1000;
+    client = sent - trace->fScan;
+    trace->fReads++;
+    trace->fWaitUsec += wait;
+    trace->fClientNsec += client;
+    trace->fWaitHist[Log2Bucket(wait)]++;
+    trace->fClientHist[Log2Bucket(client)]++;
+
+    if (trace->fFile)
+	fprintf(trace->fFile,
+		"%llu\t%.6f\t%lld\t%lld\t%lld\t%lld\t%lld\t%d\t0x%04x\n",
+		(unsigned long long) trace->fReads,
+		(double) (trace->fPosted - trace->fStart) / 1e9,
+		(long long) wait,
+		(long long) (trace->fTranslate - trace->fScan),
+		(long long) (trace->fSend - trace->fTranslate),
+		(long long) (sent - trace->fSend),
+		(long long) client, length, comp_mask);
+    trace->fPosted = 0;
+} /*TraceReadDone*/
+
 int VTSendData(tVTConnection * conn, char * buffer, int length, int comp_mask)
 { /*VTSendData*/
     int   	returnValue = kVTCNoError;
-    tVTMTerminalIOResponse  * resp = 
-           (tVTMTerminalIOResponse * ) conn->fSendBuffer;
+    int		needed;
+    tVTMTerminalIOResponse  * resp;
 
     if (length > conn->fSendBufferSize - sizeof(tVTMTerminalIOResponse)) 
              length = conn->fSendBufferSize - sizeof(tVTMTerminalIOResponse);
 
+    needed = length + sizeof(tVTMTerminalIOResponse);
+    if (needed > conn->fSendBufferPeak)
+	{
+	if (!GrowBuffer(&conn->fSendBuffer, &conn->fSendBufferAlloc,
+			needed, conn->fSendBufferSize))
+	    return kVTCMemoryAllocationError;
+	conn->fSendBufferPeak = needed;
+	}
+    resp = (tVTMTerminalIOResponse * ) conn->fSendBuffer;
+
     FillStandardMessageHeader((tVTMHeader *) resp, kvmtTerminalIOResp,
-				kVTIORead);
+				conn->fReadPrimitive);
     resp->fResponseCode = ((comp_mask == kVTIOCSuccessful)
 			   ? htons(kVTIOCSuccessful)
 			   : htons(kVTIOCEOF));
@@ -1212,6 +2263,8 @@ int VTSendData(tVTConnection * conn, char * buffer, int length, int comp_mask)
     memcpy(resp->fBytes, buffer, length);
     returnValue = SendToAM(conn, (tVTMHeader *) resp,
         length + sizeof(tVTMTerminalIOResponse) - sizeof(resp->fBytes));
+    if (conn->fTrace)
+	TraceReadDone(conn, length, comp_mask);
 /*
 Last:
  */
@@ -22,10 +22,22 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
 #ifndef _VTCONN_H
 #define _VTCONN_H
 
+#include <stdio.h>
+#include <sys/uio.h>
+
 /* Connection constants */
 
 #define kVT_PORT	1570
 #define kVT_MAX_BUFFER	24576
+#define kVT_MIN_BUFFER		1024	/* Record buffers start this big */
+#define kVT_RECEIVE_RING	65536	/* Most bytes pulled per read() */
+#define kVT_RECEIVE_RING_MIN	4096
+#define kVT_TRIM_INTERVAL	64	/* Ring empties between trims */
+#define kVT_OUT_QUEUE		4096	/* Replies held per batch */
+#define kVT_SEND_BACKLOG	(256 * 1024)	/* Most a host may leave unread */
+#define kVT_SEND_TIMEOUT	30000	/* ms a send may wait otherwise */
+#define kVT_CONNECT_TIMEOUT	30000	/* Default connect deadline, ms */
+#define kVT_MAX_CONNECT_ATTEMPTS	4	/* Addresses tried at once */
 
 /* Connection structure. This structure manages everything to do with
    a single connection. It could easily be encapsulated into a C++ class,
@@ -34,9 +46,126 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
 
 #define kMaxLineDeleteEcho	23		/* Long enough, no? */
 
-typedef void tVTDataOutProc(int32_t refCon, char * outBuffer, size_t bufferLength);
+typedef void tVTDataOutProc(intptr_t refCon, char * outBuffer, size_t bufferLength);
 typedef tVTDataOutProc * tVTDataOutProcPtr;
 
+/* The vectored data-out proc receives everything one host record	*/
+/* produces (carriage control and data) in a single call.		*/
+
+typedef void tVTDataOutVProc(intptr_t refCon, const struct iovec * iov, int iovCount);
+typedef tVTDataOutVProc * tVTDataOutVProcPtr;
+
+/* For a data-out proc that buffers: called once output the user is	*/
+/* waiting to see (echo) is complete, so it can go out at once.	*/
+
+typedef void tVTDataOutFlushProc(intptr_t refCon);
+typedef tVTDataOutFlushProc * tVTDataOutFlushProcPtr;
+
+/* Keyboard input on its way to the host. Each connection has its own	*/
+/* typeahead ring, immediate queue (status request answers and the	*/
+/* like, which go ahead of the typeahead) and the record being built	*/
+/* to satisfy the current read.						*/
+
+#define kVT_INPUT_QUEUE		kVT_MAX_BUFFER
+#define kVT_IMM_INPUT_QUEUE	256
+
+/* Typeahead is assembled into fRec before the read that will take it	*/
+/* is posted, under the settings the last read left behind. If the	*/
+/* read comes with the same settings the record goes straight out.	*/
+
+#define kVTAheadIdle		0	/* fRec not holding typeahead	*/
+#define kVTAheadPartial		1	/* Part of a line assembled	*/
+#define kVTAheadRecord		2	/* A whole record is ready	*/
+#define kVTAheadGiveUp		3	/* Leave it for the read	*/
+
+#define kVT_AHEAD_ECHO		1024	/* More echo than this: give up	*/
+
+/* In an input script (freevt3k -a/-I, vt3kload) a line holding just	*/
+/* this is sent as RS, which ends a block mode read the way the	*/
+/* terminal's ENTER key does; a newline only ever sends CR.		*/
+
+#define kVT_SCRIPT_ENTER	"^^"
+#define kVT_SCRIPT_ENTER_LEN	2
+
+/* A logon dialogue queued before the session opens answers the first	*/
+/* reads the host posts, one line each, ahead of any typeahead.	*/
+
+#define kVT_LOGON_LINES		8
+#define kVT_LOGON_LENGTH	128
+
+typedef struct stVTLogonLine
+{
+    int			fLength;
+    bool		fSecret;		/* Password: no echo, no log */
+    char		fText[kVT_LOGON_LENGTH];
+} tVTLogonLine;
+
+typedef struct stVTInputSettings
+{
+    int			fReadLength;
+    int			fDriverMode;
+    int			fEchoControl;
+    int			fCharDeleteEcho;
+    int			fLineDeleteEchoLength;
+    int			fSubsysBreakChar;
+    char		fCharDeleteChar;
+    char		fLineDeleteChar;
+    char		fLineTerminationChar;
+    char		fAltLineTerminationChar;
+    bool		fUneditedMode;
+    bool		fBinaryMode;
+    bool		fDisableLineDeleteEcho;
+    bool		fSubsysBreakEnabled;
+    bool		fEchoCRLFOnCR;
+} tVTInputSettings;
+
+typedef struct stVTInput
+{
+    int			fRecLength;
+
+    char *		fQueueRead;
+    char *		fQueueWrite;
+    int			fQueueLength;
+
+    char *		fImmQueueRead;
+    char *		fImmQueueWrite;
+    int			fImmQueueLength;
+
+    int			fAheadState;		/* kVTAhead...		*/
+    char *		fAheadRead;		/* Last ring byte scanned */
+    int			fAheadLength;		/* Ring bytes scanned	*/
+    int			fAheadCompMask;
+    int			fAheadSendIndex;
+    tVTInputSettings	fAheadSettings;		/* fRec built under these */
+    int			fAheadEchoLength;
+
+    bool		fStopAtEOF;		/* Done when queue runs dry */
+    bool		fEOF;			/* ...and it has	*/
+
+    /* An input file, fed into the ring as it makes room; see FeedQ() */
+
+    bool		fFeeding;		/* A file is open	*/
+    bool		fFeedWait;		/* Pipe: wait until readable */
+    bool		fFeedEOF;
+    int			fFeedFd;
+    char *		fFeedMap;		/* Whole file, if mapped */
+    size_t		fFeedSize;
+    size_t		fFeedOffset;
+    int			fFeedMark;		/* kVT_SCRIPT_ENTER matched */
+
+    tVTLogonLine	fLogon[kVT_LOGON_LINES];
+    int			fLogonLines;
+    int			fLogonNext;		/* Next one to send	*/
+
+    /* The buffers come last and are not cleared when the structure is	*/
+    /* set up, so pages of them nobody has used yet cost nothing.	*/
+
+    char		fImmQueue[kVT_IMM_INPUT_QUEUE];
+    char		fAheadEcho[kVT_AHEAD_ECHO];	/* Shown when taken */
+    char		fRec[kVT_MAX_BUFFER];	/* Line awaiting send	*/
+    char		fQueue[kVT_INPUT_QUEUE];
+} tVTInput;
+
 typedef enum etVTState
 {
     kvtsUninitialized		= 0,
@@ -44,9 +173,85 @@ typedef enum etVTState
     kvtsWaitingForAM    	= 2, 
     kvtsWaitingForTMReply	= 3,
     kvtsOpen			= 4,
-    kvtsWaitingForCloseReply	= 5
+    kvtsWaitingForCloseReply	= 5,
+    kvtsResolving		= 6,
+    kvtsConnecting		= 7
 } tVTState;
 
+/* When each step of session setup finished, from MyMonotonicUsec().	*/
+/* Zero means the step hasn't happened (yet).				*/
+
+typedef struct stVTPhaseTimes
+{
+    int64_t		fStart;			/* VTConnect* called	*/
+    int64_t		fResolved;		/* Have an address	*/
+    int64_t		fConnected;		/* TCP connect done	*/
+    int64_t		fAMNegotiation;		/* AM's first request	*/
+    int64_t		fOpen;			/* TM reply, kvtsOpen	*/
+    int64_t		fFirstRead;		/* Host's first prompt	*/
+    int64_t		fReady;			/* First read after logon */
+} tVTPhaseTimes;
+
+/* Protocol statistics, kept per connection. Every record received is	*/
+/* counted by message type and primitive; the time taken to process	*/
+/* it is measured on one record in kVT_STATS_SAMPLE, into power-of-two	*/
+/* nanosecond buckets (bucket n holds times in [2^n, 2^(n+1)) ns).	*/
+
+#define kVT_STATS_TYPES		12	/* kvmtEnvCntlReq..kvmtGenericFDCResp */
+#define kVT_STATS_PRIMS		8
+#define kVT_STATS_BUCKETS	32
+#define kVT_STATS_SAMPLE	64
+
+typedef struct stVTStatsCount
+{
+    uint64_t		fRecords;
+    uint64_t		fBytes;
+} tVTStatsCount;
+
+typedef struct stVTStats
+{
+    int64_t		fSince;			/* MyMonotonicUsec() at reset */
+    tVTStatsCount	fCounts[kVT_STATS_TYPES][kVT_STATS_PRIMS];
+    uint64_t		fOtherRecords;		/* Type or prim out of range */
+    uint64_t		fErrors;		/* Records that failed	*/
+    uint64_t		fReads;			/* read()s from the socket */
+    uint64_t		fReadBytes;
+    uint64_t		fSends;			/* send()s to the socket */
+    uint64_t		fSendBytes;
+
+    uint32_t		fSampleCountdown;
+    uint64_t		fSamples[kVT_STATS_TYPES];
+    uint64_t		fSampleNsec[kVT_STATS_TYPES];	/* Total time	*/
+    uint64_t		fTimeHist[kVT_STATS_TYPES][kVT_STATS_BUCKETS];
+} tVTStats;
+
+/* Read round-trip tracing, off unless VTTraceStart() is called. A	*/
+/* terminal read runs from the host posting it to our reply going out. */
+/* The time until the final ProcessQueueToHost() scan begins is spent	*/
+/* waiting for the user; from there to the send is spent in the client. */
+
+#define kVTTraceScan		0	/* ProcessQueueToHost() entered	*/
+#define kVTTraceTranslate	1	/* Record assembled, translating */
+#define kVTTraceSend		2	/* Calling VTSendData()		*/
+
+typedef struct stVTReadTrace
+{
+    FILE *		fFile;			/* One line per read, or NULL */
+    int64_t		fStart;			/* MyMonotonicNsec() at start */
+    int64_t		fPosted;		/* Read request received */
+    int64_t		fScan;
+    int64_t		fTranslate;
+    int64_t		fSend;
+    uint64_t		fReads;
+    uint64_t		fWaitUsec;		/* Totals over fReads	*/
+    uint64_t		fClientNsec;
+    uint64_t		fWaitHist[kVT_STATS_BUCKETS];	/* usec buckets */
+    uint64_t		fClientHist[kVT_STATS_BUCKETS];	/* nsec buckets */
+} tVTReadTrace;
+
+struct stVTConnectAttempt;
+typedef struct stVTCapture tVTCapture;	/* See vtcapture.c */
+
 typedef struct stVTConnection
 {
     tVTState		fState;
@@ -54,21 +259,89 @@ typedef struct stVTConnection
     int			fSocket;
     int			fLastSocketError;	/* Set when error occurs. */
 
+    /* Set up by VTConnectStart() while the name is being resolved	*/
+    /* and the connects are outstanding; NULL otherwise.		*/
+
+    struct stVTConnectAttempt * fAttempt;
+    tVTPhaseTimes	fTimes;
+
+    /* Socket tuning (see transport.h). fTransportProfile is what the	*/
+    /* user asked for; with kTransportAutoBulk the bulk profile is	*/
+    /* used instead while the host has the driver in block mode.	*/
+    /* fTransportActive is what the socket currently has.		*/
+
+    int			fTransportProfile;
+    int			fTransportFlags;
+    int			fTransportActive;
+    tVTStats		fStats;
+    tVTReadTrace *	fTrace;
+    tVTCapture *	fCapture;
+
+    /* The record buffers and receive ring start small and grow as	*/
+    /* records need them, up to the sizes negotiated with the AM. Every	*/
+    /* kVT_TRIM_INTERVAL times the ring empties, a buffer that has used	*/
+    /* no more than a quarter of itself since the last look is halved.	*/
+
     char *		fSendBuffer;		/* Data to be sent */
     char *		fReceiveBuffer;		/* Data from VT host */
-    int			fSendBufferSize;
+    int			fSendBufferSize;	/* Largest record allowed */
     int			fReceiveBufferSize;
-    int			fLengthToReceive;	/* Length left in cur rec */
-    uint16_t		fLengthWord;		/* Length word being rec'd */
-    int			fReceiveBufferOffset;	/* Where to put next block */
+    int			fSendBufferAlloc;	/* Bytes allocated	*/
+    int			fReceiveBufferAlloc;
+    int			fSendBufferPeak;	/* Most used since trim	*/
+    int			fReceiveBufferPeak;
+    int			fRingPeak;
+    int			fTrimCountdown;
+
+    /* Raw bytes from the socket are read into the receive ring as	*/
+    /* many at a time as the socket has, then split into records.	*/
+    /* fRingHead is the start of the first unparsed record, fRingTail	*/
+    /* is where the next read() goes. A partial record stays in the	*/
+    /* ring until the rest of it arrives.				*/
+
+    char *		fReceiveRing;
+    int			fReceiveRingSize;	/* Bytes allocated	*/
+    int			fRingHead;
+    int			fRingTail;
     int			fSendBufferOffset;	/* Where to put next in char */
+
+    /* Replies generated while a batch of received records is being	*/
+    /* processed are gathered in the outbound queue and go out with a	*/
+    /* single send() once the batch is done.				*/
+
+    /* The AM sends at most fAMSendBurst records (from negotiation; 0	*/
+    /* if it gave none) before waiting to hear back, so the queue is	*/
+    /* flushed as soon as it holds that many replies rather than at	*/
+    /* the end of the batch. The AM can then send the next burst while	*/
+    /* we work through the rest of this one.				*/
+
+    char *		fOutQueue;
+    int			fOutQueueSize;
+    int			fOutQueueLength;
+    int			fOutQueueRecords;
+    int			fAMSendBurst;
+    bool		fOutQueueHold;		/* true while batching	*/
+
+    /* With fSendNoWait set, whatever the socket won't take is kept	*/
+    /* in the send backlog instead of waiting for room; the caller	*/
+    /* watches for the socket to be writable while VTSendPending()	*/
+    /* and then calls VTSendReady(). Without it a send waits, but no	*/
+    /* more than kVT_SEND_TIMEOUT. Either way a host that stops	*/
+    /* reading ends the session rather than hanging the caller.	*/
+
+    bool		fSendNoWait;
+    char *		fSendBacklog;
+    int			fSendBacklogSize;
+    int			fSendBacklogLength;
     bool		fReadInProgress;	/* true when OK to read */
     bool		fReadStarted;		/* true when read initiated */
     bool		fReadFlush;		/* Flush type-ahead? */
     uint16_t		fReadRequestCount;      /* From orignl read req */
+    uint8_t		fReadPrimitive;		/* Read or WriteRead	*/
     int			fReadBufferOffset;	/* Where to put next term char*/
     int			fReadLength;		/* Length of current read */
     uint16_t		fCurrentTMRequestCount;	/* For sequencing */
+    uint16_t		fApplReqCount;		/* Break requests sent	*/
 
     /* Terminal state variables */
 
@@ -121,10 +394,22 @@ typedef struct stVTConnection
     char		fTypeAhead;		/* Typeahead enabled	*/
     bool		fBlockModeSupported;	/* Ok for block mode forms ? */
 
+    tVTInput *		fInput;			/* Keyboard queues	*/
+
+    /* What the AM's logon info request said, if it sent one */
+
+    bool		fHaveLogonInfo;
+    char		fLogonSessionID[7];
+    char		fLogonInfo[kVT_LOGON_LENGTH];
+
     /* The data-out proc. The default just dumps stuff onto the terminal */
+    /* If fDataOutVProc is NULL, VTDataOut falls back to calling	*/
+    /* fDataOutProc once per piece. fDataOutFlushProc may be NULL.	*/
 
     tVTDataOutProcPtr	fDataOutProc;
-    int32_t		fDataOutRefCon;
+    tVTDataOutVProcPtr	fDataOutVProc;
+    tVTDataOutFlushProcPtr fDataOutFlushProc;
+    intptr_t		fDataOutRefCon;
 } tVTConnection;
 
 /* Error codes returned from VT routines */
@@ -146,19 +431,55 @@ typedef struct stVTConnection
 #define kVTCReceivedUnexpectedIOResp    14
 #define kVTCReceivedUnexpectedControlResp 15
 #define kVTCReceivedUnexpectedAppCtlReq 16
+#define kVTCResolveError		17
+#define kVTCConnectTimeout		18
+#define kVTCConnectPending		19	/* Not an error; call again */
+#define kVTCFileError			20
+#define kVTCConnectionClosed		21
 
 /* Prototypes */
 
-void FlushQ (void);
-int  GetQ (void);
-int  PutQ (char);
+void FlushQ (tVTConnection * conn);
+int  GetQ (tVTConnection * conn);
+int  PutQ (tVTConnection * conn, char ch);
+int  PutQBuffer (tVTConnection * conn, const char * buf, int len);
+int  PutImmediateQ (tVTConnection * conn, char ch);
+void PreassembleQ (tVTConnection * conn);
+void DiscardAheadQ (tVTConnection * conn);
+int  PutLogonQ (tVTConnection * conn, const char * text, int length, bool secret);
+int  LoadLogonProfile (tVTConnection * conn, const char * fileName);
+int  OpenFeedQ (tVTConnection * conn, const char * fileName);
+int  FeedQ (tVTConnection * conn);
+bool FeedPending (tVTConnection * conn);
+void CloseFeedQ (tVTConnection * conn);
 void VTErrorMessage(tVTConnection * conn, int code, char * msg, int maxLen);
 int  VTInitConnection(tVTConnection * conn, long ipAddress, int ipPort);
 void VTCleanUpConnection(tVTConnection * conn);
 int  VTConnect(tVTConnection * conn);
+int  VTConnectStart(tVTConnection * conn, char * hostName, int ipPort, int timeoutMs);
+int  VTConnectStep(tVTConnection * conn);
+int  VTConnectWait(tVTConnection * conn);
+int  VTConnectSockets(tVTConnection * conn, int * fds, int maxFds);
+int  VTConnectTimeLeft(tVTConnection * conn);
+void VTConnectNotify(int fd);
+int  VTConnectHost(tVTConnection * conn, char * hostName, int ipPort, int timeoutMs);
+void VTSetTransportProfile(tVTConnection * conn, int profile, int flags);
+void VTFormatTimes(tVTConnection * conn, char * msg, int maxLen);
+void VTStatsReset(tVTConnection * conn);
+void VTStatsPrint(tVTConnection * conn, FILE * fp, bool json);
+int  VTTraceStart(tVTConnection * conn, const char * fileName);
+void VTTraceMark(tVTConnection * conn, int event);
+void VTTracePrint(tVTConnection * conn, FILE * fp, bool json);
+void VTTraceStop(tVTConnection * conn);
+void VTReportPrint(tVTConnection * conn, FILE * fp, bool json);
 int  VTReceiveDataReady(tVTConnection * conn);
+int  VTReplayRecord(tVTConnection * conn, const char * record, int length);
+bool VTReceivePending(tVTConnection * conn);
+bool VTSendPending(tVTConnection * conn);
+int  VTSendReady(tVTConnection * conn);
 int  VTProcessKeyBuffer(tVTConnection * conn, char * buffer, int length);
 int  VTSetDataOutProc(tVTConnection * conn, tVTDataOutProcPtr dataOutProc);
+void VTDataOut(tVTConnection * conn, const struct iovec * iov, int iovCount);
 int  VTCloseConnection(tVTConnection * conn);
 int  VTSocket(tVTConnection * conn);
 int  VTSendBreak(tVTConnection * conn, int send_index);
@@ -0,0 +1,290 @@
+/*
+This file is part of FreeVT3k.
+
+FreeVT3k is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+FreeVT3k is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License along
+with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/************************************************************
+ * vtoutput.c -- Terminal output thread
+ *
+ * Terminal output goes into a single-producer, single-
+ *   consumer ring and a thread of its own writes it to the
+ *   terminal, so a terminal that is slow to take it holds up
+ *   only that thread and not the protocol. Nothing is ever
+ *   dropped: when the ring fills, the producer waits, and
+ *   VTOutputBacklog() lets it stop taking on more work well
+ *   before then.
+ ************************************************************/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#endif
+
+#include "vtoutput.h"
+
+#ifdef HAVE_PTHREAD
+
+struct stVTOutput
+{
+    int			fFd;
+    char *		fRing;
+    size_t		fMask;
+    int			fWake[2];	/* Pipe; see VTOutputBacklog() */
+
+    /* Head is the writer's, tail the producer's */
+
+    char		fPad0[64];
+    _Atomic size_t	fHead;
+    char		fPad1[64];
+    _Atomic size_t	fTail;
+    char		fPad2[64];
+
+    /* Whoever sets one of these sleeps on fCond until the other side	*/
+    /* has done something about it.					*/
+
+    _Atomic bool	fWriterIdle;
+    _Atomic bool	fProducerWaiting;
+    _Atomic bool	fWantWake;
+    _Atomic bool	fStop;
+    pthread_mutex_t	fLock;
+    pthread_cond_t	fCond;
+    pthread_t		fWriter;
+};
+
+static void Wake(tVTOutput * out)
+{ /*Wake*/
+    pthread_mutex_lock(&out->fLock);
+    pthread_cond_broadcast(&out->fCond);
+    pthread_mutex_unlock(&out->fLock);
+} /*Wake*/
+
+static void * WriterThread(void * arg)
+{ /*WriterThread*/
+    tVTOutput * out = (tVTOutput *) arg;
+    size_t head, tail, off, length;
+    ssize_t written;
+
+    for (;;)
+	{
+	head = atomic_load_explicit(&out->fHead, memory_order_relaxed);
+	tail = atomic_load(&out->fTail);
+	if (head == tail)
+	    {
+	    pthread_mutex_lock(&out->fLock);
+	    atomic_store(&out->fWriterIdle, true);
+	    if (atomic_load(&out->fProducerWaiting))
+		pthread_cond_broadcast(&out->fCond);
+	    while ((atomic_load(&out->fTail) == head) &&
+		   (!atomic_load(&out->fStop)))
+		pthread_cond_wait(&out->fCond, &out->fLock);
+	    atomic_store(&out->fWriterIdle, false);
+	    pthread_mutex_unlock(&out->fLock);
+	    if (atomic_load(&out->fTail) == head)
+		break;		/* Stopped, and nothing left */
+	    continue;
+	    }
+
+	/* Everything up to the end of the ring goes in one write */
+
+	off = head & out->fMask;
+	length = tail - head;
+	if (length > out->fMask + 1 - off)
+	    length = out->fMask + 1 - off;
+	written = write(out->fFd, out->fRing + off, length);
+	if (written < 0)
+	    {
+	    if (errno == EINTR)
+		continue;
+	    written = length;	/* Terminal gone; keep the producer moving */
+	    }
+	head += written;
+	atomic_store(&out->fHead, head);
+
+	if (atomic_load(&out->fProducerWaiting))
+	    Wake(out);
+	if ((tail - head <= (out->fMask + 1) / 4) &&
+	    (atomic_exchange(&out->fWantWake, false)))
+	    {
+	    if (write(out->fWake[1], "", 1)) {}
+	    }
+	}
+    return NULL;
+} /*WriterThread*/
+
+tVTOutput * VTOutputStart(int fd)
+{ /*VTOutputStart*/
+    tVTOutput * out;
+    int i;
+
+    out = (tVTOutput *) calloc(1, sizeof(tVTOutput));
+    if (out == NULL)
+	return NULL;
+    out->fRing = (char *) malloc(kVT_OUTPUT_RING);
+    if ((out->fRing == NULL) || (pipe(out->fWake) == -1))
+	{
+	free(out->fRing);
+	free(out);
+	return NULL;
+	}
+    for (i = 0; i < 2; i++)
+	fcntl(out->fWake[i], F_SETFL, fcntl(out->fWake[i], F_GETFL) | O_NONBLOCK);
+    out->fFd = fd;
+    out->fMask = kVT_OUTPUT_RING - 1;
+    atomic_init(&out->fHead, 0);
+    atomic_init(&out->fTail, 0);
+    atomic_init(&out->fWriterIdle, false);
+    atomic_init(&out->fProducerWaiting, false);
+    atomic_init(&out->fWantWake, false);
+    atomic_init(&out->fStop, false);
+    pthread_mutex_init(&out->fLock, NULL);
+    pthread_cond_init(&out->fCond, NULL);
+    if (pthread_create(&out->fWriter, NULL, WriterThread, out))
+	{
+	pthread_cond_destroy(&out->fCond);
+	pthread_mutex_destroy(&out->fLock);
+	close(out->fWake[0]);
+	close(out->fWake[1]);
+	free(out->fRing);
+	free(out);
+	return NULL;
+	}
+    return out;
+} /*VTOutputStart*/
+
+void VTOutputWrite(tVTOutput * out, const char * buf, size_t length)
+{ /*VTOutputWrite*/
+    size_t head, tail, room, off, n;
+
+    while (length > 0)
+	{
+	head = atomic_load(&out->fHead);
+	tail = atomic_load_explicit(&out->fTail, memory_order_relaxed);
+	room = (out->fMask + 1) - (tail - head);
+	if (room == 0)
+	    {
+	    pthread_mutex_lock(&out->fLock);
+	    atomic_store(&out->fProducerWaiting, true);
+	    while (atomic_load(&out->fHead) == head)
+		pthread_cond_wait(&out->fCond, &out->fLock);
+	    atomic_store(&out->fProducerWaiting, false);
+	    pthread_mutex_unlock(&out->fLock);
+	    continue;
+	    }
+	n = (room < length) ? room : length;
+	off = tail & out->fMask;
+	if (n <= out->fMask + 1 - off)
+	    memcpy(out->fRing + off, buf, n);
+	else
+	    {
+	    memcpy(out->fRing + off, buf, out->fMask + 1 - off);
+	    memcpy(out->fRing, buf + (out->fMask + 1 - off),
+		   n - (out->fMask + 1 - off));
+	    }
+	atomic_store(&out->fTail, tail + n);
+	buf += n;
+	length -= n;
+	if (atomic_load(&out->fWriterIdle))
+	    Wake(out);
+	}
+} /*VTOutputWrite*/
+
+/* Waits until the terminal has been given everything */
+
+void VTOutputDrain(tVTOutput * out)
+{ /*VTOutputDrain*/
+    pthread_mutex_lock(&out->fLock);
+    atomic_store(&out->fProducerWaiting, true);
+    while (atomic_load(&out->fHead) != atomic_load(&out->fTail))
+	pthread_cond_wait(&out->fCond, &out->fLock);
+    atomic_store(&out->fProducerWaiting, false);
+    pthread_mutex_unlock(&out->fLock);
+} /*VTOutputDrain*/
+
+void VTOutputStop(tVTOutput * out)
+{ /*VTOutputStop*/
+    if (out == NULL)
+	return;
+    atomic_store(&out->fStop, true);
+    Wake(out);
+    pthread_join(out->fWriter, NULL);
+    pthread_cond_destroy(&out->fCond);
+    pthread_mutex_destroy(&out->fLock);
+    close(out->fWake[0]);
+    close(out->fWake[1]);
+    free(out->fRing);
+    free(out);
+} /*VTOutputStop*/
+
+bool VTOutputBacklog(tVTOutput * out)
+{ /*VTOutputBacklog*/
+    size_t size = out->fMask + 1;
+
+    if (atomic_load(&out->fTail) - atomic_load(&out->fHead) <= size / 2)
+	return false;
+    atomic_store(&out->fWantWake, true);
+
+    /* The writer may have got below a quarter before it saw the flag */
+
+    if ((atomic_load(&out->fTail) - atomic_load(&out->fHead) <= size / 4) &&
+	(atomic_exchange(&out->fWantWake, false)))
+	return false;
+    return true;
+} /*VTOutputBacklog*/
+
+int VTOutputWakeFd(tVTOutput * out)
+{ /*VTOutputWakeFd*/
+    return out->fWake[0];
+} /*VTOutputWakeFd*/
+
+void VTOutputWoken(tVTOutput * out)
+{ /*VTOutputWoken*/
+    char buf[16];
+
+    while (read(out->fWake[0], buf, sizeof(buf)) > 0)
+	;
+} /*VTOutputWoken*/
+
+#else /* HAVE_PTHREAD */
+
+tVTOutput * VTOutputStart(int fd)
+{ /*VTOutputStart*/
+    return NULL;
+} /*VTOutputStart*/
+
+void VTOutputWrite(tVTOutput * out, const char * buf, size_t length) { }
+void VTOutputDrain(tVTOutput * out) { }
+void VTOutputStop(tVTOutput * out) { }
+bool VTOutputBacklog(tVTOutput * out) { return false; }
+int  VTOutputWakeFd(tVTOutput * out) { return -1; }
+void VTOutputWoken(tVTOutput * out) { }
+
+#endif /* HAVE_PTHREAD */
+
+/* Local Variables: */
+/* c-indent-level: 0 */
+/* c-continued-statement-offset: 4 */
+/* c-brace-offset: 0 */
+/* c-argdecl-indent: 4 */
+/* c-label-offset: -4 */
+/* End: */
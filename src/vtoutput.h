@@ -0,0 +1,40 @@
+/*
+This file is part of FreeVT3k.
+
+FreeVT3k is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+FreeVT3k is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License along
+with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/************************************************************
+ * vtoutput.h -- Terminal output thread
+ ************************************************************/
+
+#define kVT_OUTPUT_RING		(256 * 1024)	/* Power of two */
+
+typedef struct stVTOutput tVTOutput;
+
+/* VTOutputStart() returns NULL if threads are not available or the	*/
+/* thread could not be started; write to the fd directly then.		*/
+
+tVTOutput * VTOutputStart(int fd);
+void VTOutputWrite(tVTOutput * out, const char * buf, size_t length);
+void VTOutputDrain(tVTOutput * out);
+void VTOutputStop(tVTOutput * out);
+
+/* Backpressure. VTOutputBacklog() is true once the ring is half full;	*/
+/* the fd from VTOutputWakeFd() then becomes readable when it has	*/
+/* drained to a quarter, and VTOutputWoken() clears it again.		*/
+
+bool VTOutputBacklog(tVTOutput * out);
+int  VTOutputWakeFd(tVTOutput * out);
+void VTOutputWoken(tVTOutput * out);
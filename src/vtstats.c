@@ -0,0 +1,379 @@
+/* Copyright (C) 1996 Office Products Technology, Inc.
+
+This file is part of FreeVT3k.
+
+FreeVT3k is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+FreeVT3k is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+for more details.
+
+You should have received a copy of the GNU General Public License along
+with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/************************************************************
+ * vtstats.c -- Protocol statistics reporting
+ ************************************************************/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "vt.h"
+#include "vtconn.h"
+#include "timers.h"
+
+static const char * typeNames[kVT_STATS_TYPES] =
+{
+    "EnvCntlReq",	"EnvCntlResp",
+    "TerminalIOReq",	"TerminalIOResp",
+    "TerminalCntlReq",	"TerminalCntlResp",
+    "ApplicationCntlReq", "ApplicationCntlResp",
+    "MPECntlReq",	"MPECntlResp",
+    "GenericFDCReq",	"GenericFDCResp"
+};
+
+static const char * PrimName(int type, int prim, char * buffer)
+{ /*PrimName*/
+    static const char * envNames[] =
+	{ "TMNegotiate", "AMNegotiate", "Terminate", "LogonInfo" };
+    static const char * ioNames[] =
+	{ "Read", "Write", "WriteRead", "3", "Abort" };
+    static const char * cntlNames[] =
+	{ "SetBreakInfo", "SetDriverInfo" };
+    static const char * mpeNames[] =
+	{ "MPECntl", "MPEGetInfo" };
+    static const char * fdcNames[] =
+	{ "DevSet", "DevGetInfo" };
+
+    switch (type / 2)
+	{
+    case kvmtEnvCntlReq / 2:
+	if (prim < 4) return envNames[prim];
+	break;
+    case kvmtTerminalIOReq / 2:
+	if (prim < 5) return ioNames[prim];
+	break;
+    case kvmtTerminalCntlReq / 2:
+	if (prim < 2) return cntlNames[prim];
+	break;
+    case kvmtApplicationCntlReq / 2:
+	if (prim == kvtpApplInvokeBreak) return "InvokeBreak";
+	break;
+    case kvmtMPECntlReq / 2:
+	if (prim < 2) return mpeNames[prim];
+	break;
+    case kvmtGenericFDCReq / 2:
+	if (prim < 2) return fdcNames[prim];
+	break;
+	}
+    sprintf(buffer, "%d", prim);
+    return buffer;
+} /*PrimName*/
+
+void VTStatsReset(tVTConnection * conn)
+{ /*VTStatsReset*/
+    memset((char *) &conn->fStats, 0, sizeof(conn->fStats));
+    conn->fStats.fSince = MyMonotonicUsec();
+} /*VTStatsReset*/
+
+static void PrintBucket(FILE * fp, int bucket)
+{ /*PrintBucket*/
+    /* Lower bound of a histogram bucket, in readable units */
+
+    uint64_t  ns = (uint64_t) 1 << bucket;
+
+    if (ns < 1000)
+	fprintf(fp, "%lluns", (unsigned long long) ns);
+    else if (ns < 1000000)
+	fprintf(fp, "%lluus", (unsigned long long) (ns / 1000));
+    else
+	fprintf(fp, "%llums", (unsigned long long) (ns / 1000000));
+} /*PrintBucket*/
+
+static void PrintText(tVTConnection * conn, FILE * fp)
+{ /*PrintText*/
+    tVTStats * st = &conn->fStats;
+    char      primBuffer[16];
+    int       type, prim, bucket;
+
+    fprintf(fp, "Protocol statistics for the last %.3f s\n",
+	    (double) (MyMonotonicUsec() - st->fSince) / 1e6);
+    fprintf(fp, "  socket reads %llu (%llu bytes), sends %llu (%llu bytes)\n",
+	    (unsigned long long) st->fReads,
+	    (unsigned long long) st->fReadBytes,
+	    (unsigned long long) st->fSends,
+	    (unsigned long long) st->fSendBytes);
+    fprintf(fp, "  records failed %llu, unknown type %llu\n",
+	    (unsigned long long) st->fErrors,
+	    (unsigned long long) st->fOtherRecords);
+
+    fprintf(fp, "  %-34s %12s %14s\n", "message", "records", "bytes");
+    for (type = 0; type < kVT_STATS_TYPES; type++)
+	for (prim = 0; prim < kVT_STATS_PRIMS; prim++)
+	    {
+	    if (!st->fCounts[type][prim].fRecords)
+		continue;
+	    fprintf(fp, "  %-20s %-13s %12llu %14llu\n", typeNames[type],
+		    PrimName(type, prim, primBuffer),
+		    (unsigned long long) st->fCounts[type][prim].fRecords,
+		    (unsigned long long) st->fCounts[type][prim].fBytes);
+	    }
+
+    fprintf(fp, "  processing time, 1 record in %d timed:\n",
+	    kVT_STATS_SAMPLE);
+    for (type = 0; type < kVT_STATS_TYPES; type++)
+	{
+	if (!st->fSamples[type])
+	    continue;
+	fprintf(fp, "  %-20s %llu timed, mean %.0f ns\n    ", typeNames[type],
+		(unsigned long long) st->fSamples[type],
+		(double) st->fSampleNsec[type] / st->fSamples[type]);
+	for (bucket = 0; bucket < kVT_STATS_BUCKETS; bucket++)
+	    {
+	    if (!st->fTimeHist[type][bucket])
+		continue;
+	    fprintf(fp, " ");
+	    PrintBucket(fp, bucket);
+	    fprintf(fp, ":%llu",
+		    (unsigned long long) st->fTimeHist[type][bucket]);
+	    }
+	fprintf(fp, "\n");
+	}
+} /*PrintText*/
+
+static void PrintJSON(tVTConnection * conn, FILE * fp)
+{ /*PrintJSON*/
+    tVTStats * st = &conn->fStats;
+    char      primBuffer[16];
+    int       type, prim, bucket;
+    bool      first = true, firstBucket;
+
+    fprintf(fp, "{\"elapsed_us\":%lld,",
+	    (long long) (MyMonotonicUsec() - st->fSince));
+    fprintf(fp, "\"reads\":%llu,\"read_bytes\":%llu,"
+		"\"sends\":%llu,\"send_bytes\":%llu,"
+		"\"errors\":%llu,\"unknown\":%llu,",
+	    (unsigned long long) st->fReads,
+	    (unsigned long long) st->fReadBytes,
+	    (unsigned long long) st->fSends,
+	    (unsigned long long) st->fSendBytes,
+	    (unsigned long long) st->fErrors,
+	    (unsigned long long) st->fOtherRecords);
+
+    fprintf(fp, "\"messages\":[");
+    for (type = 0; type < kVT_STATS_TYPES; type++)
+	for (prim = 0; prim < kVT_STATS_PRIMS; prim++)
+	    {
+	    if (!st->fCounts[type][prim].fRecords)
+		continue;
+	    fprintf(fp, "%s{\"type\":\"%s\",\"primitive\":\"%s\","
+			"\"records\":%llu,\"bytes\":%llu}",
+		    (first) ? "" : ",", typeNames[type],
+		    PrimName(type, prim, primBuffer),
+		    (unsigned long long) st->fCounts[type][prim].fRecords,
+		    (unsigned long long) st->fCounts[type][prim].fBytes);
+	    first = false;
+	    }
+
+    fprintf(fp, "],\"sample_every\":%d,\"timing\":[", kVT_STATS_SAMPLE);
+    first = true;
+    for (type = 0; type < kVT_STATS_TYPES; type++)
+	{
+	if (!st->fSamples[type])
+	    continue;
+	fprintf(fp, "%s{\"type\":\"%s\",\"samples\":%llu,\"total_ns\":%llu,"
+		    "\"histogram_ns\":{",
+		(first) ? "" : ",", typeNames[type],
+		(unsigned long long) st->fSamples[type],
+		(unsigned long long) st->fSampleNsec[type]);
+	first = false;
+	firstBucket = true;
+	for (bucket = 0; bucket < kVT_STATS_BUCKETS; bucket++)
+	    {
+	    if (!st->fTimeHist[type][bucket])
+		continue;
+	    fprintf(fp, "%s\"%llu\":%llu", (firstBucket) ? "" : ",",
+		    (unsigned long long) ((uint64_t) 1 << bucket),
+		    (unsigned long long) st->fTimeHist[type][bucket]);
+	    firstBucket = false;
+	    }
+	fprintf(fp, "}}");
+	}
+    fprintf(fp, "]}");
+} /*PrintJSON*/
+
+void VTStatsPrint(tVTConnection * conn, FILE * fp, bool json)
+{ /*VTStatsPrint*/
+    if (json)
+	{
+	PrintJSON(conn, fp);
+	fprintf(fp, "\n");
+	}
+    else
+	PrintText(conn, fp);
+    fflush(fp);
+} /*VTStatsPrint*/
+
+int VTTraceStart(tVTConnection * conn, const char * fileName)
+{ /*VTTraceStart*/
+    tVTReadTrace * trace;
+
+    if (conn->fTrace)
+	return kVTCNoError;
+    trace = (tVTReadTrace *) calloc(1, sizeof(tVTReadTrace));
+    if (trace == NULL)
+	return kVTCMemoryAllocationError;
+    if (fileName)
+	{
+	trace->fFile = fopen(fileName, "w");
+	if (trace->fFile == NULL)
+	    {
+	    free(trace);
+	    return kVTCFileError;
+	    }
+	fprintf(trace->fFile, "# read\tposted_s\twait_us\tscan_ns"
+		"\ttranslate_ns\tsend_ns\tclient_ns\tbytes\tcompletion\n");
+	}
+    trace->fStart = MyMonotonicNsec();
+    conn->fTrace = trace;
+    return kVTCNoError;
+} /*VTTraceStart*/
+
+void VTTraceMark(tVTConnection * conn, int event)
+{ /*VTTraceMark*/
+    tVTReadTrace * trace = conn->fTrace;
+
+    if (trace == NULL)
+	return;
+    switch (event)
+	{
+    case kVTTraceScan:
+	trace->fScan = MyMonotonicNsec();
+	break;
+    case kVTTraceTranslate:
+	trace->fTranslate = MyMonotonicNsec();
+	break;
+    case kVTTraceSend:
+	trace->fSend = MyMonotonicNsec();
+	break;
+	}
+} /*VTTraceMark*/
+
+static void PrintHist(FILE * fp, uint64_t * hist, const char * units)
+{ /*PrintHist*/
+    int bucket;
+
+    for (bucket = 0; bucket < kVT_STATS_BUCKETS; bucket++)
+	if (hist[bucket])
+	    fprintf(fp, " %llu%s:%llu",
+		    (unsigned long long) ((uint64_t) 1 << bucket), units,
+		    (unsigned long long) hist[bucket]);
+} /*PrintHist*/
+
+static void PrintHistJSON(FILE * fp, uint64_t * hist)
+{ /*PrintHistJSON*/
+    int  bucket;
+    bool first = true;
+
+    fprintf(fp, "{");
+    for (bucket = 0; bucket < kVT_STATS_BUCKETS; bucket++)
+	{
+	if (!hist[bucket])
+	    continue;
+	fprintf(fp, "%s\"%llu\":%llu", (first) ? "" : ",",
+		(unsigned long long) ((uint64_t) 1 << bucket),
+		(unsigned long long) hist[bucket]);
+	first = false;
+	}
+    fprintf(fp, "}");
+} /*PrintHistJSON*/
+
+static void PrintTraceJSON(tVTReadTrace * trace, FILE * fp)
+{ /*PrintTraceJSON*/
+    fprintf(fp, "{\"reads\":%llu,\"wait_us\":%llu,\"client_ns\":%llu,"
+		"\"wait_hist_us\":",
+	    (unsigned long long) trace->fReads,
+	    (unsigned long long) trace->fWaitUsec,
+	    (unsigned long long) trace->fClientNsec);
+    PrintHistJSON(fp, trace->fWaitHist);
+    fprintf(fp, ",\"client_hist_ns\":");
+    PrintHistJSON(fp, trace->fClientHist);
+    fprintf(fp, "}");
+} /*PrintTraceJSON*/
+
+void VTTracePrint(tVTConnection * conn, FILE * fp, bool json)
+{ /*VTTracePrint*/
+    tVTReadTrace * trace = conn->fTrace;
+    double    reads;
+
+    if (trace == NULL)
+	return;
+    reads = (trace->fReads) ? (double) trace->fReads : 1.0;
+    if (json)
+	{
+	PrintTraceJSON(trace, fp);
+	fprintf(fp, "\n");
+	}
+    else
+	{
+	fprintf(fp, "Terminal reads answered: %llu\n",
+		(unsigned long long) trace->fReads);
+	fprintf(fp, "  waiting for input, mean %.0f us\n   ",
+		(double) trace->fWaitUsec / reads);
+	PrintHist(fp, trace->fWaitHist, "us");
+	fprintf(fp, "\n  in the client, mean %.0f ns\n   ",
+		(double) trace->fClientNsec / reads);
+	PrintHist(fp, trace->fClientHist, "ns");
+	fprintf(fp, "\n");
+	}
+    fflush(fp);
+} /*VTTracePrint*/
+
+/* Stats and trace together; as JSON, one {"stats":...,"trace":...} object */
+void VTReportPrint(tVTConnection * conn, FILE * fp, bool json)
+{ /*VTReportPrint*/
+    if (!json)
+	{
+	VTStatsPrint(conn, fp, false);
+	VTTracePrint(conn, fp, false);
+	return;
+	}
+    fprintf(fp, "{\"stats\":");
+    PrintJSON(conn, fp);
+    fprintf(fp, ",\"trace\":");
+    if (conn->fTrace)
+	PrintTraceJSON(conn->fTrace, fp);
+    else
+	fprintf(fp, "null");
+    fprintf(fp, "}\n");
+    fflush(fp);
+} /*VTReportPrint*/
+
+void VTTraceStop(tVTConnection * conn)
+{ /*VTTraceStop*/
+    if (conn->fTrace == NULL)
+	return;
+    if (conn->fTrace->fFile)
+	fclose(conn->fTrace->fFile);
+    free(conn->fTrace);
+    conn->fTrace = NULL;
+} /*VTTraceStop*/
+
+/* Local Variables: */
+/* c-indent-level: 0 */
+/* c-continued-statement-offset: 4 */
+/* c-brace-offset: 0 */
+/* c-argdecl-indent: 4 */
+/* c-label-offset: -4 */
+/* End: */
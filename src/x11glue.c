@@ -82,6 +82,7 @@ with FreeVT3k. If not, see <https://www.gnu.org/licenses/>.
 #include "logging.h"
 #include "vtconn.h"
 #include "kbdtable.h"
+#include "transport.h"
 #include "terminal.bm"
 
 #define DEBUG_KEYSYMS 0
@@ -872,6 +873,10 @@ void Usage (void)
   printf ("   -df             - start with Display Functions enabled.\n");
   printf ("   -font fontname  - override default font with fontname.\n");
   printf ("   -title title    - override default window title.\n");
+  printf ("   -profile name   - transport tuning: interactive (default), bulk\n");
+  printf ("                     or default (leave the system's settings alone)\n");
+  printf ("   -tos            - let the profile set IP type of service;\n");
+  printf ("                     old MPE V NS transports cannot take it\n");
 
 } /*Usage */
 
@@ -884,6 +889,8 @@ int main (int argc, char **argv)
    parity = 'N', *input_file = NULL, *hostname = NULL, *log_file = NULL, *ttyname = NULL;
   int
     ipPort = kVT_PORT;
+  int
+    profile = kTransportInteractive, transport_flags = 0;
 
   char *font1 = NULL;
   char *wintitle = NULL;
@@ -966,6 +973,19 @@ int main (int argc, char **argv)
       else
 	++parm_error;
     }
+    else if (!strcmp (*argv, "-profile"))
+    {
+      if ((--argc) && (argv[1][0] != '-'))
+      {
+	++argv;
+	if ((profile = TransportProfileByName (*argv)) == -1)
+	  ++parm_error;
+      }
+      else
+	++parm_error;
+    }
+    else if (!strcmp (*argv, "-tos"))
+      transport_flags |= kTransportAllowTOS;
     else if (!strcmp (*argv, "-a"))
     {
       if ((--argc) && (argv[1][0] != '-'))
@@ -1076,34 +1096,6 @@ int main (int argc, char **argv)
   if (display_fns)
     set_display_functions ();
 
-  if (input_file)
-  {
-    FILE *input;
-    char buf[128], *ptr;
-    if ((input = fopen (input_file, "r")) == (FILE *) NULL)
-    {
-      char buf[128];
-      sprintf (buf, "fopen [%s]:", input_file);
-      perror (buf);
-      return (1);
-    }
-    for (;;)
-    {
-      if (fgets (buf, sizeof (buf) - 1, input) == NULL)
-	break;
-      ptr = buf;
-      while (*ptr)
-      {
-	if (*ptr == '\n')
-	  PutQ ('\r');
-	else
-	  PutQ (*ptr);
-	++ptr;
-      }
-    }
-    fclose (input);
-  }
-
   if (LogOpen(log_file, log_mask) != 0) {
     return 1;
   }
@@ -1112,14 +1104,15 @@ int main (int argc, char **argv)
   {
     char ttyinfo[256];
     sprintf (ttyinfo, "%s|%d|%c", ttyname, speed, parity);
-    con = conmgr_connect (e_tty, ttyinfo, 0);
+    con = conmgr_connect (e_tty, ttyinfo, 0, profile, transport_flags);
   }
   else if (hostname)
   {
     if (use_rlogin)
-	con = conmgr_connect (e_rlogin, hostname, 0);
+	con = conmgr_connect (e_rlogin, hostname, 0, profile, transport_flags);
     else
-        con = conmgr_connect (e_vt3k, hostname, ipPort);
+        con = conmgr_connect (e_vt3k, hostname, ipPort, profile,
+			      transport_flags);
   }
   else
   {
@@ -1133,6 +1126,35 @@ int main (int argc, char **argv)
   if (!con)
     return (1);
 
+  /* Preload the typeahead; only a vt3k connection has one */
+  if ((input_file) && (con->type == e_vt3k))
+  {
+    FILE *input;
+    char buf[128], *ptr;
+    if ((input = fopen (input_file, "r")) == (FILE *) NULL)
+    {
+      char buf[128];
+      sprintf (buf, "fopen [%s]:", input_file);
+      perror (buf);
+      return (1);
+    }
+    for (;;)
+    {
+      if (fgets (buf, sizeof (buf) - 1, input) == NULL)
+	break;
+      ptr = buf;
+      while (*ptr)
+      {
+	if (*ptr == '\n')
+	  PutQ ((tVTConnection *) con->ptr, '\r');
+	else
+	  PutQ ((tVTConnection *) con->ptr, *ptr);
+	++ptr;
+      }
+    }
+    fclose (input);
+  }
+
   event_loop ();
 
   XUnloadFont (display, font_info->fid);